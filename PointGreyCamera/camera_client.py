@@ -41,6 +41,11 @@ with open( config_file, "r" ) as cf:
 
 sock_name_ = sock
 
+# When cam_server runs with --transport shm, read frames from shared memory.
+import shm_client
+import socket_client
+shm_name_ = shm_client.shm_name_from_config( config_file )
+
 img_shape_ = ( h, w )
 frame_size_ = img_shape_[0] * img_shape_[1]
 
@@ -83,12 +88,16 @@ def poll_socket( ):
 def main( ):
     global img_, buf_
     global image_stack_
-    s = socket.socket( socket.AF_UNIX, socket.SOCK_STREAM )
+    reader = None
 
     while True:
-        if os.path.exists( sock_name_ ):
+        if shm_name_ and os.path.exists( shm_client.shm_path( shm_name_ ) ):
+            reader = shm_client.ShmFrameReader( shm_name_ )
+            print( '[INFO] Reading frames from shared memory %s' % shm_name_ )
+            break
+        elif os.path.exists( sock_name_ ):
             try:
-                s.connect( sock_name_ )
+                reader = socket_client.SocketFrameReader( sock_name_ )
                 break
             except Exception as e:
                 print( 'Error connecting %s' % e )
@@ -97,41 +106,37 @@ def main( ):
             print( 'Could not find %s' % sock_name_ )
             time.sleep( 1 )
 
-    # print( s.getsockopt( socket.SOL_SOCKET, socket.SO_SNDBUF ) )
-    # Make it non-blocking.
-    # fcntl.fcntl( s, fcntl.F_SETFL, os.O_NONBLOCK )
-    totalBytesRead = 0
     totalFrames = 0
-    buf = ''
     init_stack( )
     framesInStack = 0
     trial_count = 0
     while True:
         try:
-            data = s.recv( frame_size_ )
-            buf += data
-            if len( buf) >= frame_size_:
-                img = np.frombuffer( buf[:frame_size_], dtype = np.uint8 )
-                img = np.reshape( img, img_shape_ )
-                now = datetime.datetime.now().isoformat( ) 
-                if write_timestamp_:
-                    cv2.putText( img, now, (0, 10)
-                            , cv2.FONT_HERSHEY_SIMPLEX, 0.4, 0, 1
-                            )
-                print( 'f', end='')
-                sys.stdout.flush( )
-                # print( img.shape, img.max(), img.min(), len(img) )
-                try:
-                    cv2.imshow( 'img', img )
-                    cv2.waitKey( 1 )
-                except Exception as e:
-                    pass
-                image_stack_[ framesInStack ] = img
-                metadata_[ 'acquisition_datetime' ].append( now )
-                framesInStack += 1
-                buf = buf[frame_size_:]
-            else:
+            f = reader.next_frame( )
+            if f is None:
+                if not reader.writer_alive( ):
+                    print( 'Camera server has quit' )
+                    break
+                continue
+            img = np.array( f[2] )
+            # When the camera gave the frame, not when we got it.
+            now = socket_client.host_to_datetime( f[4] ).isoformat( )
+            if write_timestamp_:
+                cv2.putText( img, now, (0, 10)
+                        , cv2.FONT_HERSHEY_SIMPLEX, 0.4, 0, 1
+                        )
+            print( 'f', end='')
+            sys.stdout.flush( )
+            # print( img.shape, img.max(), img.min(), len(img) )
+            try:
+                cv2.imshow( 'img', img )
+                cv2.waitKey( 1 )
+            except Exception as e:
                 pass
+            image_stack_[ framesInStack ] = img
+            metadata_[ 'acquisition_datetime' ].append( now )
+            framesInStack += 1
+            reader.ack( f )
 
         except Exception as e:
             err = e.args[0]
@@ -0,0 +1,65 @@
+#!/usr/bin/env python
+"""serial_client.py: Latest line from the Arduino, read by arduino_reader.
+
+arduino_reader keeps what it last read from the board in /dev/shm (see
+src/SerialReader.hpp): the line, when it came (CLOCK_MONOTONIC), and trial
+and camera pin of the last data line. A read takes a few microseconds.
+
+"""
+from __future__ import print_function
+
+__license__          = "GNU GPL"
+__version__          = "1.0.0"
+__status__           = "Development"
+
+import os
+import sys
+import time
+import collections
+import treadmill_client
+
+ARDUINO_STATE_MAGIC = 0x52444145
+ARDUINO_STATE_VERSION = 1
+
+# struct ArduinoState, 168 bytes.
+state_fmt_ = '<QQQiiII128s'
+
+State = collections.namedtuple( 'State'
+        , 'host_ns lines bytes trial camera arduino_ms errors line' )
+
+def shm_name_from_config( config_file ):
+    return treadmill_client.shm_name_from_config( config_file, 'ARDUINO_SHM_NAME' )
+
+class ArduinoStateReader( treadmill_client.LatestReader ):
+    """read( ) gives a State; line is a str. """
+
+    def __init__( self, name ):
+        treadmill_client.LatestReader.__init__( self, name, ARDUINO_STATE_MAGIC
+                , ARDUINO_STATE_VERSION, state_fmt_, State )
+        self.baud_rate = self.param
+
+    def read( self ):
+        s = treadmill_client.LatestReader.read( self )
+        if s is None:
+            return None
+        line = s.line.split( b'\0', 1 )[0].decode( 'ascii', 'replace' )
+        return s._replace( line = line )
+
+def main( ):
+    script_dir = os.path.dirname( os.path.realpath( __file__ ) )
+    name = shm_name_from_config( os.path.join( script_dir, 'config.h' ) )
+    reader = ArduinoStateReader( sys.argv[1] if len( sys.argv ) > 1 else name )
+    print( '[INFO] Board at %d baud' % reader.baud_rate )
+    while reader.writer_alive( ):
+        s = reader.read( )
+        if s is not None:
+            print( '[STAT] t=%d ns lines=%d trial=%d camera=%d: %s' % (
+                s.host_ns, s.lines, s.trial, s.camera, s.line ) )
+        time.sleep( 0.1 )
+    print( '[INFO] Writer has quit' )
+
+if __name__ == '__main__':
+    try:
+        main( )
+    except KeyboardInterrupt:
+        print( "User terminated" )
@@ -0,0 +1,207 @@
+#!/usr/bin/env python
+"""shm_client.py: Read frames published by `cam_server --transport shm`.
+
+The ring lives in /dev/shm (see src/ShmTransport.hpp for layout). Frames are
+read in place: next_frame( ) returns a numpy view on the shared slot, which is
+valid till the writer laps the reader (SHM_NUM_SLOTS frames later). Copy it if
+you want to keep it longer. reader.exposure_ns is when the camera exposed the
+last frame, on the host clock (0 if not known). Camera k > 0 of `cam_server
+--cameras N` publishes to socket_client.channel_name( SHM_NAME, k ).
+
+Version 2 slots carry what version 6 socket headers do (see socket_client.py):
+reader.tag, reader.x0, reader.y0, reader.bin, reader.stream, reader.motion and
+reader.eye of the last frame.
+
+"""
+from __future__ import print_function
+
+__license__          = "GNU GPL"
+__version__          = "1.0.0"
+__status__           = "Development"
+
+import os
+import re
+import sys
+import mmap
+import time
+import ctypes
+import struct
+import platform
+import numpy as np
+from socket_client import Tag
+
+SHM_RING_MAGIC = 0x48534245
+SHM_RING_VERSION = 2
+
+# struct ShmRingHeader. Atomics are plain integers in memory.
+ring_fmt_ = '<8IIIQI'
+# struct ShmSlotHeader (128 bytes): fields of version 1, then version,
+# header_size, flags, tag, origin, motion and eye box.
+slot_fmt_ = '<QQQIIIfQIIQ'
+slot_v2_fmt_ = '<HHIqi4sII4H4f4H'
+slot_v2_offset_ = struct.calcsize( slot_fmt_ )
+
+# Offsets of fields we poll.
+published_offset_ = 32
+waiters_offset_ = 36
+write_count_offset_ = 40
+writer_alive_offset_ = 48
+
+FUTEX_WAIT = 0
+SYS_futex = { 'x86_64' : 202, 'i686' : 240, 'aarch64' : 98, 'armv7l' : 240 }
+
+class timespec( ctypes.Structure ):
+    _fields_ = [ ('tv_sec', ctypes.c_long), ('tv_nsec', ctypes.c_long) ]
+
+def shm_name_from_config( config_file ):
+    with open( config_file, "r" ) as cf:
+        m = re.search( r'#define\s+SHM_NAME\s+\"(.+?)\"', cf.read( ) )
+    return m.group(1) if m else None
+
+def shm_path( name ):
+    return os.path.join( '/dev/shm', name.lstrip( '/' ) )
+
+class ShmFrameReader( object ):
+
+    def __init__( self, name ):
+        self.path = shm_path( name )
+        fd = os.open( self.path, os.O_RDWR )
+        try:
+            size = os.fstat( fd ).st_size
+            self.mm = mmap.mmap( fd, size, mmap.MAP_SHARED
+                    , mmap.PROT_READ | mmap.PROT_WRITE )
+        finally:
+            os.close( fd )
+
+        fields = struct.unpack_from( ring_fmt_, self.mm, 0 )
+        magic, version, self.num_slots, self.slot_size, self.data_offset = fields[:5]
+        self.max_frame_bytes, self.width, self.height = fields[5:8]
+        if magic != SHM_RING_MAGIC or version != SHM_RING_VERSION:
+            raise RuntimeError( '%s is not a frame ring (or version mismatch)' % self.path )
+
+        self.buf = np.frombuffer( self.mm, dtype = np.uint8 )
+        self.missed = 0
+        self.exposure_ns = 0                    # of the last frame; 0 unknown
+        self.tag = None                         # of the last frame
+        self.x0, self.y0 = 0, 0                 # of the last frame in camera frame
+        self.bin = 1
+        self.stream = 0
+        self.motion = ()                        # of the last frame, per mask
+        self.eye = ()                           # box of blink of the last frame
+        self.next = self._u64( write_count_offset_ )
+        self._init_futex( )
+
+    def _u32( self, off ):
+        return struct.unpack_from( '<I', self.mm, off )[0]
+
+    def _u64( self, off ):
+        return struct.unpack_from( '<Q', self.mm, off )[0]
+
+    def _init_futex( self ):
+        # Sleep on the same futex word as the C++ readers. Fall back to polling
+        # when syscall number is unknown.
+        self.futex = None
+        nr = SYS_futex.get( platform.machine( ) )
+        if nr is None or not sys.platform.startswith( 'linux' ):
+            return
+        libc = ctypes.CDLL( None, use_errno = True )
+        self.syscall = libc.syscall
+        self.futex = nr
+        addr = ctypes.addressof( ctypes.c_char.from_buffer( self.mm ) )
+        self.futex_addr = ctypes.c_void_p( addr + published_offset_ )
+        self.waiters = ctypes.c_uint32.from_buffer( self.mm, waiters_offset_ )
+
+    def writer_alive( self ):
+        return self._u32( writer_alive_offset_ ) != 0
+
+    def wait( self, timeout = 1.0 ):
+        """Wait for next frame. Returns False on timeout or when the writer is
+        gone. """
+        deadline = time.time( ) + timeout
+        while self._u64( write_count_offset_ ) <= self.next:
+            if not self.writer_alive( ):
+                return False
+            left = deadline - time.time( )
+            if left <= 0:
+                return False
+            seen = self._u32( published_offset_ )
+            if self._u64( write_count_offset_ ) > self.next:
+                break
+            if self.futex is None:
+                time.sleep( min( left, 1e-3 ) )
+                continue
+            ts = timespec( int( left ), int( (left % 1) * 1e9 ) )
+            # Not atomic from python, but the writer only wakes when this is
+            # non-zero; a lost update at worst costs one timeout.
+            self.waiters.value += 1
+            self.syscall( self.futex, self.futex_addr, FUTEX_WAIT
+                    , ctypes.c_uint32( seen ), ctypes.byref( ts ), None, 0 )
+            self.waiters.value -= 1
+        return True
+
+    def next_frame( self, timeout = 1.0 ):
+        """Return ( frame_id, timestamp_ns, img, blink, host_ns, dropped ) of
+        the next frame or None. img is a view on shared memory, not a copy.
+        blink is the blink signal computed by cam_server (-1 with --no-blink),
+        host_ns its CLOCK_MONOTONIC when the camera gave the frame and dropped
+        the number of frames cam_server lost so far.
+        """
+        while self.wait( timeout ):
+            written = self._u64( write_count_offset_ )
+            if written - self.next > self.num_slots:
+                self.missed += written - self.next - self.num_slots
+                self.next = written - self.num_slots
+
+            n = self.next
+            self.next += 1
+            off = self.data_offset + ( n % self.num_slots ) * self.slot_size
+            fields = struct.unpack_from( slot_fmt_, self.mm, off )
+            seq, frame_id, ts, w, h, size, blink, host_ns, dropped, pixfmt, exposure_ns = fields
+            if seq != 2 * n + 2:
+                self.missed += 1
+                continue
+            v2 = struct.unpack_from( slot_v2_fmt_, self.mm, off + slot_v2_offset_ )
+            _, hsize, flags, us, trial, state, ms, pins = v2[:8]
+            self.exposure_ns = exposure_ns
+            self.tag = Tag( us, trial, state.rstrip( b'\0' ).decode( ), ms, pins, flags )
+            self.x0, self.y0, self.bin, self.stream = v2[8:12]
+            self.motion = v2[12:16]
+            self.eye = v2[16:] if any( v2[16:] ) else ()
+            start = off + hsize
+            img = self.buf[ start : start + size ].reshape( h, w )
+            return frame_id, ts, img, blink, host_ns, dropped
+        return None
+
+    def ack( self, frame ):
+        # Nobody to tell: cam_server does not know its shm readers.
+        pass
+
+    def close( self ):
+        self.waiters = None
+        self.buf = None
+        self.mm.close( )
+
+def main( ):
+    script_dir = os.path.dirname( os.path.realpath( __file__ ) )
+    name = shm_name_from_config( os.path.join( script_dir, 'config.h' ) )
+    reader = ShmFrameReader( sys.argv[1] if len( sys.argv ) > 1 else name )
+    print( '[INFO] %dx%d frames, %d slots' % ( reader.width, reader.height, reader.num_slots ) )
+    t0, n = time.time( ), 0
+    while True:
+        f = reader.next_frame( )
+        if f is None:
+            if not reader.writer_alive( ):
+                break
+            continue
+        n += 1
+        if time.time( ) - t0 >= 1.0:
+            print( '[STAT] fps=%.1f frame_id=%d blink=%.1f missed=%d' % (
+                n / ( time.time( ) - t0 ), f[0], f[3], reader.missed ) )
+            t0, n = time.time( ), 0
+    print( '[INFO] Writer has quit' )
+
+if __name__ == '__main__':
+    try:
+        main( )
+    except KeyboardInterrupt:
+        print( "User terminated" )
@@ -0,0 +1,240 @@
+#!/usr/bin/env python
+"""socket_client.py: Read frames served by `cam_server --transport socket`.
+
+Every frame on the socket comes after a FrameHeader (see
+src/FrameHeader.hpp): frame id, camera timestamp, CLOCK_MONOTONIC when the
+camera gave the frame, geometry, and the number of frames cam_server has lost
+so far. next_frame( ) returns the same tuple as shm_client.ShmFrameReader.
+
+Version 2 headers also carry the Arduino side of the frame (Tag, see
+src/ClockSync.hpp), which is in reader.tag after next_frame( ). Version 3
+adds the camera index and exposure_ns: when the camera exposed the frame, on
+the same clock as host_ns for every camera (reader.camera and
+reader.exposure_ns). With `cam_server --cameras N`, camera k > 0 is served
+on channel_name( SOCK_PATH, k ).
+
+Version 4 tells where the pixels come from: frames of the preview and crop
+streams (stream_name( SOCK_PATH, k, 'preview' ) etc.) are binned reader.bin
+times, or start at reader.x0, reader.y0 of the camera frame.
+
+Version 5 adds motion energy, mean absolute frame to frame difference per
+pixel over each `cam_server --motion` mask, in reader.motion (-1 for masks
+not set, and for the first frame).
+
+Version 6 adds the box cam_server computed the blink on, which follows the
+eye (`cam_server --track`), in reader.eye as ( x0, y0, x1, y1 ); () when
+the frame has no blink.
+
+"""
+from __future__ import print_function
+
+__license__          = "GNU GPL"
+__version__          = "1.0.0"
+__status__           = "Development"
+
+import os
+import re
+import sys
+import time
+import ctypes
+import socket
+import struct
+import datetime
+import collections
+import numpy as np
+
+FRAME_HEADER_MAGIC = 0x46484245
+FRAME_HEADER_VERSION = 6
+
+# struct FrameHeader (64 bytes of version 1).
+header_fmt_ = '<IHHQQQIIIIQIf'
+header_size_ = struct.calcsize( header_fmt_ )
+
+# Appended by version 2; flags of version 1 are the tag's.
+tag_fmt_ = '<qi4sII'
+tag_size_ = struct.calcsize( tag_fmt_ )
+
+# Appended by version 3: camera, reserved, exposure_ns.
+camera_fmt_ = '<IIQ'
+camera_size_ = struct.calcsize( camera_fmt_ )
+
+# Appended by version 4: x0, y0, bin, stream.
+origin_fmt_ = '<HHHH'
+origin_size_ = struct.calcsize( origin_fmt_ )
+
+# Appended by version 5: motion energy of 4 masks (FRAME_MOTION_MASKS).
+motion_fmt_ = '<4f'
+motion_size_ = struct.calcsize( motion_fmt_ )
+
+# Appended by version 6: box of the blink signal, x0, y0, x1, y1.
+eye_fmt_ = '<4H'
+eye_size_ = struct.calcsize( eye_fmt_ )
+
+# Streams of cam_server (FRAME_STREAM_* in src/FrameSource.hpp).
+STREAM_CAMERA, STREAM_PREVIEW, STREAM_CROP = 0, 1, 2
+
+# Tag.flags and Tag.pins (SYNC_* in src/ClockSync.hpp).
+SYNC_SYNCED, SYNC_SAMPLE, SYNC_FINAL = 1, 2, 4
+PIN_PUFF, PIN_TONE, PIN_LED, PIN_CAMERA, PIN_IMAGING = 1, 2, 4, 8, 16
+
+# arduino_us: frame time by Arduino micros( ) (-1 not synced); trial, state,
+# sample_ms and pins of the last Arduino sample before it.
+Tag = collections.namedtuple( 'Tag', 'arduino_us trial state sample_ms pins flags' )
+
+CLOCK_MONOTONIC = 1
+
+class timespec( ctypes.Structure ):
+    _fields_ = [ ('tv_sec', ctypes.c_long), ('tv_nsec', ctypes.c_long) ]
+
+def _clock_gettime( ):
+    libc = ctypes.CDLL( None, use_errno = True )
+    ts = timespec( )
+    def now( ):
+        libc.clock_gettime( CLOCK_MONOTONIC, ctypes.byref( ts ) )
+        return ts.tv_sec * 1000000000 + ts.tv_nsec
+    return now
+
+if hasattr( time, 'monotonic' ):
+    monotonic_ns = lambda: int( time.monotonic( ) * 1e9 )
+else:
+    # python2
+    monotonic_ns = _clock_gettime( )
+
+def host_to_datetime( host_ns ):
+    """Wall clock time of host_ns (CLOCK_MONOTONIC of this machine). """
+    return datetime.datetime.now( ) - datetime.timedelta(
+            microseconds = ( monotonic_ns( ) - host_ns ) / 1000.0 )
+
+def channel_name( base, camera ):
+    """Socket path (or shm name) of camera; camera 0 keeps the plain one. """
+    return base if camera == 0 else '%s_cam%d' % ( base, camera )
+
+def stream_name( base, camera, stream ):
+    """Socket path (or shm name) of the 'preview' or 'crop' stream of camera. """
+    return '%s_%s' % ( channel_name( base, camera ), stream )
+
+def sock_path_from_config( config_file ):
+    with open( config_file, "r" ) as cf:
+        m = re.search( r'#define\s+SOCK_PATH\s+\"(.+?)\"', cf.read( ) )
+    return m.group(1) if m else None
+
+class SocketFrameReader( object ):
+    """Subscriber of cam_server. request is 'lossless' (default), 'latest' or
+    'nth N'; see src/broadcast-server.h.
+    """
+
+    def __init__( self, path, request = None ):
+        self.path = path
+        self.s = socket.socket( socket.AF_UNIX, socket.SOCK_STREAM )
+        self.s.connect( path )
+        if request:
+            self.s.sendall( ( request + '\n' ).encode( ) )
+        self.closed = False
+        self.last_id = None
+        self.missed = 0                         # gaps in frame ids
+        self.dropped = 0                        # lost in cam_server
+        self.latency_ns = 0                     # of the last frame
+        self.tag = None                         # of the last frame
+        self.camera = 0                         # of the last frame
+        self.exposure_ns = 0                    # of the last frame; 0 unknown
+        self.x0, self.y0 = 0, 0                 # of the last frame in camera frame
+        self.bin = 1                            # of the last frame
+        self.stream = STREAM_CAMERA             # of the last frame
+        self.motion = ()                        # of the last frame, per mask
+        self.eye = ()                           # box of blink of the last frame
+
+    def _recv( self, size ):
+        buf = bytearray( size )
+        view = memoryview( buf )
+        got = 0
+        while got < size:
+            n = self.s.recv_into( view[got:], size - got )
+            if n == 0:
+                self.closed = True
+                return None
+            got += n
+        return buf
+
+    def writer_alive( self ):
+        return not self.closed
+
+    def next_frame( self ):
+        """Return ( frame_id, camera_ns, img, blink, host_ns, dropped ) of the
+        next frame, or None when cam_server has gone away. dropped counts
+        frames cam_server lost (camera gaps, full ring) since it started.
+        """
+        head = self._recv( header_size_ )
+        if head is None:
+            return None
+        fields = struct.unpack_from( header_fmt_, head, 0 )
+        magic, version, hsize, frame_id, camera_ns, host_ns = fields[:6]
+        w, h, pixfmt, size, dropped, flags, blink = fields[6:]
+        if magic != FRAME_HEADER_MAGIC:
+            raise RuntimeError( '%s: not a frame header (old cam_server?)' % self.path )
+        ext = b''
+        if hsize > header_size_:
+            ext = self._recv( hsize - header_size_ )
+            if ext is None:
+                return None
+        self.tag = None
+        if len( ext ) >= tag_size_:
+            us, trial, state, ms, pins = struct.unpack_from( tag_fmt_, ext, 0 )
+            self.tag = Tag( us, trial, state.rstrip( b'\0' ).decode( ), ms, pins, flags )
+        if len( ext ) >= tag_size_ + camera_size_:
+            self.camera, _, self.exposure_ns = struct.unpack_from( camera_fmt_, ext, tag_size_ )
+        if len( ext ) >= tag_size_ + camera_size_ + origin_size_:
+            self.x0, self.y0, self.bin, self.stream = struct.unpack_from( origin_fmt_, ext
+                    , tag_size_ + camera_size_ )
+        if len( ext ) >= tag_size_ + camera_size_ + origin_size_ + motion_size_:
+            self.motion = struct.unpack_from( motion_fmt_, ext
+                    , tag_size_ + camera_size_ + origin_size_ )
+        self.eye = ()
+        if len( ext ) >= tag_size_ + camera_size_ + origin_size_ + motion_size_ + eye_size_:
+            eye = struct.unpack_from( eye_fmt_, ext
+                    , tag_size_ + camera_size_ + origin_size_ + motion_size_ )
+            self.eye = eye if any( eye ) else ()
+        pixels = self._recv( size )
+        if pixels is None:
+            return None
+
+        self.latency_ns = monotonic_ns( ) - host_ns
+        if self.last_id is not None and frame_id > self.last_id + 1:
+            self.missed += frame_id - self.last_id - 1
+        self.last_id = frame_id
+        self.dropped = dropped
+        img = np.frombuffer( pixels, dtype = np.uint8 ).reshape( h, w )
+        return frame_id, camera_ns, img, blink, host_ns, dropped
+
+    def ack( self, frame ):
+        """Tell cam_server we are done with frame (a tuple from next_frame);
+        it keeps a histogram of camera to ack latency (the 'stats' command).
+        """
+        self.s.sendall( ( 'ack %d\n' % frame[4] ).encode( ) )
+
+    def close( self ):
+        self.s.close( )
+
+def main( ):
+    script_dir = os.path.dirname( os.path.realpath( __file__ ) )
+    path = sock_path_from_config( os.path.join( script_dir, 'config.h' ) )
+    reader = SocketFrameReader( sys.argv[1] if len( sys.argv ) > 1 else path )
+    t0, n, lat = time.time( ), 0, [ ]
+    while True:
+        f = reader.next_frame( )
+        if f is None:
+            break
+        reader.ack( f )
+        n += 1
+        lat.append( reader.latency_ns / 1e6 )
+        if time.time( ) - t0 >= 1.0:
+            print( '[STAT] fps=%.1f frame_id=%d latency=%.2f ms (max %.2f) missed=%d dropped=%d' % (
+                n / ( time.time( ) - t0 ), f[0], np.median( lat ), max( lat )
+                , reader.missed, reader.dropped ) )
+            t0, n, lat = time.time( ), 0, [ ]
+    print( '[INFO] Server has quit' )
+
+if __name__ == '__main__':
+    try:
+        main( )
+    except KeyboardInterrupt:
+        print( "User terminated" )
@@ -0,0 +1,282 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  Acquisition.hpp
+ *
+ *    Description:  Capture and sender threads. Capture thread only drains the
+ *    camera into a ring of frames; the sender thread consumes the ring and
+ *    hands frames to the sink (e.g. socket). A slow reader therefore can not
+ *    stall the camera; frames are dropped (and counted) instead.
+ *
+ *    Frames are not copied: the ring holds frames which still point to the
+ *    source's buffers. They are released back to the source after the sink
+ *    is done with them, or immediately when the ring is full.
+ *
+ *    With several cameras there is one Acquisition (two threads and a ring)
+ *    per camera; frames carry the camera's index.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  Acquisition_INC
+#define  Acquisition_INC
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <cstdint>
+#include <string>
+
+#include "FrameSource.hpp"
+#include "FrameRing.hpp"
+#include "LatencyHistogram.hpp"
+
+/**
+ * @brief Counters shared by capture and sender thread.
+ */
+struct PipelineStats
+{
+    std::atomic<uint64_t> captured;             /* Frames from source. */
+    std::atomic<uint64_t> sent;                 /* Frames consumed by sink. */
+    std::atomic<uint64_t> incomplete;           /* Incomplete images. */
+    std::atomic<uint64_t> overruns;             /* Ring full; frame released. */
+    std::atomic<uint64_t> dropped;              /* Gaps in camera frame ids. */
+    std::atomic<uint64_t> peak_occupancy;
+
+    /* Camera timestamp to source returning the frame, above the least delay
+     * seen: camera and host clocks have an unknown offset. */
+    LatencyHistogram camera;
+    /* Source returning the frame to sink done with it (ring, analysis,
+     * recorder, handed to transport). */
+    LatencyHistogram queue;
+
+    PipelineStats( ) : captured( 0 ), sent( 0 ), incomplete( 0 )
+        , overruns( 0 ), dropped( 0 ), peak_occupancy( 0 )
+    { }
+};
+
+class Acquisition
+{
+public:
+    /**
+     * @brief Sink is called by the sender thread for every frame. It returns
+     * false on a fatal error (e.g. client went away) which stops acquisition.
+     */
+    typedef std::function<bool( const Frame& )> Sink;
+
+    /**
+     * @brief Analyzer is called by the sender thread on every frame before it
+     * goes to the sink, e.g. to compute the blink signal.
+     */
+    typedef std::function<void( Frame& )> Analyzer;
+
+    /**
+     * @brief Constructor.
+     *
+     * @param camera Index of the camera; goes into Frame::camera.
+     */
+    Acquisition( FrameSource* source, Sink sink, size_t ring_size, unsigned camera = 0 )
+        : source_( source ), sink_( sink ), ring_( ring_size ), camera_( camera )
+        , stop_( false ), capture_done_( false ), result_( 0 ), last_captured_( 0 )
+    { }
+
+    unsigned camera( ) const
+    {
+        return camera_;
+    }
+
+    void set_analyzer( Analyzer analyzer )
+    {
+        analyzer_ = analyzer;
+    }
+
+    /**
+     * @brief Launch capture and sender threads.
+     *
+     * @return 0 on success, -1 if source failed to start.
+     */
+    int start( )
+    {
+        if( source_->begin_acquisition( ) != 0 )
+            return -1;
+        last_print_ = std::chrono::steady_clock::now( );
+        sender_ = std::thread( &Acquisition::send_loop, this );
+        capture_ = std::thread( &Acquisition::capture_loop, this );
+        return 0;
+    }
+
+    /**
+     * @brief Ask both threads to stop, wait for them and stop the source.
+     * Frames still in ring are released without sending.
+     */
+    int stop( )
+    {
+        stop_ = true;
+        if( capture_.joinable( ) )
+            capture_.join( );
+        if( sender_.joinable( ) )
+            sender_.join( );
+
+        Frame frame;
+        while( ring_.pop( frame ) )
+            source_->release( frame );
+
+        source_->end_acquisition( );
+        return result_;
+    }
+
+    /* True once capture thread has stopped, e.g. replay is over or sink
+     * failed. */
+    bool done( ) const
+    {
+        return capture_done_;
+    }
+
+    const PipelineStats& stats( ) const
+    {
+        return stats_;
+    }
+
+    /**
+     * @brief One line summary of counters; replaces the old 'Running FPS'
+     * print. fps is over the time since the last call, so stalls show.
+     */
+    void print_stats( std::ostream& os ) const
+    {
+        auto now = std::chrono::steady_clock::now( );
+        std::chrono::duration<double> elapsed = now - last_print_;
+        uint64_t captured = stats_.captured;
+        os << "[STAT] " << (camera_ ? "cam" + std::to_string( camera_ ) + " " : "")
+            << "fps=" << std::fixed << std::setprecision( 1 )
+            << (captured - last_captured_) / elapsed.count( )
+            << " captured=" << stats_.captured
+            << " sent=" << stats_.sent
+            << " ring=" << ring_.size( ) << "/" << ring_.capacity( )
+            << " (peak " << stats_.peak_occupancy << ")"
+            << " overruns=" << stats_.overruns
+            << " dropped=" << stats_.dropped
+            << " incomplete=" << stats_.incomplete
+            << std::endl;
+        last_print_ = now;
+        last_captured_ = captured;
+    }
+
+private:
+
+    void capture_loop( )
+    {
+        Frame frame;
+        bool first = true;
+        uint64_t lastId = 0;
+        int64_t leastDelay = INT64_MAX;
+
+        while( ! stop_ )
+        {
+            if( ! source_->next_frame( frame ) )
+            {
+                // Timeout on camera; end of replay on other sources.
+                if( source_->name( ) == "spinnaker" )
+                    continue;
+                std::cout << "[INFO] No more frames from " << source_->name( ) << std::endl;
+                break;
+            }
+
+            if( ! first && frame.frame_id > lastId + 1 )
+                stats_.dropped += frame.frame_id - lastId - 1;
+            first = false;
+            lastId = frame.frame_id;
+
+            int64_t delay = (int64_t)(frame.host_ns - frame.timestamp);
+            if( delay < leastDelay )
+                leastDelay = delay;
+            stats_.camera.record( delay - leastDelay );
+
+            if( frame.incomplete )
+            {
+                stats_.incomplete += 1;
+                source_->release( frame );
+                continue;
+            }
+
+            // Goes out with the frame so that readers see what they missed.
+            frame.dropped = stats_.dropped + stats_.overruns + stats_.incomplete;
+            frame.camera = camera_;
+
+            stats_.captured += 1;
+            if( ! ring_.push( frame ) )
+            {
+                // Sender is behind. Give the buffer back to camera right away.
+                stats_.overruns += 1;
+                source_->release( frame );
+                continue;
+            }
+
+            uint64_t occupancy = ring_.size( );
+            if( occupancy > stats_.peak_occupancy )
+                stats_.peak_occupancy = occupancy;
+        }
+        capture_done_ = true;
+    }
+
+    void send_loop( )
+    {
+        Frame frame;
+        while( true )
+        {
+            if( ! ring_.pop( frame ) )
+            {
+                if( stop_ )
+                    break;
+                // Capture may have pushed one last frame after we looked.
+                if( capture_done_ )
+                {
+                    if( ring_.size( ) == 0 )
+                        break;
+                    continue;
+                }
+                // Nothing to send. Frames arrive every few ms; don't burn a
+                // core spinning.
+                std::this_thread::sleep_for( std::chrono::microseconds( 50 ) );
+                continue;
+            }
+
+            if( analyzer_ )
+                analyzer_( frame );
+            bool ok = sink_( frame );
+            source_->release( frame );
+            if( ! ok )
+            {
+                result_ = -1;
+                stop_ = true;
+                break;
+            }
+            stats_.sent += 1;
+            stats_.queue.record_diff( monotonic_ns( ), frame.host_ns );
+        }
+    }
+
+    FrameSource* source_;
+    Sink sink_;
+    Analyzer analyzer_;
+    SpscRing<Frame> ring_;
+    unsigned camera_;
+    PipelineStats stats_;
+
+    std::atomic<bool> stop_;
+    std::atomic<bool> capture_done_;
+    std::atomic<int> result_;
+
+    std::thread capture_;
+    std::thread sender_;
+    mutable std::chrono::steady_clock::time_point last_print_;
+    mutable uint64_t last_captured_;
+};
+
+#endif   /* ----- #ifndef Acquisition_INC  ----- */
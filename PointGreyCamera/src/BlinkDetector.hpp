@@ -0,0 +1,439 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  BlinkDetector.hpp
+ *
+ *    Description:  Blink signal of a frame, computed natively. Same metric as
+ *    blinky.find_blinks_using_pixals( ) on an equalized ROI:
+ *
+ *      1. equalizeHist on ROI.
+ *      2. 13x13 GaussianBlur, sigma 1 (BORDER_REFLECT_101).
+ *      3. threshold = max( 0, mean - std ) of blurred ROI.
+ *      4. 255 * (pixels below threshold in centre quadrant) / (rows*cols/4).
+ *
+ *    Blur is separable and in fixed point with the same 8 bit kernel and
+ *    rounding as OpenCV's bit-exact GaussianBlur for 8U images, so blurred
+ *    ROI matches cv2.GaussianBlur exactly. All of it is done in three sweeps
+ *    over the ROI: histogram; equalize + horizontal + vertical blur + sum and
+ *    sum of squares; and counting over the centre quadrant. Statistics use
+ *    SSE2/AVX2 when compiled for them.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  BlinkDetector_INC
+#define  BlinkDetector_INC
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief Sum and sum of squares of n pixels.
+ */
+inline void blink_row_stats( const uint8_t* p, size_t n, uint64_t& sum, uint64_t& sumsq )
+{
+    size_t i = 0;
+    uint64_t s = 0, ss = 0;
+#if defined(__AVX2__)
+    const __m256i zero = _mm256_setzero_si256( );
+    __m256i vs = zero, vss = zero;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256( (const __m256i*)(p + i) );
+        vs = _mm256_add_epi64( vs, _mm256_sad_epu8( v, zero ) );
+        __m256i lo = _mm256_unpacklo_epi8( v, zero );
+        __m256i hi = _mm256_unpackhi_epi8( v, zero );
+        vss = _mm256_add_epi32( vss, _mm256_madd_epi16( lo, lo ) );
+        vss = _mm256_add_epi32( vss, _mm256_madd_epi16( hi, hi ) );
+    }
+    alignas(32) uint64_t s4[4];
+    alignas(32) uint32_t ss8[8];
+    _mm256_store_si256( (__m256i*)s4, vs );
+    _mm256_store_si256( (__m256i*)ss8, vss );
+    for (int k = 0; k < 4; k++)
+        s += s4[k];
+    for (int k = 0; k < 8; k++)
+        ss += ss8[k];
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128( );
+    __m128i vs = zero, vss = zero;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i v = _mm_loadu_si128( (const __m128i*)(p + i) );
+        vs = _mm_add_epi64( vs, _mm_sad_epu8( v, zero ) );
+        __m128i lo = _mm_unpacklo_epi8( v, zero );
+        __m128i hi = _mm_unpackhi_epi8( v, zero );
+        vss = _mm_add_epi32( vss, _mm_madd_epi16( lo, lo ) );
+        vss = _mm_add_epi32( vss, _mm_madd_epi16( hi, hi ) );
+    }
+    alignas(16) uint64_t s2[2];
+    alignas(16) uint32_t ss4[4];
+    _mm_store_si128( (__m128i*)s2, vs );
+    _mm_store_si128( (__m128i*)ss4, vss );
+    s += s2[0] + s2[1];
+    for (int k = 0; k < 4; k++)
+        ss += ss4[k];
+#endif
+    for (; i < n; i++)
+    {
+        s += p[i];
+        ss += (uint32_t)p[i] * p[i];
+    }
+    sum += s;
+    sumsq += ss;
+}
+
+/**
+ * @brief Number of pixels less than t.
+ */
+inline size_t blink_count_below( const uint8_t* p, size_t n, uint8_t t )
+{
+    size_t i = 0, count = 0;
+#if defined(__AVX2__)
+    const __m256i zero = _mm256_setzero_si256( );
+    const __m256i one = _mm256_set1_epi8( 1 );
+    const __m256i vt = _mm256_set1_epi8( (char)t );
+    __m256i acc = zero;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256( (const __m256i*)(p + i) );
+        // t - v saturates to 0 unless v < t.
+        __m256i lt = _mm256_min_epu8( _mm256_subs_epu8( vt, v ), one );
+        acc = _mm256_add_epi64( acc, _mm256_sad_epu8( lt, zero ) );
+    }
+    alignas(32) uint64_t c4[4];
+    _mm256_store_si256( (__m256i*)c4, acc );
+    count += c4[0] + c4[1] + c4[2] + c4[3];
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128( );
+    const __m128i one = _mm_set1_epi8( 1 );
+    const __m128i vt = _mm_set1_epi8( (char)t );
+    __m128i acc = zero;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i v = _mm_loadu_si128( (const __m128i*)(p + i) );
+        __m128i lt = _mm_min_epu8( _mm_subs_epu8( vt, v ), one );
+        acc = _mm_add_epi64( acc, _mm_sad_epu8( lt, zero ) );
+    }
+    alignas(16) uint64_t c2[2];
+    _mm_store_si128( (__m128i*)c2, acc );
+    count += c2[0] + c2[1];
+#endif
+    for (; i < n; i++)
+        count += p[i] < t;
+    return count;
+}
+
+/**
+ * @brief Blink detector for frames of FRAME_WIDTH x FRAME_HEIGHT Mono8.
+ * Frame geometry is fixed at compile time; ROI can be changed at run time.
+ */
+template< size_t W, size_t H >
+class BlinkDetector
+{
+public:
+    /**
+     * @brief Constructor.
+     *
+     * @param x0, y0, x1, y1 ROI; columns [x0, x1) and rows [y0, y1) as in
+     * img[y0:y1, x0:x1] of camera_arduino_client.py.
+     * @param ksize, sigma Gaussian blur.
+     */
+    BlinkDetector( size_t x0, size_t y0, size_t x1, size_t y1
+            , int ksize = 13, double sigma = 1.0 )
+        : threshold_( 0 ), count_( 0 )
+    {
+        make_kernel( ksize, sigma );
+        set_roi( x0, y0, x1, y1 );
+    }
+
+    void set_roi( size_t x0, size_t y0, size_t x1, size_t y1 )
+    {
+        x1 = std::min( x1, W );
+        y1 = std::min( y1, H );
+        if( x0 + 4 > x1 || y0 + 4 > y1 )
+            throw std::invalid_argument( "Blink ROI must be at least 4x4 and inside frame" );
+
+        x0_ = x0;
+        y0_ = y0;
+        rw_ = x1 - x0;
+        rh_ = y1 - y0;
+        row_.assign( rw_ + 2 * radius_, 0 );
+        hblur_.assign( rw_ * rh_, 0 );
+        acc_.assign( rw_, 0 );
+        blurred_.assign( rw_ * rh_, 0 );
+
+        // Column indices of the padded row (BORDER_REFLECT_101).
+        col_.resize( rw_ + 2 * radius_ );
+        for (size_t i = 0; i < col_.size( ); i++)
+            col_[i] = reflect101( (long)i - radius_, rw_ );
+    }
+
+    /**
+     * @brief Blink signal of frame; 0 (eye open) to 255 (closed).
+     *
+     * @param frame W x H Mono8 pixels.
+     */
+    float process( const uint8_t* frame )
+    {
+        equalize_lut( frame );
+
+        uint64_t sum = 0, sumsq = 0;
+        size_t computed = 0;
+        for (size_t y = 0; y < rh_; y++)
+        {
+            // Horizontal pass lazily, just ahead of the vertical pass.
+            size_t need = std::min( y + radius_ + 1, rh_ );
+            for (; computed < need; computed++)
+                blur_row( frame + (y0_ + computed) * W + x0_, &hblur_[computed * rw_] );
+
+            uint8_t* out = &blurred_[y * rw_];
+            blur_column( y, out );
+            blink_row_stats( out, rw_, sum, sumsq );
+        }
+
+        double n = double( rw_ * rh_ );
+        double mean = sum / n;
+        double var = std::max( 0.0, sumsq / n - mean * mean );
+        threshold_ = std::max( 0.0, mean - std::sqrt( var ) );
+
+        // Pixel v < threshold <=> v < ceil( threshold ).
+        uint8_t t = (uint8_t)std::min( 255.0, std::ceil( threshold_ ) );
+
+        size_t r0 = rh_ / 2, c0 = rw_ / 2;
+        size_t rq = rh_ / 4, cq = rw_ / 4;
+        count_ = 0;
+        for (size_t y = r0 - rq; y < r0 + rq; y++)
+            count_ += blink_count_below( &blurred_[y * rw_ + c0 - cq], 2 * cq, t );
+
+        size_t area = rh_ * rw_ / 4;
+        return 255.0f * count_ / area;
+    }
+
+    /* Blurred, equalized ROI of last frame; rows x cols, row major. */
+    const std::vector<uint8_t>& blurred( ) const
+    {
+        return blurred_;
+    }
+
+    const std::vector<uint16_t>& kernel( ) const
+    {
+        return kernel_;
+    }
+
+    double threshold( ) const
+    {
+        return threshold_;
+    }
+
+    size_t rows( ) const
+    {
+        return rh_;
+    }
+
+    /* Top-left of ROI in the frame. */
+    size_t x0( ) const
+    {
+        return x0_;
+    }
+
+    size_t y0( ) const
+    {
+        return y0_;
+    }
+
+    size_t cols( ) const
+    {
+        return rw_;
+    }
+
+private:
+
+    static size_t reflect101( long i, size_t n )
+    {
+        if( n == 1 )
+            return 0;
+        while( i < 0 || i >= (long)n )
+            i = i < 0 ? -i : 2 * ((long)n - 1) - i;
+        return i;
+    }
+
+    /**
+     * @brief 8 bit fixed point Gaussian kernel. Rounding errors are carried
+     * forward from the tails so that taps add up to 256, as in OpenCV's
+     * bit-exact GaussianBlur. Zero taps are dropped.
+     */
+    void make_kernel( int ksize, double sigma )
+    {
+        if( ksize < 1 || ksize % 2 == 0 )
+            throw std::invalid_argument( "Blink blur kernel size must be odd" );
+
+        std::vector<double> k( ksize );
+        double total = 0;
+        int c = ksize / 2;
+        for (int i = 0; i < ksize; i++)
+        {
+            k[i] = std::exp( -(i - c) * (i - c) / (2 * sigma * sigma) );
+            total += k[i];
+        }
+
+        std::vector<int> fixed( ksize, 0 );
+        double err = 0;
+        int sides = 0;
+        for (int i = 0; i < c; i++)
+        {
+            double adj = k[i] / total * 256 + err;
+            int v = (int)std::lround( adj );
+            err = adj - v;
+            fixed[i] = fixed[ksize - 1 - i] = v;
+            sides += v;
+        }
+        fixed[c] = 256 - 2 * sides;
+
+        int first = 0;
+        while( fixed[first] == 0 )
+            first++;
+        radius_ = c - first;
+        kernel_.assign( fixed.begin( ) + first, fixed.end( ) - first );
+    }
+
+    /**
+     * @brief LUT of cv::equalizeHist for ROI of frame.
+     */
+    void equalize_lut( const uint8_t* frame )
+    {
+        // Four histograms so that runs of equal pixels don't serialize on one
+        // counter.
+        uint32_t hist4[4][256];
+        memset( hist4, 0, sizeof( hist4 ) );
+        for (size_t y = 0; y < rh_; y++)
+        {
+            const uint8_t* p = frame + (y0_ + y) * W + x0_;
+            size_t x = 0;
+            for (; x + 4 <= rw_; x += 4)
+            {
+                hist4[0][p[x]]++;
+                hist4[1][p[x + 1]]++;
+                hist4[2][p[x + 2]]++;
+                hist4[3][p[x + 3]]++;
+            }
+            for (; x < rw_; x++)
+                hist4[0][p[x]]++;
+        }
+
+        uint32_t hist[256];
+        for (int i = 0; i < 256; i++)
+            hist[i] = hist4[0][i] + hist4[1][i] + hist4[2][i] + hist4[3][i];
+
+        uint32_t total = rw_ * rh_;
+        int i = 0;
+        while( ! hist[i] )
+            ++i;
+
+        memset( lut_, 0, sizeof( lut_ ) );
+        if( hist[i] == total )
+        {
+            // Flat ROI; equalizeHist leaves it as it is.
+            std::fill( lut_, lut_ + 256, (uint8_t)i );
+            return;
+        }
+
+        float scale = 255.f / (total - hist[i]);
+        uint32_t sum = 0;
+        for (lut_[i++] = 0; i < 256; i++)
+        {
+            sum += hist[i];
+            lut_[i] = (uint8_t)std::min( 255L, std::lrint( sum * scale ) );
+        }
+    }
+
+    /**
+     * @brief Equalize one ROI row and blur it horizontally. Output is in 8 bit
+     * fixed point; it can't overflow 16 bits since taps add up to 256.
+     * Loops run over x innermost so that they vectorize.
+     */
+    void blur_row( const uint8_t* src, uint16_t* dst )
+    {
+        // Locals: stores through uint8_t* may alias members, which stops
+        // loops from vectorizing.
+        const size_t n = rw_;
+        const size_t padded = col_.size( );
+        const size_t* col = &col_[0];
+        const uint8_t* lut = lut_;
+        uint16_t* row = &row_[0];
+        for (size_t i = 0; i < n; i++)
+            row[i + radius_] = lut[src[i]];
+        for (int i = 0; i < radius_; i++)
+        {
+            row[i] = row[radius_ + col[i]];
+            row[padded - 1 - i] = row[radius_ + col[padded - 1 - i]];
+        }
+
+        const uint16_t* k = &kernel_[radius_];
+        const uint16_t* e = row + radius_;
+        for (size_t x = 0; x < n; x++)
+            dst[x] = k[0] * e[x];
+        for (int j = 1; j <= radius_; j++)
+        {
+            const uint16_t kj = k[j];
+            const uint16_t* l = e - j;
+            const uint16_t* r = e + j;
+            for (size_t x = 0; x < n; x++)
+                dst[x] += kj * (l[x] + r[x]);
+        }
+    }
+
+    /**
+     * @brief Vertical pass for output row y; rounds back to 8 bits.
+     */
+    void blur_column( size_t y, uint8_t* out )
+    {
+        const size_t n = rw_;
+        const uint16_t* k = &kernel_[radius_];
+        uint32_t* acc = &acc_[0];
+
+        const uint16_t* mid = &hblur_[y * n];
+        for (size_t x = 0; x < n; x++)
+            acc[x] = (uint32_t)k[0] * mid[x];
+        for (int j = 1; j <= radius_; j++)
+        {
+            const uint32_t kj = k[j];
+            const uint16_t* up = &hblur_[reflect101( (long)y - j, rh_ ) * n];
+            const uint16_t* down = &hblur_[reflect101( (long)y + j, rh_ ) * n];
+            for (size_t x = 0; x < n; x++)
+                acc[x] += kj * ((uint32_t)up[x] + down[x]);
+        }
+        for (size_t x = 0; x < n; x++)
+            out[x] = (uint8_t)((acc[x] + (1 << 15)) >> 16);
+    }
+
+    size_t x0_, y0_;
+    size_t rw_, rh_;
+
+    int radius_;
+    std::vector<uint16_t> kernel_;
+    std::vector<size_t> col_;
+    uint8_t lut_[256];
+
+    std::vector<uint16_t> row_;
+    std::vector<uint16_t> hblur_;
+    std::vector<uint32_t> acc_;
+    std::vector<uint8_t> blurred_;
+
+    double threshold_;
+    size_t count_;
+};
+
+#endif   /* ----- #ifndef BlinkDetector_INC  ----- */
@@ -0,0 +1,512 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  ClockSync.hpp
+ *
+ *    Description:  Puts camera frames and Arduino samples on one clock and
+ *    tags every frame with the Arduino sample taken when it was exposed.
+ *
+ *    Three clocks are involved: the camera timestamp, CLOCK_MONOTONIC of
+ *    this machine (host) and micros( ) of the Arduino. Each is mapped to
+ *    host time by a ClockFit, a least squares line (offset and drift)
+ *    through the best sample of each of the last few blocks of time:
+ *
+ *      camera -> host   every frame; best is the least host - camera delay.
+ *      arduino -> host  ping: host writes '?', Arduino replies with
+ *                       ">>PING micros". The reply was stamped between the
+ *                       write and the read of the reply less the time its
+ *                       bytes take on the wire; best is the narrowest.
+ *
+ *    The Arduino also reports ">>TTL level micros" when it drives
+ *    CAMERA_TTL_PIN and ">>TRIAL n millis" when a trial starts (data lines
+ *    carry millis( ) since trial start). TTL edges give the camera pin of a
+ *    frame to the microsecond; how late they reach the host by the model is
+ *    kept as a check on the fit (ttl_lag( )), and on_ttl( ) hears of each
+ *    edge (cam_server starts and stops recording a trial on them). A board
+ *    which sends binary packets (BINARY_SAMPLES) has them decoded to the
+ *    same lines by SampleDecoder; only their time on the wire differs.
+ *
+ *    Every camera of cam_server has its own camera -> host fit (by
+ *    Frame::camera), so frames of all cameras share one time base: tag( )
+ *    sets Frame::exposure_ns, the frame's camera time on the host clock.
+ *
+ *    tag( ) maps the frame's camera time to the Arduino clock and looks up
+ *    the last data line sampled before it. Lines reach the host a few ms
+ *    after frames, so a tag is SYNC_FINAL only when a later sample had
+ *    already arrived; arduino_us is exact either way and recordings can be
+ *    aligned offline from it.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  ClockSync_INC
+#define  ClockSync_INC
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+#include "FrameSource.hpp"
+#include "LatencyHistogram.hpp"
+#include "SampleDecoder.hpp"
+
+/* BehaviourTag::pins */
+#define SYNC_PIN_PUFF           (1 << 0)
+#define SYNC_PIN_TONE           (1 << 1)
+#define SYNC_PIN_LED            (1 << 2)
+#define SYNC_PIN_CAMERA         (1 << 3)
+#define SYNC_PIN_IMAGING        (1 << 4)
+
+/* BehaviourTag::flags */
+#define SYNC_SYNCED             (1 << 0)        /* arduino_us is valid. */
+#define SYNC_SAMPLE             (1 << 1)        /* trial, state, pins are of a sample. */
+#define SYNC_FINAL              (1 << 2)        /* A later sample had arrived. */
+
+/* Samples and edges kept for lookup, by Arduino time. */
+#define SYNC_HISTORY_US         10000000
+
+/**
+ * @brief y = y0 + slope * (x - x0), least squares through the sample of least
+ * error in each of the last nblocks blocks of x.
+ */
+class ClockFit
+{
+public:
+    ClockFit( int64_t block, size_t nblocks ) : block_( block ), nblocks_( nblocks )
+    {
+        reset( );
+    }
+
+    void reset( )
+    {
+        points_.clear( );
+        x0_ = y0_ = 0;
+        slope_ = 1.0;
+    }
+
+    void add( int64_t x, int64_t y, int64_t err )
+    {
+        if( ! points_.empty( ) && x / block_ < points_.back( ).x / block_ )
+            return;
+        if( ! points_.empty( ) && x / block_ == points_.back( ).x / block_ )
+        {
+            if( err >= points_.back( ).err )
+                return;
+            points_.back( ) = Point{ x, y, err };
+        }
+        else
+        {
+            points_.push_back( Point{ x, y, err } );
+            if( points_.size( ) > nblocks_ )
+                points_.pop_front( );
+        }
+        fit( );
+    }
+
+    bool valid( ) const
+    {
+        return ! points_.empty( );
+    }
+
+    size_t size( ) const
+    {
+        return points_.size( );
+    }
+
+    int64_t map( int64_t x ) const
+    {
+        return y0_ + (int64_t)llround( slope_ * (x - x0_) );
+    }
+
+    int64_t unmap( int64_t y ) const
+    {
+        return x0_ + (int64_t)llround( (y - y0_) / slope_ );
+    }
+
+    /* How much faster y runs than x, in parts per million. */
+    double drift_ppm( ) const
+    {
+        return (slope_ - 1.0) * 1e6;
+    }
+
+    /* Largest distance of a point from the line, in units of y; includes
+     * the open block. */
+    int64_t residual( ) const
+    {
+        int64_t r = 0;
+        for( auto& p : points_ )
+            r = std::max( r, std::abs( p.y - map( p.x ) ) );
+        return r;
+    }
+
+private:
+    struct Point
+    {
+        int64_t x, y, err;
+    };
+
+    void fit( )
+    {
+        // The last block is still open and its point may be a poor one; it
+        // is left out once there are enough closed blocks.
+        size_t n = points_.size( ) > 2 ? points_.size( ) - 1 : points_.size( );
+
+        // Relative to the mean; ns since boot squared do not fit a double.
+        const Point& last = points_[n - 1];
+        double mx = 0, my = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            mx += points_[i].x - last.x;
+            my += points_[i].y - last.y;
+        }
+        mx /= n;
+        my /= n;
+        double sxx = 0, sxy = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            const Point& p = points_[i];
+            double dx = p.x - last.x - mx, dy = p.y - last.y - my;
+            sxx += dx * dx;
+            sxy += dx * dy;
+        }
+        x0_ = last.x + (int64_t)llround( mx );
+        y0_ = last.y + (int64_t)llround( my );
+        slope_ = sxx > 0 ? sxy / sxx : 1.0;
+    }
+
+    int64_t block_;
+    size_t nblocks_;
+    std::deque<Point> points_;
+    int64_t x0_, y0_;
+    double slope_;
+};
+
+class ClockSync
+{
+public:
+    /**
+     * @brief Constructor.
+     *
+     * @param block_ms Fits keep the best sample of each block of this many ms.
+     * @param nblocks Blocks the fits are made over; the window drift is
+     * assumed constant in.
+     * @param baud Of the Arduino serial port; for time on the wire.
+     * @param packets The board sends binary packets (sample_protocol.h)
+     * which were decoded to lines; they are shorter on the wire.
+     */
+    ClockSync( unsigned block_ms, size_t nblocks, unsigned baud, bool packets = false )
+        : baud_( baud )
+        , packets_( packets )
+        , arduino_( (int64_t)block_ms * 1000000, nblocks )
+        , block_ns_( (int64_t)block_ms * 1000000 ), nblocks_( nblocks )
+    {
+        reset_arduino( );
+    }
+
+    /**
+     * @brief A line from the Arduino, read at host_ns: a data line, or one of
+     * the >>PING, >>TTL, >>TRIAL reports. Other lines are ignored.
+     */
+    void arduino_line( uint64_t host_ns, const std::string& line )
+    {
+        std::function<void( bool, uint64_t, int )> handler;
+        bool high = false;
+        uint64_t edge_ns = 0;
+        int trial = -1;
+        {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            if( read_line( host_ns, line, high, edge_ns, trial ) )
+                handler = ttl_handler_;
+        }
+        // The handler may start a trial and write files; tag( ) of every
+        // camera would wait on the lock all that time.
+        if( handler )
+            handler( high, edge_ns, trial );
+    }
+
+    /**
+     * @brief handler( high, host_ns, trial ) is called for every edge of the
+     * camera TTL, with the host time of the edge (by the fit; when the line
+     * was sent before there is one) and the trial of the last >>TRIAL. It
+     * runs on the thread which feeds lines, after the lock is let go.
+     */
+    void on_ttl( std::function<void( bool, uint64_t, int )> handler )
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        ttl_handler_ = handler;
+    }
+
+    /* Host wrote the ping command ('?') at host_ns. */
+    void ping_sent( uint64_t host_ns )
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        ping_ns_ = host_ns;
+    }
+
+    /**
+     * @brief Fill frame.tag and frame.exposure_ns. The frame's camera
+     * timestamp also goes into the fit of its camera; call for every frame
+     * of a camera, in order (cameras may interleave).
+     */
+    void tag( Frame& frame )
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        BehaviourTag& t = frame.tag;
+        t = BehaviourTag( );
+
+        int64_t host = frame.host_ns;
+        if( frame.timestamp > 0 && frame.host_ns > 0 )
+        {
+            while( cameras_.size( ) <= frame.camera )
+                cameras_.push_back( ClockFit( block_ns_, nblocks_ ) );
+            ClockFit& fit = cameras_[frame.camera];
+            int64_t cam = frame.timestamp;
+            // Camera clock restarted (new acquisition): start again.
+            if( fit.valid( ) && std::abs( fit.map( cam ) - host ) > 1000000000 )
+                fit.reset( );
+            fit.add( cam, host, host - cam );
+            host = fit.map( cam );
+        }
+        frame.exposure_ns = host;
+        if( ! arduino_.valid( ) || host == 0 )
+            return;
+
+        int64_t us = arduino_.map( host ) / 1000;
+        t.arduino_us = us;
+        t.flags |= SYNC_SYNCED;
+
+        auto it = std::upper_bound( samples_.begin( ), samples_.end( ), us
+                , []( int64_t u, const Sample& s ) { return u < s.us; } );
+        if( it != samples_.begin( ) )
+        {
+            const Sample& s = *(it - 1);
+            t.trial = s.trial;
+            memcpy( t.state, s.state, sizeof( t.state ) );
+            t.sample_ms = s.ms;
+            t.pins = s.pins;
+            t.flags |= SYNC_SAMPLE;
+            if( it != samples_.end( ) )
+                t.flags |= SYNC_FINAL;
+        }
+
+        // Camera pin from its edges rather than from the sampled line.
+        auto e = std::upper_bound( edges_.begin( ), edges_.end( ), us
+                , []( int64_t u, const Edge& x ) { return u < x.us; } );
+        if( e != edges_.begin( ) )
+            t.pins = (e - 1)->high ? (t.pins | SYNC_PIN_CAMERA) : (t.pins & ~SYNC_PIN_CAMERA);
+    }
+
+    /* Host to reply of pings. */
+    const LatencyHistogram& rtt( ) const
+    {
+        return rtt_;
+    }
+
+    /* TTL report read by host after the edge by the fit; grows when the fit
+     * is off (or the serial line is backed up). */
+    const LatencyHistogram& ttl_lag( ) const
+    {
+        return ttl_lag_;
+    }
+
+    bool synced( )
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        return arduino_.valid( );
+    }
+
+    /* e.g. arduino pings=120 drift=-412.3ppm residual=85us camera drift=3.1ppm ... */
+    std::string status( )
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        std::ostringstream os;
+        os << std::fixed << std::setprecision( 1 )
+            << "arduino " << (arduino_.valid( ) ? "synced" : "unsynced")
+            << " lines=" << lines_ << " pings=" << pings_
+            << " points=" << arduino_.size( )
+            << " drift=" << arduino_.drift_ppm( ) << "ppm"
+            << " residual=" << arduino_.residual( ) / 1000 << "us";
+        for (size_t i = 0; i < cameras_.size( ); i++)
+            os << " camera" << (i ? std::to_string( i ) : "")
+                << " points=" << cameras_[i].size( )
+                << " drift=" << -cameras_[i].drift_ppm( ) << "ppm"
+                << " residual=" << cameras_[i].residual( ) / 1000 << "us";
+        return os.str( );
+    }
+
+private:
+    /**
+     * @brief arduino_line( ) with the lock held; true on a TTL edge, which
+     * is in high, edge_ns (host time) and trial.
+     */
+    bool read_line( uint64_t host_ns, const std::string& line, bool& high, uint64_t& edge_ns
+            , int& trial )
+    {
+        lines_ += 1;
+        // Arduino stamped the line before sending it.
+        int64_t sent = (int64_t)host_ns - wire_ns( wire_bytes( line ) );
+        unsigned long a = 0, b = 0;
+        if( sscanf( line.c_str( ), ">>PING %lu", &a ) == 1 )
+        {
+            if( ping_ns_ == 0 )
+                return false;
+            int64_t lo = ping_ns_, hi = std::max( sent, lo );
+            rtt_.record_diff( host_ns, ping_ns_ );
+            arduino_.add( lo + (hi - lo) / 2, unwrap( a ) * 1000, hi - lo );
+            pings_ += 1;
+            ping_ns_ = 0;
+        }
+        else if( sscanf( line.c_str( ), ">>TTL %lu %lu", &a, &b ) == 2 )
+        {
+            int64_t us = unwrap( b );
+            edges_.push_back( Edge{ us, a != 0 } );
+            while( edges_.size( ) > 1 && edges_.front( ).us < us - SYNC_HISTORY_US )
+                edges_.pop_front( );
+            if( arduino_.valid( ) )
+                ttl_lag_.record( std::max( (int64_t)0, sent - arduino_.unmap( us * 1000 ) ) );
+            high = a != 0;
+            edge_ns = arduino_.valid( ) ? arduino_.unmap( us * 1000 ) : sent;
+            trial = trial_;
+            return true;
+        }
+        else if( sscanf( line.c_str( ), ">>TRIAL %lu %lu", &a, &b ) == 2 )
+        {
+            trial_ = a;
+            trial_start_ms_ = b;
+        }
+        else if( line.compare( 0, 11, ">>> Waiting" ) == 0 )
+        {
+            // Board (re)booted: micros( ) starts again from 0.
+            reset_arduino( );
+        }
+        else
+            add_sample( line );
+        return false;
+    }
+
+    struct Sample
+    {
+        int64_t us;                             /* Arduino micros( ), unwrapped. */
+        int32_t trial;
+        char state[4];
+        uint32_t ms;                            /* As on the line. */
+        uint32_t pins;
+    };
+
+    struct Edge
+    {
+        int64_t us;
+        bool high;
+    };
+
+    void reset_arduino( )
+    {
+        arduino_.reset( );
+        samples_.clear( );
+        edges_.clear( );
+        ping_ns_ = 0;
+        trial_ = 0;
+        trial_start_ms_ = 0;
+        micros_last_ = 0;
+        micros_high_ = 0;
+    }
+
+    /* Time bytes take at baud_ (8N1). */
+    int64_t wire_ns( size_t bytes ) const
+    {
+        return baud_ ? (int64_t)bytes * 10 * 1000000000ll / baud_ : 0;
+    }
+
+    /* Bytes a line took on the wire, as text or as the packet it came in. */
+    size_t wire_bytes( const std::string& line ) const
+    {
+        if( ! packets_ )
+            return line.size( ) + 2;
+        if( line.compare( 0, 6, ">>PING" ) == 0 )
+            return SP_OVERHEAD + sizeof( sp_ping );
+        if( line.compare( 0, 5, ">>TTL" ) == 0 )
+            return SP_OVERHEAD + sizeof( sp_ttl );
+        if( line.compare( 0, 1, ">" ) == 0 )
+            return SP_OVERHEAD + line.size( );
+        return SP_OVERHEAD + sizeof( sp_sample );
+    }
+
+    /* micros( ) wraps every 71 minutes; a session is longer. */
+    int64_t unwrap( unsigned long micros )
+    {
+        micros &= 0xffffffffUL;
+        if( micros < micros_last_ && micros_last_ - micros > 0x80000000UL )
+            micros_high_ += 1ll << 32;
+        micros_last_ = micros;
+        return micros_high_ + micros;
+    }
+
+    /* time,trial,puff,tone,led,motion1,motion2,camera,imaging,state */
+    void add_sample( const std::string& line )
+    {
+        const char* p = line.c_str( );
+        long f[9];
+        for (int i = 0; i < 9; i++)
+        {
+            char* end = NULL;
+            f[i] = strtol( p, &end, 10 );
+            if( end == p || *end != ',' )
+                return;
+            p = end + 1;
+        }
+        while( *p == ' ' )
+            p++;
+
+        Sample s;
+        s.ms = f[0];
+        s.us = ((int64_t)trial_start_ms_ + f[0]) * 1000;
+        s.trial = f[1];
+        memset( s.state, 0, sizeof( s.state ) );
+        for (size_t i = 0; i < sizeof( s.state ) && p[i] && p[i] != '\r'; i++)
+            s.state[i] = p[i];
+        s.pins = (f[2] ? SYNC_PIN_PUFF : 0) | (f[3] ? SYNC_PIN_TONE : 0)
+            | (f[4] ? SYNC_PIN_LED : 0) | (f[7] ? SYNC_PIN_CAMERA : 0)
+            | (f[8] ? SYNC_PIN_IMAGING : 0);
+
+        // Sorted for lookup, whatever the board says.
+        if( ! samples_.empty( ) && s.us < samples_.back( ).us )
+            s.us = samples_.back( ).us;
+        samples_.push_back( s );
+        while( samples_.front( ).us < s.us - SYNC_HISTORY_US )
+            samples_.pop_front( );
+    }
+
+    std::mutex mutex_;
+    unsigned baud_;
+    bool packets_;
+    ClockFit arduino_;                          /* host ns -> arduino ns */
+    int64_t block_ns_;
+    size_t nblocks_;
+    std::vector<ClockFit> cameras_;             /* camera ns -> host ns, per camera */
+    std::deque<Sample> samples_;
+    std::deque<Edge> edges_;
+    uint64_t ping_ns_;                          /* Ping in flight since; 0 none. */
+    int trial_;                                 /* Of the last >>TRIAL. */
+    unsigned long trial_start_ms_;
+    unsigned long micros_last_;
+    int64_t micros_high_;
+    uint64_t lines_ = 0, pings_ = 0;
+    LatencyHistogram rtt_;
+    LatencyHistogram ttl_lag_;
+    std::function<void( bool, uint64_t, int )> ttl_handler_;
+};
+
+#endif   /* ----- #ifndef ClockSync_INC  ----- */
@@ -0,0 +1,308 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  EyeTracker.hpp
+ *
+ *    Description:  Keeps the blink ROI on the eye when the animal shifts.
+ *
+ *    The box given (blink ROI, or one drawn in camera_arduino_client.py) is
+ *    the template, at full size, binned 2x2 and binned 8x8. Every frame the
+ *    box is searched for a few pixels around where it was, binned 2x2 and
+ *    then at full size; every `every` frames the binned 8x8 template is
+ *    searched over the whole frame first, so that the eye is found again
+ *    after a jump. Match is the sum of absolute differences (psadbw),
+ *    starting where the eye is expected so that other places are dropped
+ *    after a few rows.
+ *
+ *    The box moves only on a good match (mean difference per pixel at most
+ *    max_diff), and only when it is clearly better than staying; a closing
+ *    eye matches badly and holds the box where it is.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  EyeTracker_INC
+#define  EyeTracker_INC
+
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <limits>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include "SubStreams.hpp"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief Sum of absolute differences of a w x h block of img (rows stride
+ * apart) and template t (rows w apart). Stops, with some sum at least
+ * limit, once it gets there; checked every 4 rows.
+ */
+inline uint64_t block_sad( const uint8_t* img, size_t stride, const uint8_t* t, size_t w, size_t h
+        , uint64_t limit )
+{
+    uint64_t sum = 0;
+    for (size_t y = 0; y < h && sum < limit; y += 4)
+    {
+        size_t rows = std::min( h - y, (size_t)4 );
+        for (size_t r = y; r < y + rows; r++)
+        {
+            const uint8_t* a = img + r * stride;
+            const uint8_t* b = t + r * w;
+            size_t i = 0;
+#if defined(__AVX2__)
+            __m256i acc = _mm256_setzero_si256( );
+            for (; i + 32 <= w; i += 32)
+                acc = _mm256_add_epi64( acc, _mm256_sad_epu8(
+                            _mm256_loadu_si256( (const __m256i*)(a + i) )
+                            , _mm256_loadu_si256( (const __m256i*)(b + i) ) ) );
+            __m128i acc2 = _mm_add_epi64( _mm256_castsi256_si128( acc )
+                    , _mm256_extracti128_si256( acc, 1 ) );
+            for (; i + 16 <= w; i += 16)
+                acc2 = _mm_add_epi64( acc2, _mm_sad_epu8( _mm_loadu_si128( (const __m128i*)(a + i) )
+                            , _mm_loadu_si128( (const __m128i*)(b + i) ) ) );
+            sum += _mm_cvtsi128_si64( acc2 ) + _mm_cvtsi128_si64( _mm_unpackhi_epi64( acc2, acc2 ) );
+#elif defined(__SSE2__)
+            __m128i acc2 = _mm_setzero_si128( );
+            for (; i + 16 <= w; i += 16)
+                acc2 = _mm_add_epi64( acc2, _mm_sad_epu8( _mm_loadu_si128( (const __m128i*)(a + i) )
+                            , _mm_loadu_si128( (const __m128i*)(b + i) ) ) );
+            sum += _mm_cvtsi128_si64( acc2 ) + _mm_cvtsi128_si64( _mm_unpackhi_epi64( acc2, acc2 ) );
+#endif
+            for (; i < w; i++)
+                sum += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+        }
+    }
+    return sum;
+}
+
+class EyeTracker
+{
+public:
+    typedef std::array<size_t, 4> Box;          /* x0, y0, x1, y1 */
+
+    /**
+     * @brief Constructor.
+     *
+     * @param width, height Of the (Mono8) frames.
+     * @param box Eye; columns [x0, x1) and rows [y0, y1), at least 16x16.
+     * @param every Search the whole frame every so many frames.
+     * @param max_diff Move only on matches this good (mean absolute
+     * difference per pixel, 0 to 255).
+     */
+    EyeTracker( size_t width, size_t height, const Box& box, unsigned every = 100
+            , double max_diff = 30 )
+        : width_( width ), height_( height ), every_( every ), max_diff_( max_diff )
+        , frames_( 0 ), searches_( 0 ), moves_( 0 ), diff_( -1 ), pending_( false )
+    {
+        if( every == 0 )
+            throw std::invalid_argument( "eye search interval must be at least 1 frame" );
+        w_[0] = width;
+        h_[0] = height;
+        w_[1] = width / 2;
+        h_[1] = height / 2;
+        w_[2] = w_[1] / 4;
+        h_[2] = h_[1] / 4;
+        level1_.resize( w_[1] * h_[1] );
+        level3_.resize( w_[2] * h_[2] );
+        set_box( box );
+    }
+
+    /**
+     * @brief Track box instead; its template is taken from the next frame.
+     * Any thread.
+     */
+    void set_box( const Box& b )
+    {
+        if( b[0] + 16 > b[2] || b[1] + 16 > b[3] || b[2] > width_ || b[3] > height_ )
+            throw std::invalid_argument( "eye box must be at least 16x16 and inside frame" );
+        std::lock_guard<std::mutex> lock( mutex_ );
+        next_ = b;
+        pending_ = true;
+    }
+
+    /**
+     * @brief Track the eye on frame; true if the box moved (or was set).
+     */
+    bool process( const uint8_t* frame )
+    {
+        bool grab = false;
+        {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            if( pending_ )
+            {
+                box_ = next_;
+                pending_ = false;
+                grab = true;
+            }
+        }
+        bin_frame( frame, width_, height_, 2, &level1_[0] );
+        if( grab )
+        {
+            take_template( frame );
+            frames_ = 0;
+            diff_ = 0;
+            return true;
+        }
+
+        // Where the template of each level is, in that level's pixels.
+        long x = box_[0], y = box_[1];
+        long x1 = x / 2 + ox_[1], y1 = y / 2;
+        if( ++frames_ % every_ == 0 )
+        {
+            bin_frame( &level1_[0], w_[1], h_[1], 4, &level3_[0] );
+            Match c = search( &level3_[0], 2, 0, 0, w_[2], h_[2], -1, -1 );
+            x1 = 4 * ((long)c.x - ox_[2]) + ox_[1];
+            y1 = 4 * (long)c.y;
+            searches_ += 1;
+        }
+        Match m1 = search( &level1_[0], 1, x1 - radius_, y1 - radius_, x1 + radius_ + 1
+                , y1 + radius_ + 1, x1, y1 );
+        // Binned 2x2 is a pixel off at odd shifts; 2 either side covers it.
+        long x0 = 2 * ((long)m1.x - ox_[1]) + ox_[0], y0 = 2 * (long)m1.y;
+        Match m0 = search( frame, 0, x0 - 2, y0 - 2, x0 + 3, y0 + 3, x0, y0 );
+
+        double diff = double( m0.sad ) / (tw_[0] * th_[0]);
+        long nx = (long)m0.x - ox_[0], ny = m0.y;
+        std::lock_guard<std::mutex> lock( mutex_ );
+        diff_ = diff;
+        size_t bw = box_[2] - box_[0], bh = box_[3] - box_[1];
+        if( diff > max_diff_ || (nx == x && ny == y) || nx < 0 || nx + bw > width_
+                || ny + bh > height_ )
+            return false;
+        // Within 1/16 of staying is noise, not a move.
+        uint64_t stay = block_sad( frame + y * width_ + x + ox_[0], width_, &tmpl_[0][0]
+                , tw_[0], th_[0], std::numeric_limits<uint64_t>::max( ) );
+        if( m0.sad * 16 >= stay * 15 )
+            return false;
+        box_ = Box{ { (size_t)nx, (size_t)ny, nx + bw, ny + bh } };
+        moves_ += 1;
+        return true;
+    }
+
+    Box box( ) const
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        return box_;
+    }
+
+    /* Mean absolute difference per pixel of the last best match. */
+    double diff( ) const
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        return diff_;
+    }
+
+    /* Searches of the whole frame so far. */
+    size_t searches( ) const
+    {
+        return searches_;
+    }
+
+    size_t moves( ) const
+    {
+        return moves_;
+    }
+
+    /* "x0,y0,x1,y1" */
+    std::string describe( ) const
+    {
+        Box b = box( );
+        return std::to_string( b[0] ) + "," + std::to_string( b[1] ) + ","
+            + std::to_string( b[2] ) + "," + std::to_string( b[3] );
+    }
+
+private:
+    struct Match
+    {
+        size_t x, y;
+        uint64_t sad;
+    };
+
+    /**
+     * @brief Box of frame, binned 2x2 and 8x8, as templates 0, 1, 2. Width
+     * is cut down to a multiple of 16, keeping the middle, so that rows are
+     * whole vectors; ox_ is where the template starts in the box.
+     */
+    void take_template( const uint8_t* frame )
+    {
+        bin_frame( &level1_[0], w_[1], h_[1], 4, &level3_[0] );
+        const uint8_t* levels[3] = { frame, &level1_[0], &level3_[0] };
+        const unsigned scales[3] = { 1, 2, 8 };
+        for (int l = 0; l < 3; l++)
+        {
+            size_t bw = (box_[2] - box_[0]) / scales[l];
+            tw_[l] = bw >= 16 ? bw / 16 * 16 : bw;
+            th_[l] = (box_[3] - box_[1]) / scales[l];
+            ox_[l] = (bw - tw_[l]) / 2;
+            size_t x0 = box_[0] / scales[l] + ox_[l], y0 = box_[1] / scales[l];
+            tmpl_[l].resize( tw_[l] * th_[l] );
+            for (size_t y = 0; y < th_[l]; y++)
+                memcpy( &tmpl_[l][y * tw_[l]], levels[l] + (y0 + y) * w_[l] + x0, tw_[l] );
+        }
+    }
+
+    /**
+     * @brief Best place of template l in img (level l) with top-left in
+     * [x0, x1) x [y0, y1), cut to the image; (gx, gy) first if in there, so
+     * that other places are dropped early.
+     */
+    Match search( const uint8_t* img, int l, long x0, long y0, long x1, long y1
+            , long gx, long gy ) const
+    {
+        x0 = std::max( x0, 0L );
+        y0 = std::max( y0, 0L );
+        x1 = std::max( std::min( x1, long( w_[l] - tw_[l] + 1 ) ), x0 + 1 );
+        y1 = std::max( std::min( y1, long( h_[l] - th_[l] + 1 ) ), y0 + 1 );
+        Match best = { (size_t)x0, (size_t)y0, std::numeric_limits<uint64_t>::max( ) };
+        if( gx >= x0 && gx < x1 && gy >= y0 && gy < y1 )
+            best = Match{ (size_t)gx, (size_t)gy, block_sad( img + gy * w_[l] + gx, w_[l]
+                    , &tmpl_[l][0], tw_[l], th_[l], best.sad ) };
+        for (long y = y0; y < y1; y++)
+            for (long x = x0; x < x1; x++)
+            {
+                uint64_t s = block_sad( img + y * w_[l] + x, w_[l], &tmpl_[l][0], tw_[l], th_[l]
+                        , best.sad );
+                if( s < best.sad )
+                    best = Match{ (size_t)x, (size_t)y, s };
+            }
+        return best;
+    }
+
+    size_t width_;
+    size_t height_;
+    size_t w_[3], h_[3];                        /* Full, binned 2x2, binned 8x8 */
+    unsigned every_;
+    double max_diff_;
+    const long radius_ = 3;                     /* Local search, binned 2x2 pixels */
+
+    std::vector<uint8_t> level1_;
+    std::vector<uint8_t> level3_;
+    std::vector<uint8_t> tmpl_[3];
+    size_t tw_[3], th_[3];
+    long ox_[3];
+
+    size_t frames_;
+    std::atomic<size_t> searches_;
+    std::atomic<size_t> moves_;
+
+    mutable std::mutex mutex_;                  /* box_, next_, pending_, diff_ */
+    Box box_;
+    Box next_;
+    double diff_;
+    bool pending_;
+};
+
+#endif   /* ----- #ifndef EyeTracker_INC  ----- */
@@ -0,0 +1,694 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  FrameCodec.hpp
+ *
+ *    Description:  Lossless compression of Mono8 frames for recording.
+ *
+ *    Most of an eye-camera frame (fur, head-plate, background) does not change
+ *    from one frame to the next. Every pixel is predicted from the same pixel
+ *    of the previous frame (key frames: from the pixel on its left), and the
+ *    residuals are zigzag mapped and Golomb-Rice coded in blocks of 16 with
+ *    a parameter k per block. A block of zero residuals costs 4 bits.
+ *
+ *    A frame is cut into horizontal tiles which are coded independently, on
+ *    all cores (TaskPool). A tile which does not get smaller is stored raw.
+ *
+ *    Encoded frame:
+ *
+ *      CodecFrameHeader                    (24 bytes)
+ *      uint32_t tile_bytes[tiles]
+ *      tile payloads: 1 byte mode (raw/rice), then pixels or bits.
+ *
+ *    A frame is only decodable after the key frame before it; the encoder
+ *    writes a key frame every key_interval frames.
+ *
+ *    CodecFileWriter/CodecFileReader store a trial as a 16 byte file header
+ *    followed by encoded frames (trial_%03d.ebz).
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  FrameCodec_INC
+#define  FrameCodec_INC
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "TaskPool.hpp"
+#include "PageWriter.hpp"
+
+#define CODEC_MAGIC         0x315a4245          /* "EBZ1" */
+#define CODEC_FILE_MAGIC    0x465a4245          /* "EBZF" */
+#define CODEC_VERSION       1
+
+/* CodecFrameHeader::flags */
+#define CODEC_KEY           0x1
+
+struct CodecFrameHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint32_t width;
+    uint32_t height;
+    uint32_t tiles;
+    uint32_t size;                              /* Bytes including this header. */
+};
+
+struct CodecFileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+};
+
+namespace codec_detail
+{
+
+enum { block_ = 16, qlimit_ = 16, zero_block_ = 15, max_k_ = 7 };
+enum { tile_raw_ = 0, tile_rice_ = 1 };
+
+/* Small residuals (either sign) to small codes: 0, -1, 1, -2 ... -> 0, 1, 2, 3 ... */
+inline uint8_t zigzag( uint8_t d )
+{
+    return (uint8_t)((d << 1) ^ (uint8_t)((int8_t)d >> 7));
+}
+
+inline uint8_t unzigzag( uint8_t v )
+{
+    return (uint8_t)((v >> 1) ^ (uint8_t)(-(v & 1)));
+}
+
+/* Bits are written LSB first; the code of one value is at most 24 bits. */
+class BitWriter
+{
+public:
+    BitWriter( uint8_t* out ) : p_( out ), acc_( 0 ), n_( 0 ) { }
+
+    inline void put( uint32_t v, unsigned bits )
+    {
+        acc_ |= (uint64_t)v << n_;
+        n_ += bits;
+        if( n_ >= 32 )
+        {
+            memcpy( p_, &acc_, 4 );
+            p_ += 4;
+            acc_ >>= 32;
+            n_ -= 32;
+        }
+    }
+
+    /* Write pending bits; returns end of output. */
+    uint8_t* finish( )
+    {
+        for (; n_ > 0; n_ = n_ > 8 ? n_ - 8 : 0)
+        {
+            *p_++ = (uint8_t)acc_;
+            acc_ >>= 8;
+        }
+        return p_;
+    }
+
+private:
+    uint8_t* p_;
+    uint64_t acc_;
+    unsigned n_;
+};
+
+class BitReader
+{
+public:
+    BitReader( const uint8_t* in, const uint8_t* end )
+        : p_( in ), end_( end ), acc_( 0 ), n_( 0 ), pad_( 0 ) { }
+
+    /* At least 56 bits in acc_ after this; zeros past the end. */
+    inline void refill( )
+    {
+        if( end_ - p_ >= 8 )
+        {
+            uint64_t w;
+            memcpy( &w, p_, 8 );
+            acc_ |= w << n_;
+            p_ += (63 - n_) >> 3;
+            n_ |= 56;
+            return;
+        }
+        while( n_ <= 56 )
+        {
+            if( p_ < end_ )
+                acc_ |= (uint64_t)(*p_++) << n_;
+            else
+                pad_ += 1;
+            n_ += 8;
+        }
+    }
+
+    inline uint64_t peek( ) const
+    {
+        return acc_;
+    }
+
+    inline void skip( unsigned bits )
+    {
+        acc_ >>= bits;
+        n_ -= bits;
+    }
+
+    inline uint32_t get( unsigned bits )
+    {
+        uint32_t v = (uint32_t)(acc_ & ((1ull << bits) - 1));
+        skip( bits );
+        return v;
+    }
+
+    /* True if more bits were taken than there were. */
+    bool overrun( ) const
+    {
+        return pad_ * 8 > n_;
+    }
+
+private:
+    const uint8_t* p_;
+    const uint8_t* end_;
+    uint64_t acc_;
+    unsigned n_;
+    unsigned pad_;
+};
+
+inline unsigned rice_cost( const uint8_t* v, size_t len, unsigned k )
+{
+    unsigned cost = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned q = v[i] >> k;
+        cost += q < qlimit_ ? q + 1 + k : qlimit_ + 8;
+    }
+    return cost;
+}
+
+inline void rice_block( BitWriter& bw, const uint8_t* v, size_t len )
+{
+    unsigned sum = 0;
+    for (size_t i = 0; i < len; i++)
+        sum += v[i];
+    if( sum == 0 )
+    {
+        bw.put( zero_block_, 4 );
+        return;
+    }
+
+    // k about log2 of mean; try its neighbours too.
+    unsigned mean = sum / len, k0 = 0;
+    while( (mean >> k0) > 0 )
+        k0++;
+    unsigned k = k0 > 0 ? k0 - 1 : 0, best = rice_cost( v, len, k );
+    for (unsigned c = k + 1; c <= std::min( k0 + 1, (unsigned)max_k_ ); c++)
+    {
+        unsigned cost = rice_cost( v, len, c );
+        if( cost < best )
+        {
+            best = cost;
+            k = c;
+        }
+    }
+
+    bw.put( k, 4 );
+    const uint32_t mask = (1u << k) - 1;
+    for (size_t i = 0; i < len; i++)
+    {
+        uint32_t q = v[i] >> k;
+        if( q < qlimit_ )
+            bw.put( ((v[i] & mask) << (q + 1)) | ((1u << q) - 1), q + 1 + k );
+        else
+            bw.put( ((uint32_t)v[i] << qlimit_) | ((1u << qlimit_) - 1), qlimit_ + 8 );
+    }
+}
+
+/* Decode len residuals of a block; false on a bad block header. */
+inline bool rice_unblock( BitReader& br, uint8_t* v, size_t len )
+{
+    br.refill( );
+    unsigned k = br.get( 4 );
+    if( k == zero_block_ )
+    {
+        memset( v, 0, len );
+        return true;
+    }
+    if( k > max_k_ )
+        return false;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        br.refill( );
+        // qlimit_ ones is an escape; don't look further.
+        unsigned q = __builtin_ctzll( ~br.peek( ) | (1ull << qlimit_) );
+        if( q < qlimit_ )
+        {
+            br.skip( q + 1 );
+            v[i] = (uint8_t)((q << k) | br.get( k ));
+        }
+        else
+        {
+            br.skip( qlimit_ );
+            v[i] = (uint8_t)br.get( 8 );
+        }
+    }
+    return true;
+}
+
+/* Rows of tile t of n. */
+inline void tile_rows( size_t height, size_t n, size_t t, size_t& r0, size_t& r1 )
+{
+    r0 = t * height / n;
+    r1 = (t + 1) * height / n;
+}
+
+}   /* ----- end of namespace codec_detail ----- */
+
+class FrameEncoder
+{
+public:
+    /**
+     * @brief Constructor.
+     *
+     * @param width, height Frame geometry.
+     * @param key_interval A key frame every so many frames.
+     * @param threads Threads coding tiles; 0 for one per core.
+     * @param tiles Tiles per frame (at most one per row).
+     */
+    FrameEncoder( size_t width, size_t height, size_t key_interval = 200
+            , size_t threads = 0, size_t tiles = 16 )
+        : width_( width ), height_( height ), key_interval_( std::max( key_interval, (size_t)1 ) )
+        , tiles_( std::max( std::min( tiles, height ), (size_t)1 ) )
+        , frames_( 0 ), prev_( width * height ), pool_( threads )
+        , residual_( tiles_ ), out_( tiles_ ), bytes_( tiles_ )
+    {
+        for (size_t t = 0; t < tiles_; t++)
+        {
+            size_t r0, r1;
+            codec_detail::tile_rows( height_, tiles_, t, r0, r1 );
+            size_t n = (r1 - r0) * width_;
+            residual_[t].resize( n );
+            // 4 bits per block and at most 24 bits per pixel; never more than
+            // raw once done, but the coder does not check while writing.
+            out_[t].resize( 1 + n * 3 + (n / codec_detail::block_ + 1) + 8 );
+        }
+    }
+
+    size_t width( ) const { return width_; }
+    size_t height( ) const { return height_; }
+    size_t tiles( ) const { return tiles_; }
+    size_t threads( ) const { return pool_.threads( ); }
+
+    /* Next frame is a key frame. */
+    void force_key( )
+    {
+        frames_ = 0;
+    }
+
+    /**
+     * @brief Append encoded frame to out.
+     *
+     * @return Bytes appended.
+     */
+    size_t encode( const uint8_t* frame, std::vector<uint8_t>& out )
+    {
+        bool key = frames_ % key_interval_ == 0;
+        frames_ += 1;
+
+        pool_.run( tiles_, [&]( size_t t ) { encode_tile( t, frame, key ); } );
+
+        CodecFrameHeader hdr;
+        hdr.magic = CODEC_MAGIC;
+        hdr.version = CODEC_VERSION;
+        hdr.flags = key ? CODEC_KEY : 0;
+        hdr.width = width_;
+        hdr.height = height_;
+        hdr.tiles = tiles_;
+        hdr.size = sizeof( hdr ) + tiles_ * sizeof( uint32_t );
+        for (size_t t = 0; t < tiles_; t++)
+            hdr.size += bytes_[t];
+
+        size_t start = out.size( );
+        out.resize( start + hdr.size );
+        uint8_t* p = &out[start];
+        memcpy( p, &hdr, sizeof( hdr ) );
+        p += sizeof( hdr );
+        for (size_t t = 0; t < tiles_; t++, p += sizeof( uint32_t ))
+            memcpy( p, &bytes_[t], sizeof( uint32_t ) );
+        for (size_t t = 0; t < tiles_; t++)
+        {
+            memcpy( p, &out_[t][0], bytes_[t] );
+            p += bytes_[t];
+        }
+        return hdr.size;
+    }
+
+private:
+    void encode_tile( size_t t, const uint8_t* frame, bool key )
+    {
+        using namespace codec_detail;
+
+        size_t r0, r1;
+        tile_rows( height_, tiles_, t, r0, r1 );
+        const size_t n = (r1 - r0) * width_;
+        const uint8_t* cur = frame + r0 * width_;
+        uint8_t* prev = &prev_[r0 * width_];
+        uint8_t* res = &residual_[t][0];
+
+        if( key )
+        {
+            res[0] = zigzag( cur[0] );
+            for (size_t i = 1; i < n; i++)
+                res[i] = zigzag( cur[i] - cur[i - 1] );
+        }
+        else
+        {
+            for (size_t i = 0; i < n; i++)
+                res[i] = zigzag( cur[i] - prev[i] );
+        }
+        memcpy( prev, cur, n );
+
+        uint8_t* out = &out_[t][0];
+        out[0] = tile_rice_;
+        BitWriter bw( out + 1 );
+        for (size_t i = 0; i < n; i += block_)
+            rice_block( bw, res + i, std::min( (size_t)block_, n - i ) );
+        size_t bytes = bw.finish( ) - out;
+
+        if( bytes > n + 1 )
+        {
+            // Noise (or a new scene) does not compress.
+            out[0] = tile_raw_;
+            memcpy( out + 1, cur, n );
+            bytes = n + 1;
+        }
+        bytes_[t] = bytes;
+    }
+
+    size_t width_;
+    size_t height_;
+    size_t key_interval_;
+    size_t tiles_;
+    size_t frames_;
+
+    std::vector<uint8_t> prev_;
+    TaskPool pool_;
+    std::vector<std::vector<uint8_t> > residual_;
+    std::vector<std::vector<uint8_t> > out_;
+    std::vector<uint32_t> bytes_;
+};
+
+class FrameDecoder
+{
+public:
+    /**
+     * @param threads Threads decoding tiles; 0 for one per core.
+     */
+    FrameDecoder( size_t threads = 0 )
+        : width_( 0 ), height_( 0 ), have_key_( false ), pool_( threads )
+    {
+    }
+
+    size_t width( ) const { return width_; }
+    size_t height( ) const { return height_; }
+
+    /* Geometry of an encoded frame, 0 if data is not one. */
+    static size_t frame_size( const uint8_t* data, size_t size )
+    {
+        CodecFrameHeader hdr;
+        if( size < sizeof( hdr ) )
+            return 0;
+        memcpy( &hdr, data, sizeof( hdr ) );
+        if( hdr.magic != CODEC_MAGIC || hdr.version != CODEC_VERSION )
+            return 0;
+        return (size_t)hdr.width * hdr.height;
+    }
+
+    /**
+     * @brief Decode one frame of encode( ) into frame (width x height).
+     *
+     * @param frame_bytes Size of frame; data of another size is refused
+     * before anything is allocated or written.
+     *
+     * @return false if data is corrupt, does not fit frame, or no key frame
+     * has been decoded yet.
+     */
+    bool decode( const uint8_t* data, size_t size, uint8_t* frame, size_t frame_bytes )
+    {
+        using namespace codec_detail;
+
+        CodecFrameHeader hdr;
+        size_t bytes = frame_size( data, size );
+        if( bytes == 0 || bytes != frame_bytes )
+            return false;
+        memcpy( &hdr, data, sizeof( hdr ) );
+        if( hdr.size > size || hdr.tiles == 0 || hdr.tiles > hdr.height )
+            return false;
+        size_t table = sizeof( hdr ) + hdr.tiles * sizeof( uint32_t );
+        if( table > hdr.size )
+            return false;
+
+        bool key = hdr.flags & CODEC_KEY;
+        if( key )
+        {
+            if( hdr.width != width_ || hdr.height != height_ )
+            {
+                width_ = hdr.width;
+                height_ = hdr.height;
+                prev_.assign( width_ * height_, 0 );
+                residual_.assign( width_ * height_, 0 );
+            }
+            have_key_ = true;
+        }
+        else if( ! have_key_ || hdr.width != width_ || hdr.height != height_ )
+            return false;
+
+        // Where tile payloads start.
+        std::vector<size_t> offset( hdr.tiles + 1, table );
+        for (size_t t = 0; t < hdr.tiles; t++)
+        {
+            uint32_t bytes;
+            memcpy( &bytes, data + sizeof( hdr ) + t * sizeof( uint32_t ), sizeof( bytes ) );
+            offset[t + 1] = offset[t] + bytes;
+        }
+        if( offset[hdr.tiles] != hdr.size )
+            return false;
+
+        std::atomic<bool> ok( true );
+        pool_.run( hdr.tiles, [&]( size_t t ) {
+                if( ! decode_tile( t, hdr.tiles, key, data + offset[t], offset[t + 1] - offset[t] ) )
+                    ok = false;
+                } );
+        if( ! ok )
+        {
+            // Following delta frames would be garbage.
+            have_key_ = false;
+            return false;
+        }
+        memcpy( frame, &prev_[0], width_ * height_ );
+        return true;
+    }
+
+private:
+    bool decode_tile( size_t t, size_t tiles, bool key, const uint8_t* in, size_t size )
+    {
+        using namespace codec_detail;
+
+        size_t r0, r1;
+        tile_rows( height_, tiles, t, r0, r1 );
+        const size_t n = (r1 - r0) * width_;
+        uint8_t* cur = &prev_[r0 * width_];
+        uint8_t* res = &residual_[r0 * width_];
+
+        if( size < 1 )
+            return false;
+        if( in[0] == tile_raw_ )
+        {
+            if( size != n + 1 )
+                return false;
+            memcpy( cur, in + 1, n );
+            return true;
+        }
+        if( in[0] != tile_rice_ )
+            return false;
+
+        BitReader br( in + 1, in + size );
+        for (size_t i = 0; i < n; i += block_)
+            if( ! rice_unblock( br, res + i, std::min( (size_t)block_, n - i ) ) )
+                return false;
+        if( br.overrun( ) )
+            return false;
+
+        if( key )
+        {
+            uint8_t p = 0;
+            for (size_t i = 0; i < n; i++)
+                cur[i] = p = p + unzigzag( res[i] );
+        }
+        else
+        {
+            for (size_t i = 0; i < n; i++)
+                cur[i] += unzigzag( res[i] );
+        }
+        return true;
+    }
+
+    size_t width_;
+    size_t height_;
+    bool have_key_;
+    std::vector<uint8_t> prev_;                 /* Last decoded frame. */
+    std::vector<uint8_t> residual_;
+    TaskPool pool_;
+};
+
+/**
+ * @brief Writes pages to a trial_%03d.ebz file. The first page is a key
+ * frame.
+ */
+class CodecFileWriter : public PageWriter
+{
+public:
+    CodecFileWriter( const std::string& filename, size_t width, size_t height
+            , size_t key_interval = 200, size_t threads = 0 )
+        : filename_( filename ), encoder_( width, height, key_interval, threads )
+        , page_( 0 ), bytes_( 0 )
+    {
+        file_ = fopen( filename.c_str( ), "wb" );
+        if( ! file_ )
+            return;
+        setvbuf( file_, NULL, _IOFBF, 1 << 20 );
+        CodecFileHeader hdr = { CODEC_FILE_MAGIC, CODEC_VERSION, (uint32_t)width, (uint32_t)height };
+        if( fwrite( &hdr, sizeof( hdr ), 1, file_ ) != 1 )
+        {
+            fclose( file_ );
+            file_ = NULL;
+        }
+    }
+
+    ~CodecFileWriter( )
+    {
+        if( file_ )
+            fclose( file_ );
+    }
+
+    bool is_open( ) const
+    {
+        return file_ != NULL;
+    }
+
+    bool write( const unsigned char* buffer )
+    {
+        if( ! file_ )
+            return false;
+        buf_.clear( );
+        size_t n = encoder_.encode( buffer, buf_ );
+        if( fwrite( &buf_[0], 1, n, file_ ) != n )
+            return false;
+        page_ += 1;
+        bytes_ += n;
+        return true;
+    }
+
+    size_t pages( ) const
+    {
+        return page_;
+    }
+
+    const std::string& filename( ) const
+    {
+        return filename_;
+    }
+
+    /* Encoded bytes written so far (without file header). */
+    size_t bytes( ) const
+    {
+        return bytes_;
+    }
+
+private:
+    std::string filename_;
+    FILE* file_;
+    FrameEncoder encoder_;
+    std::vector<uint8_t> buf_;
+    size_t page_;
+    size_t bytes_;
+};
+
+/**
+ * @brief Reads frames of a CodecFileWriter file in order.
+ */
+class CodecFileReader
+{
+public:
+    CodecFileReader( const std::string& filename, size_t threads = 0 )
+        : decoder_( threads ), width_( 0 ), height_( 0 )
+    {
+        file_ = fopen( filename.c_str( ), "rb" );
+        CodecFileHeader hdr;
+        if( file_ && fread( &hdr, sizeof( hdr ), 1, file_ ) == 1
+                && hdr.magic == CODEC_FILE_MAGIC && hdr.version == CODEC_VERSION )
+        {
+            width_ = hdr.width;
+            height_ = hdr.height;
+            return;
+        }
+        if( file_ )
+            fclose( file_ );
+        file_ = NULL;
+    }
+
+    ~CodecFileReader( )
+    {
+        if( file_ )
+            fclose( file_ );
+    }
+
+    bool is_open( ) const { return file_ != NULL; }
+    size_t width( ) const { return width_; }
+    size_t height( ) const { return height_; }
+
+    /**
+     * @brief Decode next frame into frame (width x height).
+     *
+     * @return false at end of file or on a corrupt frame.
+     */
+    bool next( uint8_t* frame )
+    {
+        if( ! file_ )
+            return false;
+        CodecFrameHeader hdr;
+        if( fread( &hdr, sizeof( hdr ), 1, file_ ) != 1 || hdr.size < sizeof( hdr ) )
+            return false;
+        // Every frame has the geometry of the file; a raw tile is one byte
+        // longer than its pixels, so nothing valid is larger than this.
+        size_t most = sizeof( hdr ) + height_ * (sizeof( uint32_t ) + 1) + width_ * height_;
+        if( hdr.width != width_ || hdr.height != height_ || hdr.size > most )
+            return false;
+        buf_.resize( hdr.size );
+        memcpy( &buf_[0], &hdr, sizeof( hdr ) );
+        size_t rest = hdr.size - sizeof( hdr );
+        if( fread( &buf_[sizeof( hdr )], 1, rest, file_ ) != rest )
+            return false;
+        return decoder_.decode( &buf_[0], buf_.size( ), frame, width_ * height_ );
+    }
+
+private:
+    FILE* file_;
+    FrameDecoder decoder_;
+    std::vector<uint8_t> buf_;
+    size_t width_;
+    size_t height_;
+};
+
+#endif   /* ----- #ifndef FrameCodec_INC  ----- */
@@ -0,0 +1,117 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  FrameHeader.hpp
+ *
+ *    Description:  Header which precedes every frame on SOCK_PATH. The stream
+ *    is a sequence of
+ *
+ *      FrameHeader (header_size bytes) | pixels (payload_size bytes)
+ *
+ *    so readers find frame boundaries from the header instead of counting
+ *    bytes, see gaps in frame_id and the dropped counter, and compute
+ *    latency from host_ns (CLOCK_MONOTONIC on the same machine).
+ *
+ *    Fields are little endian. Readers must skip header_size bytes rather
+ *    than sizeof( FrameHeader ): later versions only append fields.
+ *    Subscribers which send 'raw' get pixels only, as before.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  FrameHeader_INC
+#define  FrameHeader_INC
+
+#include <cstdint>
+#include <cstring>
+
+#include "FrameSource.hpp"
+
+#define FRAME_HEADER_MAGIC      0x46484245      /* "EBHF" */
+#define FRAME_HEADER_VERSION    6
+
+struct FrameHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;                       /* Bytes; pixels follow. */
+    uint64_t frame_id;                          /* Camera frame id. */
+    uint64_t camera_ns;                         /* Camera timestamp. */
+    uint64_t host_ns;                           /* CLOCK_MONOTONIC when camera gave frame. */
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixel_format;                      /* PIXEL_FORMAT_* (PFNC) */
+    uint32_t payload_size;                      /* Bytes of pixels. */
+    uint64_t dropped;                           /* Frames lost in cam_server so far. */
+    uint32_t flags;                             /* SYNC_* of the tag below. */
+    float blink;                                /* -1 if not computed. */
+
+    /* Version 2: BehaviourTag of the frame (ClockSync.hpp). */
+    int64_t arduino_us;                         /* Frame time by Arduino; -1 not synced. */
+    int32_t trial;                              /* Of the Arduino sample; -1 none. */
+    char state[4];                              /* e.g. PRE_, CS+, TRAC, PUFF, POST */
+    uint32_t sample_ms;
+    uint32_t pins;                              /* SYNC_PIN_* */
+
+    /* Version 3: which camera, and when it exposed the frame on host clock
+     * (CLOCK_MONOTONIC, by ClockSync's fit of that camera's clock). Frames
+     * of all cameras line up on exposure_ns. */
+    uint32_t camera;
+    uint32_t reserved;
+    uint64_t exposure_ns;                       /* 0 if not known. */
+
+    /* Version 4: where the pixels come from, for the preview and crop
+     * streams (SubStreams.hpp); 0, 0, 1, FRAME_STREAM_CAMERA otherwise. */
+    uint16_t x0, y0;                            /* Top-left in the camera frame. */
+    uint16_t bin;                               /* Camera pixels per pixel along x and y. */
+    uint16_t stream;                            /* FRAME_STREAM_* */
+
+    /* Version 5: motion energy of each mask (MotionEnergy.hpp), mean
+     * absolute difference per pixel; -1 for masks not set. */
+    float motion[FRAME_MOTION_MASKS];
+
+    /* Version 6: box the blink was computed on, which follows the eye
+     * (EyeTracker.hpp); x0, y0, x1, y1, all 0 without blink. */
+    uint16_t eye[4];
+};
+
+static_assert( sizeof( FrameHeader ) == 136, "FrameHeader must be 136 bytes" );
+
+inline FrameHeader make_frame_header( const Frame& frame )
+{
+    FrameHeader h;
+    h.magic = FRAME_HEADER_MAGIC;
+    h.version = FRAME_HEADER_VERSION;
+    h.header_size = sizeof( FrameHeader );
+    h.frame_id = frame.frame_id;
+    h.camera_ns = frame.timestamp;
+    h.host_ns = frame.host_ns;
+    h.width = frame.width;
+    h.height = frame.height;
+    h.pixel_format = frame.pixel_format;
+    h.payload_size = frame.size;
+    h.dropped = frame.dropped;
+    h.flags = frame.tag.flags;
+    h.blink = frame.blink;
+    h.arduino_us = frame.tag.arduino_us;
+    h.trial = frame.tag.trial;
+    memcpy( h.state, frame.tag.state, sizeof( h.state ) );
+    h.sample_ms = frame.tag.sample_ms;
+    h.pins = frame.tag.pins;
+    h.camera = frame.camera;
+    h.reserved = 0;
+    h.exposure_ns = frame.exposure_ns;
+    h.x0 = frame.x0;
+    h.y0 = frame.y0;
+    h.bin = frame.bin;
+    h.stream = frame.stream;
+    memcpy( h.motion, frame.motion, sizeof( h.motion ) );
+    memcpy( h.eye, frame.eye, sizeof( h.eye ) );
+    return h;
+}
+
+#endif   /* ----- #ifndef FrameHeader_INC  ----- */
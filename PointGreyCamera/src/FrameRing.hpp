@@ -0,0 +1,100 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  FrameRing.hpp
+ *
+ *    Description:  Lock-free single-producer/single-consumer ring of
+ *    preallocated slots. Capture thread is the only producer, sender thread
+ *    is the only consumer.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  FrameRing_INC
+#define  FrameRing_INC
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <stdexcept>
+
+template<typename T>
+class SpscRing
+{
+public:
+    /**
+     * @brief Constructor.
+     *
+     * @param capacity Number of slots; must be a power of 2.
+     */
+    SpscRing( size_t capacity ) : slots_( capacity ), mask_( capacity - 1 )
+        , head_( 0 ), tail_( 0 )
+    {
+        if( capacity == 0 || (capacity & mask_) != 0 )
+            throw std::invalid_argument( "SpscRing capacity must be power of 2" );
+    }
+
+    SpscRing( const SpscRing& ) = delete;
+    SpscRing& operator=( const SpscRing& ) = delete;
+
+    /**
+     * @brief Producer side.
+     *
+     * @return false when ring is full; value is not stored.
+     */
+    bool push( const T& value )
+    {
+        size_t head = head_.load( std::memory_order_relaxed );
+        if( head - tail_.load( std::memory_order_acquire ) > mask_ )
+            return false;
+        slots_[head & mask_] = value;
+        head_.store( head + 1, std::memory_order_release );
+        return true;
+    }
+
+    /**
+     * @brief Consumer side.
+     *
+     * @return false when ring is empty.
+     */
+    bool pop( T& value )
+    {
+        size_t tail = tail_.load( std::memory_order_relaxed );
+        if( tail == head_.load( std::memory_order_acquire ) )
+            return false;
+        value = slots_[tail & mask_];
+        tail_.store( tail + 1, std::memory_order_release );
+        return true;
+    }
+
+    /* Number of occupied slots. Approximate when called concurrently. */
+    size_t size( ) const
+    {
+        return head_.load( std::memory_order_acquire )
+            - tail_.load( std::memory_order_acquire );
+    }
+
+    size_t capacity( ) const
+    {
+        return mask_ + 1;
+    }
+
+private:
+    std::vector<T> slots_;
+    const size_t mask_;
+
+    // Keep producer and consumer index on separate cache lines. Padding
+    // rather than alignas( 64 ): rings live in objects made with new (one
+    // Acquisition per camera), which C++11 does not align beyond 16.
+    char pad0_[64];
+    std::atomic<size_t> head_;
+    char pad1_[64 - sizeof( std::atomic<size_t> )];
+    std::atomic<size_t> tail_;
+    char pad2_[64 - sizeof( std::atomic<size_t> )];
+};
+
+#endif   /* ----- #ifndef FrameRing_INC  ----- */
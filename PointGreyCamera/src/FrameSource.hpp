@@ -0,0 +1,208 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  FrameSource.hpp
+ *
+ *    Description:  Abstract source of frames. cam_server talks to the camera
+ *    only through this interface so that the transport and processing path
+ *    can be exercised without a physical camera attached.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  FrameSource_INC
+#define  FrameSource_INC
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <new>
+#include <ctime>
+
+/* Pixel formats, GenICam PFNC codes as Spinnaker reports them. */
+#define PIXEL_FORMAT_MONO8      0x01080001
+#define PIXEL_FORMAT_MONO12P    0x010C0047      /* USB3 Vision packing */
+#define PIXEL_FORMAT_MONO12PACKED   0x010C0006  /* GigE Vision packing */
+#define PIXEL_FORMAT_MONO16     0x01100007
+
+/* Which stream of cam_server a frame is on (SubStreams.hpp). */
+#define FRAME_STREAM_CAMERA     0               /* Frames as the camera gave them. */
+#define FRAME_STREAM_PREVIEW    1               /* Binned, a few per second. */
+#define FRAME_STREAM_CROP       2               /* ROI of every frame. */
+
+/* Motion energy masks a frame carries (MotionEnergy.hpp). */
+#define FRAME_MOTION_MASKS      4
+
+/**
+ * @brief CLOCK_MONOTONIC in ns. Sources stamp frames with it the moment they
+ * get them; clients compare it with their own CLOCK_MONOTONIC for latency.
+ */
+inline uint64_t monotonic_ns( )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @brief Arduino side of a frame, filled by ClockSync::tag( ): the frame's
+ * time on the Arduino clock and the sample the Arduino took last before it.
+ */
+struct BehaviourTag
+{
+    int64_t arduino_us;                         /* Arduino micros( ); -1 if not synced. */
+    int32_t trial;                              /* Trial of the sample; -1 if none. */
+    char state[4];                              /* trial_state_ of it, e.g. PRE_, CS+, PUFF */
+    uint32_t sample_ms;                         /* Its time field (ms since trial start). */
+    uint32_t pins;                              /* SYNC_PIN_* */
+    uint32_t flags;                             /* SYNC_* */
+
+    BehaviourTag( ) : arduino_us( -1 ), trial( -1 ), sample_ms( 0 ), pins( 0 ), flags( 0 )
+    {
+        state[0] = state[1] = state[2] = state[3] = 0;
+    }
+};
+
+/**
+ * @brief A frame handed out by a FrameSource. The pixel buffer is owned by the
+ * source and stays valid until the frame is given back with
+ * FrameSource::release( ).
+ */
+struct Frame
+{
+    unsigned char* data;
+    size_t width;
+    size_t height;
+    size_t size;                                /* Size of buffer in bytes. */
+    uint64_t frame_id;                          /* Id assigned by the source. */
+    uint64_t timestamp;                         /* Camera timestamp (ns). */
+    uint64_t host_ns;                           /* monotonic_ns( ) when source got it. */
+    uint32_t pixel_format;                      /* PIXEL_FORMAT_* */
+    uint64_t dropped;                           /* Frames lost before this one. */
+    bool incomplete;
+    int status;                                 /* Image status if incomplete. */
+    void* handle;                               /* Opaque; used by release( ). */
+    float blink;                                /* Blink signal; -1 if not computed. */
+    uint32_t camera;                            /* Index of camera in cam_server; 0 is the eye. */
+    uint64_t exposure_ns;                       /* Camera timestamp on host clock; 0 if not known. */
+    const uint16_t* wide;                       /* Full bit depth pixels, if PixelConverter kept them. */
+    uint16_t x0, y0;                            /* Top-left of the pixels in the camera frame. */
+    uint16_t bin;                               /* Camera pixels per pixel along x and y. */
+    uint16_t stream;                            /* FRAME_STREAM_* */
+    float motion[FRAME_MOTION_MASKS];           /* Motion energy of each mask; -1 if none. */
+    uint16_t eye[4];                            /* Box of the blink signal x0, y0, x1, y1; 0s if none. */
+    BehaviourTag tag;
+
+    Frame( ) : data( NULL ), width( 0 ), height( 0 ), size( 0 )
+        , frame_id( 0 ), timestamp( 0 ), host_ns( 0 ), pixel_format( PIXEL_FORMAT_MONO8 )
+        , dropped( 0 ), incomplete( false ), status( 0 )
+        , handle( NULL ), blink( -1.0f ), camera( 0 ), exposure_ns( 0 ), wide( NULL )
+        , x0( 0 ), y0( 0 ), bin( 1 ), stream( FRAME_STREAM_CAMERA )
+    {
+        for (size_t m = 0; m < FRAME_MOTION_MASKS; m++)
+            motion[m] = -1.0f;
+        eye[0] = eye[1] = eye[2] = eye[3] = 0;
+    }
+};
+
+/**
+ * @brief Interface which covers whatever RunSingleCamera/AcquireImages need
+ * from a camera. All functions returning int follow the Spinnaker examples:
+ * 0 on success and -1 on failure.
+ */
+class FrameSource
+{
+public:
+    virtual ~FrameSource( ) { }
+
+    virtual std::string name( ) const = 0;
+
+    /* Open the device and configure geometry, frame rate and exposure. */
+    virtual int init( ) = 0;
+
+    virtual int begin_acquisition( ) = 0;
+
+    /**
+     * @brief Block until next frame is available.
+     *
+     * @return false when source has no more frames (end of replay) or when
+     * it timed out; frame is not touched in that case.
+     */
+    virtual bool next_frame( Frame& frame ) = 0;
+
+    /* Give the buffer of frame back to source. */
+    virtual void release( Frame& frame ) = 0;
+
+    virtual void end_acquisition( ) = 0;
+
+    virtual void deinit( ) = 0;
+
+    /* Frame rate the source is configured to deliver. */
+    virtual double frame_rate( ) const = 0;
+};
+
+/**
+ * @brief Fixed pool of frame sized buffers used by the stand-in sources. When
+ * all buffers are in use, acquire( ) returns NULL and the caller must drop the
+ * frame, just like a camera which runs out of stream buffers.
+ */
+class BufferPool
+{
+public:
+    BufferPool( size_t nbuffers, size_t bufsize ) : bufsize_( bufsize )
+    {
+        for (size_t i = 0; i < nbuffers; i++)
+        {
+            void* p = NULL;
+            if( posix_memalign( &p, 64, ((bufsize + 63) / 64) * 64 ) != 0 )
+                throw std::bad_alloc( );
+            unsigned char* buf = static_cast<unsigned char*>( p );
+            all_.push_back( buf );
+            free_.push_back( buf );
+        }
+    }
+
+    ~BufferPool( )
+    {
+        for( auto b : all_ )
+            free( b );
+    }
+
+    BufferPool( const BufferPool& ) = delete;
+    BufferPool& operator=( const BufferPool& ) = delete;
+
+    unsigned char* acquire( )
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        if( free_.empty( ) )
+            return NULL;
+        unsigned char* buf = free_.back( );
+        free_.pop_back( );
+        return buf;
+    }
+
+    void release( unsigned char* buf )
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        free_.push_back( buf );
+    }
+
+    size_t bufsize( ) const
+    {
+        return bufsize_;
+    }
+
+private:
+    size_t bufsize_;
+    std::vector<unsigned char*> all_;
+    std::vector<unsigned char*> free_;
+    std::mutex mutex_;
+};
+
+#endif   /* ----- #ifndef FrameSource_INC  ----- */
@@ -0,0 +1,159 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  LatencyHistogram.hpp
+ *
+ *    Description:  Log-linear latency histogram, as in HdrHistogram: every
+ *    power of two is split in 16 linear buckets, so any value is known to
+ *    within 1/16 (6%) from 1 ns to 2^40 ns (18 minutes) with 592 counters.
+ *
+ *    record( ) is one relaxed atomic increment and can be called from any
+ *    thread on every frame. Readers take a snapshot( ); snapshots subtract,
+ *    which gives the histogram of a trial without resetting anything.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  LatencyHistogram_INC
+#define  LatencyHistogram_INC
+
+#include <cstdint>
+#include <cstdio>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#define LATENCY_SUB_BITS        4
+#define LATENCY_SUB_BUCKETS     (1 << LATENCY_SUB_BITS)
+#define LATENCY_MAX_BITS        40
+#define LATENCY_NUM_BUCKETS     ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+/**
+ * @brief Counts of a LatencyHistogram at some instant.
+ */
+struct LatencyCounts
+{
+    std::vector<uint64_t> counts;
+
+    LatencyCounts( ) : counts( LATENCY_NUM_BUCKETS, 0 )
+    { }
+
+    static size_t bucket( uint64_t ns )
+    {
+        if( ns < LATENCY_SUB_BUCKETS )
+            return ns;
+        int msb = 63 - __builtin_clzll( ns );
+        if( msb >= LATENCY_MAX_BITS )
+            return LATENCY_NUM_BUCKETS - 1;
+        int shift = msb - LATENCY_SUB_BITS;
+        return (shift + 1) * LATENCY_SUB_BUCKETS + (ns >> shift) - LATENCY_SUB_BUCKETS;
+    }
+
+    /* Largest value which falls in bucket b. */
+    static uint64_t upper( size_t b )
+    {
+        if( b < LATENCY_SUB_BUCKETS )
+            return b;
+        int shift = b / LATENCY_SUB_BUCKETS - 1;
+        uint64_t sub = b % LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    uint64_t count( ) const
+    {
+        uint64_t n = 0;
+        for( auto c : counts )
+            n += c;
+        return n;
+    }
+
+    /**
+     * @brief Value below which fraction q of samples are (within 6%); 0 if
+     * there are none.
+     */
+    uint64_t percentile( double q ) const
+    {
+        uint64_t n = count( );
+        if( n == 0 )
+            return 0;
+        uint64_t rank = (uint64_t)(q * n + 0.5);
+        if( rank < 1 )
+            rank = 1;
+        uint64_t seen = 0;
+        for (size_t b = 0; b < counts.size( ); b++)
+        {
+            seen += counts[b];
+            if( seen >= rank )
+                return upper( b );
+        }
+        return upper( counts.size( ) - 1 );
+    }
+
+    uint64_t max( ) const
+    {
+        for (size_t b = counts.size( ); b > 0; b--)
+            if( counts[b - 1] > 0 )
+                return upper( b - 1 );
+        return 0;
+    }
+
+    /* Samples taken since earlier snapshot. */
+    LatencyCounts operator-( const LatencyCounts& earlier ) const
+    {
+        LatencyCounts d;
+        for (size_t b = 0; b < counts.size( ); b++)
+            d.counts[b] = counts[b] - earlier.counts[b];
+        return d;
+    }
+
+    /* e.g. n=1200 p50=0.31 p99=0.87 p99.9=2.10 max=3.80 ms */
+    std::string summary( ) const
+    {
+        char buf[128];
+        snprintf( buf, sizeof( buf ), "n=%llu p50=%.3f p99=%.3f p99.9=%.3f max=%.3f ms"
+                , (unsigned long long)count( ), percentile( 0.5 ) / 1e6
+                , percentile( 0.99 ) / 1e6, percentile( 0.999 ) / 1e6, max( ) / 1e6 );
+        return buf;
+    }
+};
+
+class LatencyHistogram
+{
+public:
+    LatencyHistogram( ) : counts_( LATENCY_NUM_BUCKETS )
+    {
+        for( auto& c : counts_ )
+            c = 0;
+    }
+
+    LatencyHistogram( const LatencyHistogram& ) = delete;
+    LatencyHistogram& operator=( const LatencyHistogram& ) = delete;
+
+    void record( uint64_t ns )
+    {
+        counts_[LatencyCounts::bucket( ns )].fetch_add( 1, std::memory_order_relaxed );
+    }
+
+    /* Negative latencies (clocks of two machines) count as 0. */
+    void record_diff( uint64_t later, uint64_t earlier )
+    {
+        record( later > earlier ? later - earlier : 0 );
+    }
+
+    LatencyCounts snapshot( ) const
+    {
+        LatencyCounts s;
+        for (size_t b = 0; b < counts_.size( ); b++)
+            s.counts[b] = counts_[b].load( std::memory_order_relaxed );
+        return s;
+    }
+
+private:
+    std::vector<std::atomic<uint64_t> > counts_;
+};
+
+#endif   /* ----- #ifndef LatencyHistogram_INC  ----- */
@@ -0,0 +1,35 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  PageWriter.hpp
+ *
+ *    Description:  What TrialRecorder needs from a file format: append pages
+ *    of one geometry to a file. See TiffWriter.hpp and FrameCodec.hpp.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  PageWriter_INC
+#define  PageWriter_INC
+
+#include <string>
+
+class PageWriter
+{
+public:
+    virtual ~PageWriter( ) { }
+
+    virtual bool is_open( ) const = 0;
+
+    /* Append a page; false on write error. */
+    virtual bool write( const unsigned char* buffer ) = 0;
+
+    virtual size_t pages( ) const = 0;
+    virtual const std::string& filename( ) const = 0;
+};
+
+#endif   /* ----- #ifndef PageWriter_INC  ----- */
@@ -0,0 +1,464 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  PixelUnpack.hpp
+ *
+ *    Description:  Mono12p, Mono12Packed and Mono16 frames to Mono8 through a
+ *    window (or gamma LUT), fast enough for 200 fps. The SDK's Convert( ) is
+ *    not. Pixels are unpacked to 12 bit with SIMD, then mapped to 8 bit; rows
+ *    of a frame are split across a TaskPool.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  PixelUnpack_INC
+#define  PixelUnpack_INC
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include "FrameSource.hpp"
+#include "TaskPool.hpp"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Bit layout of two pixels p0, p1 in three bytes b0 b1 b2:
+ *   Mono12p (USB3)       p0 = b0 | (b1 & 0xF) << 8    p1 = b1 >> 4 | b2 << 4
+ *   Mono12Packed (GigE)  p0 = b0 << 4 | (b1 & 0xF)    p1 = b2 << 4 | b1 >> 4
+ * Mono16 is little endian; cameras with a 12 bit ADC leave its low 4 bits 0.
+ */
+
+inline const char* pixel_format_name( uint32_t format )
+{
+    switch( format )
+    {
+        case PIXEL_FORMAT_MONO8:
+            return "mono8";
+        case PIXEL_FORMAT_MONO12P:
+            return "mono12p";
+        case PIXEL_FORMAT_MONO12PACKED:
+            return "mono12packed";
+        case PIXEL_FORMAT_MONO16:
+            return "mono16";
+    }
+    return "unknown";
+}
+
+/* PIXEL_FORMAT_* of name (as printed by pixel_format_name( ), or the
+ * GenICam symbolic e.g. Mono12p); 0 if not known. */
+inline uint32_t pixel_format_from_name( std::string name )
+{
+    std::transform( name.begin( ), name.end( ), name.begin( ), ::tolower );
+    for( uint32_t f : { PIXEL_FORMAT_MONO8, PIXEL_FORMAT_MONO12P
+            , PIXEL_FORMAT_MONO12PACKED, PIXEL_FORMAT_MONO16 } )
+        if( name == pixel_format_name( f ) )
+            return f;
+    return 0;
+}
+
+/* Bytes of n pixels; n is even for the 12 bit formats. */
+inline size_t pixel_format_bytes( uint32_t format, size_t n )
+{
+    switch( format )
+    {
+        case PIXEL_FORMAT_MONO12P:
+        case PIXEL_FORMAT_MONO12PACKED:
+            return n / 2 * 3;
+        case PIXEL_FORMAT_MONO16:
+            return 2 * n;
+    }
+    return n;
+}
+
+/* Right shift which takes a pixel of format to 12 bit. */
+inline unsigned pixel_format_shift( uint32_t format )
+{
+    return format == PIXEL_FORMAT_MONO16 ? 4 : 0;
+}
+
+/**
+ * @brief Pack n 12 bit pixels (n even) into a 12 bit format. Stand-in
+ * sources and tests use it; it need not be fast.
+ */
+inline void pack_mono12( const uint16_t* in, size_t n, uint8_t* out, uint32_t format )
+{
+    for (size_t i = 0; i < n; i += 2, out += 3)
+    {
+        uint16_t p0 = in[i] & 0xFFF, p1 = in[i + 1] & 0xFFF;
+        if( format == PIXEL_FORMAT_MONO12PACKED )
+        {
+            out[0] = p0 >> 4;
+            out[1] = (p0 & 0xF) | (p1 & 0xF) << 4;
+            out[2] = p1 >> 4;
+        }
+        else
+        {
+            out[0] = p0 & 0xFF;
+            out[1] = p0 >> 8 | (p1 & 0xF) << 4;
+            out[2] = p1 >> 4;
+        }
+    }
+}
+
+/**
+ * @brief Unpack n pixels (n even) of a 12 bit format starting at src.
+ * Scalar; unpack_mono12( ) does the same with SIMD.
+ */
+inline void unpack_mono12_scalar( const uint8_t* src, size_t n, uint16_t* out, uint32_t format )
+{
+    const bool gige = format == PIXEL_FORMAT_MONO12PACKED;
+    for (size_t i = 0; i < n; i += 2, src += 3)
+    {
+        if( gige )
+        {
+            out[i] = src[0] << 4 | (src[1] & 0xF);
+            out[i + 1] = src[2] << 4 | src[1] >> 4;
+        }
+        else
+        {
+            out[i] = src[0] | (src[1] & 0xF) << 8;
+            out[i + 1] = src[1] >> 4 | src[2] << 4;
+        }
+    }
+}
+
+/**
+ * @brief Unpack n pixels (n even) of a 12 bit format to 12 bit values.
+ *
+ * Eight pixels are 12 bytes. A byte shuffle puts the two bytes holding each
+ * pixel into its 16 bit lane; one mask or shift per lane parity finishes it.
+ * Loads are 16 bytes, so the vector loop stops 4 bytes short of the end.
+ */
+inline void unpack_mono12( const uint8_t* src, size_t n, uint16_t* out, uint32_t format )
+{
+    size_t i = 0;
+    const bool gige = format == PIXEL_FORMAT_MONO12PACKED;
+#if defined(__AVX2__)
+    // Lanes of p0 get (b0, b1) for Mono12p, (b1, b0) for Mono12Packed; lanes
+    // of p1 get (b1, b2) for both.
+    const __m256i shuf = gige
+        ? _mm256_setr_epi8( 1, 0, 1, 2, 4, 3, 4, 5, 7, 6, 7, 8, 10, 9, 10, 11
+                , 1, 0, 1, 2, 4, 3, 4, 5, 7, 6, 7, 8, 10, 9, 10, 11 )
+        : _mm256_setr_epi8( 0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11
+                , 0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11 );
+    const __m256i low12 = _mm256_set1_epi16( 0x0FFF );
+    const __m256i mid8 = _mm256_set1_epi16( 0x0FF0 );
+    const __m256i low4 = _mm256_set1_epi16( 0x000F );
+    for (; i + 19 <= n; i += 16)
+    {
+        const uint8_t* s = src + i / 2 * 3;
+        __m256i v = _mm256_inserti128_si256( _mm256_castsi128_si256(
+                    _mm_loadu_si128( (const __m128i*)s ) )
+                , _mm_loadu_si128( (const __m128i*)(s + 12) ), 1 );
+        v = _mm256_shuffle_epi8( v, shuf );
+        __m256i odd = _mm256_srli_epi16( v, 4 );
+        __m256i even = gige
+            ? _mm256_or_si256( _mm256_and_si256( odd, mid8 ), _mm256_and_si256( v, low4 ) )
+            : _mm256_and_si256( v, low12 );
+        _mm256_storeu_si256( (__m256i*)(out + i), _mm256_blend_epi16( even, odd, 0xAA ) );
+    }
+#elif defined(__SSSE3__)
+    const __m128i shuf = gige
+        ? _mm_setr_epi8( 1, 0, 1, 2, 4, 3, 4, 5, 7, 6, 7, 8, 10, 9, 10, 11 )
+        : _mm_setr_epi8( 0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11 );
+    const __m128i low12 = _mm_set1_epi16( 0x0FFF );
+    const __m128i mid8 = _mm_set1_epi16( 0x0FF0 );
+    const __m128i low4 = _mm_set1_epi16( 0x000F );
+    const __m128i evenLanes = _mm_set1_epi32( 0x0000FFFF );
+    for (; i + 11 <= n; i += 8)
+    {
+        __m128i v = _mm_loadu_si128( (const __m128i*)(src + i / 2 * 3) );
+        v = _mm_shuffle_epi8( v, shuf );
+        __m128i odd = _mm_srli_epi16( v, 4 );
+        __m128i even = gige
+            ? _mm_or_si128( _mm_and_si128( odd, mid8 ), _mm_and_si128( v, low4 ) )
+            : _mm_and_si128( v, low12 );
+        __m128i px = _mm_or_si128( _mm_and_si128( evenLanes, even )
+                , _mm_andnot_si128( evenLanes, odd ) );
+        _mm_storeu_si128( (__m128i*)(out + i), px );
+    }
+#endif
+    unpack_mono12_scalar( src + i / 2 * 3, n - i, out + i, format );
+}
+
+/**
+ * @brief Mono16 pixels to 12 bit values (top 12 bits).
+ */
+inline void unpack_mono16( const uint16_t* src, size_t n, uint16_t* out )
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i v = _mm256_loadu_si256( (const __m256i*)(src + i) );
+        _mm256_storeu_si256( (__m256i*)(out + i), _mm256_srli_epi16( v, 4 ) );
+    }
+#elif defined(__SSE2__)
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i v = _mm_loadu_si128( (const __m128i*)(src + i) );
+        _mm_storeu_si128( (__m128i*)(out + i), _mm_srli_epi16( v, 4 ) );
+    }
+#endif
+    for (; i < n; i++)
+        out[i] = src[i] >> 4;
+}
+
+/**
+ * @brief Linear window of 12 bit values to 8 bit:
+ * min( 255, (max( v - lo, 0 ) * mul) >> 16 ).
+ */
+inline void map_window( const uint16_t* in, size_t n, uint16_t lo, uint16_t mul, uint8_t* out )
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i vlo = _mm256_set1_epi16( (short)lo );
+    const __m256i vmul = _mm256_set1_epi16( (short)mul );
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256( (const __m256i*)(in + i) );
+        __m256i b = _mm256_loadu_si256( (const __m256i*)(in + i + 16) );
+        a = _mm256_mulhi_epu16( _mm256_subs_epu16( a, vlo ), vmul );
+        b = _mm256_mulhi_epu16( _mm256_subs_epu16( b, vlo ), vmul );
+        // packus works per 128 bit lane; put the quadwords back in order.
+        __m256i p = _mm256_permute4x64_epi64( _mm256_packus_epi16( a, b ), 0xD8 );
+        _mm256_storeu_si256( (__m256i*)(out + i), p );
+    }
+#elif defined(__SSE2__)
+    const __m128i vlo = _mm_set1_epi16( (short)lo );
+    const __m128i vmul = _mm_set1_epi16( (short)mul );
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i a = _mm_loadu_si128( (const __m128i*)(in + i) );
+        __m128i b = _mm_loadu_si128( (const __m128i*)(in + i + 8) );
+        a = _mm_mulhi_epu16( _mm_subs_epu16( a, vlo ), vmul );
+        b = _mm_mulhi_epu16( _mm_subs_epu16( b, vlo ), vmul );
+        _mm_storeu_si128( (__m128i*)(out + i), _mm_packus_epi16( a, b ) );
+    }
+#endif
+    for (; i < n; i++)
+    {
+        uint32_t d = in[i] > lo ? in[i] - lo : 0;
+        out[i] = (uint8_t)std::min( 255u, (d * mul) >> 16 );
+    }
+}
+
+/* 12 bit values to 8 bit through a table of 4096. */
+inline void map_lut( const uint16_t* in, size_t n, const uint8_t* lut, uint8_t* out )
+{
+    for (size_t i = 0; i < n; i++)
+        out[i] = lut[in[i] & 0xFFF];
+}
+
+/**
+ * @brief Mapping from 12 bit to 8 bit. With gamma 1 and a window of at least
+ * 256 levels it is linear and map_window( ) does it; else the table is used.
+ * The table holds the same values in either case.
+ */
+struct PixelMap
+{
+    unsigned shift;                             /* Of the pixel format it was made for. */
+    uint16_t lo;
+    uint16_t mul;
+    bool linear;
+    uint8_t lut[4096];
+
+    PixelMap( unsigned shift, uint32_t lo, uint32_t hi, double gamma )
+        : shift( shift ), lo( 0 ), mul( 0 ), linear( false )
+    {
+        uint32_t lo12 = std::min( lo >> shift, 4095u );
+        uint32_t hi12 = std::max( std::min( hi >> shift, 4095u ), lo12 + 1 );
+        uint32_t span = hi12 - lo12;
+        this->lo = lo12;
+        linear = gamma == 1.0 && span >= 256;
+        if( linear )
+        {
+            // Rounded up so that hi maps to 255.
+            mul = ((255u << 16) + span - 1) / span;
+            for (uint32_t v = 0; v < 4096; v++)
+            {
+                uint32_t d = v > lo12 ? v - lo12 : 0;
+                lut[v] = (uint8_t)std::min( 255u, (d * mul) >> 16 );
+            }
+            return;
+        }
+        for (uint32_t v = 0; v < 4096; v++)
+        {
+            double x = std::min( 1.0, std::max( 0.0, ((double)v - lo12) / span ) );
+            lut[v] = (uint8_t)std::lround( 255.0 * std::pow( x, 1.0 / gamma ) );
+        }
+    }
+};
+
+/**
+ * @brief Turns frames of any PIXEL_FORMAT_* into Mono8 for the blink
+ * detector, transports and recorder. One per camera; convert( ) is called
+ * from its sender thread, set_window( ) from any thread.
+ */
+class PixelConverter
+{
+public:
+    /**
+     * @brief Constructor.
+     *
+     * @param width, height Frame geometry; width must be even for the 12 bit
+     * formats.
+     * @param threads Threads converting a frame, including the caller.
+     */
+    PixelConverter( size_t width, size_t height, size_t threads = 1 )
+        : width_( width ), height_( height ), pool_( std::max( threads, (size_t)1 ) )
+        , out_( width * height ), lo_( 0 ), hi_( 0 ), gamma_( 1.0 )
+    { }
+
+    PixelConverter( const PixelConverter& ) = delete;
+    PixelConverter& operator=( const PixelConverter& ) = delete;
+
+    /**
+     * @brief Pixels from lo to hi (in units of the camera's pixel format, e.g.
+     * 0-4095 for Mono12p) are spread over 0-255.
+     *
+     * @param hi 0 for the full range of the format.
+     * @param gamma Output is ((v - lo) / (hi - lo))^(1/gamma); > 1 brightens
+     * the dark end.
+     */
+    void set_window( uint32_t lo, uint32_t hi, double gamma = 1.0 )
+    {
+        if( (hi != 0 && hi <= lo) || ! (gamma > 0.0) )
+            throw std::invalid_argument( "window needs lo < hi and gamma > 0" );
+        std::lock_guard<std::mutex> lock( mutex_ );
+        lo_ = lo;
+        hi_ = hi;
+        gamma_ = gamma;
+        map_.reset( );
+    }
+
+    /* Window as gain and offset: out = (v - offset) * gain. */
+    void set_gain( double gain, uint32_t offset )
+    {
+        if( ! (gain > 0.0) )
+            throw std::invalid_argument( "gain must be > 0" );
+        set_window( offset, offset + (uint32_t)std::max( 1.0, std::ceil( 255.0 / gain ) ) );
+    }
+
+    /* "lo,hi,gamma" */
+    std::string window( )
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        std::ostringstream ss;
+        ss << lo_ << ',' << hi_ << ',' << gamma_;
+        return ss.str( );
+    }
+
+    /* Keep full bit depth pixels for the recorder, see convert( ). */
+    void keep_wide( bool keep )
+    {
+        if( keep )
+            wide_.resize( width_ * height_ );
+        else
+            wide_.clear( );
+    }
+
+    /**
+     * @brief Make frame Mono8: data points to a buffer of the converter,
+     * valid until the next convert( ). With keep_wide( true ), frame.wide
+     * gets the pixels at full depth (12 bit values for Mono12p and
+     * Mono12Packed). Mono8 frames are left alone.
+     *
+     * @return false if frame is of an unknown format or too small.
+     */
+    bool convert( Frame& frame )
+    {
+        uint32_t format = frame.pixel_format;
+        frame.wide = NULL;
+        if( format == PIXEL_FORMAT_MONO8 )
+            return true;
+        size_t npix = width_ * height_;
+        if( pixel_format_from_name( pixel_format_name( format ) ) == 0
+                || frame.width != width_ || frame.height != height_
+                || frame.size < pixel_format_bytes( format, npix )
+                || (format != PIXEL_FORMAT_MONO16 && width_ % 2) )
+            return false;
+
+        std::shared_ptr<const PixelMap> map = pixel_map( pixel_format_shift( format ) );
+        const uint8_t* src = frame.data;
+        uint16_t* wide = NULL;
+        if( ! wide_.empty( ) && format != PIXEL_FORMAT_MONO16 )
+            wide = &wide_[0];
+
+        size_t bands = pool_.threads( );
+        pool_.run( bands, [&]( size_t b ) {
+                size_t r0 = height_ * b / bands, r1 = height_ * (b + 1) / bands;
+                convert_pixels( src, format, r0 * width_, r1 * width_, *map, &out_[0], wide );
+                } );
+
+        // Mono16 is its own wide copy.
+        if( ! wide_.empty( ) )
+            frame.wide = format == PIXEL_FORMAT_MONO16 ? (const uint16_t*)src : wide;
+        frame.data = &out_[0];
+        frame.size = npix;
+        frame.pixel_format = PIXEL_FORMAT_MONO8;
+        return true;
+    }
+
+    /**
+     * @brief Pixels [p0, p1) of src to out (and wide if not NULL), in chunks
+     * which stay in L1. p0 is even.
+     */
+    static void convert_pixels( const uint8_t* src, uint32_t format, size_t p0, size_t p1
+            , const PixelMap& map, uint8_t* out, uint16_t* wide )
+    {
+        uint16_t scratch[chunk_];
+        for (size_t i = p0; i < p1; i += chunk_)
+        {
+            size_t n = std::min( (size_t)chunk_, p1 - i );
+            uint16_t* v = wide ? wide + i : scratch;
+            if( format == PIXEL_FORMAT_MONO16 )
+                unpack_mono16( (const uint16_t*)src + i, n, v );
+            else
+                unpack_mono12( src + i / 2 * 3, n, v, format );
+            if( map.linear )
+                map_window( v, n, map.lo, map.mul, out + i );
+            else
+                map_lut( v, n, map.lut, out + i );
+        }
+    }
+
+private:
+    std::shared_ptr<const PixelMap> pixel_map( unsigned shift )
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        if( ! map_ || map_->shift != shift )
+            map_.reset( new PixelMap( shift, lo_, hi_ ? hi_ : (4096u << shift) - 1, gamma_ ) );
+        return map_;
+    }
+
+    enum { chunk_ = 2048 };
+
+    size_t width_;
+    size_t height_;
+    TaskPool pool_;
+    std::vector<uint8_t> out_;
+    std::vector<uint16_t> wide_;
+
+    std::mutex mutex_;                          /* lo_, hi_, gamma_, map_ */
+    uint32_t lo_, hi_;
+    double gamma_;
+    std::shared_ptr<const PixelMap> map_;
+};
+
+#endif   /* ----- #ifndef PixelUnpack_INC  ----- */
@@ -0,0 +1,274 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  SampleDecoder.hpp
+ *
+ *    Description:  Decodes the binary packets of the Arduino
+ *    (../src/sample_protocol.h) from the bytes read off its serial port.
+ *    Each packet is also given as the line the text firmware would have
+ *    printed for it, so that everything which reads lines (ClockSync, the
+ *    trial .dat files) works with either firmware. pyblink/sample_protocol.py
+ *    is the same decoder in python.
+ *
+ *    Samples carry micros( ) since the previous sample; after a bad packet
+ *    the decoder does not know what it missed and drops samples until the
+ *    next SP_TIME (at most SP_TIME_EVERY samples later).
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  SampleDecoder_INC
+#define  SampleDecoder_INC
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../../src/sample_protocol.h"
+
+/* Longest line a packet gives, with the NUL. */
+#define SP_LINE_MAX     96
+
+class SampleDecoder
+{
+public:
+    struct Packet
+    {
+        uint8_t type;
+        uint8_t len;
+        uint8_t payload[SP_MAX_PAYLOAD];
+        size_t bytes;                           /* On the wire. */
+        uint32_t micros;                        /* SP_SAMPLE: micros( ) when taken. */
+        bool timed;                             /* SP_SAMPLE: micros is known. */
+    };
+
+    SampleDecoder( ) : pos_( 0 ), errors_( 0 ), junk_( 0 ), packets_( 0 )
+                       , micros_( 0 ), timed_( false )
+                       , trial_( 0 ), trial_ms_( 0 ), trial_us_( 0 )
+    { }
+
+    /* Append bytes read from the port. */
+    void feed( const uint8_t* data, size_t n )
+    {
+        if( pos_ > 4096 && pos_ * 2 > buf_.size( ) )
+        {
+            buf_.erase( buf_.begin( ), buf_.begin( ) + pos_ );
+            pos_ = 0;
+        }
+        buf_.insert( buf_.end( ), data, data + n );
+    }
+
+    /**
+     * @brief Next complete packet.
+     *
+     * @return False when the bytes fed so far have no more.
+     */
+    bool next( Packet& p )
+    {
+        while( true )
+        {
+            while( pos_ < buf_.size( ) && buf_[pos_] != SP_SYNC )
+            {
+                pos_ += 1;
+                junk_ += 1;
+            }
+            if( buf_.size( ) - pos_ < 3 )
+                return false;
+
+            const uint8_t* b = &buf_[pos_];
+            uint8_t len = b[2];
+            if( len > SP_MAX_PAYLOAD )
+            {
+                bad( );
+                continue;
+            }
+            if( buf_.size( ) - pos_ < (size_t)len + SP_OVERHEAD )
+                return false;
+            uint8_t crc = 0;
+            for (size_t i = 1; i < (size_t)len + 3; i++)
+                crc = sp_crc8( crc, b[i] );
+            if( crc != b[len + 3] )
+            {
+                bad( );
+                continue;
+            }
+
+            p.type = b[1];
+            p.len = len;
+            memcpy( p.payload, b + 3, len );
+            p.bytes = len + SP_OVERHEAD;
+            pos_ += p.bytes;
+            packets_ += 1;
+            apply( p );
+            return true;
+        }
+    }
+
+    /**
+     * @brief Next packet as a text line: data line
+     * time,trial,puff,tone,led,motion1,motion2,camera,imaging,state or one
+     * of the >>PING, >>TTL, >>TRIAL reports or a message. Packets which have
+     * no line (SP_TIME, samples whose time is not known) are skipped.
+     *
+     * @param bytes If not NULL, bytes the packet took on the wire.
+     *
+     * @return False when there are no more.
+     */
+    bool next_line( std::string& line, size_t* bytes = NULL )
+    {
+        Packet p;
+        while( next( p ) )
+        {
+            if( ! to_line( p, line ) )
+                continue;
+            if( bytes )
+                *bytes = p.bytes;
+            return true;
+        }
+        return false;
+    }
+
+    /* Line for a packet returned by next( ); false if it has none. */
+    bool to_line( const Packet& p, std::string& line ) const
+    {
+        char s[SP_LINE_MAX];
+        size_t n = to_line( p, s, sizeof( s ) );
+        if( n == 0 )
+            return false;
+        line.assign( s, n );
+        return true;
+    }
+
+    /**
+     * @brief Same, into s (n bytes, NUL terminated; SP_LINE_MAX is always
+     * enough) without allocating: what arduino_reader does for every packet.
+     *
+     * @return Length of the line, 0 if it has none.
+     */
+    size_t to_line( const Packet& p, char* s, size_t n ) const
+    {
+        int len = 0;
+        switch( p.type )
+        {
+            case SP_SAMPLE:
+                {
+                    if( ! p.timed || p.len != sizeof( sp_sample ) )
+                        return 0;
+                    sp_sample x;
+                    memcpy( &x, p.payload, sizeof( x ) );
+                    len = snprintf( s, n, "%lu,%u,%d,%d,%d,%3d,%3d,%d,%d,%s"
+                            , (unsigned long)((uint32_t)(p.micros - trial_us_) / 1000), trial_
+                            , (x.pins & SP_PIN_PUFF) != 0, (x.pins & SP_PIN_TONE) != 0
+                            , (x.pins & SP_PIN_LED) != 0, x.motion1, x.motion2
+                            , (x.pins & SP_PIN_CAMERA) != 0, (x.pins & SP_PIN_IMAGING) != 0
+                            , x.state < ST_COUNT ? sp_state_names_[x.state] : "????"
+                            );
+                    break;
+                }
+            case SP_PING:
+                {
+                    sp_ping x;
+                    memcpy( &x, p.payload, sizeof( x ) );
+                    len = snprintf( s, n, ">>PING %lu", (unsigned long)x.micros );
+                    break;
+                }
+            case SP_TTL:
+                {
+                    sp_ttl x;
+                    memcpy( &x, p.payload, sizeof( x ) );
+                    len = snprintf( s, n, ">>TTL %d %lu", x.level, (unsigned long)x.micros );
+                    break;
+                }
+            case SP_TRIAL:
+                len = snprintf( s, n, ">>TRIAL %u %lu", trial_, (unsigned long)trial_ms_ );
+                break;
+            case SP_TEXT:
+                len = std::min( (size_t)p.len, n - 1 );
+                memcpy( s, p.payload, len );
+                s[len] = '\0';
+                break;
+            default:
+                return 0;
+        }
+        return len < 0 ? 0 : std::min( (size_t)len, n - 1 );
+    }
+
+    /* Bytes fed which are after the last packet returned. */
+    size_t pending( ) const
+    {
+        return buf_.size( ) - pos_;
+    }
+
+    /* Packets with bad crc or length. */
+    uint64_t errors( ) const
+    {
+        return errors_;
+    }
+
+    /* Bytes skipped looking for a sync byte. */
+    uint64_t junk( ) const
+    {
+        return junk_;
+    }
+
+    uint64_t packets( ) const
+    {
+        return packets_;
+    }
+
+private:
+    /* Not a packet at pos_: look for the next sync byte after it. */
+    void bad( )
+    {
+        pos_ += 1;
+        errors_ += 1;
+        timed_ = false;
+    }
+
+    /* Track time and trial; stamp samples. */
+    void apply( Packet& p )
+    {
+        p.micros = 0;
+        p.timed = false;
+        if( p.type == SP_SAMPLE && p.len == sizeof( sp_sample ) )
+        {
+            sp_sample x;
+            memcpy( &x, p.payload, sizeof( x ) );
+            micros_ += x.dt_us;
+            p.micros = micros_;
+            p.timed = timed_;
+        }
+        else if( p.type == SP_TIME && p.len == sizeof( sp_time ) )
+        {
+            sp_time x;
+            memcpy( &x, p.payload, sizeof( x ) );
+            micros_ = x.micros;
+            timed_ = true;
+        }
+        else if( p.type == SP_TRIAL && p.len == sizeof( sp_trial ) )
+        {
+            sp_trial x;
+            memcpy( &x, p.payload, sizeof( x ) );
+            trial_ = x.trial;
+            trial_ms_ = x.millis;
+            trial_us_ = x.micros;
+        }
+    }
+
+    std::vector<uint8_t> buf_;
+    size_t pos_;
+    uint64_t errors_, junk_, packets_;
+    uint32_t micros_;                           /* Of the last sample. */
+    bool timed_;
+    unsigned trial_;
+    uint32_t trial_ms_, trial_us_;
+};
+
+#endif   /* ----- #ifndef SampleDecoder_INC ----- */
@@ -0,0 +1,560 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  SerialReader.hpp
+ *
+ *    Description:  Pieces of arduino_reader (src/arduino_reader.cc), which
+ *    reads the serial port of the Arduino in place of camera_arduino_client.py.
+ *
+ *    SerialPort opens the port raw (termios, no line discipline) and
+ *    non-blocking. LineSplitter cuts what is read into lines in a fixed
+ *    buffer; parse_data_line( ) picks trial and camera pin out of a data
+ *    line; neither allocates. TrialFiles writes data lines, as the python
+ *    client did, to one file per trial through a buffer which goes to disk
+ *    when full, when the trial changes and on a timer. MessageLog keeps the
+ *    lines which are not data (>>PING, acks, ">>> Waiting ...") for whoever
+ *    talks to the board. The latest ArduinoState is published in shared
+ *    memory (ShmLatest.hpp); serial_client.py reads it.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  SerialReader_INC
+#define  SerialReader_INC
+
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#include <poll.h>
+#include <termios.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "ShmLatest.hpp"
+
+#define ARDUINO_STATE_MAGIC     0x52444145      /* "EADR" */
+#define ARDUINO_STATE_VERSION   1
+
+/* Longest line, with the NUL; longer ones are dropped (and counted). */
+#define ARDUINO_LINE_MAX        128
+
+/* What arduino_reader has last read from the board. */
+struct ArduinoState
+{
+    uint64_t host_ns;                           /* CLOCK_MONOTONIC when the last byte of line came. */
+    uint64_t lines;                             /* Lines so far. */
+    uint64_t bytes;                             /* Bytes read so far. */
+    int32_t trial;                              /* Of the last data line, -1 before one. */
+    int32_t camera;                             /* Camera pin in the last data line. */
+    uint32_t arduino_ms;                        /* Time field of the last data line. */
+    uint32_t errors;                            /* Bad packets and too long lines. */
+    char line[ARDUINO_LINE_MAX];                /* Last line, NUL terminated. */
+};
+
+static_assert( sizeof( ArduinoState ) == 168, "serial_client.py expects 168 bytes" );
+
+/**
+ * @brief termios speed for a baud rate.
+ */
+inline speed_t baud_constant( unsigned baud )
+{
+    switch( baud )
+    {
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        case 500000: return B500000;
+        case 576000: return B576000;
+        case 921600: return B921600;
+        case 1000000: return B1000000;
+        case 2000000: return B2000000;
+    }
+    throw std::invalid_argument( "unsupported baud rate " + std::to_string( baud ) );
+}
+
+/**
+ * @brief The serial port: 8N1 raw, no flow control, non-blocking reads.
+ *
+ * Opening it resets an Uno (DTR), as opening it from python did.
+ */
+class SerialPort
+{
+public:
+    SerialPort( const std::string& path, unsigned baud ) : path_( path ), baud_( baud ), fd_( -1 )
+    {
+        speed_t speed = baud_constant( baud );
+        fd_ = open( path.c_str( ), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC );
+        if( fd_ < 0 )
+            throw std::runtime_error( "open " + path + ": " + strerror( errno ) );
+
+        // Nobody else opens it while we have it (root still can).
+        ioctl( fd_, TIOCEXCL );
+
+        struct termios t;
+        if( tcgetattr( fd_, &t ) != 0 )
+            fail( "tcgetattr" );
+        cfmakeraw( &t );
+        t.c_cflag |= CLOCAL | CREAD;
+        t.c_cflag &= ~(CSTOPB | CRTSCTS);
+        t.c_iflag &= ~(IXON | IXOFF | IXANY);
+        // read( ) then gives EAGAIN when there is nothing, 0 once hung up.
+        t.c_cc[VMIN] = 1;
+        t.c_cc[VTIME] = 0;
+        cfsetispeed( &t, speed );
+        cfsetospeed( &t, speed );
+        if( tcsetattr( fd_, TCSANOW, &t ) != 0 )
+            fail( "tcsetattr" );
+        tcflush( fd_, TCIOFLUSH );
+
+        // A UART driver hands bytes over as they come instead of every few
+        // ms; USB (ttyACM) ports don't have the flag and don't need it.
+        struct serial_struct ss;
+        if( ioctl( fd_, TIOCGSERIAL, &ss ) == 0 )
+        {
+            ss.flags |= ASYNC_LOW_LATENCY;
+            ioctl( fd_, TIOCSSERIAL, &ss );
+        }
+    }
+
+    ~SerialPort( )
+    {
+        if( fd_ >= 0 )
+            close( fd_ );
+    }
+
+    SerialPort( const SerialPort& ) = delete;
+    SerialPort& operator=( const SerialPort& ) = delete;
+
+    int fd( ) const
+    {
+        return fd_;
+    }
+
+    unsigned baud( ) const
+    {
+        return baud_;
+    }
+
+    /* ns a byte takes on the wire (start, 8 data, stop bits). */
+    uint64_t byte_ns( ) const
+    {
+        return 10000000000ull / baud_;
+    }
+
+    /* Write all of data; waits while the output buffer is full. */
+    bool write_all( const void* data, size_t n )
+    {
+        const char* p = static_cast<const char*>( data );
+        while( n > 0 )
+        {
+            ssize_t w = ::write( fd_, p, n );
+            if( w < 0 )
+            {
+                if( errno == EINTR )
+                    continue;
+                if( errno != EAGAIN )
+                    return false;
+                struct pollfd pfd = { fd_, POLLOUT, 0 };
+                if( poll( &pfd, 1, 1000 ) <= 0 )
+                    return false;
+                continue;
+            }
+            p += w;
+            n -= w;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Bytes the driver lost because nobody read them in time
+     * (overrun of the UART or of the tty buffer).
+     *
+     * @return -1 if the driver does not count them.
+     */
+    int64_t overruns( ) const
+    {
+        struct serial_icounter_struct ic;
+        if( ioctl( fd_, TIOCGICOUNT, &ic ) != 0 )
+            return -1;
+        return (int64_t)ic.overrun + ic.buf_overrun;
+    }
+
+private:
+    void fail( const char* what )
+    {
+        std::string msg = std::string( what ) + " " + path_ + ": " + strerror( errno );
+        close( fd_ );
+        fd_ = -1;
+        throw std::runtime_error( msg );
+    }
+
+    std::string path_;
+    unsigned baud_;
+    int fd_;
+};
+
+/**
+ * @brief Bytes to lines in a fixed buffer.
+ */
+class LineSplitter
+{
+public:
+    LineSplitter( ) : len_( 0 ), overlong_( false ), dropped_( 0 )
+    { }
+
+    /**
+     * @brief Take n bytes; on_line( line, len, after ) is called for every
+     * line they complete, without the newline (and \r), NUL terminated.
+     * after is how many of the n bytes came after the line; they took
+     * after * byte_ns on the wire after it.
+     */
+    template< typename F >
+    void feed( const char* data, size_t n, F on_line )
+    {
+        const char* end = data + n;
+        while( data < end )
+        {
+            const char* nl = static_cast<const char*>( memchr( data, '\n', end - data ) );
+            size_t chunk = (nl ? nl : end) - data;
+            if( ! overlong_ && len_ + chunk < sizeof( buf_ ) )
+            {
+                memcpy( buf_ + len_, data, chunk );
+                len_ += chunk;
+            }
+            else
+                overlong_ = true;
+            if( ! nl )
+                return;
+
+            if( overlong_ )
+                dropped_ += 1;
+            else
+            {
+                if( len_ > 0 && buf_[len_ - 1] == '\r' )
+                    len_ -= 1;
+                buf_[len_] = '\0';
+                if( len_ > 0 )
+                    on_line( (const char*)buf_, len_, (size_t)(end - nl - 1) );
+            }
+            len_ = 0;
+            overlong_ = false;
+            data = nl + 1;
+        }
+    }
+
+    /* Lines longer than ARDUINO_LINE_MAX - 1, dropped. */
+    uint64_t dropped( ) const
+    {
+        return dropped_;
+    }
+
+private:
+    char buf_[ARDUINO_LINE_MAX];
+    size_t len_;
+    bool overlong_;
+    uint64_t dropped_;
+};
+
+/* Fields of a data line the reader cares about. */
+struct DataLine
+{
+    uint32_t ms;
+    int trial;
+    int camera;
+};
+
+/**
+ * @brief Data line time,trial,puff,tone,led,motion1,motion2,camera,imaging,state
+ * (fields may be padded with spaces) to d.
+ *
+ * @return False for any other line: messages, >>PING etc.
+ */
+inline bool parse_data_line( const char* s, size_t n, DataLine& d )
+{
+    long v[9];
+    size_t field = 0;
+    const char* end = s + n;
+    while( s < end )
+    {
+        const char* comma = static_cast<const char*>( memchr( s, ',', end - s ) );
+        const char* e = comma ? comma : end;
+        if( field < 9 )
+        {
+            // An int, spaces around it allowed.
+            while( s < e && *s == ' ' )
+                s++;
+            bool neg = s < e && *s == '-';
+            if( neg )
+                s++;
+            if( s == e || *s < '0' || *s > '9' )
+                return false;
+            long x = 0;
+            while( s < e && *s >= '0' && *s <= '9' )
+                x = x * 10 + (*s++ - '0');
+            while( s < e && *s == ' ' )
+                s++;
+            if( s != e )
+                return false;
+            v[field] = neg ? -x : x;
+        }
+        else if( field > 9 || e == s || memchr( s, '>', e - s ) )
+            return false;
+        field += 1;
+        s = comma ? comma + 1 : end;
+    }
+    if( field != 10 )
+        return false;
+    d.ms = v[0];
+    d.trial = v[1];
+    d.camera = v[7];
+    return true;
+}
+
+/**
+ * @brief CLOCK_MONOTONIC to local wall time as python's
+ * datetime.now( ).isoformat( ) gives it, 2016-12-06T03:05:41.123456.
+ */
+class WallClock
+{
+public:
+    WallClock( ) : sec_( -1 )
+    {
+        sync( );
+    }
+
+    /* Measure the offset of the wall clock again (it is stepped and slewed). */
+    void sync( )
+    {
+        struct timespec m, r;
+        clock_gettime( CLOCK_MONOTONIC, &m );
+        clock_gettime( CLOCK_REALTIME, &r );
+        offset_ns_ = ((int64_t)r.tv_sec - m.tv_sec) * 1000000000ll + (r.tv_nsec - m.tv_nsec);
+    }
+
+    /* Write the time of host_ns into s (27 bytes with NUL); returns 26. */
+    size_t format( uint64_t host_ns, char* s )
+    {
+        int64_t wall = (int64_t)host_ns + offset_ns_;
+        time_t sec = wall / 1000000000ll;
+        if( sec != sec_ )
+        {
+            struct tm tm;
+            localtime_r( &sec, &tm );
+            strftime( prefix_, sizeof( prefix_ ), "%Y-%m-%dT%H:%M:%S", &tm );
+            sec_ = sec;
+        }
+        unsigned us = (wall % 1000000000ll) / 1000;
+        memcpy( s, prefix_, 19 );
+        s[19] = '.';
+        for (int i = 25; i > 19; i--, us /= 10)
+            s[i] = '0' + us % 10;
+        s[26] = '\0';
+        return 26;
+    }
+
+private:
+    int64_t offset_ns_;
+    time_t sec_;
+    char prefix_[32];
+};
+
+/**
+ * @brief Data lines to DIR/PREFIXtrial=N.dat, each as WALLTIME,LINE with the
+ * spaces of LINE taken out: the files camera_arduino_client.py wrote.
+ *
+ * Nothing is written until set_files( ). Lines collect in a buffer; it goes
+ * to disk with one write( ) when full, when the trial changes (the file of
+ * the last trial is then closed) and on flush( ).
+ */
+class TrialFiles
+{
+public:
+    TrialFiles( size_t buffer_size = 1 << 16 )
+        : fd_( -1 ), trial_( -1 ), used_( 0 ), buf_( buffer_size )
+          , lines_( 0 ), files_( 0 ), errors_( 0 )
+    { }
+
+    ~TrialFiles( )
+    {
+        close_file( );
+    }
+
+    TrialFiles( const TrialFiles& ) = delete;
+    TrialFiles& operator=( const TrialFiles& ) = delete;
+
+    void set_files( const std::string& dir, const std::string& prefix )
+    {
+        close_file( );
+        dir_ = dir;
+        prefix_ = prefix;
+    }
+
+    bool enabled( ) const
+    {
+        return ! dir_.empty( );
+    }
+
+    /* File of trial. */
+    std::string path( int trial ) const
+    {
+        return dir_ + "/" + prefix_ + "trial=" + std::to_string( trial ) + ".dat";
+    }
+
+    void write( int trial, const char* wall, size_t wall_len, const char* line, size_t n )
+    {
+        if( ! enabled( ) )
+            return;
+        if( trial != trial_ )
+        {
+            close_file( );
+            trial_ = trial;
+            fd_ = open( path( trial ).c_str( ), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644 );
+            if( fd_ < 0 )
+                errors_ += 1;
+            else
+                files_ += 1;
+        }
+        if( fd_ < 0 )
+            return;
+        if( used_ + wall_len + n + 2 > buf_.size( ) )
+            flush( );
+        char* p = &buf_[used_];
+        memcpy( p, wall, wall_len );
+        p += wall_len;
+        *p++ = ',';
+        for (size_t i = 0; i < n; i++)
+            if( line[i] != ' ' )
+                *p++ = line[i];
+        *p++ = '\n';
+        used_ = p - &buf_[0];
+        lines_ += 1;
+    }
+
+    /* Buffered lines to disk. */
+    void flush( )
+    {
+        size_t done = 0;
+        while( fd_ >= 0 && done < used_ )
+        {
+            ssize_t w = ::write( fd_, &buf_[done], used_ - done );
+            if( w < 0 && errno == EINTR )
+                continue;
+            if( w <= 0 )
+            {
+                errors_ += 1;
+                break;
+            }
+            done += w;
+        }
+        used_ = 0;
+    }
+
+    /* Trial being written, -1 if none. */
+    int trial( ) const
+    {
+        return trial_;
+    }
+
+    uint64_t lines( ) const
+    {
+        return lines_;
+    }
+
+    uint64_t files( ) const
+    {
+        return files_;
+    }
+
+    /* Files which could not be opened and failed writes. */
+    uint64_t errors( ) const
+    {
+        return errors_;
+    }
+
+private:
+    void close_file( )
+    {
+        flush( );
+        if( fd_ >= 0 )
+            close( fd_ );
+        fd_ = -1;
+        trial_ = -1;
+    }
+
+    std::string dir_, prefix_;
+    int fd_;
+    int trial_;
+    size_t used_;
+    std::vector<char> buf_;
+    uint64_t lines_, files_, errors_;
+};
+
+/**
+ * @brief The last lines which are not data, numbered from 0, for readers on
+ * another thread.
+ */
+class MessageLog
+{
+public:
+    MessageLog( size_t capacity = 256 ) : next_( 0 ), ring_( capacity )
+    { }
+
+    void add( const char* line, size_t n )
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        Message& m = ring_[next_ % ring_.size( )];
+        m.len = std::min( n, sizeof( m.text ) );
+        memcpy( m.text, line, m.len );
+        next_ += 1;
+    }
+
+    /**
+     * @brief Messages from number seq on, into out.
+     *
+     * @return Number of the next message; if it is more than seq +
+     * out.size( ), the ones in between were overwritten.
+     */
+    uint64_t since( uint64_t seq, std::vector<std::string>& out ) const
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        out.clear( );
+        if( next_ > ring_.size( ) && seq < next_ - ring_.size( ) )
+            seq = next_ - ring_.size( );
+        for (; seq < next_; seq++)
+        {
+            const Message& m = ring_[seq % ring_.size( )];
+            out.push_back( std::string( m.text, m.len ) );
+        }
+        return next_;
+    }
+
+private:
+    struct Message
+    {
+        char text[ARDUINO_LINE_MAX];
+        size_t len;
+    };
+
+    mutable std::mutex mutex_;
+    uint64_t next_;
+    std::vector<Message> ring_;
+};
+
+#endif   /* ----- #ifndef SerialReader_INC  ----- */
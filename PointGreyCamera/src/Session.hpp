@@ -0,0 +1,605 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  Session.hpp
+ *
+ *    Description:  One file per session with frames, binary per-frame
+ *    metadata, arduino lines and a trial index. Written append-only while
+ *    the camera runs; readers mmap it and find any frame in O(1).
+ *
+ *    Layout (all little endian, every chunk 8 byte aligned):
+ *
+ *      SessionFileHeader                           64 bytes
+ *      chunk ...                                   SessionChunk + payload
+ *      SESSION_INDEX_CHUNK chunk                   written by close( )
+ *      SessionTrailer                              16 bytes, last in file
+ *
+ *    Frame chunks hold chunk_frames frames of a fixed stride:
+ *
+ *      [ SessionFrame (32 bytes) | width x height pixels | pad to 8 ]
+ *
+ *    so frame k is at chunk_offset[k / chunk_frames] + sizeof( SessionChunk )
+ *    + (k % chunk_frames) * stride. Only the last frame chunk may be short.
+ *    Event chunks (arduino lines, trial start/end) follow the frame chunk
+ *    during which the events happened.
+ *
+ *    The index chunk lists frame chunk offsets, trials and event chunks. A
+ *    file without trailer (cam_server was killed) is still readable: chunks
+ *    are found by walking their headers, the index is rebuilt.
+ *
+ *    analysis/session.py reads the same format with numpy.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  Session_INC
+#define  Session_INC
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define SESSION_MAGIC           "EBSESS01"
+#define SESSION_INDEX_MAGIC     "EBSINDEX"
+#define SESSION_VERSION         1
+
+/* SessionChunk::type */
+#define SESSION_FRAMES_CHUNK    1
+#define SESSION_EVENTS_CHUNK    2
+#define SESSION_INDEX_CHUNK     3
+
+/* SessionEvent::kind */
+#define SESSION_EVENT_TEXT          1           /* Arduino line etc. */
+#define SESSION_EVENT_TRIAL_BEGIN   2
+#define SESSION_EVENT_TRIAL_END     3
+#define SESSION_EVENT_ROW           4           /* Text row of a converted tiff page. */
+
+/* SessionFrame::trial of frames outside a trial. */
+#define SESSION_NO_TRIAL        -1000
+
+struct SessionFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t width;
+    uint32_t height;
+    uint32_t frame_stride;                      /* SessionFrame + pixels + pad */
+    uint32_t chunk_frames;
+    uint64_t created_ns;                        /* Wall clock (CLOCK_REALTIME) */
+    uint8_t reserved[24];
+};
+
+struct SessionChunk
+{
+    uint32_t type;
+    uint32_t count;                             /* Frames or events in chunk. */
+    uint64_t size;                              /* Payload bytes after this header. */
+};
+
+struct SessionFrame
+{
+    uint64_t frame_id;                          /* Id given by the camera. */
+    uint64_t camera_ns;                         /* Camera timestamp. */
+    uint64_t host_ns;                           /* Host clock when frame was recorded. */
+    float blink;                                /* -1 when not computed. */
+    int32_t trial;                              /* SESSION_NO_TRIAL outside trials. */
+};
+
+/* Followed by len bytes of text, padded to 8. */
+struct SessionEvent
+{
+    uint64_t host_ns;
+    uint64_t frame;                             /* Index of next frame to be written. */
+    uint32_t kind;
+    int32_t value;                              /* Trial of TRIAL_BEGIN/END. */
+    uint32_t len;
+    uint32_t reserved;
+};
+
+struct SessionTrial
+{
+    int32_t trial;
+    uint32_t reserved;
+    uint64_t first_frame;
+    uint64_t end_frame;                         /* One past last frame. */
+    uint64_t begin_ns;                          /* Host clock. */
+    uint64_t end_ns;
+};
+
+/* Payload of the index chunk, followed by uint64_t chunk_offsets[chunks],
+ * SessionTrial trials[trials] and uint64_t event_offsets[event_chunks]. */
+struct SessionIndex
+{
+    uint64_t frames;
+    uint32_t chunks;
+    uint32_t trials;
+    uint32_t event_chunks;
+    uint32_t reserved;
+};
+
+struct SessionTrailer
+{
+    uint64_t index_offset;
+    char magic[8];
+};
+
+inline size_t session_align8( size_t n )
+{
+    return (n + 7) & ~(size_t)7;
+}
+
+class SessionWriter
+{
+public:
+    /**
+     * @brief Create filename (truncated if it exists).
+     *
+     * @param width, height Frame geometry (without metadata row).
+     * @param chunk_frames Frames per chunk; events are written after each.
+     */
+    SessionWriter( const std::string& filename, size_t width, size_t height
+            , size_t chunk_frames = 200 )
+        : filename_( filename ), width_( width ), height_( height )
+        , chunk_frames_( std::max( chunk_frames, (size_t)1 ) )
+        , stride_( session_align8( sizeof( SessionFrame ) + width * height ) )
+        , offset_( 0 ), frames_( 0 ), in_chunk_( 0 ), chunk_offset_( 0 )
+        , trial_( SESSION_NO_TRIAL ), trial_time_( 0 ), nevents_( 0 )
+    {
+        file_ = fopen( filename.c_str( ), "wb" );
+        if( ! file_ )
+            return;
+        setvbuf( file_, NULL, _IOFBF, 1 << 20 );
+
+        SessionFileHeader hdr;
+        memset( &hdr, 0, sizeof( hdr ) );
+        memcpy( hdr.magic, SESSION_MAGIC, 8 );
+        hdr.version = SESSION_VERSION;
+        hdr.header_size = sizeof( hdr );
+        hdr.width = width_;
+        hdr.height = height_;
+        hdr.frame_stride = stride_;
+        hdr.chunk_frames = chunk_frames_;
+        struct timespec ts;
+        clock_gettime( CLOCK_REALTIME, &ts );
+        hdr.created_ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+        if( ! put( &hdr, sizeof( hdr ) ) )
+            close_file( );
+    }
+
+    SessionWriter( const SessionWriter& ) = delete;
+    SessionWriter& operator=( const SessionWriter& ) = delete;
+
+    ~SessionWriter( )
+    {
+        close( );
+    }
+
+    bool is_open( ) const { return file_ != NULL; }
+    const std::string& filename( ) const { return filename_; }
+    size_t frames( ) const { return frames_; }
+    int trial( ) const { return trial_; }
+
+    /**
+     * @brief Append a frame; info.trial is set to the running trial.
+     *
+     * @return false on write error.
+     */
+    bool append( SessionFrame info, const uint8_t* pixels )
+    {
+        if( ! file_ )
+            return false;
+        if( in_chunk_ == 0 )
+        {
+            chunk_offset_ = offset_;
+            SessionChunk chunk = { SESSION_FRAMES_CHUNK, (uint32_t)chunk_frames_
+                , (uint64_t)chunk_frames_ * stride_ };
+            if( ! put( &chunk, sizeof( chunk ) ) )
+                return false;
+            chunks_.push_back( chunk_offset_ );
+        }
+
+        static const uint8_t zeros[8] = { 0 };
+        info.trial = trial_;
+        size_t pad = stride_ - sizeof( info ) - width_ * height_;
+        if( ! put( &info, sizeof( info ) ) || ! put( pixels, width_ * height_ )
+                || ! put( zeros, pad ) )
+            return false;
+
+        frames_ += 1;
+        if( ++in_chunk_ == chunk_frames_ )
+        {
+            in_chunk_ = 0;
+            return flush_events( );
+        }
+        return true;
+    }
+
+    /* Following frames belong to trial; ends the running one. */
+    void begin_trial( int trial, uint64_t host_ns )
+    {
+        if( trial_ != SESSION_NO_TRIAL )
+            end_trial( host_ns );
+        trial_ = trial;
+        add_event( SESSION_EVENT_TRIAL_BEGIN, trial, host_ns, "" );
+    }
+
+    void end_trial( uint64_t host_ns )
+    {
+        if( trial_ == SESSION_NO_TRIAL )
+            return;
+        add_event( SESSION_EVENT_TRIAL_END, trial_, host_ns, "" );
+        trial_ = SESSION_NO_TRIAL;
+    }
+
+    /* A line of text at this point of the session, e.g. from arduino. */
+    void add_text( const std::string& text, uint64_t host_ns, uint32_t kind = SESSION_EVENT_TEXT )
+    {
+        add_event( kind, trial_, host_ns, text );
+    }
+
+    /**
+     * @brief Write pending events, the index and the trailer; closes file.
+     */
+    bool close( )
+    {
+        if( ! file_ )
+            return false;
+        bool ok = true;
+        if( in_chunk_ > 0 )
+        {
+            // Shorten last frame chunk so that the file can be walked.
+            SessionChunk chunk = { SESSION_FRAMES_CHUNK, (uint32_t)in_chunk_
+                , (uint64_t)in_chunk_ * stride_ };
+            ok &= fflush( file_ ) == 0
+                && fseek( file_, chunk_offset_, SEEK_SET ) == 0
+                && fwrite( &chunk, sizeof( chunk ), 1, file_ ) == 1
+                && fseek( file_, offset_, SEEK_SET ) == 0;
+            in_chunk_ = 0;
+        }
+        end_trial( trial_time_ );
+        ok &= flush_events( );
+
+        SessionIndex index = { frames_, (uint32_t)chunks_.size( ), (uint32_t)trials_.size( )
+            , (uint32_t)event_chunks_.size( ), 0 };
+        size_t size = sizeof( index ) + chunks_.size( ) * 8
+            + trials_.size( ) * sizeof( SessionTrial ) + event_chunks_.size( ) * 8;
+        SessionChunk chunk = { SESSION_INDEX_CHUNK, 1, size };
+        uint64_t indexOffset = offset_;
+        ok &= put( &chunk, sizeof( chunk ) ) && put( &index, sizeof( index ) )
+            && put( chunks_.data( ), chunks_.size( ) * 8 )
+            && put( trials_.data( ), trials_.size( ) * sizeof( SessionTrial ) )
+            && put( event_chunks_.data( ), event_chunks_.size( ) * 8 );
+
+        SessionTrailer trailer;
+        trailer.index_offset = indexOffset;
+        memcpy( trailer.magic, SESSION_INDEX_MAGIC, 8 );
+        ok &= put( &trailer, sizeof( trailer ) );
+        ok &= close_file( );
+        return ok;
+    }
+
+private:
+    bool put( const void* data, size_t n )
+    {
+        if( n == 0 )
+            return true;
+        if( fwrite( data, 1, n, file_ ) != n )
+            return false;
+        offset_ += n;
+        return true;
+    }
+
+    bool close_file( )
+    {
+        bool ok = fclose( file_ ) == 0;
+        file_ = NULL;
+        return ok;
+    }
+
+    void add_event( uint32_t kind, int value, uint64_t host_ns, const std::string& text )
+    {
+        SessionEvent ev = { host_ns, frames_, kind, value, (uint32_t)text.size( ), 0 };
+        size_t at = events_.size( );
+        events_.resize( at + session_align8( sizeof( ev ) + text.size( ) ), 0 );
+        memcpy( &events_[at], &ev, sizeof( ev ) );
+        memcpy( &events_[at + sizeof( ev )], text.data( ), text.size( ) );
+        nevents_ += 1;
+        trial_time_ = host_ns;
+
+        if( kind == SESSION_EVENT_TRIAL_BEGIN )
+        {
+            SessionTrial t = { value, 0, frames_, frames_, host_ns, host_ns };
+            trials_.push_back( t );
+        }
+        else if( kind == SESSION_EVENT_TRIAL_END && ! trials_.empty( ) )
+        {
+            trials_.back( ).end_frame = frames_;
+            trials_.back( ).end_ns = host_ns;
+        }
+    }
+
+    /* Events go out between frame chunks. */
+    bool flush_events( )
+    {
+        if( nevents_ == 0 )
+            return true;
+        SessionChunk chunk = { SESSION_EVENTS_CHUNK, (uint32_t)nevents_, events_.size( ) };
+        event_chunks_.push_back( offset_ );
+        bool ok = put( &chunk, sizeof( chunk ) ) && put( &events_[0], events_.size( ) )
+            && fflush( file_ ) == 0;
+        events_.clear( );
+        nevents_ = 0;
+        return ok;
+    }
+
+    std::string filename_;
+    FILE* file_;
+    size_t width_;
+    size_t height_;
+    size_t chunk_frames_;
+    size_t stride_;
+
+    uint64_t offset_;                           /* Bytes written. */
+    uint64_t frames_;
+    size_t in_chunk_;                           /* Frames in current chunk. */
+    uint64_t chunk_offset_;
+    int trial_;
+    uint64_t trial_time_;                       /* Time of last event. */
+
+    std::vector<uint64_t> chunks_;
+    std::vector<uint64_t> event_chunks_;
+    std::vector<SessionTrial> trials_;
+    std::vector<uint8_t> events_;               /* Not yet written. */
+    size_t nevents_;
+};
+
+/**
+ * @brief Maps a session file. Frames and their metadata are pointers into
+ * the mapping (no copies).
+ */
+class SessionReader
+{
+public:
+    struct Event
+    {
+        SessionEvent info;
+        std::string text;
+    };
+
+    SessionReader( const std::string& filename )
+        : data_( NULL ), size_( 0 ), frames_( 0 ), indexed_( false )
+    {
+        int fd = open( filename.c_str( ), O_RDONLY );
+        if( fd < 0 )
+            return;
+        struct stat st;
+        if( fstat( fd, &st ) == 0 && (size_t)st.st_size >= sizeof( SessionFileHeader ) )
+        {
+            size_ = st.st_size;
+            void* p = mmap( NULL, size_, PROT_READ, MAP_SHARED, fd, 0 );
+            data_ = p == MAP_FAILED ? NULL : (const uint8_t*)p;
+        }
+        ::close( fd );
+        if( ! data_ )
+            return;
+
+        memcpy( &hdr_, data_, sizeof( hdr_ ) );
+        if( memcmp( hdr_.magic, SESSION_MAGIC, 8 ) != 0 || hdr_.version != SESSION_VERSION
+                || hdr_.frame_stride < sizeof( SessionFrame ) + hdr_.width * hdr_.height
+                || hdr_.chunk_frames == 0 )
+        {
+            unmap( );
+            return;
+        }
+        if( ! read_index( ) )
+            scan( );
+    }
+
+    ~SessionReader( )
+    {
+        unmap( );
+    }
+
+    SessionReader( const SessionReader& ) = delete;
+    SessionReader& operator=( const SessionReader& ) = delete;
+
+    bool is_open( ) const { return data_ != NULL; }
+    size_t width( ) const { return hdr_.width; }
+    size_t height( ) const { return hdr_.height; }
+    uint64_t frames( ) const { return frames_; }
+    const std::vector<SessionTrial>& trials( ) const { return trials_; }
+
+    /* False if index was rebuilt by walking chunks (no trailer). */
+    bool indexed( ) const { return indexed_; }
+
+    /* Metadata of frame k < frames( ). */
+    const SessionFrame* info( uint64_t k ) const
+    {
+        return (const SessionFrame*)record( k );
+    }
+
+    /* Pixels of frame k < frames( ). */
+    const uint8_t* frame( uint64_t k ) const
+    {
+        return record( k ) + sizeof( SessionFrame );
+    }
+
+    /* Trial entry, NULL if there is no such trial. */
+    const SessionTrial* find_trial( int trial ) const
+    {
+        for( auto& t : trials_ )
+            if( t.trial == trial )
+                return &t;
+        return NULL;
+    }
+
+    /**
+     * @brief First frame of trial recorded at least offset_ns after the
+     * trial began (by host clock).
+     *
+     * @return Frame index, or -1 if the trial is not there or is shorter.
+     */
+    int64_t seek( int trial, uint64_t offset_ns ) const
+    {
+        const SessionTrial* t = find_trial( trial );
+        if( ! t )
+            return -1;
+        uint64_t target = t->begin_ns + offset_ns;
+        uint64_t lo = t->first_frame, hi = t->end_frame;
+        while( lo < hi )
+        {
+            uint64_t mid = lo + (hi - lo) / 2;
+            if( info( mid )->host_ns < target )
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo < t->end_frame ? (int64_t)lo : -1;
+    }
+
+    /* All events in file order. */
+    std::vector<Event> events( ) const
+    {
+        std::vector<Event> out;
+        for( auto off : event_chunks_ )
+        {
+            SessionChunk chunk;
+            memcpy( &chunk, data_ + off, sizeof( chunk ) );
+            const uint8_t* p = data_ + off + sizeof( chunk );
+            const uint8_t* end = p + chunk.size;
+            for (uint32_t i = 0; i < chunk.count && p + sizeof( SessionEvent ) <= end; i++)
+            {
+                Event ev;
+                memcpy( &ev.info, p, sizeof( ev.info ) );
+                const char* text = (const char*)p + sizeof( ev.info );
+                ev.text.assign( text, std::min( (size_t)ev.info.len, (size_t)(end - (const uint8_t*)text) ) );
+                out.push_back( ev );
+                p += session_align8( sizeof( ev.info ) + ev.info.len );
+            }
+        }
+        return out;
+    }
+
+private:
+    const uint8_t* record( uint64_t k ) const
+    {
+        return data_ + chunks_[k / hdr_.chunk_frames] + sizeof( SessionChunk )
+            + (k % hdr_.chunk_frames) * hdr_.frame_stride;
+    }
+
+    bool read_index( )
+    {
+        SessionTrailer trailer;
+        if( size_ < sizeof( hdr_ ) + sizeof( trailer ) )
+            return false;
+        memcpy( &trailer, data_ + size_ - sizeof( trailer ), sizeof( trailer ) );
+        if( memcmp( trailer.magic, SESSION_INDEX_MAGIC, 8 ) != 0
+                || trailer.index_offset + sizeof( SessionChunk ) + sizeof( SessionIndex ) > size_ )
+            return false;
+
+        const uint8_t* p = data_ + trailer.index_offset + sizeof( SessionChunk );
+        SessionIndex index;
+        memcpy( &index, p, sizeof( index ) );
+        p += sizeof( index );
+        size_t need = index.chunks * 8 + index.trials * sizeof( SessionTrial ) + index.event_chunks * 8;
+        if( p + need > data_ + size_ - sizeof( trailer ) )
+            return false;
+
+        chunks_.resize( index.chunks );
+        memcpy( chunks_.data( ), p, index.chunks * 8 );
+        p += index.chunks * 8;
+        trials_.resize( index.trials );
+        memcpy( trials_.data( ), p, index.trials * sizeof( SessionTrial ) );
+        p += index.trials * sizeof( SessionTrial );
+        event_chunks_.resize( index.event_chunks );
+        memcpy( event_chunks_.data( ), p, index.event_chunks * 8 );
+        frames_ = index.frames;
+        indexed_ = true;
+        return true;
+    }
+
+    /* Walk chunk headers; the last frame chunk may be cut short. */
+    void scan( )
+    {
+        uint64_t off = hdr_.header_size;
+        while( off + sizeof( SessionChunk ) <= size_ )
+        {
+            SessionChunk chunk;
+            memcpy( &chunk, data_ + off, sizeof( chunk ) );
+            uint64_t avail = size_ - off - sizeof( chunk );
+            if( chunk.type == SESSION_FRAMES_CHUNK )
+            {
+                uint64_t n = std::min( (uint64_t)chunk.count, avail / hdr_.frame_stride );
+                chunks_.push_back( off );
+                frames_ += n;
+                if( n < chunk.count )
+                    break;
+            }
+            else if( chunk.type == SESSION_EVENTS_CHUNK )
+            {
+                if( chunk.size > avail )
+                    break;
+                event_chunks_.push_back( off );
+            }
+            else if( chunk.type != SESSION_INDEX_CHUNK )
+                break;
+            off += sizeof( chunk ) + chunk.size;
+        }
+
+        // Trials from their begin/end events.
+        bool running = false;
+        for( auto& ev : events( ) )
+        {
+            if( ev.info.kind == SESSION_EVENT_TRIAL_BEGIN )
+            {
+                SessionTrial t = { ev.info.value, 0, ev.info.frame, ev.info.frame
+                    , ev.info.host_ns, ev.info.host_ns };
+                trials_.push_back( t );
+                running = true;
+            }
+            else if( ev.info.kind == SESSION_EVENT_TRIAL_END && running )
+            {
+                trials_.back( ).end_frame = ev.info.frame;
+                trials_.back( ).end_ns = ev.info.host_ns;
+                running = false;
+            }
+        }
+        // A trial still running when the file ended.
+        if( running )
+            trials_.back( ).end_frame = frames_;
+        for( auto& t : trials_ )
+            t.end_frame = std::min( t.end_frame, frames_ );
+    }
+
+    void unmap( )
+    {
+        if( data_ )
+            munmap( (void*)data_, size_ );
+        data_ = NULL;
+    }
+
+    const uint8_t* data_;
+    size_t size_;
+    SessionFileHeader hdr_;
+    uint64_t frames_;
+    bool indexed_;
+    std::vector<uint64_t> chunks_;
+    std::vector<uint64_t> event_chunks_;
+    std::vector<SessionTrial> trials_;
+};
+
+#endif   /* ----- #ifndef Session_INC  ----- */
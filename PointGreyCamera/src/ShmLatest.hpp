@@ -0,0 +1,193 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  ShmLatest.hpp
+ *
+ *    Description:  The latest value of something, for other processes: a one
+ *    slot POSIX shared memory segment, a seqlock like the slots of
+ *    ShmTransport.hpp. Writer sets seq to 2n+1, writes the value, then sets
+ *    2n+2. A reader copies the value and retries if seq was odd or changed
+ *    meanwhile.
+ *
+ *    Used for the treadmill sample of mouse_server (Treadmill.hpp) and the
+ *    Arduino state of arduino_reader (SerialReader.hpp). Python reads them
+ *    with treadmill_client.LatestReader.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  ShmLatest_INC
+#define  ShmLatest_INC
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <atomic>
+#include <string>
+#include <stdexcept>
+
+/* The shared memory segment; value is at 32. */
+template< typename T >
+struct ShmLatest
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t value_size;
+    uint32_t param;                             /* Whatever the writer wants readers to know. */
+    std::atomic<uint32_t> writer_alive;         /* 0 once writer has quit. */
+    uint32_t reserved;
+    std::atomic<uint64_t> seq;
+    T value;
+};
+
+/**
+ * @brief Publishes the latest value. Only one writer.
+ */
+template< typename T >
+class ShmLatestWriter
+{
+public:
+    ShmLatestWriter( const std::string& name, uint32_t magic, uint32_t version, uint32_t param )
+        : name_( name ), shm_( NULL ), count_( 0 )
+    {
+        shm_unlink( name_.c_str( ) );
+        int fd = shm_open( name_.c_str( ), O_CREAT | O_RDWR | O_EXCL, 0644 );
+        if( fd < 0 )
+            throw std::runtime_error( "shm_open " + name_ + ": " + strerror( errno ) );
+        if( ftruncate( fd, sizeof( ShmLatest<T> ) ) != 0 )
+        {
+            close( fd );
+            throw std::runtime_error( "ftruncate " + name_ + ": " + strerror( errno ) );
+        }
+        void* p = mmap( NULL, sizeof( ShmLatest<T> ), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+        close( fd );
+        if( p == MAP_FAILED )
+            throw std::runtime_error( "mmap " + name_ + ": " + strerror( errno ) );
+
+        shm_ = static_cast<ShmLatest<T>*>( p );
+        memset( (void*)shm_, 0, sizeof( ShmLatest<T> ) );
+        shm_->version = version;
+        shm_->value_size = sizeof( T );
+        shm_->param = param;
+        shm_->writer_alive = 1;
+        std::atomic_thread_fence( std::memory_order_release );
+        shm_->magic = magic;
+    }
+
+    ~ShmLatestWriter( )
+    {
+        if( shm_ )
+        {
+            shm_->writer_alive = 0;
+            munmap( (void*)shm_, sizeof( ShmLatest<T> ) );
+        }
+        shm_unlink( name_.c_str( ) );
+    }
+
+    ShmLatestWriter( const ShmLatestWriter& ) = delete;
+    ShmLatestWriter& operator=( const ShmLatestWriter& ) = delete;
+
+    void publish( const T& v )
+    {
+        uint64_t n = count_++;
+        shm_->seq.store( 2 * n + 1, std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_release );
+        shm_->value = v;
+        shm_->seq.store( 2 * n + 2, std::memory_order_release );
+    }
+
+private:
+    std::string name_;
+    ShmLatest<T>* shm_;
+    uint64_t count_;
+};
+
+/**
+ * @brief Reads the latest value published by ShmLatestWriter.
+ */
+template< typename T >
+class ShmLatestReader
+{
+public:
+    ShmLatestReader( const std::string& name, uint32_t magic, uint32_t version )
+        : shm_( NULL ), retries_( 0 )
+    {
+        int fd = shm_open( name.c_str( ), O_RDONLY, 0 );
+        if( fd < 0 )
+            throw std::runtime_error( "shm_open " + name + ": " + strerror( errno ) );
+        void* p = mmap( NULL, sizeof( ShmLatest<T> ), PROT_READ, MAP_SHARED, fd, 0 );
+        close( fd );
+        if( p == MAP_FAILED )
+            throw std::runtime_error( "mmap " + name + ": " + strerror( errno ) );
+        shm_ = static_cast<const ShmLatest<T>*>( p );
+        if( shm_->magic != magic || shm_->version != version || shm_->value_size != sizeof( T ) )
+        {
+            munmap( (void*)shm_, sizeof( ShmLatest<T> ) );
+            shm_ = NULL;
+            throw std::runtime_error( name + ": not what was expected (or version mismatch)" );
+        }
+    }
+
+    ~ShmLatestReader( )
+    {
+        if( shm_ )
+            munmap( (void*)shm_, sizeof( ShmLatest<T> ) );
+    }
+
+    ShmLatestReader( const ShmLatestReader& ) = delete;
+    ShmLatestReader& operator=( const ShmLatestReader& ) = delete;
+
+    /**
+     * @brief Copy the latest value into v.
+     *
+     * @return false if nothing was published yet.
+     */
+    bool read( T& v )
+    {
+        while( true )
+        {
+            uint64_t seq = shm_->seq.load( std::memory_order_acquire );
+            if( seq == 0 )
+                return false;
+            if( seq % 2 == 0 )
+            {
+                v = shm_->value;
+                std::atomic_thread_fence( std::memory_order_acquire );
+                if( shm_->seq.load( std::memory_order_relaxed ) == seq )
+                    return true;
+            }
+            retries_ += 1;
+        }
+    }
+
+    bool writer_alive( ) const
+    {
+        return shm_->writer_alive != 0;
+    }
+
+    uint32_t param( ) const
+    {
+        return shm_->param;
+    }
+
+    /* Reads which raced the writer and were done again. */
+    uint64_t retries( ) const
+    {
+        return retries_;
+    }
+
+private:
+    const ShmLatest<T>* shm_;
+    uint64_t retries_;
+};
+
+#endif   /* ----- #ifndef ShmLatest_INC  ----- */
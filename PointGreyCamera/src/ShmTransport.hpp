@@ -0,0 +1,405 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  ShmTransport.hpp
+ *
+ *    Description:  Shared memory transport for frames. cam_server publishes
+ *    frames into a POSIX shared memory ring of fixed size slots; readers map
+ *    the same ring and read frames in place. No frame goes through kernel.
+ *
+ *    Layout (all offsets from start of mapping):
+ *
+ *      0             ShmRingHeader (one page)
+ *      page          slot 0: ShmSlotHeader (128 bytes) followed by pixels
+ *      page + k*S    slot k, S = slot_size (multiple of page size)
+ *
+ *    Pixels start header_size bytes into the slot; later versions only
+ *    append fields to ShmSlotHeader, like FrameHeader on the socket.
+ *
+ *    Every slot is a seqlock. Writer sets seq to 2n+1 before touching slot
+ *    and 2n+2 when frame n is complete. Reader copies/uses the pixels and
+ *    checks that seq did not change; if it did, the frame was overwritten
+ *    while being read (reader is more than num_slots frames behind).
+ *
+ *    Readers sleep on futex word header->published (low 32 bits of number of
+ *    published frames). Python readers can use the same futex through ctypes
+ *    or just poll (see shm_client.py).
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  ShmTransport_INC
+#define  ShmTransport_INC
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <atomic>
+#include <string>
+#include <stdexcept>
+
+#include "FrameSource.hpp"
+
+#define SHM_RING_MAGIC      0x48534245          /* "EBSH" */
+#define SHM_RING_VERSION    2
+
+/* Header of ring. It fits in first page of the mapping. */
+struct ShmRingHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_slots;
+    uint32_t slot_size;                         /* Bytes, including ShmSlotHeader. */
+    uint32_t data_offset;                       /* Offset of slot 0. */
+    uint32_t max_frame_bytes;
+    uint32_t width;
+    uint32_t height;
+    std::atomic<uint32_t> published;            /* Futex word; frames published (mod 2^32). */
+    std::atomic<uint32_t> waiters;              /* Readers sleeping on futex. */
+    std::atomic<uint64_t> write_count;          /* Frames published so far. */
+    std::atomic<uint32_t> writer_alive;         /* 0 once writer has quit. */
+};
+
+/* Header of each slot. Pixels follow at offset header_size. */
+struct ShmSlotHeader
+{
+    std::atomic<uint64_t> seq;
+    uint64_t frame_id;
+    uint64_t timestamp;
+    uint32_t width;
+    uint32_t height;
+    uint32_t size;
+    float blink;                                /* -1 if not computed. */
+    uint64_t host_ns;                           /* CLOCK_MONOTONIC when camera gave frame. */
+    uint32_t dropped;                           /* Frames lost in cam_server (mod 2^32). */
+    uint32_t pixel_format;                      /* PIXEL_FORMAT_* */
+    uint64_t exposure_ns;                       /* Camera timestamp on host clock; 0 unknown. */
+
+    /* Version 2: the rest of FrameHeader, so that shared memory readers
+     * know as much as socket ones. */
+    uint16_t version;                           /* SHM_RING_VERSION */
+    uint16_t header_size;                       /* Bytes; pixels follow. */
+    uint32_t flags;                             /* SYNC_* of the tag below. */
+    int64_t arduino_us;                         /* BehaviourTag (ClockSync.hpp) */
+    int32_t trial;
+    char state[4];
+    uint32_t sample_ms;
+    uint32_t pins;
+    uint16_t x0, y0;                            /* Origin in the camera frame (SubStreams.hpp). */
+    uint16_t bin;
+    uint16_t stream;                            /* FRAME_STREAM_* */
+    float motion[FRAME_MOTION_MASKS];           /* MotionEnergy.hpp; -1 for masks not set. */
+    uint16_t eye[4];                            /* Box of the blink (EyeTracker.hpp); 0s if none. */
+};
+
+static_assert( sizeof( ShmSlotHeader ) == 128, "ShmSlotHeader must be 128 bytes" );
+
+inline long futex_call( std::atomic<uint32_t>* addr, int op, uint32_t val
+        , const struct timespec* timeout = NULL )
+{
+    return syscall( SYS_futex, reinterpret_cast<uint32_t*>( addr ), op, val, timeout, NULL, 0 );
+}
+
+/**
+ * @brief Publishes frames into shared memory. Only one writer per ring.
+ */
+class ShmWriter
+{
+public:
+    ShmWriter( const std::string& name, size_t num_slots, size_t width, size_t height )
+        : name_( name ), base_( NULL ), length_( 0 ), header_( NULL )
+    {
+        size_t page = sysconf( _SC_PAGESIZE );
+        size_t maxBytes = width * height;
+        size_t slotSize = round_up( sizeof( ShmSlotHeader ) + maxBytes, page );
+        length_ = page + num_slots * slotSize;
+
+        shm_unlink( name_.c_str( ) );
+        int fd = shm_open( name_.c_str( ), O_CREAT | O_RDWR | O_EXCL, 0644 );
+        if( fd < 0 )
+            throw std::runtime_error( "shm_open " + name_ + ": " + strerror( errno ) );
+        if( ftruncate( fd, length_ ) != 0 )
+        {
+            close( fd );
+            throw std::runtime_error( "ftruncate " + name_ + ": " + strerror( errno ) );
+        }
+
+        base_ = static_cast<unsigned char*>(
+                mmap( NULL, length_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 )
+                );
+        close( fd );
+        if( base_ == MAP_FAILED )
+            throw std::runtime_error( "mmap " + name_ + ": " + strerror( errno ) );
+
+        // Touch every page now rather than on first frames.
+        memset( base_, 0, length_ );
+
+        header_ = reinterpret_cast<ShmRingHeader*>( base_ );
+        header_->num_slots = num_slots;
+        header_->slot_size = slotSize;
+        header_->data_offset = page;
+        header_->max_frame_bytes = maxBytes;
+        header_->width = width;
+        header_->height = height;
+        header_->published = 0;
+        header_->waiters = 0;
+        header_->write_count = 0;
+        header_->writer_alive = 1;
+        header_->version = SHM_RING_VERSION;
+        std::atomic_thread_fence( std::memory_order_release );
+        header_->magic = SHM_RING_MAGIC;
+    }
+
+    ~ShmWriter( )
+    {
+        if( header_ )
+        {
+            header_->writer_alive = 0;
+            // Wake readers so that they notice.
+            header_->published.fetch_add( 1 );
+            futex_call( &header_->published, FUTEX_WAKE, INT_MAX );
+        }
+        if( base_ && base_ != MAP_FAILED )
+            munmap( base_, length_ );
+        shm_unlink( name_.c_str( ) );
+    }
+
+    ShmWriter( const ShmWriter& ) = delete;
+    ShmWriter& operator=( const ShmWriter& ) = delete;
+
+    /**
+     * @brief Copy frame into next slot and wake readers.
+     *
+     * @return false if frame is larger than a slot.
+     */
+    bool publish( const Frame& frame )
+    {
+        if( frame.size > header_->max_frame_bytes )
+            return false;
+
+        uint64_t n = header_->write_count.load( std::memory_order_relaxed );
+        ShmSlotHeader* slot = slot_at( n % header_->num_slots );
+
+        slot->seq.store( 2 * n + 1, std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_release );
+
+        memcpy( reinterpret_cast<unsigned char*>( slot ) + sizeof( ShmSlotHeader )
+                , frame.data, frame.size );
+        slot->frame_id = frame.frame_id;
+        slot->timestamp = frame.timestamp;
+        slot->width = frame.width;
+        slot->height = frame.height;
+        slot->size = frame.size;
+        slot->blink = frame.blink;
+        slot->host_ns = frame.host_ns;
+        slot->dropped = frame.dropped;
+        slot->pixel_format = frame.pixel_format;
+        slot->exposure_ns = frame.exposure_ns;
+        slot->version = SHM_RING_VERSION;
+        slot->header_size = sizeof( ShmSlotHeader );
+        slot->flags = frame.tag.flags;
+        slot->arduino_us = frame.tag.arduino_us;
+        slot->trial = frame.tag.trial;
+        memcpy( slot->state, frame.tag.state, sizeof( slot->state ) );
+        slot->sample_ms = frame.tag.sample_ms;
+        slot->pins = frame.tag.pins;
+        slot->x0 = frame.x0;
+        slot->y0 = frame.y0;
+        slot->bin = frame.bin;
+        slot->stream = frame.stream;
+        memcpy( slot->motion, frame.motion, sizeof( slot->motion ) );
+        memcpy( slot->eye, frame.eye, sizeof( slot->eye ) );
+
+        slot->seq.store( 2 * n + 2, std::memory_order_release );
+        header_->write_count.store( n + 1, std::memory_order_release );
+        // Both seq_cst: a reader going to sleep either sees the new value of
+        // published or is counted in waiters.
+        header_->published.fetch_add( 1 );
+
+        // Only pay for the syscall when someone is actually asleep.
+        if( header_->waiters.load( ) > 0 )
+            futex_call( &header_->published, FUTEX_WAKE, INT_MAX );
+        return true;
+    }
+
+    size_t size( ) const
+    {
+        return length_;
+    }
+
+private:
+    static size_t round_up( size_t x, size_t to )
+    {
+        return ((x + to - 1) / to) * to;
+    }
+
+    ShmSlotHeader* slot_at( size_t i )
+    {
+        return reinterpret_cast<ShmSlotHeader*>(
+                base_ + header_->data_offset + i * header_->slot_size
+                );
+    }
+
+    std::string name_;
+    unsigned char* base_;
+    size_t length_;
+    ShmRingHeader* header_;
+};
+
+/**
+ * @brief Reads frames from a ring published by ShmWriter. Frames are read in
+ * place; see read( ).
+ */
+class ShmReader
+{
+public:
+    ShmReader( const std::string& name )
+        : name_( name ), base_( NULL ), length_( 0 ), header_( NULL )
+        , next_( 0 ), missed_( 0 )
+    {
+        int fd = shm_open( name_.c_str( ), O_RDWR, 0 );
+        if( fd < 0 )
+            throw std::runtime_error( "shm_open " + name_ + ": " + strerror( errno ) );
+        struct stat st;
+        fstat( fd, &st );
+        length_ = st.st_size;
+
+        // Mapped writable only because futex waiters counter lives in header.
+        base_ = static_cast<unsigned char*>(
+                mmap( NULL, length_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 )
+                );
+        close( fd );
+        if( base_ == MAP_FAILED )
+            throw std::runtime_error( "mmap " + name_ + ": " + strerror( errno ) );
+
+        header_ = reinterpret_cast<ShmRingHeader*>( base_ );
+        if( header_->magic != SHM_RING_MAGIC || header_->version != SHM_RING_VERSION )
+        {
+            munmap( base_, length_ );
+            base_ = NULL;
+            throw std::runtime_error( name_ + " is not a frame ring (or version mismatch)" );
+        }
+
+        // Start from the newest frame.
+        next_ = header_->write_count.load( std::memory_order_acquire );
+    }
+
+    ~ShmReader( )
+    {
+        if( base_ && base_ != MAP_FAILED )
+            munmap( base_, length_ );
+    }
+
+    ShmReader( const ShmReader& ) = delete;
+    ShmReader& operator=( const ShmReader& ) = delete;
+
+    /**
+     * @brief Wait for next frame.
+     *
+     * @param timeout_ms Give up after this many milliseconds.
+     *
+     * @return false on timeout or when writer has gone away.
+     */
+    bool wait( int timeout_ms = 1000 )
+    {
+        struct timespec ts;
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+
+        while( header_->write_count.load( std::memory_order_acquire ) <= next_ )
+        {
+            if( ! header_->writer_alive )
+                return false;
+            uint32_t seen = header_->published.load( std::memory_order_acquire );
+            if( header_->write_count.load( std::memory_order_acquire ) > next_ )
+                break;
+            header_->waiters.fetch_add( 1 );
+            long r = futex_call( &header_->published, FUTEX_WAIT, seen, &ts );
+            header_->waiters.fetch_sub( 1 );
+            if( r == -1 && errno == ETIMEDOUT )
+                return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Call f( const ShmSlotHeader&, const unsigned char* pixels ) on
+     * next frame without copying it. Frames which were overwritten before
+     * reader got to them are skipped and counted in missed( ).
+     *
+     * @return false if no frame is available (call wait( ) first) or the
+     * frame was overwritten while f was running; result of f must then be
+     * discarded.
+     */
+    template<typename F>
+    bool read( F f )
+    {
+        uint64_t written = header_->write_count.load( std::memory_order_acquire );
+        if( written <= next_ )
+            return false;
+
+        // Fell behind by more than the ring: jump to oldest frame still there.
+        if( written - next_ > header_->num_slots )
+        {
+            missed_ += written - next_ - header_->num_slots;
+            next_ = written - header_->num_slots;
+        }
+
+        uint64_t n = next_++;
+        const ShmSlotHeader* slot = slot_at( n % header_->num_slots );
+        if( slot->seq.load( std::memory_order_acquire ) != 2 * n + 2 )
+        {
+            missed_ += 1;
+            return false;
+        }
+
+        f( *slot, reinterpret_cast<const unsigned char*>( slot ) + sizeof( ShmSlotHeader ) );
+
+        std::atomic_thread_fence( std::memory_order_acquire );
+        if( slot->seq.load( std::memory_order_relaxed ) != 2 * n + 2 )
+        {
+            missed_ += 1;
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t missed( ) const
+    {
+        return missed_;
+    }
+
+    const ShmRingHeader& header( ) const
+    {
+        return *header_;
+    }
+
+private:
+    const ShmSlotHeader* slot_at( size_t i ) const
+    {
+        return reinterpret_cast<const ShmSlotHeader*>(
+                base_ + header_->data_offset + i * header_->slot_size
+                );
+    }
+
+    std::string name_;
+    unsigned char* base_;
+    size_t length_;
+    ShmRingHeader* header_;
+
+    uint64_t next_;
+    uint64_t missed_;
+};
+
+#endif   /* ----- #ifndef ShmTransport_INC  ----- */
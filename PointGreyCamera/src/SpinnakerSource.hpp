@@ -0,0 +1,548 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  SpinnakerSource.hpp
+ *
+ *    Description:  PointGrey camera (Spinnaker SDK) as a FrameSource. Camera
+ *    configuration used to live in main.cpp (RunSingleCamera).
+ *
+ *    Several sources (one per camera, see --cameras of cam_server) share
+ *    one System instance and camera list, as AcquisitionMultipleCamera of
+ *    the SDK does; it is released when the last source lets go.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  SpinnakerSource_INC
+#define  SpinnakerSource_INC
+
+#include "Spinnaker.h"
+#include "SpinGenApi/SpinnakerGenApi.h"
+#include <iostream>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+#include "FrameSource.hpp"
+#include "PixelUnpack.hpp"
+#include "config.h"
+
+using namespace Spinnaker;
+using namespace Spinnaker::GenApi;
+using namespace Spinnaker::GenICam;
+
+// This function returns the camera to its default state by re-enabling automatic
+// exposure.
+inline int ResetExposure(INodeMap & nodeMap)
+{
+        int result = 0;
+        try
+        {
+                //
+                // Turn automatic exposure back on
+                //
+                // *** NOTES ***
+                // Automatic exposure is turned on in order to return the camera to its
+                // default state.
+                //
+                CEnumerationPtr ptrExposureAuto = nodeMap.GetNode("ExposureAuto");
+                if (!IsAvailable(ptrExposureAuto) || !IsWritable(ptrExposureAuto))
+                {
+                        std::cout << "Unable to enable automatic exposure (node retrieval). Non-fatal error..." << std::endl << std::endl;
+                        return -1;
+                }
+
+                CEnumEntryPtr ptrExposureAutoContinuous = ptrExposureAuto->GetEntryByName("Continuous");
+                if (!IsAvailable(ptrExposureAutoContinuous) || !IsReadable(ptrExposureAutoContinuous))
+                {
+                        std::cout << "Unable to enable automatic exposure (enum entry retrieval). Non-fatal error..." << std::endl << std::endl;
+                        return -1;
+                }
+                ptrExposureAuto->SetIntValue(ptrExposureAutoContinuous->GetValue());
+                std::cout << "Automatic exposure enabled..." << std::endl << std::endl;
+        }
+        catch (Spinnaker::Exception &e)
+        {
+                std::cout << "Error: " << e.what() << std::endl;
+                result = -1;
+        }
+        return result;
+}
+
+// This function prints the device information of the camera from the transport
+// layer; please see NodeMapInfo example for more in-depth comments on printing
+// device information from the nodemap.
+inline int PrintDeviceInfo(INodeMap & nodeMap)
+{
+    int result = 0;
+
+    std::cout << std::endl << "*** DEVICE INFORMATION ***" << std::endl << std::endl;
+
+    try
+    {
+        FeatureList_t features;
+        CCategoryPtr category = nodeMap.GetNode("DeviceInformation");
+        if (IsAvailable(category) && IsReadable(category))
+        {
+            category->GetFeatures(features);
+
+            FeatureList_t::const_iterator it;
+            for (it = features.begin(); it != features.end(); ++it)
+            {
+                CNodePtr pfeatureNode = *it;
+                std::cout << pfeatureNode->GetName() << " : ";
+                CValuePtr pValue = (CValuePtr)pfeatureNode;
+                std::cout << (IsReadable(pValue) ? pValue->ToString() : "Node not readable");
+                std::cout << std::endl;
+            }
+
+        }
+        else
+        {
+            std::cout << "Device control information not available." << std::endl;
+        }
+    }
+    catch (Spinnaker::Exception &e)
+    {
+        std::cout << "Error: " << e.what() << std::endl;
+        result = -1;
+    }
+
+    return result;
+}
+
+/**
+ * @brief The Spinnaker System and its camera list, shared by all sources of
+ * this process.
+ */
+class SpinnakerSystem
+{
+public:
+    /* The instance in use, or a new one; throws if the cameras are in use. */
+    static std::shared_ptr<SpinnakerSystem> get( )
+    {
+        static std::mutex mutex;
+        static std::weak_ptr<SpinnakerSystem> current;
+        std::lock_guard<std::mutex> lock( mutex );
+        std::shared_ptr<SpinnakerSystem> system = current.lock( );
+        if( ! system )
+        {
+            system.reset( new SpinnakerSystem( ) );
+            current = system;
+        }
+        return system;
+    }
+
+    ~SpinnakerSystem( )
+    {
+        // Clear camera list before releasing system_
+        cam_list_.Clear();
+        system_->ReleaseInstance();
+    }
+
+    SpinnakerSystem( const SpinnakerSystem& ) = delete;
+    SpinnakerSystem& operator=( const SpinnakerSystem& ) = delete;
+
+    unsigned int size( ) const
+    {
+        return cam_list_.GetSize();
+    }
+
+    CameraPtr camera( unsigned int index )
+    {
+        return cam_list_.GetByIndex( index );
+    }
+
+private:
+    SpinnakerSystem( )
+    {
+        // Retrieve singleton reference to system object
+        system_ = System::GetInstance();
+        if( system_->IsInUse( ) )
+        {
+            system_->ReleaseInstance( );
+            throw std::runtime_error( "Camera is already in use. Reattach and continue" );
+        }
+
+        // Retrieve list of cameras from the system
+        cam_list_ = system_->GetCameras();
+        std::cout << "Number of cameras detected: " << cam_list_.GetSize() << std::endl << std::endl;
+    }
+
+    SystemPtr system_;
+    CameraList cam_list_;
+};
+
+class SpinnakerSource : public FrameSource
+{
+public:
+    /**
+     * @brief Constructor.
+     *
+     * @param index Index of camera in the list returned by the SDK.
+     * @param nbuffers Number of stream buffers the SDK allocates. Frames are
+     * handed out without copy and held until release( ), so this must be
+     * larger than the number of frames consumer may hold at a time.
+     * @param timeout_ms How long next_frame( ) waits for an image. A finite
+     * timeout lets the acquisition loop notice Ctrl+C.
+     * @param pixel_format PIXEL_FORMAT_* the camera is set to; frames of
+     * 12/16 bit formats need a PixelConverter.
+     */
+    SpinnakerSource( unsigned int index = 0, size_t nbuffers = 80, uint64_t timeout_ms = 1000
+            , uint32_t pixel_format = PIXEL_FORMAT_MONO8 )
+        : index_( index ), nbuffers_( nbuffers ), timeout_ms_( timeout_ms )
+        , fps_( EXPECTED_FPS ), pixel_format_( pixel_format )
+        , nodeMap_( NULL )
+    { }
+
+    std::string name( ) const
+    {
+        return "spinnaker";
+    }
+
+    int init( )
+    {
+        try
+        {
+            system_ = SpinnakerSystem::get( );
+        }
+        catch( std::runtime_error& e )
+        {
+            std::cout << "Warn: " << e.what( ) << std::endl;
+            return -1;
+        }
+
+        if( system_->size( ) <= index_ )
+        {
+            system_.reset( );
+            std::cout << "Not enough cameras for camera " << index_ << "! Existing ..." << std::endl;
+            return -1;
+        }
+
+        pCam_ = system_->camera( index_ );
+        return configure( );
+    }
+
+    int begin_acquisition( )
+    {
+        try
+        {
+            CEnumerationPtr ptrAcquisitionMode = nodeMap_->GetNode("AcquisitionMode");
+            if (!IsAvailable(ptrAcquisitionMode) || !IsWritable(ptrAcquisitionMode))
+            {
+                std::cout << "Unable to set acquisition mode to continuous "
+                    << " (enum retrieval). Aborting..." << std::endl << std::endl;
+                return -1;
+            }
+
+            // Retrieve entry node from enumeration node
+            CEnumEntryPtr ptrAcquisitionModeContinuous = ptrAcquisitionMode->GetEntryByName("Continuous");
+            if (!IsAvailable(ptrAcquisitionModeContinuous) || !IsReadable(ptrAcquisitionModeContinuous))
+            {
+                std::cout << "Unable to set acquisition mode to continuous " <<
+                    " (entry retrieval). Aborting..." << std::endl << std::endl;
+                return -1;
+            }
+
+            // Set integer value from entry node as new value of enumeration node
+            ptrAcquisitionMode->SetIntValue(ptrAcquisitionModeContinuous->GetValue());
+            std::cout << "Acquisition mode set to continuous..." << std::endl;
+
+            set_stream_buffers( );
+            pCam_->BeginAcquisition();
+
+            INodeMap & nodeMapTLDevice = pCam_->GetTLDeviceNodeMap();
+            CStringPtr ptrStringSerial = nodeMapTLDevice.GetNode("DeviceSerialNumber");
+            if (IsAvailable(ptrStringSerial) && IsReadable(ptrStringSerial))
+                std::cout << "Device serial number retrieved "
+                    << ptrStringSerial->GetValue() << std::endl;
+        }
+        catch (Spinnaker::Exception &e)
+        {
+            std::cout << "Error: " << e.what() << std::endl;
+            return -1;
+        }
+        return 0;
+    }
+
+    bool next_frame( Frame& frame )
+    {
+        ImagePtr pResultImage;
+        try
+        {
+            pResultImage = pCam_->GetNextImage( timeout_ms_ );
+        }
+        catch (Spinnaker::Exception &e)
+        {
+            // Most likely a timeout.
+            return false;
+        }
+        frame.host_ns = monotonic_ns( );
+
+        frame.incomplete = pResultImage->IsIncomplete( );
+        frame.status = frame.incomplete ? pResultImage->GetImageStatus( ) : 0;
+        frame.data = static_cast<unsigned char*>( pResultImage->GetData( ) );
+        frame.width = pResultImage->GetWidth( );
+        frame.height = pResultImage->GetHeight( );
+        frame.size = pResultImage->GetBufferSize( );
+        frame.pixel_format = pixel_format_;
+        frame.frame_id = pResultImage->GetFrameID( );
+        frame.timestamp = pResultImage->GetTimeStamp( );
+
+        // Keep the image alive until release( ) is called; it is released
+        // there and its buffer goes back to the camera.
+        frame.handle = new ImagePtr( pResultImage );
+        return true;
+    }
+
+    void release( Frame& frame )
+    {
+        ImagePtr* p = static_cast<ImagePtr*>( frame.handle );
+        if( ! p )
+            return;
+        try
+        {
+            (*p)->Release( );
+        }
+        catch (Spinnaker::Exception &e)
+        {
+            std::cout << "Error: " << e.what() << std::endl;
+        }
+        delete p;
+        frame.handle = NULL;
+        frame.data = NULL;
+    }
+
+    void end_acquisition( )
+    {
+        try
+        {
+            pCam_->EndAcquisition();
+        }
+        catch (Spinnaker::Exception &e)
+        {
+            std::cout << "Error: " << e.what() << std::endl;
+        }
+    }
+
+    void deinit( )
+    {
+        try
+        {
+            // Reset settings.
+            if( nodeMap_ )
+                ResetExposure( *nodeMap_ );
+
+            // Deinitialize camera
+            pCam_->DeInit();
+        }
+        catch (Spinnaker::Exception &e)
+        {
+            std::cout << "Error: " << e.what() << std::endl;
+        }
+
+        pCam_ = 0;
+        nodeMap_ = NULL;
+
+        // The last camera to go releases the system.
+        system_.reset( );
+    }
+
+    double frame_rate( ) const
+    {
+        return fps_;
+    }
+
+private:
+
+    /**
+     * @brief Ask for nbuffers_ stream buffers, handed out oldest first. The
+     * defaults (a handful of buffers, newest only) are too few once frames
+     * are held in a ring instead of being released right away.
+     */
+    void set_stream_buffers( )
+    {
+        INodeMap & sNodeMap = pCam_->GetTLStreamNodeMap();
+
+        CEnumerationPtr ptrHandlingMode = sNodeMap.GetNode("StreamBufferHandlingMode");
+        if (IsAvailable(ptrHandlingMode) && IsWritable(ptrHandlingMode))
+        {
+            CEnumEntryPtr ptrOldestFirst = ptrHandlingMode->GetEntryByName("OldestFirst");
+            if (IsAvailable(ptrOldestFirst) && IsReadable(ptrOldestFirst))
+                ptrHandlingMode->SetIntValue(ptrOldestFirst->GetValue());
+        }
+
+        CEnumerationPtr ptrCountMode = sNodeMap.GetNode("StreamBufferCountMode");
+        if (IsAvailable(ptrCountMode) && IsWritable(ptrCountMode))
+        {
+            CEnumEntryPtr ptrManual = ptrCountMode->GetEntryByName("Manual");
+            if (IsAvailable(ptrManual) && IsReadable(ptrManual))
+                ptrCountMode->SetIntValue(ptrManual->GetValue());
+        }
+
+        CIntegerPtr ptrBufferCount = sNodeMap.GetNode("StreamBufferCountManual");
+        if (!IsAvailable(ptrBufferCount) || !IsWritable(ptrBufferCount))
+        {
+            std::cout << "[WARN] Unable to set number of stream buffers. Using default ..." << std::endl;
+            return;
+        }
+        int64_t count = std::min( (int64_t) nbuffers_, ptrBufferCount->GetMax( ) );
+        ptrBufferCount->SetValue( count );
+        std::cout << "[INFO] Stream buffers set to " << count << std::endl;
+    }
+
+    // Configure geometry, frame rate, exposure and gain. Used to be
+    // RunSingleCamera.
+    int configure( )
+    {
+        try
+        {
+            // Retrieve TL device nodemap and print device information
+            INodeMap & nodeMapTLDevice = pCam_->GetTLDeviceNodeMap();
+            PrintDeviceInfo(nodeMapTLDevice);
+
+            // Initialize camera
+            pCam_->Init();
+
+            // Retrieve GenICam nodemap
+            INodeMap & nodeMap = pCam_->GetNodeMap();
+            nodeMap_ = &nodeMap;
+
+            // Pixel format first; it changes the Width increment on some
+            // models. Symbolic names are e.g. Mono12p and Mono12Packed.
+            CEnumerationPtr ptrPixelFormat = nodeMap.GetNode("PixelFormat");
+            if (IsAvailable(ptrPixelFormat) && IsWritable(ptrPixelFormat))
+            {
+                std::string want = pixel_format_name( pixel_format_ );
+                NodeList_t entries;
+                ptrPixelFormat->GetEntries( entries );
+                CEnumEntryPtr entry;
+                for( auto node : entries )
+                {
+                    CEnumEntryPtr e = node;
+                    if( IsAvailable(e) && pixel_format_from_name( e->GetSymbolic( ).c_str( ) ) == pixel_format_ )
+                        entry = e;
+                }
+                if( ! entry )
+                {
+                    std::cout << "Camera has no pixel format " << want << ". Aborting..." << std::endl;
+                    return -1;
+                }
+                ptrPixelFormat->SetIntValue( entry->GetValue( ) );
+                std::cout << "[INFO] Pixel format set to " << entry->GetSymbolic( ) << std::endl;
+            }
+            else if( pixel_format_ != PIXEL_FORMAT_MONO8 )
+            {
+                std::cout << "Unable to set pixel format. Aborting..." << std::endl;
+                return -1;
+            }
+
+            // Set width, height
+            CIntegerPtr width = nodeMap.GetNode("Width");
+            width->SetValue( FRAME_WIDTH );
+
+            CIntegerPtr height = nodeMap.GetNode("Height");
+            height->SetValue( FRAME_HEIGHT );
+
+            // Set frame rate manually.
+            CBooleanPtr pAcquisitionManualFrameRate = nodeMap.GetNode( "AcquisitionFrameRateEnable" );
+            pAcquisitionManualFrameRate->SetValue( true );
+
+            CFloatPtr ptrAcquisitionFrameRate = nodeMap.GetNode("AcquisitionFrameRate");
+
+            try {
+                std::cout << "Trying to set frame rate to " << EXPECTED_FPS << std::endl;
+                ptrAcquisitionFrameRate->SetValue( EXPECTED_FPS );
+            }
+            catch ( std::exception & e )
+            {
+                std::cout << "Failed to set frame rate. Using default ... " << std::endl;
+                std::cout << "\tError was " << e.what( ) << std::endl;
+            }
+
+            if (!IsAvailable(ptrAcquisitionFrameRate) || !IsReadable(ptrAcquisitionFrameRate))
+                std::cout << "Unable to retrieve frame rate. " << std::endl << std::endl;
+            else
+            {
+                fps_ = ptrAcquisitionFrameRate->GetValue();
+                std::cout << "[INFO] Expected frame set to " << fps_ << std::endl;
+            }
+
+            // Switch off auto-exposure and set it manually.
+            CEnumerationPtr ptrExposureAuto = nodeMap.GetNode("ExposureAuto");
+            if (!IsAvailable(ptrExposureAuto) || !IsWritable(ptrExposureAuto))
+            {
+                std::cout << "Unable to disable automatic exposure (node retrieval). Aborting..." << std::endl << std::endl;
+                return -1;
+            }
+
+            CEnumEntryPtr ptrExposureAutoOff = ptrExposureAuto->GetEntryByName("Off");
+            if (!IsAvailable(ptrExposureAutoOff) || !IsReadable(ptrExposureAutoOff))
+            {
+                std::cout << "Unable to disable automatic exposure (enum entry retrieval). Aborting..." << std::endl << std::endl;
+                return -1;
+            }
+
+            ptrExposureAuto->SetIntValue(ptrExposureAutoOff->GetValue());
+            std::cout << "Automatic exposure disabled..." << std::endl;
+            CFloatPtr ptrExposureTime = nodeMap.GetNode("ExposureTime");
+            if (!IsAvailable(ptrExposureTime) || !IsWritable(ptrExposureTime))
+            {
+                std::cout << "Unable to set exposure time. Aborting..." << std::endl << std::endl;
+                return -1;
+            }
+
+            ptrExposureTime->SetValue( EXPOSURE_TIME_IN_US );
+            std::cout << "Exposure time set to " << ptrExposureTime->GetValue( ) << " us..." << std::endl << std::endl;
+
+            // Turn of automatic gain
+            CEnumerationPtr ptrGainAuto = nodeMap.GetNode("GainAuto");
+            if (!IsAvailable(ptrGainAuto) || !IsWritable(ptrGainAuto))
+            {
+                std::cout << "Unable to disable automatic gain (node retrieval). Aborting..." << std::endl << std::endl;
+                return -1;
+            }
+            CEnumEntryPtr ptrGainAutoOff = ptrGainAuto->GetEntryByName("Off");
+            if (!IsAvailable(ptrGainAutoOff) || !IsReadable(ptrGainAutoOff))
+            {
+                std::cout << "Unable to disable automatic gain (enum entry retrieval). Aborting..." << std::endl << std::endl;
+                return -1;
+            }
+
+            // Set gain; gain recorded in decibels
+            CFloatPtr ptrGain = nodeMap.GetNode("Gain");
+            if (!IsAvailable(ptrGain) || !IsWritable(ptrGain))
+            {
+                std::cout << "[WARN] Unable to set gain (node retrieval). Using default ..." << std::endl;
+            }
+            else
+            {
+                double gainToSet = ptrGain->GetMin( );
+                ptrGain->SetValue(gainToSet);
+            }
+        }
+        catch (Spinnaker::Exception &e)
+        {
+            std::cout << "Error: " << e.what() << std::endl;
+            return -1;
+        }
+        return 0;
+    }
+
+    unsigned int index_;
+    size_t nbuffers_;
+    uint64_t timeout_ms_;
+    double fps_;
+    uint32_t pixel_format_;
+
+    std::shared_ptr<SpinnakerSystem> system_;
+    CameraPtr pCam_;
+    INodeMap* nodeMap_;
+};
+
+#endif   /* ----- #ifndef SpinnakerSource_INC  ----- */
@@ -0,0 +1,326 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  SubStreams.hpp
+ *
+ *    Description:  Cheap streams derived from the camera stream, computed
+ *    once in cam_server rather than by every reader: a binned (2x2 or 4x4
+ *    mean) preview at a few frames per second for GUIs, and the full rate,
+ *    full resolution crop of an ROI (the eye) for analysis. The crop may be
+ *    moved while the camera runs.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  SubStreams_INC
+#define  SubStreams_INC
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+
+#include "FrameSource.hpp"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/* One row of means of 2x2 blocks of rows r0, r1; n input pixels (even). */
+inline void bin_rows2( const uint8_t* r0, const uint8_t* r1, size_t n, uint8_t* out )
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i ones = _mm256_set1_epi8( 1 );
+    const __m256i two = _mm256_set1_epi16( 2 );
+    for (; i + 64 <= n; i += 64)
+    {
+        // maddubs: sums of horizontal pairs as 16 bit.
+        __m256i a = _mm256_add_epi16(
+                _mm256_maddubs_epi16( _mm256_loadu_si256( (const __m256i*)(r0 + i) ), ones )
+                , _mm256_maddubs_epi16( _mm256_loadu_si256( (const __m256i*)(r1 + i) ), ones ) );
+        __m256i b = _mm256_add_epi16(
+                _mm256_maddubs_epi16( _mm256_loadu_si256( (const __m256i*)(r0 + i + 32) ), ones )
+                , _mm256_maddubs_epi16( _mm256_loadu_si256( (const __m256i*)(r1 + i + 32) ), ones ) );
+        a = _mm256_srli_epi16( _mm256_add_epi16( a, two ), 2 );
+        b = _mm256_srli_epi16( _mm256_add_epi16( b, two ), 2 );
+        __m256i p = _mm256_permute4x64_epi64( _mm256_packus_epi16( a, b ), 0xD8 );
+        _mm256_storeu_si256( (__m256i*)(out + i / 2), p );
+    }
+#elif defined(__SSSE3__)
+    const __m128i ones = _mm_set1_epi8( 1 );
+    const __m128i two = _mm_set1_epi16( 2 );
+    for (; i + 32 <= n; i += 32)
+    {
+        __m128i a = _mm_add_epi16(
+                _mm_maddubs_epi16( _mm_loadu_si128( (const __m128i*)(r0 + i) ), ones )
+                , _mm_maddubs_epi16( _mm_loadu_si128( (const __m128i*)(r1 + i) ), ones ) );
+        __m128i b = _mm_add_epi16(
+                _mm_maddubs_epi16( _mm_loadu_si128( (const __m128i*)(r0 + i + 16) ), ones )
+                , _mm_maddubs_epi16( _mm_loadu_si128( (const __m128i*)(r1 + i + 16) ), ones ) );
+        a = _mm_srli_epi16( _mm_add_epi16( a, two ), 2 );
+        b = _mm_srli_epi16( _mm_add_epi16( b, two ), 2 );
+        _mm_storeu_si128( (__m128i*)(out + i / 2), _mm_packus_epi16( a, b ) );
+    }
+#endif
+    for (; i + 2 <= n; i += 2)
+        out[i / 2] = (r0[i] + r0[i + 1] + r1[i] + r1[i + 1] + 2) >> 2;
+}
+
+/* One row of means of 4x4 blocks of rows r[0..3]; n input pixels (multiple of 4). */
+inline void bin_rows4( const uint8_t* const r[4], size_t n, uint8_t* out )
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i ones8 = _mm256_set1_epi8( 1 );
+    const __m256i ones16 = _mm256_set1_epi16( 1 );
+    const __m256i eight = _mm256_set1_epi32( 8 );
+    // packs/packus interleave 128 bit lanes; this puts the dwords back.
+    const __m256i order = _mm256_setr_epi32( 0, 4, 1, 5, 2, 6, 3, 7 );
+    for (; i + 128 <= n; i += 128)
+    {
+        __m256i v[4];
+        for (int k = 0; k < 4; k++)
+        {
+            size_t j = i + 32 * k;
+            __m256i s = _mm256_maddubs_epi16( _mm256_loadu_si256( (const __m256i*)(r[0] + j) ), ones8 );
+            for (int row = 1; row < 4; row++)
+                s = _mm256_add_epi16( s, _mm256_maddubs_epi16(
+                            _mm256_loadu_si256( (const __m256i*)(r[row] + j) ), ones8 ) );
+            // Pairs of pair sums: sums of 4x4 blocks as 32 bit.
+            s = _mm256_madd_epi16( s, ones16 );
+            v[k] = _mm256_srli_epi32( _mm256_add_epi32( s, eight ), 4 );
+        }
+        __m256i p = _mm256_packus_epi16( _mm256_packs_epi32( v[0], v[1] ), _mm256_packs_epi32( v[2], v[3] ) );
+        _mm256_storeu_si256( (__m256i*)(out + i / 4), _mm256_permutevar8x32_epi32( p, order ) );
+    }
+#elif defined(__SSSE3__)
+    const __m128i ones8 = _mm_set1_epi8( 1 );
+    const __m128i ones16 = _mm_set1_epi16( 1 );
+    const __m128i eight = _mm_set1_epi32( 8 );
+    for (; i + 64 <= n; i += 64)
+    {
+        __m128i v[4];
+        for (int k = 0; k < 4; k++)
+        {
+            size_t j = i + 16 * k;
+            __m128i s = _mm_maddubs_epi16( _mm_loadu_si128( (const __m128i*)(r[0] + j) ), ones8 );
+            for (int row = 1; row < 4; row++)
+                s = _mm_add_epi16( s, _mm_maddubs_epi16(
+                            _mm_loadu_si128( (const __m128i*)(r[row] + j) ), ones8 ) );
+            s = _mm_madd_epi16( s, ones16 );
+            v[k] = _mm_srli_epi32( _mm_add_epi32( s, eight ), 4 );
+        }
+        __m128i p = _mm_packus_epi16( _mm_packs_epi32( v[0], v[1] ), _mm_packs_epi32( v[2], v[3] ) );
+        _mm_storeu_si128( (__m128i*)(out + i / 4), p );
+    }
+#endif
+    for (; i + 4 <= n; i += 4)
+    {
+        unsigned s = 8;
+        for (int row = 0; row < 4; row++)
+            s += r[row][i] + r[row][i + 1] + r[row][i + 2] + r[row][i + 3];
+        out[i / 4] = s >> 4;
+    }
+}
+
+/**
+ * @brief Mean of every bin x bin block (bin 2 or 4) of a Mono8 frame;
+ * dst is (width / bin) x (height / bin). Leftover columns and rows are
+ * dropped.
+ */
+inline void bin_frame( const uint8_t* src, size_t width, size_t height, unsigned bin, uint8_t* dst )
+{
+    size_t w = width / bin * bin, ow = width / bin;
+    for (size_t y = 0; y + bin <= height; y += bin, dst += ow)
+    {
+        const uint8_t* r = src + y * width;
+        if( bin == 2 )
+            bin_rows2( r, r + width, w, dst );
+        else
+        {
+            const uint8_t* const rows[4] = { r, r + width, r + 2 * width, r + 3 * width };
+            bin_rows4( rows, w, dst );
+        }
+    }
+}
+
+class SubStreams
+{
+public:
+    typedef std::function<bool( const Frame& )> Sink;
+
+    /**
+     * @brief Constructor.
+     *
+     * @param width, height Of the camera's (Mono8) frames.
+     * @param bin Preview is binned bin x bin: 2 or 4; 0 for no preview.
+     * @param preview_fps Preview frames per second, at most.
+     * @param x0, y0, x1, y1 Crop; x1 == x0 for no crop stream.
+     */
+    SubStreams( size_t width, size_t height, unsigned bin, double preview_fps
+            , size_t x0, size_t y0, size_t x1, size_t y1 )
+        : width_( width ), height_( height ), bin_( bin )
+        , period_ns_( preview_fps > 0 ? (uint64_t)(1e9 / preview_fps) : 0 ), next_ns_( 0 )
+        , crop_on_( x1 != x0 ), previews_( 0 ), crops_( 0 )
+    {
+        if( bin != 0 && bin != 2 && bin != 4 )
+            throw std::invalid_argument( "preview bin must be 2 or 4" );
+        memset( roi_, 0, sizeof( roi_ ) );
+        if( bin )
+            preview_.resize( (width / bin) * (height / bin) );
+        if( crop_on_ )
+            set_crop( x0, y0, x1, y1 );
+    }
+
+    SubStreams( const SubStreams& ) = delete;
+    SubStreams& operator=( const SubStreams& ) = delete;
+
+    bool has_preview( ) const
+    {
+        return bin_ != 0;
+    }
+
+    bool has_crop( ) const
+    {
+        return crop_on_;
+    }
+
+    size_t preview_width( ) const
+    {
+        return bin_ ? width_ / bin_ : 0;
+    }
+
+    size_t preview_height( ) const
+    {
+        return bin_ ? height_ / bin_ : 0;
+    }
+
+    /* Who gets the preview, and the crop. Set them before frames come. */
+    void set_preview_sink( Sink sink )
+    {
+        preview_sink_ = sink;
+    }
+
+    void set_crop_sink( Sink sink )
+    {
+        crop_sink_ = sink;
+    }
+
+    /* Move the crop; any thread. Throws invalid_argument if it is not
+     * inside the frame. */
+    void set_crop( size_t x0, size_t y0, size_t x1, size_t y1 )
+    {
+        if( x0 >= x1 || y0 >= y1 || x1 > width_ || y1 > height_ )
+            throw std::invalid_argument( "crop must be inside the frame with x0 < x1, y0 < y1" );
+        std::lock_guard<std::mutex> lock( mutex_ );
+        roi_[0] = x0;
+        roi_[1] = y0;
+        roi_[2] = x1;
+        roi_[3] = y1;
+    }
+
+    /* "x0,y0,x1,y1" */
+    std::string crop( )
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        std::ostringstream ss;
+        ss << roi_[0] << ',' << roi_[1] << ',' << roi_[2] << ',' << roi_[3];
+        return ss.str( );
+    }
+
+    /**
+     * @brief Derive from frame of the camera and hand the results to the
+     * sinks. Called by the camera's sender thread, after frame went out.
+     */
+    void process( const Frame& frame )
+    {
+        if( frame.pixel_format != PIXEL_FORMAT_MONO8 || frame.width != width_
+                || frame.height != height_ )
+            return;
+
+        if( bin_ && preview_sink_ && frame.host_ns >= next_ns_ )
+        {
+            // Keep the cadence; start over after a gap.
+            next_ns_ = next_ns_ + period_ns_ > frame.host_ns ? next_ns_ + period_ns_
+                : frame.host_ns + period_ns_;
+            bin_frame( frame.data, width_, height_, bin_, &preview_[0] );
+            Frame p = derived( frame, &preview_[0], width_ / bin_, height_ / bin_ );
+            p.bin = bin_;
+            p.stream = FRAME_STREAM_PREVIEW;
+            if( preview_sink_( p ) )
+                previews_ += 1;
+        }
+
+        if( crop_on_ && crop_sink_ )
+        {
+            size_t roi[4];
+            {
+                std::lock_guard<std::mutex> lock( mutex_ );
+                memcpy( roi, roi_, sizeof( roi ) );
+            }
+            size_t w = roi[2] - roi[0], h = roi[3] - roi[1];
+            crop_.resize( w * h );
+            for (size_t y = 0; y < h; y++)
+                memcpy( &crop_[y * w], frame.data + (roi[1] + y) * width_ + roi[0], w );
+            Frame c = derived( frame, &crop_[0], w, h );
+            c.x0 = roi[0];
+            c.y0 = roi[1];
+            c.stream = FRAME_STREAM_CROP;
+            if( crop_sink_( c ) )
+                crops_ += 1;
+        }
+    }
+
+    uint64_t previews( ) const
+    {
+        return previews_;
+    }
+
+    uint64_t crops( ) const
+    {
+        return crops_;
+    }
+
+private:
+    /* frame's metadata with other pixels; not to be released. */
+    static Frame derived( const Frame& frame, uint8_t* data, size_t w, size_t h )
+    {
+        Frame d = frame;
+        d.data = data;
+        d.width = w;
+        d.height = h;
+        d.size = w * h;
+        d.handle = NULL;
+        d.wide = NULL;
+        return d;
+    }
+
+    size_t width_;
+    size_t height_;
+    unsigned bin_;
+    uint64_t period_ns_;
+    uint64_t next_ns_;                          /* Sender only: preview due */
+    const bool crop_on_;
+    Sink preview_sink_;
+    Sink crop_sink_;
+    std::vector<uint8_t> preview_;
+    std::vector<uint8_t> crop_;
+
+    std::mutex mutex_;                          /* roi_ */
+    size_t roi_[4];
+
+    std::atomic<uint64_t> previews_;
+    std::atomic<uint64_t> crops_;
+};
+
+#endif   /* ----- #ifndef SubStreams_INC  ----- */
@@ -0,0 +1,237 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  SyntheticSource.hpp
+ *
+ *    Description:  A stand-in camera which generates frames of an "eye"
+ *    blinking on a noisy background at a configurable frame rate, in Mono8
+ *    or one of the 12/16 bit formats. Use it to
+ *    find the fps ceiling of the transport and processing path.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  SyntheticSource_INC
+#define  SyntheticSource_INC
+
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <random>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+#include "FrameSource.hpp"
+#include "PixelUnpack.hpp"
+
+class SyntheticSource : public FrameSource
+{
+public:
+    /**
+     * @brief Constructor.
+     *
+     * @param width, height Frame geometry.
+     * @param fps Frames per second. When 0, frames are generated as fast as
+     * possible.
+     * @param nbuffers Number of frame buffers. When consumer holds on to all
+     * of them, frames are dropped (just like a real camera).
+     * @param pixel_format PIXEL_FORMAT_*. The 8 bit picture is scaled to 12
+     * bit (16 for Mono16) with noise in the low bits, and packed.
+     */
+    SyntheticSource( size_t width, size_t height, double fps, size_t nbuffers = 32
+            , uint32_t pixel_format = PIXEL_FORMAT_MONO8 )
+        : width_( width ), height_( height ), fps_( fps ), format_( pixel_format )
+        , pool_( nbuffers, pixel_format_bytes( pixel_format, width * height ) )
+        , frame_id_( 0 ), dropped_( 0 )
+    {
+        if( format_ != PIXEL_FORMAT_MONO8 )
+            mono8_.resize( width * height );
+        if( format_ == PIXEL_FORMAT_MONO12P || format_ == PIXEL_FORMAT_MONO12PACKED )
+            wide_.resize( width * height );
+    }
+
+    std::string name( ) const
+    {
+        return "synthetic";
+    }
+
+    int init( )
+    {
+        // A few noisy backgrounds to cycle through so that consecutive frames
+        // are not identical.
+        std::mt19937 rng( 1987 );
+        std::normal_distribution<double> noise( 0.0, 6.0 );
+        backgrounds_.resize( num_backgrounds_ );
+        for( auto& bg : backgrounds_ )
+        {
+            bg.resize( width_ * height_ );
+            for (size_t r = 0; r < height_; r++)
+                for (size_t c = 0; c < width_; c++)
+                {
+                    double v = 140.0 + 40.0 * c / width_ + noise( rng );
+                    bg[r * width_ + c] = (unsigned char) std::min( 255.0, std::max( 0.0, v ) );
+                }
+        }
+        print_info( );
+        return 0;
+    }
+
+    int begin_acquisition( )
+    {
+        frame_id_ = 0;
+        start_ = std::chrono::steady_clock::now( );
+        return 0;
+    }
+
+    bool next_frame( Frame& frame )
+    {
+        while( true )
+        {
+            if( fps_ > 0.0 )
+            {
+                auto due = start_ + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                        std::chrono::duration<double>( frame_id_ / fps_ )
+                        );
+                std::this_thread::sleep_until( due );
+            }
+
+            uint64_t id = frame_id_++;
+            unsigned char* buf = pool_.acquire( );
+            if( ! buf )
+            {
+                // Consumer is holding every buffer. Drop this frame.
+                dropped_ += 1;
+                continue;
+            }
+
+            render( buf, id );
+            frame.data = buf;
+            frame.width = width_;
+            frame.height = height_;
+            frame.size = pool_.bufsize( );
+            frame.pixel_format = format_;
+            frame.frame_id = id;
+            frame.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now( ).time_since_epoch( )
+                    ).count( );
+            frame.host_ns = monotonic_ns( );
+            frame.incomplete = false;
+            frame.status = 0;
+            frame.handle = buf;
+            return true;
+        }
+    }
+
+    void release( Frame& frame )
+    {
+        if( frame.handle )
+            pool_.release( static_cast<unsigned char*>( frame.handle ) );
+        frame.handle = NULL;
+        frame.data = NULL;
+    }
+
+    void end_acquisition( )
+    {
+        if( dropped_ > 0 )
+            std::cout << "[WARN] Synthetic camera dropped " << dropped_
+                << " frames for lack of buffers" << std::endl;
+    }
+
+    void deinit( )
+    {
+        backgrounds_.clear( );
+    }
+
+    double frame_rate( ) const
+    {
+        return fps_;
+    }
+
+private:
+    void print_info( ) const
+    {
+        std::cout << "[INFO] Synthetic camera " << width_ << "x" << height_
+            << " " << pixel_format_name( format_ ) << " at " << (fps_ > 0 ? std::to_string( fps_ ) : "max" )
+            << " FPS" << std::endl;
+    }
+
+    /**
+     * @brief Draw a dark ellipse (eye) on one of the backgrounds. The eye
+     * closes for 100 ms every 2 seconds (of frame time) so that blink
+     * detection has something to detect.
+     */
+    void render( unsigned char* buf, uint64_t id )
+    {
+        if( format_ != PIXEL_FORMAT_MONO8 )
+        {
+            render8( &mono8_[0], id );
+            widen( buf, id );
+            return;
+        }
+        render8( buf, id );
+    }
+
+    void render8( unsigned char* buf, uint64_t id )
+    {
+        memcpy( buf, backgrounds_[id % num_backgrounds_].data( ), width_ * height_ );
+
+        double t = fps_ > 0.0 ? id / fps_ : id / 200.0;
+        double phase = t - 2.0 * (uint64_t)( t / 2.0 );
+        double open = 1.0;
+        if( phase < 0.1 )
+            open = std::abs( 1.0 - phase / 0.05 );
+
+        long cx = width_ / 2, cy = height_ / 2;
+        long a = width_ / 6;
+        long b = std::max( 1L, (long)( open * height_ / 8 ) );
+        for (long r = cy - b; r <= cy + b; r++)
+        {
+            if( r < 0 || r >= (long)height_ )
+                continue;
+            double dy = (double)( r - cy ) / b;
+            long half = (long)( a * std::sqrt( std::max( 0.0, 1.0 - dy * dy ) ) );
+            long c0 = std::max( 0L, cx - half );
+            long c1 = std::min( (long)width_ - 1, cx + half );
+            if( c1 >= c0 )
+                memset( buf + r * width_ + c0, 30, c1 - c0 + 1 );
+        }
+    }
+
+    /* mono8_ to buf in format_; low bits vary with id like sensor noise. */
+    void widen( unsigned char* buf, uint64_t id )
+    {
+        size_t n = width_ * height_;
+        if( format_ == PIXEL_FORMAT_MONO16 )
+        {
+            uint16_t* out = (uint16_t*)buf;
+            for (size_t i = 0; i < n; i++)
+                out[i] = mono8_[i] << 8 | ((i + id) * 37 & 0xF0);
+            return;
+        }
+        for (size_t i = 0; i < n; i++)
+            wide_[i] = mono8_[i] << 4 | ((i + id) * 37 & 0xF);
+        pack_mono12( &wide_[0], n, buf, format_ );
+    }
+
+    enum { num_backgrounds_ = 4 };
+
+    size_t width_;
+    size_t height_;
+    double fps_;
+    uint32_t format_;
+    BufferPool pool_;
+    std::vector<unsigned char> mono8_;          /* Frame before widen( ) */
+    std::vector<uint16_t> wide_;
+    std::vector< std::vector<unsigned char> > backgrounds_;
+
+    uint64_t frame_id_;
+    uint64_t dropped_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+#endif   /* ----- #ifndef SyntheticSource_INC  ----- */
@@ -0,0 +1,143 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  TaskPool.hpp
+ *
+ *    Description:  A fixed set of threads which run fn( 0 ) ... fn( n - 1 )
+ *    of one job at a time; the calling thread works too and run( ) returns
+ *    when all n are done. Tasks are handed out with an atomic counter, so a
+ *    thread which finishes early takes the next one.
+ *
+ *    Meant for splitting one frame into tiles: a job is a few hundred
+ *    microseconds, waking the threads costs a few microseconds.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  TaskPool_INC
+#define  TaskPool_INC
+
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+
+class TaskPool
+{
+public:
+    typedef std::function<void( size_t )> Task;
+
+    /**
+     * @brief Constructor.
+     *
+     * @param threads Threads working on a job including the caller of run( );
+     * 0 for one per core.
+     */
+    TaskPool( size_t threads = 0 )
+        : task_( NULL ), ntasks_( 0 ), next_( 0 ), busy_( 0 ), job_( 0 ), quit_( false )
+    {
+        if( threads == 0 )
+            threads = std::max( std::thread::hardware_concurrency( ), 1u );
+        for (size_t i = 1; i < threads; i++)
+            workers_.push_back( std::thread( &TaskPool::work_loop, this ) );
+    }
+
+    TaskPool( const TaskPool& ) = delete;
+    TaskPool& operator=( const TaskPool& ) = delete;
+
+    ~TaskPool( )
+    {
+        {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            quit_ = true;
+        }
+        start_.notify_all( );
+        for( auto& t : workers_ )
+            t.join( );
+    }
+
+    size_t threads( ) const
+    {
+        return workers_.size( ) + 1;
+    }
+
+    /**
+     * @brief Run task( i ) for i in [0, n) and wait for all of them.
+     */
+    void run( size_t n, const Task& task )
+    {
+        if( workers_.empty( ) || n == 1 )
+        {
+            for (size_t i = 0; i < n; i++)
+                task( i );
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            task_ = &task;
+            ntasks_ = n;
+            next_ = 0;
+            busy_ = workers_.size( );
+            job_ += 1;
+        }
+        start_.notify_all( );
+
+        run_tasks( );
+
+        std::unique_lock<std::mutex> lock( mutex_ );
+        done_.wait( lock, [this] { return busy_ == 0; } );
+        task_ = NULL;
+    }
+
+private:
+    void run_tasks( )
+    {
+        size_t i;
+        while( (i = next_++) < ntasks_ )
+            (*task_)( i );
+    }
+
+    void work_loop( )
+    {
+        uint64_t seen = 0;
+        while( true )
+        {
+            {
+                std::unique_lock<std::mutex> lock( mutex_ );
+                start_.wait( lock, [&] { return quit_ || job_ != seen; } );
+                if( quit_ )
+                    return;
+                seen = job_;
+            }
+
+            run_tasks( );
+
+            std::lock_guard<std::mutex> lock( mutex_ );
+            if( --busy_ == 0 )
+                done_.notify_one( );
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable start_;
+    std::condition_variable done_;
+
+    const Task* task_;
+    size_t ntasks_;
+    std::atomic<size_t> next_;
+    size_t busy_;
+    uint64_t job_;
+    bool quit_;
+};
+
+#endif   /* ----- #ifndef TaskPool_INC  ----- */
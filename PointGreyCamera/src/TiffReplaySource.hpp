@@ -0,0 +1,286 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  TiffReplaySource.hpp
+ *
+ *    Description:  A stand-in camera which replays recorded trial_%03d.tif
+ *    stacks. The first row of recorded frames carries metadata written by
+ *    camera_arduino_client.py; it is stripped before frames are handed out.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  TiffReplaySource_INC
+#define  TiffReplaySource_INC
+
+#include <tiffio.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <regex>
+#include <utility>
+
+#include "FrameSource.hpp"
+
+class TiffReplaySource : public FrameSource
+{
+public:
+    /**
+     * @brief Constructor.
+     *
+     * @param path Either a single tiff file or a directory of trial_%03d.tif
+     * files. Trials are replayed in the order of their index.
+     * @param width, height Geometry of frames without the metadata row.
+     * @param fps Replay rate. When 0, frames are replayed as fast as possible.
+     * @param loop Start again from first trial when all trials are replayed.
+     */
+    TiffReplaySource( const std::string& path, size_t width, size_t height
+            , double fps, bool loop = true, size_t nbuffers = 32 )
+        : path_( path ), width_( width ), height_( height ), fps_( fps )
+        , loop_( loop ), pool_( nbuffers, width * height )
+        , file_index_( 0 ), page_index_( 0 ), frame_id_( 0 ), dropped_( 0 )
+    { }
+
+    std::string name( ) const
+    {
+        return "tiff-replay";
+    }
+
+    int init( )
+    {
+        struct stat st;
+        if( stat( path_.c_str( ), &st ) != 0 )
+        {
+            std::cout << "[ERROR] Can't access " << path_ << std::endl;
+            return -1;
+        }
+
+        if( S_ISDIR( st.st_mode ) )
+            list_trials( );
+        else
+            files_.push_back( path_ );
+
+        if( files_.empty( ) )
+        {
+            std::cout << "[ERROR] No trial_*.tif found in " << path_ << std::endl;
+            return -1;
+        }
+
+        std::cout << "[INFO] Replaying " << files_.size( ) << " file(s) from "
+            << path_ << std::endl;
+        return 0;
+    }
+
+    int begin_acquisition( )
+    {
+        file_index_ = 0;
+        page_index_ = 0;
+        pages_.clear( );
+        frame_id_ = 0;
+        start_ = std::chrono::steady_clock::now( );
+        return 0;
+    }
+
+    bool next_frame( Frame& frame )
+    {
+        while( true )
+        {
+            if( page_index_ >= pages_.size( ) )
+                if( ! load_next_file( ) )
+                    return false;
+
+            if( fps_ > 0.0 )
+            {
+                auto due = start_ + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                        std::chrono::duration<double>( frame_id_ / fps_ )
+                        );
+                std::this_thread::sleep_until( due );
+            }
+
+            const std::vector<unsigned char>& page = pages_[page_index_++];
+            uint64_t id = frame_id_++;
+            unsigned char* buf = pool_.acquire( );
+            if( ! buf )
+            {
+                dropped_ += 1;
+                continue;
+            }
+
+            memcpy( buf, page.data( ), width_ * height_ );
+            frame.data = buf;
+            frame.width = width_;
+            frame.height = height_;
+            frame.size = width_ * height_;
+            frame.frame_id = id;
+            frame.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now( ).time_since_epoch( )
+                    ).count( );
+            frame.host_ns = monotonic_ns( );
+            frame.incomplete = false;
+            frame.status = 0;
+            frame.handle = buf;
+            return true;
+        }
+    }
+
+    void release( Frame& frame )
+    {
+        if( frame.handle )
+            pool_.release( static_cast<unsigned char*>( frame.handle ) );
+        frame.handle = NULL;
+        frame.data = NULL;
+    }
+
+    void end_acquisition( )
+    {
+        if( dropped_ > 0 )
+            std::cout << "[WARN] Replay dropped " << dropped_
+                << " frames for lack of buffers" << std::endl;
+    }
+
+    void deinit( )
+    {
+        pages_.clear( );
+        files_.clear( );
+    }
+
+    double frame_rate( ) const
+    {
+        return fps_;
+    }
+
+private:
+
+    /**
+     * @brief Collect trial_%03d.tif files in directory sorted by trial index.
+     * trial_-01.tif (frames dumped on overflow) sorts first.
+     */
+    void list_trials( )
+    {
+        std::regex re( "trial_(-?[0-9]+)\\.tif" );
+        std::vector< std::pair<int, std::string> > trials;
+
+        DIR* dir = opendir( path_.c_str( ) );
+        if( ! dir )
+            return;
+        struct dirent* ent;
+        while( (ent = readdir( dir )) != NULL )
+        {
+            std::cmatch m;
+            if( std::regex_match( ent->d_name, m, re ) )
+                trials.push_back( std::make_pair( std::stoi( m[1].str( ) )
+                            , path_ + "/" + ent->d_name )
+                        );
+        }
+        closedir( dir );
+
+        std::sort( trials.begin( ), trials.end( ) );
+        for( auto& t : trials )
+            files_.push_back( t.second );
+    }
+
+    /**
+     * @brief Read all pages of the next file into memory.
+     *
+     * @return false when there are no more files to replay.
+     */
+    bool load_next_file( )
+    {
+        while( true )
+        {
+            if( file_index_ >= files_.size( ) )
+            {
+                // Stop at the end unless looping over files which had at
+                // least one usable frame.
+                if( ! loop_ || ! any_loaded_ )
+                    return false;
+                file_index_ = 0;
+            }
+
+            pages_.clear( );
+            page_index_ = 0;
+            read_pages( files_[file_index_++] );
+            if( ! pages_.empty( ) )
+                return true;
+        }
+    }
+
+    void read_pages( const std::string& filename )
+    {
+        ::TIFF* tif = TIFFOpen( filename.c_str( ), "r" );
+        if( ! tif )
+        {
+            std::cout << "[WARN] Failed to open " << filename << std::endl;
+            return;
+        }
+
+        do
+        {
+            uint32_t w = 0, h = 0;
+            uint16_t bps = 8, spp = 1;
+            TIFFGetField( tif, TIFFTAG_IMAGEWIDTH, &w );
+            TIFFGetField( tif, TIFFTAG_IMAGELENGTH, &h );
+            TIFFGetFieldDefaulted( tif, TIFFTAG_BITSPERSAMPLE, &bps );
+            TIFFGetFieldDefaulted( tif, TIFFTAG_SAMPLESPERPIXEL, &spp );
+
+            if( bps != 8 || spp != 1 || w != width_ || h < height_ )
+            {
+                std::cout << "[WARN] " << filename << ": page " << w << "x" << h
+                    << " (" << bps << " bits) does not match " << width_ << "x"
+                    << height_ << " Mono8. Skipping file." << std::endl;
+                pages_.clear( );
+                break;
+            }
+
+            // Recorded frames have metadata in the first (h - height_) rows.
+            uint32_t skip = h - height_;
+            std::vector<unsigned char> page( width_ * height_ );
+            std::vector<unsigned char> line( TIFFScanlineSize( tif ) );
+            bool ok = true;
+            for (uint32_t row = 0; row < h; row++)
+            {
+                if( TIFFReadScanline( tif, line.data( ), row, 0 ) < 0 )
+                {
+                    ok = false;
+                    break;
+                }
+                if( row >= skip )
+                    memcpy( &page[(row - skip) * width_], line.data( ), width_ );
+            }
+            if( ok )
+                pages_.push_back( std::move( page ) );
+        } while( TIFFReadDirectory( tif ) );
+
+        TIFFClose( tif );
+        if( ! pages_.empty( ) )
+            any_loaded_ = true;
+    }
+
+    std::string path_;
+    size_t width_;
+    size_t height_;
+    double fps_;
+    bool loop_;
+    BufferPool pool_;
+
+    std::vector<std::string> files_;
+    std::vector< std::vector<unsigned char> > pages_;
+    size_t file_index_;
+    size_t page_index_;
+    bool any_loaded_ = false;
+
+    uint64_t frame_id_;
+    uint64_t dropped_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+#endif   /* ----- #ifndef TiffReplaySource_INC  ----- */
@@ -3,7 +3,10 @@
  *
  *       Filename:  TiffWriter.hpp
  *
- *    Description:  A class to write tiff files.
+ *    Description:  A class to write multi-page tiff files. All pages have the
+ *    same geometry, so tags and strip layout are set up once and every page is
+ *    written with one TIFFWriteEncodedStrip call per strip (no per-scanline
+ *    calls, no compression).
  *
  *        Version:  1.0
  *        Created:  Saturday 03 December 2016 10:31:34  IST
@@ -16,62 +19,113 @@
  * =====================================================================================
  */
 
+#ifndef  TiffWriter_INC
+#define  TiffWriter_INC
+
 #include <string>
+#include <algorithm>
 #include <tiffio.h>
- 
-class TiffWriter
+
+#include "PageWriter.hpp"
+
+class TiffWriter : public PageWriter
 {
 public:
-    TiffWriter(std::string filename, bool multiPage);
-    TiffWriter(const TiffWriter&) = delete;
-    TiffWriter& operator=(const TiffWriter&) = delete;
-    ~TiffWriter();
-     
-    void write(const unsigned char* buffer, int width, int height);
- 
-private:
-    TIFF* tiff;
-    bool multiPage;
-    unsigned int page;
-};
- 
-TiffWriter::TiffWriter(std::string filename, bool multiPage) : page(0), multiPage(multiPage)
-{
-    tiff = TIFFOpen(filename.c_str(), "w");
-}
- 
-void TiffWriter::write(const unsigned char* buffer, int width, int height)
-{
-    if (multiPage) {
+    /**
+     * @brief Constructor.
+     *
+     * @param filename
+     * @param width, height Geometry of every page.
+     * @param bigtiff Write BigTIFF, which has no 4 GB limit. Long trials at
+     * full frame rate go past it.
+     * @param rows_per_strip 0 for one strip per page.
+     * @param bits 8 or 16 bits per pixel; 16 bit pages are native endian.
+     */
+    TiffWriter( const std::string& filename, size_t width, size_t height
+            , bool bigtiff = true, size_t rows_per_strip = 0, unsigned bits = 8 )
+        : filename_( filename ), width_( width ), height_( height ), bits_( bits )
+        , rows_per_strip_( rows_per_strip ? rows_per_strip : height ), page_( 0 )
+    {
+        tiff_ = TIFFOpen( filename.c_str( ), bigtiff ? "w8" : "w" );
+    }
+
+    TiffWriter( const TiffWriter& ) = delete;
+    TiffWriter& operator=( const TiffWriter& ) = delete;
+
+    ~TiffWriter( )
+    {
+        if( tiff_ )
+            TIFFClose( tiff_ );
+    }
+
+    bool is_open( ) const
+    {
+        return tiff_ != NULL;
+    }
+
+    /**
+     * @brief Append a page.
+     *
+     * @param buffer width x height pixels (uint16_t if 16 bit).
+     *
+     * @return false on write error.
+     */
+    bool write( const unsigned char* buffer )
+    {
+        if( ! tiff_ )
+            return false;
+
         /*
          * I seriously don't know if this is supposed to be supported by the format,
          * but it's the only we way can write the page number without knowing the
          * final number of pages in advance.
          */
-        TIFFSetField(tiff, TIFFTAG_PAGENUMBER, page, page);
-        TIFFSetField(tiff, TIFFTAG_SUBFILETYPE, FILETYPE_PAGE);
+        TIFFSetField( tiff_, TIFFTAG_PAGENUMBER, page_, page_ );
+        TIFFSetField( tiff_, TIFFTAG_SUBFILETYPE, FILETYPE_PAGE );
+        TIFFSetField( tiff_, TIFFTAG_IMAGEWIDTH, (uint32_t)width_ );
+        TIFFSetField( tiff_, TIFFTAG_IMAGELENGTH, (uint32_t)height_ );
+        TIFFSetField( tiff_, TIFFTAG_BITSPERSAMPLE, bits_ );
+        TIFFSetField( tiff_, TIFFTAG_SAMPLESPERPIXEL, 1 );
+        TIFFSetField( tiff_, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT );
+        TIFFSetField( tiff_, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK );
+        TIFFSetField( tiff_, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG );
+        TIFFSetField( tiff_, TIFFTAG_COMPRESSION, COMPRESSION_NONE );
+        TIFFSetField( tiff_, TIFFTAG_ROWSPERSTRIP, (uint32_t)rows_per_strip_ );
+
+        size_t strips = (height_ + rows_per_strip_ - 1) / rows_per_strip_;
+        size_t rowBytes = width_ * bits_ / 8;
+        for (size_t s = 0; s < strips; s++)
+        {
+            size_t rows = std::min( rows_per_strip_, height_ - s * rows_per_strip_ );
+            unsigned char* strip = const_cast<unsigned char*>( buffer ) + s * rows_per_strip_ * rowBytes;
+            if( TIFFWriteEncodedStrip( tiff_, s, strip, rows * rowBytes ) < 0 )
+                return false;
+        }
+
+        if( ! TIFFWriteDirectory( tiff_ ) )
+            return false;
+        page_++;
+        return true;
     }
-    TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
-    TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, width);
-    TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, height);
-    TIFFSetField(tiff, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT);
-    TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(tiff, (unsigned int) - 1));
- 
-    unsigned int samples_per_pixel = 1;
-    unsigned int bits_per_sample = 8;
-    TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, bits_per_sample);
-    TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, samples_per_pixel);
- 
-    std::size_t stride = width;
-    for (unsigned int y = 0; y < height; ++y) {
-        TIFFWriteScanline(tiff, buf + y * stride, y, 0);
+
+    size_t pages( ) const
+    {
+        return page_;
     }
- 
-    TIFFWriteDirectory(tiff);
-    page++;
-}
- 
-TiffWriter::~TiffWriter()
-{
-    TIFFClose(tiff);
-}
+
+    const std::string& filename( ) const
+    {
+        return filename_;
+    }
+
+private:
+    ::TIFF* tiff_;
+    std::string filename_;
+    size_t width_;
+    size_t height_;
+    unsigned bits_;
+    size_t rows_per_strip_;
+    unsigned int page_;
+};
+
+#endif   /* ----- #ifndef TiffWriter_INC  ----- */
@@ -0,0 +1,232 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  Treadmill.hpp
+ *
+ *    Description:  Motion of the treadmill, read from the mouse under it by
+ *    mouse_server (src/mouse_server.cc).
+ *
+ *    MouseReports turns the input events of the mouse (evdev) into reports:
+ *    dx, dy between two SYN_REPORT and the time the kernel stamped them.
+ *    MotionEstimator keeps speed and direction over the last window_ns of
+ *    reports; every report or expiry updates it in O(1).
+ *
+ *    The latest TreadmillSample is published in a one slot shared memory
+ *    segment (ShmLatest.hpp). Python reads it with treadmill_client.py.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  Treadmill_INC
+#define  Treadmill_INC
+
+#include <linux/input.h>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <stdexcept>
+
+#include "ShmLatest.hpp"
+
+#define TREADMILL_MAGIC     0x4d444254          /* "TBDM" */
+#define TREADMILL_VERSION   1
+
+/* What the mouse moved in one report and the estimate after it. Also what
+ * mouse_server streams on its socket, one after another. */
+struct TreadmillSample
+{
+    uint64_t host_ns;                           /* CLOCK_MONOTONIC of the report (kernel stamp). */
+    int32_t dx;                                 /* Counts in this report; 0 when */
+    int32_t dy;                                 /* only the window moved on. */
+    int64_t x;                                  /* Counts since mouse_server started. */
+    int64_t y;
+    float speed;                                /* Counts/s over the window. */
+    float direction;                            /* Of net motion over the window, radians. */
+    uint64_t reports;                           /* Reports so far. */
+};
+
+static_assert( sizeof( TreadmillSample ) == 48, "TreadmillSample must be 48 bytes" );
+
+typedef ShmLatest<TreadmillSample> TreadmillShm;
+
+static_assert( offsetof( TreadmillShm, value ) == 32, "treadmill_client.py expects sample at 32" );
+
+/**
+ * @brief dx, dy of the mouse between two SYN_REPORT events.
+ */
+class MouseReports
+{
+public:
+    MouseReports( ) : dx_( 0 ), dy_( 0 ), dropped_( 0 ), syncing_( false )
+    { }
+
+    /**
+     * @brief Take one event.
+     *
+     * @return True when ev completes a report with motion in it; dx, dy and
+     * t_ns (the event time, in whatever clock the device stamps with) are
+     * set.
+     */
+    bool feed( const struct input_event& ev, int& dx, int& dy, uint64_t& t_ns )
+    {
+        if( ev.type == EV_REL && ! syncing_ )
+        {
+            if( ev.code == REL_X )
+                dx_ += ev.value;
+            else if( ev.code == REL_Y )
+                dy_ -= ev.value;                /* Up is +, as /dev/input/mouseN gives it */
+            return false;
+        }
+        if( ev.type != EV_SYN )
+            return false;
+
+        if( ev.code == SYN_DROPPED )
+        {
+            // Kernel buffer overflowed: drop everything up to next report.
+            dropped_ += 1;
+            syncing_ = true;
+            dx_ = dy_ = 0;
+            return false;
+        }
+        if( ev.code != SYN_REPORT )
+            return false;
+        if( syncing_ )
+        {
+            syncing_ = false;
+            return false;
+        }
+        if( dx_ == 0 && dy_ == 0 )
+            return false;
+        dx = dx_;
+        dy = dy_;
+        t_ns = (uint64_t)ev.time.tv_sec * 1000000000ull + (uint64_t)ev.time.tv_usec * 1000;
+        dx_ = dy_ = 0;
+        return true;
+    }
+
+    /* Times the kernel dropped events (SYN_DROPPED). */
+    uint64_t dropped( ) const
+    {
+        return dropped_;
+    }
+
+private:
+    int dx_, dy_;
+    uint64_t dropped_;
+    bool syncing_;
+};
+
+/**
+ * @brief Speed and direction over a sliding window of reports, kept as
+ * running sums: each report is added once and taken out once when it leaves
+ * the window.
+ *
+ * Speed is the distance the mouse went (sum of |(dx, dy)| of reports) over
+ * window; direction is that of the net motion.
+ */
+class MotionEstimator
+{
+public:
+    MotionEstimator( uint64_t window_ns ) : window_ns_( window_ns )
+                                           , sx_( 0 ), sy_( 0 ), path_( 0 )
+    {
+        if( window_ns_ == 0 )
+            throw std::invalid_argument( "MotionEstimator: window must be > 0" );
+    }
+
+    /* Report at t_ns; reports come in time order. */
+    void add( uint64_t t_ns, int dx, int dy )
+    {
+        Report r = { t_ns, dx, dy, std::sqrt( (double)dx * dx + (double)dy * dy ) };
+        reports_.push_back( r );
+        sx_ += dx;
+        sy_ += dy;
+        path_ += r.distance;
+        expire( t_ns );
+    }
+
+    /**
+     * @brief Drop reports older than window before now_ns.
+     *
+     * @return True if any was dropped (estimate changed).
+     */
+    bool expire( uint64_t now_ns )
+    {
+        bool changed = false;
+        while( ! reports_.empty( ) && reports_.front( ).t_ns + window_ns_ <= now_ns )
+        {
+            const Report& r = reports_.front( );
+            sx_ -= r.dx;
+            sy_ -= r.dy;
+            path_ -= r.distance;
+            reports_.pop_front( );
+            changed = true;
+        }
+        // Don't let rounding of add/subtract pile up.
+        if( reports_.empty( ) )
+            path_ = 0;
+        return changed;
+    }
+
+    /* Counts per second. */
+    double speed( ) const
+    {
+        return path_ * 1e9 / window_ns_;
+    }
+
+    /* Radians, atan2 of net motion; 0 when still. */
+    double direction( ) const
+    {
+        return (sx_ == 0 && sy_ == 0) ? 0.0 : std::atan2( (double)sy_, (double)sx_ );
+    }
+
+    bool idle( ) const
+    {
+        return reports_.empty( );
+    }
+
+    uint64_t window_ns( ) const
+    {
+        return window_ns_;
+    }
+
+private:
+    struct Report
+    {
+        uint64_t t_ns;
+        int dx, dy;
+        double distance;
+    };
+
+    uint64_t window_ns_;
+    std::deque<Report> reports_;
+    int64_t sx_, sy_;
+    double path_;
+};
+
+/**
+ * @brief Publishes the latest sample; readers learn window_ms from the slot.
+ */
+class TreadmillWriter : public ShmLatestWriter<TreadmillSample>
+{
+public:
+    TreadmillWriter( const std::string& name, unsigned window_ms )
+        : ShmLatestWriter<TreadmillSample>( name, TREADMILL_MAGIC, TREADMILL_VERSION, window_ms )
+    { }
+};
+
+class TreadmillReader : public ShmLatestReader<TreadmillSample>
+{
+public:
+    TreadmillReader( const std::string& name )
+        : ShmLatestReader<TreadmillSample>( name, TREADMILL_MAGIC, TREADMILL_VERSION )
+    { }
+};
+
+#endif   /* ----- #ifndef Treadmill_INC  ----- */
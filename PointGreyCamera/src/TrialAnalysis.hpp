@@ -0,0 +1,429 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  TrialAnalysis.hpp
+ *
+ *    Description:  What analysis/analyze_trial_video.py gets out of one
+ *    trial_%03d.tif, natively: blink trace from the text row of every page,
+ *    CS+, PUFF and PROB time slices from the arduino fields in it, and
+ *    whether the animal learnt (blink in the 300 ms after CS+ onset away from
+ *    the 200 ms before it by more than a threshold).
+ *
+ *    Only the text row of a page is read, unless the blink signal is
+ *    recomputed on an ROI; then the ROI rows too (BlinkDetector.hpp, the
+ *    metric of blinky.py). Uncompressed strips are read in pieces of a few
+ *    kB by libtiff, so the rest of the frame stays on disk.
+ *
+ *    Rows are those of camera_arduino_client.py,
+ *
+ *      frame isotime,line isotime,arduino fields...,mouse,blink
+ *
+ *    or of cam_server, "frame_id,camera_ns,blink," before such a row. Rows
+ *    of cam_server without one (pre-roll, or no client) have no arduino
+ *    fields and are on the camera clock; like python, a trial uses them only
+ *    when it has no other rows.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  TrialAnalysis_INC
+#define  TrialAnalysis_INC
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include <memory>
+
+#include <tiffio.h>
+
+#include "BlinkDetector.hpp"
+
+/* Time of trial events which did not happen. */
+const int64_t TRIAL_NO_TIME = std::numeric_limits<int64_t>::min( );
+
+/**
+ * @brief ns since 1970 of a naive ISO time as strptime( s,
+ * "%Y-%m-%dT%H:%M:%S.%f" ) takes it: the whole field, 1 to 6 fraction
+ * digits. Time zone is ignored; only differences matter. TRIAL_NO_TIME if
+ * strptime would fail.
+ */
+inline int64_t parse_iso_time( const std::string& s )
+{
+    int y, mo, d, h, mi, sec, n = 0;
+    if( sscanf( s.c_str( ), "%4d-%2d-%2dT%2d:%2d:%2d.%n", &y, &mo, &d, &h, &mi, &sec, &n ) != 6
+            || n == 0 || s[n - 1] != '.' )
+        return TRIAL_NO_TIME;
+    size_t digits = s.size( ) - n;
+    if( digits < 1 || digits > 6 || s.find_first_not_of( "0123456789", n ) != std::string::npos )
+        return TRIAL_NO_TIME;
+    if( mo < 1 || mo > 12 || d < 1 || d > 31 || h > 23 || mi > 59 || sec > 61 )
+        return TRIAL_NO_TIME;
+
+    // Days since 1970-01-01 of the civil date (proleptic Gregorian).
+    y -= mo <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int64_t yoe = y - era * 400;
+    int64_t doy = (153 * (mo + (mo > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int64_t days = era * 146097 + doe - 719468;
+
+    int64_t us = atol( s.c_str( ) + n );
+    for (size_t i = digits; i < 6; i++)
+        us *= 10;
+    return ((days * 24 + h) * 60 + mi) * 60000000000ll + sec * 1000000000ll + us * 1000;
+}
+
+/* float( s ) of python: the whole field, spaces around allowed. */
+inline bool parse_float( const std::string& s, double& v )
+{
+    const char* p = s.c_str( );
+    char* end = NULL;
+    v = strtod( p, &end );
+    if( end == p )
+        return false;
+    while( *end == ' ' || *end == '\t' )
+        end++;
+    return *end == '\0';
+}
+
+inline std::vector<std::string> split_fields( const std::string& s, char sep = ',' )
+{
+    std::vector<std::string> fields;
+    size_t start = 0;
+    while( true )
+    {
+        size_t at = s.find( sep, start );
+        fields.push_back( s.substr( start, at == std::string::npos ? at : at - start ) );
+        if( at == std::string::npos )
+            return fields;
+        start = at + 1;
+    }
+}
+
+/* Text row of a page, without trailing spaces (and NULs of short rows). */
+inline std::string row_text( const uint8_t* row, size_t n )
+{
+    std::string text( (const char*)row, n );
+    size_t end = text.find_last_not_of( std::string( " \t\r\n\0", 5 ) );
+    text.erase( end == std::string::npos ? 0 : end + 1 );
+    return text;
+}
+
+/**
+ * @brief One frame of a trial which had a time and a blink value.
+ */
+struct TrialSample
+{
+    int64_t ns;
+    double blink;
+    double speed;                               /* NAN if the row has none */
+};
+
+/**
+ * @brief Everything analyze_trial_video.process( ) puts in its pickle, and
+ * a few counters.
+ */
+struct TrialResult
+{
+    std::string file;
+    size_t pages;
+    std::vector<TrialSample> samples;
+    int64_t cs[2];                              /* CS+ first, last; or TRIAL_NO_TIME */
+    int64_t us[2];                              /* PUFF */
+    int64_t probe[2];                           /* PROB */
+    bool probe_trial;
+    bool learnt;
+    double blink_mean, blink_min, blink_max;
+
+    TrialResult( )
+        : pages( 0 ), probe_trial( false ), learnt( false )
+        , blink_mean( NAN ), blink_min( NAN ), blink_max( NAN )
+    {
+        cs[0] = cs[1] = us[0] = us[1] = probe[0] = probe[1] = TRIAL_NO_TIME;
+    }
+};
+
+/**
+ * @brief Rows of a trial to its result, the way analyze_trial_video.py does
+ * it, with two differences. A row counts when both its time and blink parse
+ * (python keeps the time of a row whose blink does not, and the two lists
+ * go out of step). The mouse field "(isotime:speed)" of
+ * camera_arduino_client.py gives the speed (python does float( ) on it and
+ * keeps none).
+ */
+class TrialAnalyzer
+{
+public:
+    /**
+     * @param threshold Learnt if some |blink - baseline mean| after CS+ is
+     * above (analysis/config.py thres_).
+     */
+    TrialAnalyzer( double threshold = 80 )
+        : threshold_( threshold )
+    { }
+
+    /* Add the text row of the next page; blink < 0 takes it from the row. */
+    void add_row( const std::string& text, double blink = -1 )
+    {
+        result_.pages += 1;
+        std::vector<std::string> f = split_fields( text );
+
+        // cam_server row: frame_id,camera_ns,blink,client row.
+        bool server = f.size( ) >= 3 && ! f[0].empty( )
+            && f[0].find_first_not_of( "0123456789" ) == std::string::npos;
+        int64_t serverNs = TRIAL_NO_TIME;
+        double serverBlink = -1;
+        if( server )
+        {
+            serverNs = strtoll( f[1].c_str( ), NULL, 10 );
+            if( ! parse_float( f[2], serverBlink ) )
+                serverBlink = -1;
+            f.erase( f.begin( ), f.begin( ) + 3 );
+            if( f.empty( ) || parse_iso_time( f[0] ) == TRIAL_NO_TIME )
+            {
+                if( serverBlink >= 0 || blink >= 0 )
+                    server_.push_back( TrialSample{ serverNs
+                            , blink >= 0 ? blink : serverBlink, NAN } );
+                return;
+            }
+        }
+
+        if( f.size( ) > 2 )
+            arduino_.push_back( f );
+        if( f.size( ) < 2 )
+            return;
+
+        TrialSample s = { parse_iso_time( f[0] ), blink, NAN };
+        if( s.ns == TRIAL_NO_TIME || (blink < 0 && ! parse_float( f.back( ), s.blink )) )
+            return;
+        if( ! parse_float( f[f.size( ) - 2], s.speed ) )
+        {
+            const std::string& m = f[f.size( ) - 2];
+            size_t colon = m.rfind( ':' );
+            if( m.size( ) > 2 && m[0] == '(' && m.back( ) == ')' && colon != std::string::npos )
+                if( ! parse_float( m.substr( colon + 1, m.size( ) - colon - 2 ), s.speed ) )
+                    s.speed = NAN;
+        }
+        result_.samples.push_back( s );
+    }
+
+    /* Slices, learning and blink stats; call once after the last row. */
+    const TrialResult& finish( )
+    {
+        // Rows on the camera clock only if there are no others to mix with.
+        if( result_.samples.empty( ) )
+            result_.samples.swap( server_ );
+        const std::vector<TrialSample>& s = result_.samples;
+        if( ! s.empty( ) )
+        {
+            double sum = 0;
+            result_.blink_min = result_.blink_max = s[0].blink;
+            for( auto& x : s )
+            {
+                sum += x.blink;
+                result_.blink_min = std::min( result_.blink_min, x.blink );
+                result_.blink_max = std::max( result_.blink_max, x.blink );
+            }
+            result_.blink_mean = sum / s.size( );
+        }
+
+        status_slice( "CS+", result_.cs );
+        status_slice( "PUFF", result_.us );
+        status_slice( "PROB", result_.probe );
+        result_.probe_trial = result_.probe[0] != TRIAL_NO_TIME;
+        result_.learnt = learnt( );
+        return result_;
+    }
+
+    TrialResult& result( )
+    {
+        return result_;
+    }
+
+private:
+    /* First and last time (field 1) of rows with a field status; python
+     * wants more than two of them. */
+    void status_slice( const std::string& status, int64_t slice[2] )
+    {
+        std::vector<const std::vector<std::string>*> rows;
+        for( auto& f : arduino_ )
+            if( std::find( f.begin( ), f.end( ), status ) != f.end( ) )
+                rows.push_back( &f );
+        if( rows.size( ) <= 2 )
+            return;
+        int64_t t0 = parse_iso_time( (*rows.front( ))[1] );
+        int64_t t1 = parse_iso_time( (*rows.back( ))[1] );
+        if( t0 != TRIAL_NO_TIME && t1 != TRIAL_NO_TIME )
+        {
+            slice[0] = t0;
+            slice[1] = t1;
+        }
+    }
+
+    /* compute_learning_yesno( ): baseline (-200, 0] ms, signal (0, 300] ms of CS+ onset. */
+    bool learnt( ) const
+    {
+        if( result_.cs[0] == TRIAL_NO_TIME )
+            return false;
+        double base = 0;
+        size_t nbase = 0;
+        std::vector<double> signal;
+        for( auto& x : result_.samples )
+        {
+            int64_t dt = x.ns - result_.cs[0];
+            if( dt > -200000000ll && dt <= 0 )
+            {
+                base += x.blink;
+                nbase += 1;
+            }
+            else if( dt > 0 && dt <= 300000000ll )
+                signal.push_back( x.blink );
+        }
+        if( nbase == 0 || signal.empty( ) )
+            return false;
+        base /= nbase;
+        for( double v : signal )
+            if( std::fabs( v - base ) > threshold_ )
+                return true;
+        return false;
+    }
+
+    double threshold_;
+    TrialResult result_;
+    std::vector<std::vector<std::string> > arduino_;
+    std::vector<TrialSample> server_;           /* Rows of cam_server alone */
+};
+
+/**
+ * @brief Analyze one trial tiff.
+ *
+ * @param roi Recompute blink on x0, y0, x1, y1 of the frame (below the text
+ * row) with BlinkDetector; NULL to take it from the rows.
+ * @param error Set when the file can't be read, or when the blink of some
+ * pages could not be recomputed (not W x (H + 1) 8 bit, e.g. --record-raw);
+ * those take it from their rows.
+ */
+template< size_t W, size_t H >
+TrialResult analyze_tiff( const std::string& filename, const size_t* roi, double threshold
+        , std::string& error )
+{
+    TrialAnalyzer analyzer( threshold );
+    analyzer.result( ).file = filename;
+    ::TIFF* tif = TIFFOpen( filename.c_str( ), "r" );
+    if( ! tif )
+    {
+        error = "can't open " + filename;
+        return analyzer.finish( );
+    }
+
+    std::unique_ptr<BlinkDetector<W, H> > blink;
+    if( roi )
+        blink.reset( new BlinkDetector<W, H>( roi[0], roi[1], roi[2], roi[3] ) );
+    std::vector<uint8_t> row( TIFFScanlineSize( tif ) ), frame( roi ? W * H : 0 );
+    size_t fromRows = 0;                        /* Pages ROI blink was not computed on */
+    do
+    {
+        uint32_t w = 0, h = 0;
+        uint16_t bits = 8;
+        TIFFGetField( tif, TIFFTAG_IMAGEWIDTH, &w );
+        TIFFGetField( tif, TIFFTAG_IMAGELENGTH, &h );
+        TIFFGetField( tif, TIFFTAG_BITSPERSAMPLE, &bits );
+        row.resize( std::max( row.size( ), (size_t)TIFFScanlineSize( tif ) ) );
+        if( h == 0 || TIFFReadScanline( tif, &row[0], 0, 0 ) < 0 )
+        {
+            error = "can't read page " + std::to_string( analyzer.result( ).pages ) + " of " + filename;
+            break;
+        }
+        std::string text = row_text( &row[0], TIFFScanlineSize( tif ) );
+
+        double value = -1;
+        if( blink && w == W && h == H + 1 && bits == 8 )
+        {
+            // Only the ROI rows, in order; the rest are never decoded.
+            bool ok = true;
+            for (size_t y = roi[1]; y < std::min( roi[3], H ) && ok; y++)
+                ok = TIFFReadScanline( tif, &frame[y * W], y + 1, 0 ) >= 0;
+            if( ok )
+                value = blink->process( &frame[0] );
+            else
+                fromRows += 1;
+        }
+        else if( blink )
+            fromRows += 1;
+        analyzer.add_row( text, value );
+    } while( TIFFReadDirectory( tif ) );
+    TIFFClose( tif );
+    if( fromRows > 0 && error.empty( ) )
+        error = std::to_string( fromRows ) + " of " + std::to_string( analyzer.result( ).pages )
+            + " pages of " + filename + " are not " + std::to_string( W ) + "x"
+            + std::to_string( H + 1 ) + " 8 bit or unreadable; their blink is from the text row";
+    return analyzer.finish( );
+}
+
+/* ms of ns after origin, or "" for no time. */
+inline std::string trial_ms( int64_t ns, int64_t origin )
+{
+    if( ns == TRIAL_NO_TIME )
+        return "";
+    char buf[32];
+    snprintf( buf, sizeof( buf ), "%.3f", (ns - origin) / 1e6 );
+    return buf;
+}
+
+/* Header and fields of a summary row; see summary_row( ). */
+inline std::string summary_header( )
+{
+    return "file,pages,frames,cs_start_ms,cs_end_ms,us_start_ms,us_end_ms,probe,learnt"
+        ",blink_mean,blink_min,blink_max";
+}
+
+/* Times in ms after the first frame. */
+inline std::string summary_row( const TrialResult& r )
+{
+    int64_t t0 = r.samples.empty( ) ? 0 : r.samples[0].ns;
+    std::ostringstream ss;
+    ss << r.file << ',' << r.pages << ',' << r.samples.size( )
+        << ',' << trial_ms( r.cs[0], t0 ) << ',' << trial_ms( r.cs[1], t0 )
+        << ',' << trial_ms( r.us[0], t0 ) << ',' << trial_ms( r.us[1], t0 )
+        << ',' << r.probe_trial << ',' << r.learnt
+        << ',' << r.blink_mean << ',' << r.blink_min << ',' << r.blink_max;
+    return ss.str( );
+}
+
+/**
+ * @brief Per trial result file: "# " summary header and row, then
+ * "time_ms,blink,speed" of every frame, time after the first frame.
+ *
+ * @return false on write error.
+ */
+inline bool write_trial_result( const TrialResult& r, const std::string& filename )
+{
+    FILE* out = fopen( filename.c_str( ), "w" );
+    if( ! out )
+        return false;
+    int64_t t0 = r.samples.empty( ) ? 0 : r.samples[0].ns;
+    fprintf( out, "# %s\n# %s\n", summary_header( ).c_str( ), summary_row( r ).c_str( ) );
+    fprintf( out, "# first frame at %.6f s (naive wall clock)\n", t0 / 1e9 );
+    fprintf( out, "time_ms,blink,speed\n" );
+    for( auto& s : r.samples )
+    {
+        if( std::isnan( s.speed ) )
+            fprintf( out, "%.3f,%.3f,\n", (s.ns - t0) / 1e6, s.blink );
+        else
+            fprintf( out, "%.3f,%.3f,%g\n", (s.ns - t0) / 1e6, s.blink, s.speed );
+    }
+    return fclose( out ) == 0;
+}
+
+#endif   /* ----- #ifndef TrialAnalysis_INC  ----- */
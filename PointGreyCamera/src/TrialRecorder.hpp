@@ -0,0 +1,586 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  TrialRecorder.hpp
+ *
+ *    Description:  Writes frames of a trial to DIR/trial_%03d.tif on a thread
+ *    of its own, so disk never holds up the camera.
+ *
+ *    The sender thread copies each frame into a preallocated page and puts it
+ *    on a bounded queue; the writer thread appends pages to the file of the
+ *    trial the frame belongs to and starts a new file when the trial changes.
+ *    When the queue is full (disk too slow), frames are dropped and counted.
+ *
+ *    Which frames belong to a trial is decided by their host_ns: a trial
+ *    starts at a time (trigger( ), e.g. when the camera TTL went up) less a
+ *    pre-roll, and ends at a time (release( )) plus a post-roll. Frames
+ *    outside a trial are kept in a fixed ring of pages; when the trial
+ *    starts, frames in the ring from its start on are committed first. The
+ *    trigger may so come after the frames it is about (the TTL report comes
+ *    10-30 ms after the edge) without losing them. All pages are allocated
+ *    once; memory does not grow with trials.
+ *
+ *    Pages have the layout of camera_arduino_client.py recordings: one row of
+ *    text (frame id, camera timestamp, blink signal and the last line given
+ *    with set_meta( ), padded with spaces) above the frame.
+ *
+ *    Format "tiff" writes trial_%03d.tif; "ebz" writes trial_%03d.ebz, the
+ *    lossless codec of FrameCodec.hpp (about a third of the bytes for a
+ *    mostly still scene, and no libtiff per page). "session" appends all
+ *    trials to one DIR/session.ebs (Session.hpp) with binary metadata
+ *    instead of the text row; set_meta( ) lines become events.
+ *
+ *    A wide recorder writes 16 bit tiff pages of Frame::wide, the pixels of
+ *    a Mono12p/Mono12Packed/Mono16 camera before PixelConverter made them
+ *    8 bit. Its text row is the same bytes, two to a pixel.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  TrialRecorder_INC
+#define  TrialRecorder_INC
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+#include "FrameSource.hpp"
+#include "FrameRing.hpp"
+#include "TiffWriter.hpp"
+#include "FrameCodec.hpp"
+#include "Session.hpp"
+
+class TrialRecorder
+{
+public:
+    /**
+     * @brief Constructor.
+     *
+     * @param dir Directory for trial_%03d.tif files.
+     * @param width, height Frame geometry; pages are one row taller.
+     * @param queue_size Frames which can wait for disk; power of 2.
+     * @param bigtiff Write BigTIFF files.
+     * @param format "tiff", "ebz" or "session".
+     * @param key_interval, threads Of the ebz encoder (see FrameEncoder).
+     * @param chunk_frames Frames per chunk of session files.
+     * @param roll_frames Frames kept before a trial starts; pre-roll can't
+     * reach further back than this many frames before the trigger arrives.
+     * @param wide Record full bit depth pixels (16 bit pages); "tiff" only.
+     */
+    TrialRecorder( const std::string& dir, size_t width, size_t height
+            , size_t queue_size, bool bigtiff = true, const std::string& format = "tiff"
+            , size_t key_interval = 200, size_t threads = 0, size_t chunk_frames = 200
+            , size_t roll_frames = 0, bool wide = false )
+        : dir_( dir ), format_( format ), width_( width ), height_( height ), bigtiff_( bigtiff )
+        , wide_( wide ), row_bytes_( width * (wide ? 2 : 1) )
+        , key_interval_( key_interval ), threads_( threads ), chunk_frames_( chunk_frames )
+        , pages_( queue_size + roll_frames ), full_( pow2( queue_size + roll_frames ) )
+        , free_( pow2( queue_size + roll_frames ) ), roll_( roll_frames ), roll_head_( 0 ), roll_count_( 0 )
+        , trial_( no_trial_ ), stop_( false ), preroll_ns_( 0 ), postroll_ns_( 0 )
+        , start_ns_( 0 ), stop_ns_( no_stop_ ), meta_seq_( 0 )
+        , written_( 0 ), dropped_( 0 ), files_( 0 ), errors_( 0 ), rolled_( 0 )
+    {
+        for (size_t i = 0; i < pages_.size( ); i++)
+        {
+            pages_[i].data.resize( (height_ + 1) * row_bytes_ );
+            free_.push( &pages_[i] );
+        }
+        spare_.reserve( pages_.size( ) );
+    }
+
+    ~TrialRecorder( )
+    {
+        stop( );
+    }
+
+    void start( )
+    {
+        writer_ = std::thread( &TrialRecorder::write_loop, this );
+    }
+
+    /* Write whatever is queued, close the file and stop the writer. */
+    void stop( )
+    {
+        if( ! writer_.joinable( ) )
+            return;
+        stop_ = true;
+        wake_.notify_one( );
+        writer_.join( );
+    }
+
+    /* Frames from now (less pre-roll) on go to trial_%03d.tif of index. */
+    void begin_trial( int index )
+    {
+        trigger( index, now_ns( ) );
+    }
+
+    /* Stop recording after post-roll; the file is closed once its frames
+     * are written. */
+    void end_trial( )
+    {
+        release( now_ns( ) );
+    }
+
+    /**
+     * @brief Trial index starts at host time at_ns: frames from at_ns less
+     * pre-roll on are recorded. Nothing changes if index is being recorded.
+     */
+    void trigger( int index, uint64_t at_ns )
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        if( trial_ == index && stop_ns_ == no_stop_ )
+            return;
+        trial_ = index;
+        start_ns_ = at_ns > preroll_ns_ ? at_ns - preroll_ns_ : 0;
+        stop_ns_ = no_stop_;
+    }
+
+    /* Trial ends at host time at_ns: frames before at_ns plus post-roll are
+     * recorded. Nothing changes if it is already ending. */
+    void release( uint64_t at_ns )
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        if( trial_ != no_trial_ && stop_ns_ == no_stop_ )
+            stop_ns_ = at_ns + postroll_ns_;
+    }
+
+    /* Frames kept before the trigger and after the release. */
+    void set_roll( uint64_t preroll_ns, uint64_t postroll_ns )
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        preroll_ns_ = preroll_ns;
+        postroll_ns_ = postroll_ns;
+    }
+
+    /* A trial is being recorded (or its post-roll). */
+    bool recording( ) const
+    {
+        return trial_ != no_trial_;
+    }
+
+    void set_dir( const std::string& dir )
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        dir_ = dir;
+    }
+
+    std::string dir( )
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        return dir_;
+    }
+
+    static bool valid_format( const std::string& format )
+    {
+        return format == "tiff" || format == "ebz" || format == "session";
+    }
+
+    /* Format of files opened from now on; false if unknown, or not "tiff"
+     * for a wide recorder. */
+    bool set_format( const std::string& format )
+    {
+        if( ! valid_format( format ) || (wide_ && format != "tiff") )
+            return false;
+        std::lock_guard<std::mutex> lock( mutex_ );
+        format_ = format;
+        return true;
+    }
+
+    /* Text written in metadata row of following frames, e.g. arduino line. */
+    void set_meta( const std::string& meta )
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        meta_ = meta;
+        meta_seq_ += 1;
+    }
+
+    /**
+     * @brief Queue frame if it belongs to a trial, else keep it in the
+     * pre-roll ring. Called by the sender thread only; never blocks.
+     *
+     * @return false if a frame of a trial had to be dropped.
+     */
+    bool record( const Frame& frame )
+    {
+        if( frame.width != width_ || frame.height != height_ )
+            return false;
+        uint64_t t = frame.host_ns ? frame.host_ns : now_ns( );
+
+        int trial;
+        uint64_t start;
+        {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            if( trial_ != no_trial_ && t >= stop_ns_ )
+            {
+                trial_ = no_trial_;
+                stop_ns_ = no_stop_;
+                wake_.notify_one( );
+            }
+            trial = trial_;
+            start = start_ns_;
+        }
+
+        if( trial != no_trial_ )
+        {
+            // Frames in the ring from the start on go first.
+            while( roll_count_ > 0 )
+            {
+                Page* p = roll_pop( );
+                if( p->info.host_ns >= start )
+                {
+                    commit( p, trial );
+                    rolled_ += 1;
+                }
+                else
+                    spare_.push_back( p );
+            }
+            if( t < start )
+                trial = no_trial_;
+        }
+        if( trial == no_trial_ && roll_.empty( ) )
+            return true;
+
+        Page* page = NULL;
+        if( ! spare_.empty( ) )
+        {
+            page = spare_.back( );
+            spare_.pop_back( );
+        }
+        else if( ! free_.pop( page ) )
+        {
+            if( trial == no_trial_ && roll_count_ > 0 )
+                page = roll_pop( );
+            else
+            {
+                if( trial != no_trial_ )
+                    dropped_ += 1;
+                return trial == no_trial_;
+            }
+        }
+        fill( page, frame, t );
+
+        if( trial != no_trial_ )
+            commit( page, trial );
+        else
+        {
+            if( roll_count_ == roll_.size( ) )
+                spare_.push_back( roll_pop( ) );
+            roll_[(roll_head_ + roll_count_) % roll_.size( )] = page;
+            roll_count_ += 1;
+        }
+        return true;
+    }
+
+    std::string status( )
+    {
+        std::ostringstream os;
+        std::lock_guard<std::mutex> lock( mutex_ );
+        os << "trial=" << (recording( ) ? std::to_string( (int)trial_ ) : "none")
+            << " written=" << written_ << " dropped=" << dropped_
+            << " queued=" << full_.size( ) << "/" << full_.capacity( )
+            << " prerolled=" << rolled_
+            << " files=" << files_ << " errors=" << errors_ << " format=" << format_
+            << " bits=" << (wide_ ? 16 : 8)
+            << " file=" << current_file_;
+        return os.str( );
+    }
+
+private:
+    struct Page
+    {
+        int trial;
+        SessionFrame info;
+        uint64_t meta_seq;                      /* set_meta( ) calls before frame */
+        std::vector<unsigned char> data;        /* Text row, then frame. */
+    };
+
+    enum { no_trial_ = -1000 };
+    static const uint64_t no_stop_ = UINT64_MAX;
+
+    /* Smallest power of 2 >= n; ring sizes must be one. */
+    static size_t pow2( size_t n )
+    {
+        size_t p = 1;
+        while( p < n )
+            p *= 2;
+        return p;
+    }
+
+    /* Copy frame into page, text row first. */
+    void fill( Page* page, const Frame& frame, uint64_t host_ns )
+    {
+        page->info.frame_id = frame.frame_id;
+        page->info.camera_ns = frame.timestamp;
+        page->info.host_ns = host_ns;
+        page->info.blink = frame.blink;
+        unsigned char* row = &page->data[0];
+        memset( row, ' ', row_bytes_ );
+        {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            page->meta_seq = meta_seq_;
+            int n = snprintf( (char*)row, width_, "%llu,%llu,%.3f,%s"
+                    , (unsigned long long)frame.frame_id
+                    , (unsigned long long)frame.timestamp
+                    , frame.blink, meta_.c_str( ) );
+            // snprintf leaves a NUL; the row is text padded with spaces.
+            if( n >= 0 && (size_t)n < width_ )
+                row[n] = ' ';
+            else
+                row[width_ - 1] = ' ';
+        }
+        if( ! wide_ )
+        {
+            memcpy( row + width_, frame.data, width_ * height_ );
+            return;
+        }
+        uint16_t* pixels = (uint16_t*)(row + row_bytes_);
+        if( frame.wide )
+            memcpy( pixels, frame.wide, 2 * width_ * height_ );
+        else
+            for (size_t i = 0; i < width_ * height_; i++)
+                pixels[i] = frame.data[i];
+    }
+
+    /* Page to the writer as a frame of trial. */
+    void commit( Page* page, int trial )
+    {
+        page->trial = trial;
+        page->info.trial = trial;
+        full_.push( page );
+        wake_.notify_one( );
+    }
+
+    /* Oldest page of the pre-roll ring. */
+    Page* roll_pop( )
+    {
+        Page* p = roll_[roll_head_];
+        roll_head_ = (roll_head_ + 1) % roll_.size( );
+        roll_count_ -= 1;
+        return p;
+    }
+
+    void write_loop( )
+    {
+        std::unique_ptr<PageWriter> file;
+        std::unique_ptr<SessionWriter> session;
+        int openTrial = no_trial_;
+        uint64_t metaSeq = 0;
+
+        while( true )
+        {
+            // Frames recorded before stop( ) are queued before stop_ is seen.
+            bool stopping = stop_;
+            Page* page = NULL;
+            if( ! full_.pop( page ) )
+            {
+                // Queue is empty. Close file once the trial is over.
+                if( openTrial != no_trial_ && trial_ != openTrial )
+                {
+                    close_file( file );
+                    if( session )
+                        session->end_trial( now_ns( ) );
+                    openTrial = no_trial_;
+                }
+                if( stopping )
+                    break;
+                std::unique_lock<std::mutex> lock( wake_mutex_ );
+                wake_.wait_for( lock, std::chrono::milliseconds( 20 ) );
+                continue;
+            }
+
+            if( page->trial != openTrial )
+            {
+                close_file( file );
+                if( session_format( ) )
+                {
+                    open_session( session );
+                    if( session )
+                        session->begin_trial( page->trial, page->info.host_ns );
+                }
+                else
+                {
+                    close_session( session );
+                    file.reset( open_file( page->trial ) );
+                }
+                openTrial = page->trial;
+            }
+
+            bool ok = false;
+            if( file )
+                ok = file->write( &page->data[0] );
+            else if( session )
+            {
+                if( page->meta_seq != metaSeq )
+                {
+                    metaSeq = page->meta_seq;
+                    session->add_text( meta( ), page->info.host_ns );
+                }
+                ok = session->append( page->info, &page->data[width_] );
+            }
+
+            if( ok )
+                written_ += 1;
+            else
+                errors_ += 1;
+            free_.push( page );
+        }
+        close_file( file );
+        close_session( session );
+    }
+
+    static uint64_t now_ns( )
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now( ).time_since_epoch( ) ).count( );
+    }
+
+    bool session_format( )
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        return format_ == "session";
+    }
+
+    std::string meta( )
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        return meta_;
+    }
+
+    PageWriter* open_file( int trial )
+    {
+        std::string filename, format;
+        {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            format = format_;
+            char name[32];
+            snprintf( name, sizeof( name ), "trial_%03d.%s", trial
+                    , format == "ebz" ? "ebz" : "tif" );
+            filename = dir_ + "/" + name;
+            current_file_ = filename;
+        }
+        PageWriter* file;
+        if( wide_ )
+            file = new TiffWriter( filename, width_, height_ + 1, bigtiff_, 0, 16 );
+        else if( format == "ebz" )
+            file = new CodecFileWriter( filename, width_, height_ + 1, key_interval_, threads_ );
+        else
+            file = new TiffWriter( filename, width_, height_ + 1, bigtiff_ );
+        if( ! file->is_open( ) )
+            std::cout << "[ERROR] Could not open " << filename << " for writing" << std::endl;
+        else
+            files_ += 1;
+        return file;
+    }
+
+    void close_file( std::unique_ptr<PageWriter>& file )
+    {
+        if( ! file )
+            return;
+        std::cout << "[INFO] Wrote " << file->pages( ) << " frames to "
+            << file->filename( ) << std::endl;
+        file.reset( );
+        std::lock_guard<std::mutex> lock( mutex_ );
+        current_file_ = "";
+    }
+
+    /* One session file per directory; a new one if dir_ changed. Existing
+     * files are never overwritten: session_1.ebs, session_2.ebs ... */
+    void open_session( std::unique_ptr<SessionWriter>& session )
+    {
+        std::string dir;
+        {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            dir = dir_;
+        }
+        if( session && session_dir_ == dir )
+            return;
+        close_session( session );
+
+        std::string filename = dir + "/session.ebs";
+        for (int i = 1; access( filename.c_str( ), F_OK ) == 0; i++)
+            filename = dir + "/session_" + std::to_string( i ) + ".ebs";
+        session.reset( new SessionWriter( filename, width_, height_, chunk_frames_ ) );
+        if( ! session->is_open( ) )
+        {
+            std::cout << "[ERROR] Could not open " << filename << " for writing" << std::endl;
+            session.reset( );
+            return;
+        }
+        session_dir_ = dir;
+        files_ += 1;
+        std::lock_guard<std::mutex> lock( mutex_ );
+        current_file_ = filename;
+    }
+
+    void close_session( std::unique_ptr<SessionWriter>& session )
+    {
+        if( ! session )
+            return;
+        session->end_trial( now_ns( ) );
+        if( ! session->close( ) )
+            errors_ += 1;
+        std::cout << "[INFO] Wrote " << session->frames( ) << " frames to "
+            << session->filename( ) << std::endl;
+        session.reset( );
+        std::lock_guard<std::mutex> lock( mutex_ );
+        current_file_ = "";
+    }
+
+    std::string dir_;
+    std::string format_;
+    size_t width_;
+    size_t height_;
+    bool bigtiff_;
+    const bool wide_;
+    const size_t row_bytes_;                    /* Of a page. */
+    size_t key_interval_;
+    size_t threads_;
+    size_t chunk_frames_;
+    std::string session_dir_;                   /* Of the open session file. */
+
+    std::vector<Page> pages_;
+    SpscRing<Page*> full_;                      /* sender -> writer */
+    SpscRing<Page*> free_;                      /* writer -> sender */
+
+    // Sender only: last frames before a trial, and pages it holds unused.
+    std::vector<Page*> roll_;
+    size_t roll_head_, roll_count_;
+    std::vector<Page*> spare_;
+
+    std::atomic<int> trial_;                    /* Set under mutex_; writer reads it. */
+    std::atomic<bool> stop_;
+    uint64_t preroll_ns_, postroll_ns_;         /* mutex_ */
+    uint64_t start_ns_, stop_ns_;               /* mutex_: of trial_ */
+    std::thread writer_;
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+
+    std::mutex mutex_;                          /* dir_, format_, meta_, current_file_, trial times */
+    std::string meta_;
+    uint64_t meta_seq_;
+    std::string current_file_;
+
+    std::atomic<uint64_t> written_;
+    std::atomic<uint64_t> dropped_;
+    std::atomic<uint64_t> files_;
+    std::atomic<uint64_t> errors_;
+    std::atomic<uint64_t> rolled_;              /* Frames committed from the ring. */
+};
+
+#endif   /* ----- #ifndef TrialRecorder_INC  ----- */
@@ -0,0 +1,194 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  WorkStealingPool.hpp
+ *
+ *    Description:  Threads running tasks which may submit more tasks, e.g.
+ *    a session submitting its trials. Every thread has a deque of its own:
+ *    it pushes and pops at the back (newest first, still in cache) and,
+ *    when its deque is empty, steals the oldest task of another thread.
+ *    Tasks of very different length (a 10 frame trial next to a 2000 frame
+ *    one) keep all threads busy without a central queue.
+ *
+ *    Unlike TaskPool, which splits one frame into equal tiles in a few
+ *    microseconds, tasks here are milliseconds to seconds long; a mutex per
+ *    deque is cheap enough.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  WorkStealingPool_INC
+#define  WorkStealingPool_INC
+
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <vector>
+
+class WorkStealingPool
+{
+public:
+    typedef std::function<void( )> Task;
+
+    /**
+     * @brief Constructor.
+     *
+     * @param threads Worker threads; 0 for one per core.
+     */
+    WorkStealingPool( size_t threads = 0 )
+        : queued_( 0 ), pending_( 0 ), steals_( 0 ), next_( 0 ), quit_( false )
+    {
+        if( threads == 0 )
+            threads = std::max( std::thread::hardware_concurrency( ), 1u );
+        for (size_t i = 0; i < threads; i++)
+            queues_.push_back( std::unique_ptr<Queue>( new Queue ) );
+        for (size_t i = 0; i < threads; i++)
+            workers_.push_back( std::thread( &WorkStealingPool::work_loop, this, i ) );
+    }
+
+    WorkStealingPool( const WorkStealingPool& ) = delete;
+    WorkStealingPool& operator=( const WorkStealingPool& ) = delete;
+
+    /* Waits for every task. */
+    ~WorkStealingPool( )
+    {
+        wait( );
+        {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            quit_ = true;
+        }
+        work_.notify_all( );
+        for( auto& t : workers_ )
+            t.join( );
+    }
+
+    size_t threads( ) const
+    {
+        return workers_.size( );
+    }
+
+    /**
+     * @brief Run task on some thread. From a task, it goes on the deque of
+     * that thread; from outside, on the deques in turn.
+     */
+    void submit( Task task )
+    {
+        size_t k = self( ).first == this ? self( ).second : next_++ % queues_.size( );
+        pending_ += 1;
+        {
+            std::lock_guard<std::mutex> lock( queues_[k]->mutex );
+            queues_[k]->tasks.push_back( std::move( task ) );
+        }
+        {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            queued_ += 1;
+        }
+        work_.notify_one( );
+    }
+
+    /**
+     * @brief Wait until all tasks, and the tasks they submitted, are done.
+     * Not from a task.
+     */
+    void wait( )
+    {
+        std::unique_lock<std::mutex> lock( mutex_ );
+        done_.wait( lock, [this] { return pending_ == 0; } );
+    }
+
+    /* Tasks taken from the deque of another thread so far. */
+    uint64_t steals( ) const
+    {
+        return steals_;
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    /* Pool and deque of the calling thread; NULL pool outside workers. */
+    static std::pair<WorkStealingPool*, size_t>& self( )
+    {
+        static thread_local std::pair<WorkStealingPool*, size_t> s( NULL, 0 );
+        return s;
+    }
+
+    /* Newest task of deque k, else oldest of another; false if none. */
+    bool take( size_t k, Task& task )
+    {
+        {
+            Queue& q = *queues_[k];
+            std::lock_guard<std::mutex> lock( q.mutex );
+            if( ! q.tasks.empty( ) )
+            {
+                task = std::move( q.tasks.back( ) );
+                q.tasks.pop_back( );
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues_.size( ); i++)
+        {
+            Queue& q = *queues_[(k + i) % queues_.size( )];
+            std::lock_guard<std::mutex> lock( q.mutex );
+            if( ! q.tasks.empty( ) )
+            {
+                task = std::move( q.tasks.front( ) );
+                q.tasks.pop_front( );
+                steals_ += 1;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void work_loop( size_t k )
+    {
+        self( ) = std::make_pair( this, k );
+        while( true )
+        {
+            Task task;
+            if( take( k, task ) )
+            {
+                queued_ -= 1;
+                task( );
+                task = nullptr;
+                std::lock_guard<std::mutex> lock( mutex_ );
+                if( --pending_ == 0 )
+                    done_.notify_all( );
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock( mutex_ );
+            work_.wait( lock, [this] { return quit_ || queued_ > 0; } );
+            if( quit_ && queued_ == 0 )
+                return;
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue> > queues_;
+    std::vector<std::thread> workers_;
+
+    std::mutex mutex_;                          /* Sleeping and waiting */
+    std::condition_variable work_;
+    std::condition_variable done_;
+    std::atomic<int64_t> queued_;               /* Tasks in deques */
+    std::atomic<int64_t> pending_;              /* Submitted, not finished */
+    std::atomic<uint64_t> steals_;
+    std::atomic<size_t> next_;
+    bool quit_;
+};
+
+#endif   /* ----- #ifndef WorkStealingPool_INC  ----- */
@@ -0,0 +1,263 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  analyze_trials.cc
+ *
+ *    Description:  analysis/analyze_trial_video.py for every trial of many
+ *    sessions at once (src/TrialAnalysis.hpp).
+ *
+ *      $ ./analyze_trials [-j THREADS] [--roi X0,Y0,X1,Y1] [--thres T] PATH...
+ *
+ *    PATH is a trial tiff or a directory, searched for trial_%03d.tif files;
+ *    each directory holding some is a session. For every trial it writes
+ *    SESSION/_analysis/trial_NNN.tif.csv (blink trace and summary, see
+ *    write_trial_result( )), and per session _analysis/summary.csv with one
+ *    row per trial. --roi recomputes the blink signal on that box of the
+ *    frame instead of taking it from the text row.
+ *
+ *    Directories, sessions and trials are all tasks of one WorkStealingPool:
+ *    a thread done with its short trials takes trials of a long session
+ *    from another.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "TrialAnalysis.hpp"
+#include "WorkStealingPool.hpp"
+
+using namespace std;
+
+/* Where python's analysis goes too (analysis/config.py tempdir). */
+const string result_dir_ = "_analysis";
+
+std::mutex print_mutex_;
+std::atomic<size_t> trials_( 0 ), failed_( 0 ), pages_( 0 );
+
+size_t* roi_ = NULL;
+double threshold_ = 80;                         /* analysis/config.py thres_ */
+
+void log( const string& msg )
+{
+    std::lock_guard<std::mutex> lock( print_mutex_ );
+    cout << msg << endl;
+}
+
+bool is_dir( const string& path )
+{
+    struct stat st;
+    return stat( path.c_str( ), &st ) == 0 && S_ISDIR( st.st_mode );
+}
+
+bool is_trial_tiff( const string& name )
+{
+    int trial;
+    char ext[8];
+    return sscanf( name.c_str( ), "trial_%d.%7s", &trial, ext ) == 2
+        && (string( ext ) == "tif" || string( ext ) == "tiff");
+}
+
+string base_name( const string& path )
+{
+    size_t at = path.rfind( '/' );
+    return at == string::npos ? path : path.substr( at + 1 );
+}
+
+string dir_name( const string& path )
+{
+    size_t at = path.rfind( '/' );
+    return at == string::npos ? "." : path.substr( 0, at );
+}
+
+/**
+ * @brief Trials of one directory; the last one to finish writes the
+ * summary.
+ */
+struct Session
+{
+    string dir;
+    vector<string> files;
+    vector<TrialResult> results;
+    atomic<size_t> left;
+
+    Session( const string& d, const vector<string>& f )
+        : dir( d ), files( f ), results( f.size( ) ), left( f.size( ) )
+    { }
+};
+
+void write_summary( const Session& s )
+{
+    string filename = s.dir + "/" + result_dir_ + "/summary.csv";
+    ofstream out( filename );
+    out << summary_header( ) << endl;
+    size_t learnt = 0;
+    for( auto& r : s.results )
+    {
+        out << summary_row( r ) << endl;
+        learnt += r.learnt;
+    }
+    if( ! out )
+        failed_ += 1;
+    log( "[INFO] " + s.dir + ": " + to_string( s.results.size( ) ) + " trials, "
+            + to_string( learnt ) + " learnt; " + filename );
+}
+
+void analyze_trial( Session* s, size_t i )
+{
+    string error;
+    TrialResult r = analyze_tiff<FRAME_WIDTH, FRAME_HEIGHT>( s->files[i], roi_, threshold_, error );
+    pages_ += r.pages;
+    if( ! error.empty( ) )
+    {
+        failed_ += 1;
+        log( "[WARN] " + error );
+    }
+    r.file = base_name( r.file );
+    string out = s->dir + "/" + result_dir_ + "/" + r.file + ".csv";
+    if( ! write_trial_result( r, out ) )
+    {
+        failed_ += 1;
+        log( "[WARN] can't write " + out );
+    }
+    trials_ += 1;
+    s->results[i] = std::move( r );
+
+    if( --s->left == 0 )
+    {
+        write_summary( *s );
+        delete s;
+    }
+}
+
+/* Trials of dir are a session; subdirectories are searched the same way. */
+void analyze_dir( WorkStealingPool& pool, const string& dir )
+{
+    vector<string> names;
+    DIR* d = opendir( dir.c_str( ) );
+    if( ! d )
+    {
+        failed_ += 1;
+        log( "[WARN] can't read directory " + dir );
+        return;
+    }
+    while( struct dirent* e = readdir( d ) )
+        names.push_back( e->d_name );
+    closedir( d );
+    sort( names.begin( ), names.end( ) );
+
+    vector<string> trials;
+    for( auto& name : names )
+    {
+        if( name == "." || name == ".." || name == result_dir_ )
+            continue;
+        string path = dir + "/" + name;
+        if( is_trial_tiff( name ) )
+            trials.push_back( path );
+        else if( is_dir( path ) )
+            pool.submit( [&pool, path]( ) { analyze_dir( pool, path ); } );
+    }
+    if( trials.empty( ) )
+        return;
+
+    mkdir( (dir + "/" + result_dir_).c_str( ), 0755 );
+    Session* s = new Session( dir, trials );
+    for (size_t i = 0; i < trials.size( ); i++)
+        pool.submit( [s, i]( ) { analyze_trial( s, i ); } );
+}
+
+void usage( const char* name )
+{
+    cout << "Usage: " << name << " [-j THREADS] [--roi X0,Y0,X1,Y1] [--thres T] PATH..." << endl
+        << "  PATH              trial_%03d.tif, or directory searched for them" << endl
+        << "  -j THREADS        Threads (default one per core)" << endl
+        << "  --roi X0,Y0,X1,Y1 Recompute blink signal on this box of the frame" << endl
+        << "                    (default: blink of the text row)" << endl
+        << "  --thres T         Learnt if blink after CS+ is T off baseline (default "
+        << threshold_ << ")" << endl;
+}
+
+int main( int argc, char** argv )
+{
+    size_t threads = 0;
+    size_t roi[4];
+    vector<string> paths;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if( arg == "-j" && i + 1 < argc )
+            threads = atoi( argv[++i] );
+        else if( arg == "--thres" && i + 1 < argc )
+            threshold_ = atof( argv[++i] );
+        else if( arg == "--roi" && i + 1 < argc
+                && sscanf( argv[++i], "%zu,%zu,%zu,%zu", &roi[0], &roi[1], &roi[2], &roi[3] ) == 4 )
+            roi_ = roi;
+        else if( arg[0] != '-' )
+            paths.push_back( arg );
+        else
+        {
+            usage( argv[0] );
+            return arg == "--help" || arg == "-h" ? 0 : -1;
+        }
+    }
+    if( paths.empty( ) )
+    {
+        usage( argv[0] );
+        return -1;
+    }
+    if( roi_ )
+    {
+        try
+        {
+            BlinkDetector<FRAME_WIDTH, FRAME_HEIGHT> check( roi[0], roi[1], roi[2], roi[3] );
+        }
+        catch( invalid_argument& e )
+        {
+            cout << "[ERROR] " << e.what( ) << endl;
+            return -1;
+        }
+    }
+
+    auto t0 = chrono::steady_clock::now( );
+    {
+        WorkStealingPool pool( threads );
+        map<string, vector<string> > files;     /* Tiffs given, by directory */
+        for( auto& path : paths )
+        {
+            if( is_dir( path ) )
+                pool.submit( [&pool, path]( ) { analyze_dir( pool, path ); } );
+            else
+                files[dir_name( path )].push_back( path );
+        }
+        for( auto& f : files )
+        {
+            mkdir( (f.first + "/" + result_dir_).c_str( ), 0755 );
+            Session* s = new Session( f.first, f.second );
+            for (size_t i = 0; i < f.second.size( ); i++)
+                pool.submit( [s, i]( ) { analyze_trial( s, i ); } );
+        }
+        pool.wait( );
+        cout << "[INFO] " << trials_ << " trials (" << pages_ << " frames) on "
+            << pool.threads( ) << " threads, " << pool.steals( ) << " steals, in "
+            << chrono::duration<double>( chrono::steady_clock::now( ) - t0 ).count( )
+            << " s" << endl;
+    }
+    if( failed_ > 0 )
+        cout << "[WARN] " << failed_ << " files failed" << endl;
+    return failed_ > 0 ? -1 : 0;
+}
@@ -0,0 +1,478 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  arduino_reader.cc
+ *
+ *    Description:  Reads the serial port of the Arduino (was done by
+ *    camera_arduino_client.py).
+ *
+ *      $ ./arduino_reader /dev/ttyACM0 [options]
+ *
+ *    Bytes are read as they come (epoll on the raw port, SerialReader.hpp)
+ *    and stamped with CLOCK_MONOTONIC right after read( ); a line which was
+ *    not the last of what one read( ) gave is stamped earlier by the time
+ *    the bytes after it took on the wire. A binary board (BINARY_SAMPLES)
+ *    is decoded to lines with SampleDecoder. Every line goes
+ *
+ *      - to cam_server on CONTROL_SOCK_PATH ("arduino HOST_NS LINE", sent
+ *        in batches from a thread of its own) for its clock fit, along with
+ *        the pings ('?') written every --ping-ms,
+ *      - into shared memory ARDUINO_SHM_NAME as the latest ArduinoState
+ *        (serial_client.py reads it),
+ *      - if a data line of trial >= 1, to that trial's .dat file once the
+ *        client has said where (command files),
+ *      - else into the log of messages (command messages).
+ *
+ *    Commands on ARDUINO_SOCK_PATH (ControlServer line protocol):
+ *
+ *      send TEXT           write TEXT to the board
+ *      sendhex HEX         write bytes to the board
+ *      files DIR PREFIX    data lines to DIR/PREFIXtrial=N.dat
+ *      messages SEQ        messages from SEQ on: NEXT<TAB>msg<TAB>msg...
+ *      stats               counters
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <cstdlib>
+#include <signal.h>
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "config.h"
+#include "FrameSource.hpp"
+#include "SampleDecoder.hpp"
+#include "SerialReader.hpp"
+#include "control-server.h"
+
+using namespace std;
+
+volatile sig_atomic_t interrupted_ = 0;         /* Set on Ctrl+C */
+
+void sig_handler( int s )
+{
+    interrupted_ = 1;
+}
+
+/**
+ * @brief Lines and pings to cam_server's ClockSync, in the order they
+ * happened. They collect in a string which a thread sends every period_ms,
+ * one connection per batch (the control server takes one client at a time),
+ * so the reading loop never waits for cam_server.
+ */
+class SyncFeed
+{
+public:
+    SyncFeed( const string& path, unsigned period_ms )
+        : path_( path ), period_ms_( period_ms ), stop_( false ), sent_( 0 ), lost_( 0 )
+    {
+        pending_.reserve( 1 << 16 );
+        sending_.reserve( 1 << 16 );
+        thread_ = thread( &SyncFeed::run, this );
+    }
+
+    ~SyncFeed( )
+    {
+        {
+            lock_guard<mutex> lock( mutex_ );
+            stop_ = true;
+        }
+        wake_.notify_all( );
+        thread_.join( );
+    }
+
+    void line( uint64_t host_ns, const char* line, size_t n )
+    {
+        char head[40];
+        int h = snprintf( head, sizeof( head ), "arduino %llu ", (unsigned long long)host_ns );
+        lock_guard<mutex> lock( mutex_ );
+        if( pending_.size( ) > max_pending_ )
+            return;
+        pending_.append( head, h );
+        pending_.append( line, n );
+        pending_ += '\n';
+    }
+
+    void ping( uint64_t host_ns )
+    {
+        char s[40];
+        int n = snprintf( s, sizeof( s ), "ping %llu\n", (unsigned long long)host_ns );
+        lock_guard<mutex> lock( mutex_ );
+        pending_.append( s, n );
+    }
+
+    /* Batches cam_server took, and ones it did not (not running). */
+    uint64_t sent( ) const
+    {
+        return sent_;
+    }
+
+    uint64_t lost( ) const
+    {
+        return lost_;
+    }
+
+private:
+    void run( )
+    {
+        unique_lock<mutex> lock( mutex_ );
+        while( ! stop_ )
+        {
+            wake_.wait_for( lock, chrono::milliseconds( period_ms_ ) );
+            swap( pending_, sending_ );
+            lock.unlock( );
+            if( ! sending_.empty( ) )
+            {
+                if( send( sending_ ) )
+                    sent_ += 1;
+                else
+                    lost_ += 1;
+                sending_.clear( );
+            }
+            lock.lock( );
+        }
+    }
+
+    bool send( const string& batch )
+    {
+        if( path_.empty( ) || access( path_.c_str( ), F_OK ) != 0 )
+            return false;
+        int s = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+        if( s < 0 )
+            return false;
+        struct sockaddr_un addr;
+        memset( &addr, 0, sizeof( addr ) );
+        addr.sun_family = AF_UNIX;
+        strncpy( addr.sun_path, path_.c_str( ), sizeof( addr.sun_path ) - 1 );
+        struct timeval tv = { 1, 0 };
+        setsockopt( s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof( tv ) );
+        setsockopt( s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof( tv ) );
+        bool ok = connect( s, (struct sockaddr*)&addr, sizeof( addr ) ) == 0;
+        for (size_t done = 0; ok && done < batch.size( ); )
+        {
+            ssize_t w = ::send( s, batch.data( ) + done, batch.size( ) - done, MSG_NOSIGNAL );
+            ok = w > 0;
+            done += ok ? w : 0;
+        }
+        // Replies (one OK per line) until the server closes.
+        if( ok )
+        {
+            shutdown( s, SHUT_WR );
+            char buf[4096];
+            while( recv( s, buf, sizeof( buf ), 0 ) > 0 )
+                ;
+        }
+        close( s );
+        return ok;
+    }
+
+    static const size_t max_pending_ = 1 << 22;
+
+    string path_;
+    unsigned period_ms_;
+    mutex mutex_;
+    condition_variable wake_;
+    bool stop_;
+    string pending_, sending_;
+    atomic<uint64_t> sent_, lost_;
+    thread thread_;
+};
+
+/* "73 3f" etc. to bytes. */
+string from_hex( const vector<string>& words )
+{
+    string hex, out;
+    for (auto& w : words)
+        hex += w;
+    if( hex.size( ) % 2 != 0 )
+        throw runtime_error( "odd number of hex digits" );
+    for (size_t i = 0; i < hex.size( ); i += 2)
+    {
+        char* end;
+        string byte = hex.substr( i, 2 );
+        long v = strtol( byte.c_str( ), &end, 16 );
+        if( *end != '\0' )
+            throw runtime_error( "not hex: " + byte );
+        out += (char)v;
+    }
+    return out;
+}
+
+void usage( const char* prog )
+{
+    cout << "Usage: " << prog << " PORT [options]" << endl
+        << "  PORT              Serial port of the board, e.g. /dev/ttyACM0" << endl
+        << "  --baud N          Baud rate (default " << ARDUINO_BAUD_RATE << ")" << endl
+        << "  --binary 0|1      Board sends binary packets (default " << ARDUINO_BINARY_SAMPLES << ")" << endl
+        << "  --ping-ms N       Ping board every N ms, 0 never (default 100)" << endl
+        << "  --socket PATH     Commands here (default " << ARDUINO_SOCK_PATH << ")" << endl
+        << "  --shm NAME        Latest state here (default " << ARDUINO_SHM_NAME << ")" << endl
+        << "  --control PATH    cam_server's clock sync (default " << CONTROL_SOCK_PATH << ")" << endl
+        << "  --dir DIR --prefix PREFIX  Write trial files from the start" << endl;
+}
+
+int main( int argc, char** argv )
+{
+    string device;
+    unsigned baud = ARDUINO_BAUD_RATE;
+    bool binary = ARDUINO_BINARY_SAMPLES;
+    unsigned pingMs = 100;
+    string sockPath = ARDUINO_SOCK_PATH;
+    string shmName = ARDUINO_SHM_NAME;
+    string controlPath = CONTROL_SOCK_PATH;
+    string dir, prefix;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if( arg == "--baud" && i + 1 < argc )
+            baud = atoi( argv[++i] );
+        else if( arg == "--binary" && i + 1 < argc )
+            binary = atoi( argv[++i] ) != 0;
+        else if( arg == "--ping-ms" && i + 1 < argc )
+            pingMs = atoi( argv[++i] );
+        else if( arg == "--socket" && i + 1 < argc )
+            sockPath = argv[++i];
+        else if( arg == "--shm" && i + 1 < argc )
+            shmName = argv[++i];
+        else if( arg == "--control" && i + 1 < argc )
+            controlPath = argv[++i];
+        else if( arg == "--dir" && i + 1 < argc )
+            dir = argv[++i];
+        else if( arg == "--prefix" && i + 1 < argc )
+            prefix = argv[++i];
+        else if( arg[0] != '-' && device.empty( ) )
+            device = arg;
+        else
+        {
+            usage( argv[0] );
+            return arg == "--help" || arg == "-h" ? 0 : -1;
+        }
+    }
+    if( device.empty( ) )
+    {
+        usage( argv[0] );
+        return -1;
+    }
+
+    SerialPort* port = NULL;
+    try
+    {
+        port = new SerialPort( device, baud );
+    }
+    catch( exception& e )
+    {
+        cout << "[ERROR] " << e.what( ) << endl;
+        return -1;
+    }
+    cout << "[INFO] Reading " << device << " at " << baud << " baud"
+        << (binary ? " (binary packets)" : "") << endl;
+
+    ShmLatestWriter<ArduinoState> shm( shmName, ARDUINO_STATE_MAGIC, ARDUINO_STATE_VERSION, baud );
+    SyncFeed sync( controlPath, 10 );
+    MessageLog messages;
+    TrialFiles files;
+    mutex filesMutex;
+    if( ! dir.empty( ) )
+        files.set_files( dir, prefix );
+
+    ArduinoState state;
+    memset( &state, 0, sizeof( state ) );
+    state.trial = -1;
+    shm.publish( state );
+
+    ControlServer control( sockPath );
+    control.add_command( "send", "send TEXT: write TEXT to the board"
+            , [&]( const vector<string>& args ) {
+                string text;
+                for (size_t i = 0; i < args.size( ); i++)
+                    text += (i > 0 ? " " : "") + args[i];
+                if( text.empty( ) || ! port->write_all( text.data( ), text.size( ) ) )
+                    throw runtime_error( "could not write to board" );
+                return string( "" );
+            } );
+    control.add_command( "sendhex", "sendhex HEX: write bytes to the board"
+            , [&]( const vector<string>& args ) {
+                string bytes = from_hex( args );
+                if( bytes.empty( ) || ! port->write_all( bytes.data( ), bytes.size( ) ) )
+                    throw runtime_error( "could not write to board" );
+                return string( "" );
+            } );
+    control.add_command( "files", "files DIR PREFIX: data lines to DIR/PREFIXtrial=N.dat"
+            , [&]( const vector<string>& args ) {
+                if( args.size( ) > 2 || args.empty( ) )
+                    throw runtime_error( "usage: files DIR PREFIX" );
+                lock_guard<mutex> lock( filesMutex );
+                files.set_files( args[0], args.size( ) > 1 ? args[1] : "" );
+                return files.path( 0 );
+            } );
+    control.add_command( "messages", "messages SEQ: lines other than data from SEQ on"
+            , [&]( const vector<string>& args ) {
+                vector<string> lines;
+                uint64_t next = messages.since( args.empty( ) ? 0 : strtoull( args[0].c_str( ), NULL, 10 ), lines );
+                string reply = to_string( next );
+                for (auto& l : lines)
+                    reply += "\t" + l;
+                return reply;
+            } );
+    control.add_command( "stats", "counters"
+            , [&]( const vector<string>& ) {
+                lock_guard<mutex> lock( filesMutex );
+                ostringstream os;
+                os << "lines " << state.lines << " bytes " << state.bytes
+                    << " errors " << state.errors << " written " << files.lines( )
+                    << " files " << files.files( ) << " file_errors " << files.errors( )
+                    << " sync_batches " << sync.sent( ) << " sync_lost " << sync.lost( )
+                    << " overruns " << port->overruns( );
+                return os.str( );
+            } );
+    control.start( );
+
+    signal( SIGINT, sig_handler );
+    signal( SIGTERM, sig_handler );
+    signal( SIGPIPE, SIG_IGN );
+
+    // Pings, and files to disk every second.
+    unsigned tickMs = pingMs > 0 ? pingMs : 1000;
+    int tick = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+    struct itimerspec its;
+    its.it_interval.tv_sec = tickMs / 1000;
+    its.it_interval.tv_nsec = (tickMs % 1000) * 1000000L;
+    its.it_value = its.it_interval;
+    timerfd_settime( tick, 0, &its, NULL );
+
+    int epoll = epoll_create1( EPOLL_CLOEXEC );
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = port->fd( );
+    epoll_ctl( epoll, EPOLL_CTL_ADD, port->fd( ), &ev );
+    ev.data.fd = tick;
+    epoll_ctl( epoll, EPOLL_CTL_ADD, tick, &ev );
+
+    WallClock wall;
+    LineSplitter splitter;
+    SampleDecoder decoder;
+    const uint64_t byteNs = port->byte_ns( );
+    uint64_t lastFlush = monotonic_ns( );
+
+    auto on_line = [&]( uint64_t host_ns, const char* line, size_t n ) {
+        sync.line( host_ns, line, n );
+        state.host_ns = host_ns;
+        state.lines += 1;
+        memcpy( state.line, line, n + 1 );
+        DataLine d;
+        if( ! parse_data_line( line, n, d ) )
+        {
+            messages.add( line, n );
+            return;
+        }
+        state.trial = d.trial;
+        state.camera = d.camera;
+        state.arduino_ms = d.ms;
+        if( d.trial >= 1 && files.enabled( ) )
+        {
+            char t[32];
+            size_t tn = wall.format( host_ns, t );
+            files.write( d.trial, t, tn, line, n );
+        }
+    };
+
+    int result = 0;
+    static char buf[1 << 16];
+    while( ! interrupted_ )
+    {
+        struct epoll_event ready[2];
+        int n = epoll_wait( epoll, ready, 2, 1000 );
+        if( n < 0 && errno != EINTR )
+        {
+            perror( "epoll_wait" );
+            result = -1;
+            break;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            if( ready[i].data.fd == tick )
+            {
+                uint64_t expirations;
+                if( read( tick, &expirations, sizeof( expirations ) ) < 0 )
+                    continue;
+                if( pingMs > 0 )
+                {
+                    uint64_t sent = monotonic_ns( );
+                    if( port->write_all( "?", 1 ) )
+                        sync.ping( sent );
+                }
+                if( monotonic_ns( ) - lastFlush >= 1000000000ull )
+                {
+                    lock_guard<mutex> lock( filesMutex );
+                    files.flush( );
+                    wall.sync( );
+                    lastFlush = monotonic_ns( );
+                }
+                continue;
+            }
+
+            ssize_t got;
+            while( (got = read( port->fd( ), buf, sizeof( buf ) )) > 0 )
+            {
+                uint64_t now = monotonic_ns( );
+                state.bytes += got;
+                lock_guard<mutex> lock( filesMutex );
+                if( binary )
+                {
+                    decoder.feed( (const uint8_t*)buf, got );
+                    SampleDecoder::Packet p;
+                    char line[SP_LINE_MAX];
+                    while( decoder.next( p ) )
+                    {
+                        size_t len = decoder.to_line( p, line, sizeof( line ) );
+                        if( len > 0 )
+                            on_line( now - decoder.pending( ) * byteNs, line, len );
+                    }
+                    state.errors = decoder.errors( );
+                }
+                else
+                {
+                    splitter.feed( buf, got, [&]( const char* line, size_t len, size_t after ) {
+                            on_line( now - after * byteNs, line, len );
+                            } );
+                    state.errors = splitter.dropped( );
+                }
+                shm.publish( state );
+            }
+            if( got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR) )
+            {
+                // Board unplugged (or reset by somebody closing the port).
+                cout << "[ERROR] " << device << ": "
+                    << (got == 0 ? "hung up" : strerror( errno )) << endl;
+                result = -1;
+                interrupted_ = 1;
+            }
+        }
+    }
+
+    control.stop( );
+    {
+        lock_guard<mutex> lock( filesMutex );
+        files.set_files( "", "" );
+    }
+    cout << "[INFO] " << state.lines << " lines, " << state.bytes << " bytes, "
+        << state.errors << " errors, " << files.lines( ) << " written to "
+        << files.files( ) << " files; driver overruns " << port->overruns( ) << endl;
+    close( epoll );
+    close( tick );
+    delete port;
+    return result;
+}
@@ -0,0 +1,393 @@
+#include "broadcast-server.h"
+#include "FrameSource.hpp"
+
+#include <iostream>
+#include <sstream>
+
+BroadcastServer::BroadcastServer(const string& socket_name, size_t max_queue)
+    : UnixServer(socket_name), max_queue_(max_queue), epoll_(-1), event_(-1),
+      stop_(false), num_clients_(0), header_size_(0), blocked_(0) {
+    server_ = -1;
+}
+
+BroadcastServer::~BroadcastServer() {
+    stop();
+}
+
+bool
+BroadcastServer::start() {
+    create();
+
+    // accept() must never block the server thread
+    fcntl(server_, F_SETFL, fcntl(server_, F_GETFL) | O_NONBLOCK);
+
+    epoll_ = epoll_create1(EPOLL_CLOEXEC);
+    event_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_ < 0 || event_ < 0) {
+        perror("epoll/eventfd");
+        return false;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = server_;
+    epoll_ctl(epoll_, EPOLL_CTL_ADD, server_, &ev);
+    ev.data.fd = event_;
+    epoll_ctl(epoll_, EPOLL_CTL_ADD, event_, &ev);
+
+    thread_ = std::thread(&BroadcastServer::serve, this);
+    return true;
+}
+
+void
+BroadcastServer::stop() {
+    if (thread_.joinable()) {
+        stop_ = true;
+        uint64_t one = 1;
+        if (write(event_, &one, sizeof(one)) < 0)
+            perror("eventfd");
+        thread_.join();
+    }
+
+    for (auto& c : clients_) {
+        cout << "[INFO] Subscriber " << c.first << ": sent=" << c.second->sent
+             << " dropped=" << c.second->dropped << endl;
+        close(c.first);
+    }
+    clients_.clear();
+    num_clients_ = 0;
+
+    if (event_ >= 0)
+        close(event_);
+    if (epoll_ >= 0)
+        close(epoll_);
+    event_ = epoll_ = -1;
+    if (server_ >= 0) {
+        close(server_);
+        close_socket();
+    }
+    server_ = -1;
+}
+
+bool
+BroadcastServer::broadcast(const void* data, size_t size) {
+    return broadcast(NULL, 0, data, size);
+}
+
+bool
+BroadcastServer::broadcast(const void* header, size_t header_size, const void* data,
+                           size_t size) {
+    FramePtr frame = get_buffer(header_size + size);
+    if (header_size > 0)
+        memcpy(frame->bytes.data(), header, header_size);
+    memcpy(frame->bytes.data() + header_size, data, size);
+    frame->queued_ns = monotonic_ns();
+    header_size_ = header_size;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        pending_.push_back(frame);
+    }
+    // wake the server thread; it hands the frame to every subscriber
+    uint64_t one = 1;
+    if (write(event_, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        return false;
+    return true;
+}
+
+void
+BroadcastServer::print_stats(std::ostream& os) {
+    std::lock_guard<std::mutex> lock(clients_mutex_);
+    os << "[STAT] subscribers=" << clients_.size() << " blocked=" << blocked_;
+    for (auto& c : clients_)
+        os << " [" << c.first << " sent=" << c.second->sent
+           << " dropped=" << c.second->dropped << "]";
+    os << endl;
+}
+
+FramePtr
+BroadcastServer::get_buffer(size_t size) {
+    // a buffer nobody but the pool refers to is free
+    for (auto& b : pool_) {
+        if (b.use_count() == 1 && b->bytes.size() == size) {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return b;
+        }
+    }
+    FramePtr b = std::make_shared<FrameBuffer>(size);
+    // keep as many as may be queued on a lossless subscriber; beyond that
+    // buffers are not recycled
+    if (pool_.size() < max_queue_ + 16)
+        pool_.push_back(b);
+    return b;
+}
+
+void
+BroadcastServer::serve() {
+    const int maxevents = 64;
+    struct epoll_event events[maxevents];
+
+    while (not stop_) {
+        int n = epoll_wait(epoll_, events, maxevents, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == server_) {
+                accept_clients();
+                continue;
+            }
+            if (fd == event_) {
+                uint64_t count;
+                if (read(event_, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                    perror("eventfd");
+                distribute();
+                continue;
+            }
+
+            auto it = clients_.find(fd);
+            if (it == clients_.end())
+                continue;
+            Subscriber* sub = it->second.get();
+            if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                drop_client(sub, "hung up");
+                continue;
+            }
+            if (events[i].events & EPOLLIN)
+                read_requests(sub);
+            if (events[i].events & EPOLLOUT)
+                flush(sub);
+        }
+        remove_closed();
+    }
+}
+
+void
+BroadcastServer::close_socket() {
+    UnixServer::close_socket();
+}
+
+void
+BroadcastServer::accept_clients() {
+    int client;
+    while ((client = accept4(server_, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        std::unique_ptr<Subscriber> sub(new Subscriber());
+        sub->fd = client;
+        sub->policy = LOSSLESS;
+        sub->nth = 1;
+        sub->seen = 0;
+        sub->raw = false;
+        sub->offset = 0;
+        sub->want_out = false;
+        sub->dead = false;
+        sub->sent = 0;
+        sub->dropped = 0;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = client;
+        epoll_ctl(epoll_, EPOLL_CTL_ADD, client, &ev);
+
+        std::lock_guard<std::mutex> lock(clients_mutex_);
+        clients_[client] = std::move(sub);
+        num_clients_ = clients_.size();
+        cout << "[INFO] Subscriber " << client << " connected (" << num_clients_
+             << " total)" << endl;
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+        perror("accept");
+}
+
+void
+BroadcastServer::read_requests(Subscriber* sub) {
+    while (true) {
+        int nread = recv(sub->fd, buf_, buflen_, 0);
+        if (nread < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                drop_client(sub, strerror(errno));
+            break;
+        } else if (nread == 0) {
+            drop_client(sub, "closed connection");
+            return;
+        }
+        sub->request.append(buf_, nread);
+    }
+
+    size_t pos;
+    while ((pos = sub->request.find("\n")) != string::npos) {
+        string line = sub->request.substr(0, pos);
+        sub->request.erase(0, pos + 1);
+        if (line.compare(0, 4, "ack ") == 0) {
+            if (not ack(line))
+                cout << "[WARN] Subscriber " << sub->fd << ": bad ack '" << line << "'" << endl;
+            continue;
+        }
+        if (not set_policy(sub, line))
+            cout << "[WARN] Subscriber " << sub->fd << ": bad request '" << line
+                 << "'. Expected lossless, latest, nth N or raw" << endl;
+    }
+    // nobody sends long requests
+    if (sub->request.size() > 1024)
+        drop_client(sub, "garbage request");
+}
+
+bool
+BroadcastServer::set_policy(Subscriber* sub, const string& line) {
+    std::istringstream is(line);
+    string word;
+    is >> word;
+    if (word == "lossless")
+        sub->policy = LOSSLESS;
+    else if (word == "latest")
+        sub->policy = LATEST;
+    else if (word == "raw")
+        sub->raw = true;
+    else if (word == "nth") {
+        int n = 0;
+        if (not (is >> n) or n < 1)
+            return false;
+        sub->policy = NTH;
+        sub->nth = n;
+    } else
+        return false;
+    cout << "[INFO] Subscriber " << sub->fd << " wants " << line << endl;
+    return true;
+}
+
+bool
+BroadcastServer::ack(const string& line) {
+    std::istringstream is(line.substr(4));
+    uint64_t host_ns = 0;
+    if (not (is >> host_ns))
+        return false;
+    ack_latency_.record_diff(monotonic_ns(), host_ns);
+    return true;
+}
+
+void
+BroadcastServer::distribute() {
+    std::vector<FramePtr> frames;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        frames.swap(pending_);
+    }
+
+    for (auto& c : clients_) {
+        Subscriber* sub = c.second.get();
+        for (auto& f : frames)
+            enqueue(sub, f);
+        flush(sub);
+    }
+}
+
+void
+BroadcastServer::enqueue(Subscriber* sub, const FramePtr& frame) {
+    if (sub->dead)
+        return;
+
+    // a frame which is partly written must be finished first
+    size_t busy = sub->offset > skip(sub) ? 1 : 0;
+
+    switch (sub->policy) {
+    case LOSSLESS:
+        if (sub->queue.size() >= max_queue_) {
+            drop_client(sub, "too slow for lossless");
+            return;
+        }
+        break;
+    case LATEST:
+        if (sub->queue.size() > busy) {
+            sub->dropped += sub->queue.size() - busy;
+            sub->queue.resize(busy);
+        }
+        break;
+    case NTH:
+        if (sub->seen++ % sub->nth != 0)
+            return;
+        if (sub->queue.size() >= max_queue_) {
+            sub->dropped += 1;
+            return;
+        }
+        break;
+    }
+    sub->queue.push_back(frame);
+}
+
+void
+BroadcastServer::flush(Subscriber* sub) {
+    while (not sub->dead and not sub->queue.empty()) {
+        const FrameBuffer& frame = *sub->queue.front();
+        if (sub->offset < skip(sub))
+            sub->offset = skip(sub);
+        ssize_t nwritten = send(sub->fd, frame.bytes.data() + sub->offset,
+                                frame.bytes.size() - sub->offset, MSG_NOSIGNAL);
+        if (nwritten < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                drop_client(sub, strerror(errno));
+            else if (sub->queue.size() > 1)
+                blocked_ += 1;
+            break;
+        }
+        sub->offset += nwritten;
+        if (sub->offset == frame.bytes.size()) {
+            send_latency_.record_diff(monotonic_ns(), frame.queued_ns);
+            sub->queue.pop_front();
+            sub->offset = 0;
+            sub->sent += 1;
+        }
+    }
+    update_interest(sub);
+}
+
+size_t
+BroadcastServer::skip(const Subscriber* sub) const {
+    return sub->raw ? header_size_.load() : 0;
+}
+
+void
+BroadcastServer::update_interest(Subscriber* sub) {
+    if (sub->dead)
+        return;
+    // ask for EPOLLOUT only while something is pending, else we spin
+    bool want = not sub->queue.empty();
+    if (want == sub->want_out)
+        return;
+    struct epoll_event ev;
+    ev.events = EPOLLIN | (want ? EPOLLOUT : 0);
+    ev.data.fd = sub->fd;
+    epoll_ctl(epoll_, EPOLL_CTL_MOD, sub->fd, &ev);
+    sub->want_out = want;
+}
+
+void
+BroadcastServer::drop_client(Subscriber* sub, const string& reason) {
+    if (sub->dead)
+        return;
+    sub->dead = true;
+    cout << "[INFO] Subscriber " << sub->fd << " " << reason << ": sent=" << sub->sent
+         << " dropped=" << sub->dropped << ". Disconnecting" << endl;
+    closing_.push_back(sub);
+}
+
+void
+BroadcastServer::remove_closed() {
+    if (closing_.empty())
+        return;
+    std::lock_guard<std::mutex> lock(clients_mutex_);
+    for (auto sub : closing_) {
+        int fd = sub->fd;
+        epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, NULL);
+        close(fd);
+        clients_.erase(fd);
+    }
+    closing_.clear();
+    num_clients_ = clients_.size();
+}
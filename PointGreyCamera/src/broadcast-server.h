@@ -0,0 +1,127 @@
+#pragma once
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include "unix-server.h"
+#include "LatencyHistogram.hpp"
+
+// Frames are copied once into a shared buffer which is queued on every
+// subscriber; the buffer goes back to the pool when the last subscriber has
+// sent it.
+struct FrameBuffer {
+    std::vector<unsigned char> bytes;
+    uint64_t queued_ns;         // CLOCK_MONOTONIC when broadcast() got it
+
+    FrameBuffer(size_t size) : bytes(size), queued_ns(0) {}
+};
+typedef std::shared_ptr<FrameBuffer> FramePtr;
+
+// How a subscriber wants frames when it can't keep up. A subscriber selects
+// its policy by sending one of these lines; without one it is lossless.
+//
+//   lossless      every frame; disconnected when max_queue frames are pending
+//   latest        only the newest frame; older pending frames are dropped
+//   nth N         every Nth frame; dropped when max_queue frames are pending
+//
+// Frames go out with their header (see FrameHeader.hpp); 'raw' asks for the
+// pixels only, which is what clients older than the header expect. A
+// subscriber may send 'ack HOST_NS' with host_ns of a header once it is done
+// with the frame; the server keeps a histogram of camera-to-ack latency.
+enum Policy { LOSSLESS, LATEST, NTH };
+
+struct Subscriber {
+    int fd;
+    Policy policy;
+    unsigned int nth;
+    uint64_t seen;
+    bool raw;                   // skip the header of every frame
+
+    std::deque<FramePtr> queue;
+    size_t offset;              // bytes of queue.front() already sent
+    bool want_out;              // EPOLLOUT registered
+    bool dead;                  // removed at the end of this epoll round
+    string request;
+
+    std::atomic<uint64_t> sent;
+    std::atomic<uint64_t> dropped;
+};
+
+class BroadcastServer : public UnixServer {
+
+public:
+    BroadcastServer(const string& socket_name, size_t max_queue);
+    ~BroadcastServer();
+
+    // create the socket and serve subscribers on a thread of their own
+    bool start();
+    void stop();
+
+    // queue a frame for all subscribers; never blocks on a subscriber
+    bool broadcast(const void* data, size_t size);
+    // same, header followed by data; 'raw' subscribers get data only
+    bool broadcast(const void* header, size_t header_size, const void* data, size_t size);
+
+    size_t num_clients() const { return num_clients_; }
+    void print_stats(std::ostream&);
+
+    // broadcast() to last byte written, per subscriber and frame
+    const LatencyHistogram& send_latency() const { return send_latency_; }
+    // host_ns of frame to its ack
+    const LatencyHistogram& ack_latency() const { return ack_latency_; }
+    // times a subscriber's socket was full with whole frames waiting behind
+    uint64_t blocked() const { return blocked_; }
+
+protected:
+    void serve();
+    void close_socket();
+
+private:
+    void accept_clients();
+    void read_requests(Subscriber*);
+    bool set_policy(Subscriber*, const string&);
+    bool ack(const string&);
+    void distribute();
+    void enqueue(Subscriber*, const FramePtr&);
+    void flush(Subscriber*);
+    void update_interest(Subscriber*);
+    size_t skip(const Subscriber*) const;
+    void drop_client(Subscriber*, const string&);
+    void remove_closed();
+    FramePtr get_buffer(size_t);
+
+    size_t max_queue_;
+    int epoll_;
+    int event_;
+
+    std::thread thread_;
+    std::atomic<bool> stop_;
+    std::atomic<size_t> num_clients_;
+    // header size of the frames being broadcast
+    std::atomic<size_t> header_size_;
+
+    LatencyHistogram send_latency_;
+    LatencyHistogram ack_latency_;
+    std::atomic<uint64_t> blocked_;
+
+    // written by broadcast(), drained by the server thread
+    std::mutex pending_mutex_;
+    std::vector<FramePtr> pending_;
+    // only touched by the thread calling broadcast()
+    std::vector<FramePtr> pool_;
+
+    // held when adding/removing subscribers and by print_stats()
+    std::mutex clients_mutex_;
+    std::map<int, std::unique_ptr<Subscriber> > clients_;
+    std::vector<Subscriber*> closing_;
+};
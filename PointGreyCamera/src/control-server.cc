@@ -0,0 +1,101 @@
+#include "control-server.h"
+
+#include <sstream>
+#include <stdexcept>
+
+ControlServer::ControlServer(const string& socket_name)
+    : UnixServer(socket_name), client_(-1), stop_(false) {
+    server_ = -1;
+    add_command("help", "list commands", [this](const std::vector<string>&) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        string reply;
+        for (auto& c : commands_)
+            reply += c.first + " (" + c.second.help + "); ";
+        return reply;
+    });
+}
+
+ControlServer::~ControlServer() {
+    stop();
+}
+
+void
+ControlServer::add_command(const string& name, const string& help, Handler handler) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    commands_[name] = Command{help, handler};
+}
+
+bool
+ControlServer::start() {
+    create();
+    thread_ = std::thread(&ControlServer::serve, this);
+    return true;
+}
+
+void
+ControlServer::stop() {
+    if (not thread_.joinable())
+        return;
+    stop_ = true;
+    // wake accept() and the recv() of a connected client
+    shutdown(server_, SHUT_RDWR);
+    int client = client_;
+    if (client >= 0)
+        shutdown(client, SHUT_RDWR);
+    thread_.join();
+    close(server_);
+    close_socket();
+    server_ = -1;
+}
+
+void
+ControlServer::handle(int client) {
+    client_ = client;
+    Server::handle(client);
+    client_ = -1;
+    if (stop_)
+        shutdown(server_, SHUT_RDWR);
+}
+
+string
+ControlServer::process(const string& request) {
+    // a request may carry more than one line
+    string response;
+    std::istringstream lines(request);
+    string line;
+    while (std::getline(lines, line)) {
+        if (not line.empty() and line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+        if (line.empty())
+            continue;
+        response += run(line) + "\n";
+    }
+    return response;
+}
+
+string
+ControlServer::run(const string& line) {
+    std::istringstream is(line);
+    std::vector<string> words;
+    string w;
+    while (is >> w)
+        words.push_back(w);
+    if (words.empty())
+        return "ERR empty command";
+
+    Handler handler;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = commands_.find(words[0]);
+        if (it == commands_.end())
+            return "ERR unknown command " + words[0] + "; try help";
+        handler = it->second.handler;
+    }
+
+    try {
+        string reply = handler(std::vector<string>(words.begin() + 1, words.end()));
+        return reply.empty() ? "OK" : "OK " + reply;
+    } catch (std::exception& e) {
+        return string("ERR ") + e.what();
+    }
+}
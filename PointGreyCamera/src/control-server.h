@@ -0,0 +1,54 @@
+#pragma once
+
+#include <sys/socket.h>
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "unix-server.h"
+
+// Line protocol to control cam_server while it runs, e.g.
+//
+//   $ echo "trial 3" | socat - UNIX-CONNECT:/tmp/eye_blink_control
+//   OK recording trial 3
+//
+// Every request line gets exactly one reply line starting with OK or ERR.
+// Commands are registered by whoever owns the thing being controlled.
+class ControlServer : public UnixServer {
+
+public:
+    // gets the words of the request after the command; returns the reply
+    // (without OK); throws runtime_error to reply ERR
+    typedef std::function<string(const std::vector<string>&)> Handler;
+
+    ControlServer(const string& socket_name);
+    ~ControlServer();
+
+    void add_command(const string& name, const string& help, Handler handler);
+
+    // serve clients (one at a time) on a thread of their own
+    bool start();
+    void stop();
+
+protected:
+    void handle(int);
+    string process(const string&);
+
+private:
+    string run(const string& line);
+
+    struct Command {
+        string help;
+        Handler handler;
+    };
+
+    std::mutex mutex_;
+    std::map<string, Command> commands_;
+    std::thread thread_;
+    std::atomic<int> client_;
+    std::atomic<bool> stop_;
+};
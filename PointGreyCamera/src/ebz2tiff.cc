@@ -0,0 +1,61 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  ebz2tiff.cc
+ *
+ *    Description:  Decode trial_%03d.ebz (cam_server --record-format ebz) to
+ *    the multi-page tiff the analysis scripts read.
+ *
+ *      $ ./ebz2tiff trial_001.ebz [trial_001.tif]
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <iostream>
+#include <vector>
+
+#include "TiffWriter.hpp"
+#include "FrameCodec.hpp"
+
+using namespace std;
+
+int main( int argc, char** argv )
+{
+    if( argc < 2 )
+    {
+        cout << "Usage: " << argv[0] << " trial.ebz [trial.tif]" << endl;
+        return -1;
+    }
+
+    string in = argv[1];
+    string out = argc > 2 ? argv[2] : in.substr( 0, in.rfind( '.' ) ) + ".tif";
+
+    CodecFileReader reader( in );
+    if( ! reader.is_open( ) )
+    {
+        cout << "[ERROR] " << in << " is not an ebz file" << endl;
+        return -1;
+    }
+
+    TiffWriter writer( out, reader.width( ), reader.height( ) );
+    if( ! writer.is_open( ) )
+    {
+        cout << "[ERROR] Could not open " << out << " for writing" << endl;
+        return -1;
+    }
+
+    vector<uint8_t> frame( reader.width( ) * reader.height( ) );
+    while( reader.next( &frame[0] ) )
+        if( ! writer.write( &frame[0] ) )
+        {
+            cout << "[ERROR] Failed to write " << out << endl;
+            return -1;
+        }
+
+    cout << "[INFO] Wrote " << writer.pages( ) << " frames to " << out << endl;
+    return 0;
+}
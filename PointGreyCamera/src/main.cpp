@@ -1,517 +1,1188 @@
-#include "Spinnaker.h"
-#include "SpinGenApi/SpinnakerGenApi.h"
 #include <iostream>
 #include <sstream>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/un.h>
+#include <sys/stat.h>
 #include <error.h>
-#include "Streamer.hpp"
+#include <signal.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
 #include <chrono>
 #include <exception>
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <fstream>
+#include <vector>
+#include <memory>
+
+#ifdef TEST_WITH_CV
 #include <opencv2/highgui/highgui.hpp>
+#endif
 
 #include "config.h"
+#include "FrameSource.hpp"
+#include "SyntheticSource.hpp"
+#include "Acquisition.hpp"
+#include "ShmTransport.hpp"
+#include "FrameHeader.hpp"
+#include "broadcast-server.h"
+#include "control-server.h"
+#include "BlinkDetector.hpp"
+#include "PixelUnpack.hpp"
+#include "SubStreams.hpp"
+#include "MotionEnergy.hpp"
+#include "EyeTracker.hpp"
+#include "ClockSync.hpp"
+
+// libtiff must come before Spinnaker: Spinnaker headers pull Spinnaker::TIFF
+// into global namespace.
+#ifdef HAVE_TIFF
+#include "TiffReplaySource.hpp"
+#include "TrialRecorder.hpp"
+#endif
+
+#ifdef USE_SPINNAKER
+#include "SpinnakerSource.hpp"
+#endif
 
 using namespace std::chrono;
-using namespace cv;
+using namespace std;
 
+volatile sig_atomic_t interrupted_ = 0;         /* Set on Ctrl+C */
 
-using namespace Spinnaker;
-using namespace Spinnaker::GenApi;
-using namespace Spinnaker::GenICam;
-using namespace std;
+typedef BlinkDetector<FRAME_WIDTH, FRAME_HEIGHT> Blink;
+Blink* blink_ = NULL;                           /* NULL with --no-blink */
 
-int total_frames_ = 0;
-int socket_ = -1;                               /* Socket descriptor */
-float fps_ = 0.0;                               /* Frame per second. */
+/* Keeps blink_'s ROI on the eye; NULL with --no-track, see 'eye' */
+EyeTracker* eye_ = NULL;
 
-SystemPtr system_;
-CameraList cam_list_;
+/* Crop of camera 0 goes where the eye goes, unless --crop was given */
+bool crop_follows_eye_ = false;
 
+/* 12/16 bit frames of camera k to Mono8; set by main, see 'window' */
+vector<PixelConverter*> converters_;
 
-void sig_handler( int s )
+/* Preview and crop of camera k; set by main, see 'crop' */
+vector<SubStreams*> substreams_;
+
+/* Motion energy of camera k, in Frame::motion; set by main, none with --no-motion */
+vector<MotionEnergy*> motions_;
+
+/* Arduino and camera clocks; lines come on CONTROL_SOCK_PATH, see add_sync_commands */
+ClockSync* sync_ = NULL;
+
+#ifdef HAVE_TIFF
+/* Trials to tiff, one per camera; see add_recorder_commands */
+vector<TrialRecorder*> recorders_;
+#endif
+
+/* What 'stats' reports on, per camera; set by AcquireImages while it runs. */
+std::mutex stats_mutex_;
+vector<Acquisition*> acqs_;
+vector<BroadcastServer*> servers_;
+
+/* Stats, status and stage names of camera k > 0 start with this. */
+string camera_prefix( size_t k )
 {
-    cout << "Got keyboard interrupt. Removing socket" << endl;
-    close( socket_ );
-    remove( SOCK_PATH );
-    throw runtime_error( "Ctrl+C pressed" );
+    return k == 0 ? "" : "cam" + to_string( k ) + " ";
 }
 
-// This function returns the camera to its default state by re-enabling automatic
-// exposure.
-int ResetExposure(INodeMap & nodeMap)
+/* Socket path or shm name of camera k; camera 0 keeps the plain one. */
+string channel_name( const string& base, size_t k )
 {
-        int result = 0;
-        try
-        {
-                // 
-                // Turn automatic exposure back on
-                //
-                // *** NOTES ***
-                // Automatic exposure is turned on in order to return the camera to its 
-                // default state.
-                //
-                CEnumerationPtr ptrExposureAuto = nodeMap.GetNode("ExposureAuto");
-                if (!IsAvailable(ptrExposureAuto) || !IsWritable(ptrExposureAuto))
-                {
-                        cout << "Unable to enable automatic exposure (node retrieval). Non-fatal error..." << endl << endl;
-                        return -1;
-                }
-        
-                CEnumEntryPtr ptrExposureAutoContinuous = ptrExposureAuto->GetEntryByName("Continuous");
-                if (!IsAvailable(ptrExposureAutoContinuous) || !IsReadable(ptrExposureAutoContinuous))
-                {
-                        cout << "Unable to enable automatic exposure (enum entry retrieval). Non-fatal error..." << endl << endl;
-                        return -1;
-                }
-                ptrExposureAuto->SetIntValue(ptrExposureAutoContinuous->GetValue());
-                cout << "Automatic exposure enabled..." << endl << endl;
-        }
-        catch (Spinnaker::Exception &e)
-        {
-                cout << "Error: " << e.what() << endl;
-                result = -1;
-        }
-        return result;
+    return k == 0 ? base : base + "_cam" + to_string( k );
+}
+
+/* Where camera k records (and replays) trials: camK under dir of camera 0. */
+string camera_dir( const string& dir, size_t k )
+{
+    return k == 0 ? dir : dir + "/cam" + to_string( k );
 }
 
 /**
- * @brief Write data to socket.
+ * @brief Latency of every stage and counters at some instant. Latency
+ * stages, in the order a frame goes through them:
+ *
+ *   camera   camera timestamp to GetNextImage return (above least delay seen)
+ *   queue    GetNextImage return to frame handed to transport
+ *   send     handed to socket to last byte written, per subscriber
+ *   ack      GetNextImage return to subscriber's ack, i.e. end to end
+ *
+ * and of the Arduino link (ClockSync.hpp):
  *
- * @param data
- * @param size
+ *   ping     host writes ping to reply read
+ *   ttl      CAMERA_TTL_PIN edge to its report read, by the clock fit
  *
- * @return 
+ * Stages of camera k > 0 are named e.g. "cam1 queue"; counters are summed
+ * over cameras.
  */
-int write_data( void* data, size_t width, size_t height )
+struct Stats
 {
-    // If socket_ is not set, don't try to write.
-    if( socket_ == 0 )
-        return 0;
+    vector<pair<string, LatencyCounts> > latency;
+    uint64_t captured, incomplete, overruns, dropped, blocked;
 
-    Mat img(height, width, CV_8UC1, data );
-    data = img.data;
+    Stats( ) : captured( 0 ), incomplete( 0 ), overruns( 0 ), dropped( 0 ), blocked( 0 )
+    { }
+};
 
-#ifdef TEST_WITH_CV
-    imshow( "MyImg", img );
-    waitKey( 10 );
-#else
-    try 
+Stats take_stats( )
+{
+    Stats s;
+    std::lock_guard<std::mutex> lock( stats_mutex_ );
+    for (size_t k = 0; k < acqs_.size( ); k++)
     {
-        if( write( socket_, data,  width * height ) == -1 )
-            throw runtime_error( strerror( errno ) );
-    } 
-    catch ( exception & e )
+        const PipelineStats& p = acqs_[k]->stats( );
+        s.latency.push_back( make_pair( camera_prefix( k ) + "camera", p.camera.snapshot( ) ) );
+        s.latency.push_back( make_pair( camera_prefix( k ) + "queue", p.queue.snapshot( ) ) );
+        s.captured += p.captured;
+        s.incomplete += p.incomplete;
+        s.overruns += p.overruns;
+        s.dropped += p.dropped;
+    }
+    for (size_t k = 0; k < servers_.size( ); k++)
     {
-        throw runtime_error( "Error in writing" );
+        BroadcastServer* server = servers_[k];
+        s.latency.push_back( make_pair( camera_prefix( k ) + "send", server->send_latency( ).snapshot( ) ) );
+        s.latency.push_back( make_pair( camera_prefix( k ) + "ack", server->ack_latency( ).snapshot( ) ) );
+        s.blocked += server->blocked( );
     }
-#endif
-    return 0;
+    if( sync_ )
+    {
+        s.latency.push_back( make_pair( "ping", sync_->rtt( ).snapshot( ) ) );
+        s.latency.push_back( make_pair( "ttl", sync_->ttl_lag( ).snapshot( ) ) );
+    }
+    return s;
 }
 
-int create_socket( bool waitfor_client = true )
+/**
+ * @brief Stats of what happened since 'since' (e.g. start of a trial); one
+ * entry per stage and one of counters.
+ */
+vector<string> describe( const Stats& now, const Stats& since = Stats( ) )
 {
-    int s, s2, len;
-    struct sockaddr_un local, remote;
-
-    if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
-        perror("socket");
-        exit(1);
+    vector<string> lines;
+    for (size_t i = 0; i < now.latency.size( ); i++)
+    {
+        LatencyCounts c = now.latency[i].second;
+        if( i < since.latency.size( ) )
+            c = c - since.latency[i].second;
+        lines.push_back( now.latency[i].first + " " + c.summary( ) );
     }
+    ostringstream os;
+    os << "captured=" << now.captured - since.captured
+        << " incomplete=" << now.incomplete - since.incomplete
+        << " overruns=" << now.overruns - since.overruns
+        << " dropped=" << now.dropped - since.dropped
+        << " blocked=" << now.blocked - since.blocked;
+    lines.push_back( os.str( ) );
+    return lines;
+}
 
-    local.sun_family = AF_UNIX;
-    cout << "[INFO] Creating socket " << SOCK_PATH << endl;
-    strcpy(local.sun_path, SOCK_PATH);
-    
-    remove(local.sun_path);
-    len = strlen(local.sun_path) + sizeof(local.sun_family);
-    if (bind(s, (struct sockaddr *)&local, len) == -1) {
-        perror("bind");
-        exit(1);
-    }
+string join( const vector<string>& lines, const string& sep )
+{
+    string s;
+    for( auto& l : lines )
+        s += (s.empty( ) ? "" : sep) + l;
+    return s;
+}
 
-    if (listen(s, 5) == -1) {
-        perror("listen");
-        exit(1);
-    }
+#ifdef HAVE_TIFF
+Stats trial_stats_;                             /* Taken when trial began. */
+int trial_ = -1;
 
+std::mutex stats_log_mutex_;
+vector<pair<string, string> > stats_log_;      /* File, line; see flush_stats_log( ) */
 
-    // There is no point continuing if there is not one to read the data.
-    while( true )
-    {
-        if( ! waitfor_client )
-            return 0;
-        int done, n;
-        cout << "Waiting for a connection..." << endl;
-        socklen_t t = sizeof(remote);
-        if( (s2 = accept(s, (struct sockaddr *)&remote, &t)) == -1 )
-        {
-            perror("accept");
-            exit(1);
-        }
-
-        cout << "Connected." << endl;
-        break;
-    }
-
-    // Assign to global value.
-    socket_ = s2;
-    return s2;
+/**
+ * @brief Stats of a trial (or session) go to latency.txt next to its frames.
+ * Trials start and stop on a TTL edge, on the thread feeding arduino lines,
+ * which should not wait on files; the line is only queued here.
+ */
+void log_stats( const string& what, const Stats& since )
+{
+    string line = what + ": " + join( describe( take_stats( ), since ), "; " );
+    std::lock_guard<std::mutex> lock( stats_log_mutex_ );
+    stats_log_.push_back( make_pair( recorders_[0]->dir( ) + "/latency.txt", line ) );
 }
 
-#if 0
-void configure_camera( CameraPtr pCam )
+/* Append the lines log_stats( ) queued; on the main thread. */
+void flush_stats_log( )
 {
-    cout << "Max width: " << pCam->Width << endl;
-    //cout << "Max height: " << pCam->Height.GetValue( ) << endl;
+    vector<pair<string, string> > lines;
+    {
+        std::lock_guard<std::mutex> lock( stats_log_mutex_ );
+        lines.swap( stats_log_ );
+    }
+    for( auto& l : lines )
+    {
+        ofstream out( l.first.c_str( ), ios::app );
+        if( ! out )
+            cout << "[WARN] Can't write " << l.first << endl;
+        out << l.second << endl;
+    }
 }
 #endif
 
 
-int AcquireImages(CameraPtr pCam, INodeMap & nodeMap , INodeMap & nodeMapTLDevice , int socket )
+void sig_handler( int s )
+{
+    // Acquisition loop checks this flag and cleans up (closes socket, stops
+    // the camera). Don't do anything fancy in signal handler.
+    interrupted_ = 1;
+}
+
+/**
+ * @brief Ctrl+C (and kill) stop acquisition through interrupted_.
+ */
+void install_signal_handlers( )
 {
     signal( SIGINT, sig_handler );
-    int result = 0;
-    try
-    {
+    // So that the shared memory ring and socket are removed when killed.
+    signal( SIGTERM, sig_handler );
+    // A subscriber going away should not kill us.
+    signal( SIGPIPE, SIG_IGN );
+}
 
-        auto startTime = system_clock::now();
+/* Blink ROI, and crop of camera 0, onto the box the tracker found. */
+void follow_eye( )
+{
+    EyeTracker::Box b = eye_->box( );
+    blink_->set_roi( b[0], b[1], b[2], b[3] );
+    if( crop_follows_eye_ && ! substreams_.empty( ) && substreams_[0]->has_crop( ) )
+        substreams_[0]->set_crop( b[0], b[1], b[2], b[3] );
+}
 
-#if 1
-        CEnumerationPtr ptrAcquisitionMode = nodeMap.GetNode("AcquisitionMode");
-        if (!IsAvailable(ptrAcquisitionMode) || !IsWritable(ptrAcquisitionMode))
+/**
+ * @brief Acquire frames from every source and hand them to its sink till
+ * user presses Ctrl+C or a source runs out of frames. Each camera's frames
+ * are captured and sent by threads of their own (see Acquisition.hpp); this
+ * thread only prints the counters now and then.
+ *
+ * @param sources One per camera; camera k is sources[k].
+ * @param sinks Hands a frame of camera k to subscribers or shared memory of
+ * that camera. Frames of a trial being recorded go to recorders_[k] first;
+ * substreams_[k] derives preview and crop after.
+ * @param servers Subscribers of each camera, if any; only for stats.
+ *
+ * @return 0 on success, -1 otherwise.
+ */
+int AcquireImages( const vector<FrameSource*>& sources, const vector<Acquisition::Sink>& sinks
+        , const vector<BroadcastServer*>& servers = vector<BroadcastServer*>( ) )
+{
+    vector<unique_ptr<Acquisition> > acqs;
+    for (size_t k = 0; k < sources.size( ); k++)
+    {
+        Acquisition::Sink sink = sinks[k];
+        if( k < substreams_.size( ) )
         {
-            cout << "Unable to set acquisition mode to continuous " 
-                << " (enum retrieval). Aborting..." << endl << endl;
-            return -1;
+            // After the frame went out at full rate; preview and crop are
+            // cheap and on their own channels.
+            SubStreams* sub = substreams_[k];
+            sink = [sink, sub]( const Frame& f ) {
+                bool ok = sink( f );
+                sub->process( f );
+                return ok;
+            };
         }
-
-        // Retrieve entry node from enumeration node
-        CEnumEntryPtr ptrAcquisitionModeContinuous = ptrAcquisitionMode->GetEntryByName("Continuous");
-        if (!IsAvailable(ptrAcquisitionModeContinuous) || !IsReadable(ptrAcquisitionModeContinuous))
+#ifdef HAVE_TIFF
+        if( k < recorders_.size( ) )
         {
-            cout << "Unable to set acquisition mode to continuous " << 
-                " (entry retrieval). Aborting..." << endl << endl;
-            return -1;
+            TrialRecorder* recorder = recorders_[k];
+            sink = [sink, recorder]( const Frame& f ) {
+                recorder->record( f );
+                return sink( f );
+            };
         }
-
-        // Retrieve integer value from entry node
-        int64_t acquisitionModeContinuous = ptrAcquisitionModeContinuous->GetValue();
-
-        // Set integer value from entry node as new value of enumeration node
-        ptrAcquisitionMode->SetIntValue(acquisitionModeContinuous);
-        cout << "Acquisition mode set to continuous..." << endl;
-
-        // Change the acquition frame rate.
-
-#else
-        // This section does not work.
-        CEnumerationPtr pAcquisitionMode = nodeMap.GetNode( "AcquisitionMode" );
-        pAcquisitionMode->SetIntValue( AcquisitionMode_MultiFrame );
-        CIntegerPtr pAcquitionFrameCount = nodeMap.GetNode( "AcquisitionBurstFrameCount" );
-        pAcquitionFrameCount->SetValue( 3 );
-        cout << "Frame per fetch " << pAcquitionFrameCount->GetValue( ) << endl;
 #endif
+        acqs.push_back( unique_ptr<Acquisition>(
+                    new Acquisition( sources[k], sink, FRAME_RING_SIZE, k ) ) );
+
+        // Frames go on as Mono8 (the recorder may keep full depth too).
+        // Arduino sample, exposure time and motion energy go out with the
+        // frame; blink signal of the eye camera too.
+        PixelConverter* converter = k < converters_.size( ) ? converters_[k] : NULL;
+        MotionEnergy* motion = k < motions_.size( ) ? motions_[k] : NULL;
+        acqs.back( )->set_analyzer( [converter, motion]( Frame& f ) {
+                if( converter )
+                    converter->convert( f );
+                if( motion && f.pixel_format == PIXEL_FORMAT_MONO8 && f.width == FRAME_WIDTH
+                        && f.height == FRAME_HEIGHT )
+                    motion->process( f.data, f.motion );
+                if( sync_ )
+                    sync_->tag( f );
+                if( blink_ && f.camera == 0 && f.width == FRAME_WIDTH && f.height == FRAME_HEIGHT )
+                {
+                    if( eye_ && eye_->process( f.data ) )
+                        follow_eye( );
+                    f.blink = blink_->process( f.data );
+                    f.eye[0] = blink_->x0( );
+                    f.eye[1] = blink_->y0( );
+                    f.eye[2] = blink_->x0( ) + blink_->cols( );
+                    f.eye[3] = blink_->y0( ) + blink_->rows( );
+                }
+                } );
+    }
+    {
+        std::lock_guard<std::mutex> lock( stats_mutex_ );
+        acqs_.clear( );
+        for( auto& acq : acqs )
+            acqs_.push_back( acq.get( ) );
+        servers_ = servers;
+    }
 
-        pCam->BeginAcquisition();
-
-        gcstring deviceSerialNumber("");
-        CStringPtr ptrStringSerial = nodeMapTLDevice.GetNode("DeviceSerialNumber");
-        if (IsAvailable(ptrStringSerial) && IsReadable(ptrStringSerial))
+    size_t started = 0;
+    while( started < acqs.size( ) && acqs[started]->start( ) == 0 )
+        started += 1;
+    int result = started == acqs.size( ) ? 0 : -1;
+    if( result != 0 )
+        cout << "[ERROR] Camera " << started << " failed to start" << endl;
+
+    auto done = [&acqs]( ) {
+        for( auto& acq : acqs )
+            if( acq->done( ) )
+                return true;
+        return false;
+    };
+
+    auto lastPrint = steady_clock::now( );
+    while( result == 0 && ! interrupted_ && ! done( ) )
+    {
+        this_thread::sleep_for( milliseconds( 100 ) );
+#ifdef HAVE_TIFF
+        flush_stats_log( );
+#endif
+        if( steady_clock::now( ) - lastPrint >= seconds( STATS_INTERVAL_SEC ) )
         {
-            deviceSerialNumber = ptrStringSerial->GetValue();
-            cout << "Device serial number retrieved " << deviceSerialNumber 
-                << endl;
+            for( auto& acq : acqs )
+                acq->print_stats( cout );
+            for( auto server : servers )
+                server->print_stats( cout );
+#ifdef HAVE_TIFF
+            for (size_t k = 0; k < recorders_.size( ); k++)
+                if( recorders_[k]->recording( ) )
+                    cout << "[STAT] recorder " << camera_prefix( k ) << recorders_[k]->status( ) << endl;
+#endif
+            lastPrint = steady_clock::now( );
         }
+    }
 
+    if( interrupted_ )
+        cout << "User pressed Ctrl+c" << endl;
 
-        char notification[100] = "running ..";
-        while( true )
-        {
-            try
-            {
-                ImagePtr pResultImage = pCam->GetNextImage();
-                //cout << "Pixal format: " << pResultImage->GetPixelFormatName( ) << endl;
-
-                if ( pResultImage->IsIncomplete() ) /* Image is incomplete. */
-                {
-                    cout << "[WARN] Image incomplete with image status " << 
-                        pResultImage->GetImageStatus() << " ..." << endl;
-                }
-                else
-                {
-                    size_t width = pResultImage->GetWidth();
-                    size_t height = pResultImage->GetHeight();
-                    size_t size = pResultImage->GetBufferSize( );
-                    total_frames_ += 1;
-                    //cout << "H: "<< height << " W: " << width << " S: " << size << endl;
-                    // Convert the image to Monochorme, 8 bits (1 byte) and send
-                    // the output.
-                    //auto img = pResultImage->Convert( PixelFormat_Mono8 );
-                    write_data( pResultImage->GetData( ), width, height );
-                    if( total_frames_ % 100 == 0 )
-                    {
-                        duration<double> elapsedSecs = system_clock::now( ) - startTime;
-                        fps_ = ( float ) total_frames_ / elapsedSecs.count( );
-                        cout << "Running FPS : " << fps_ << endl;
-                    }
-                }
-            }
-            catch( runtime_error& e )
-            {
-                cout << "User pressed Ctrl+c" << endl;
-                break;
-            }
-            catch (Spinnaker::Exception &e)
-            {
-                cout << "Error: " << e.what() << endl;
-                result = -1;
-            }
-        }
-        pCam->EndAcquisition();
-    }
-    catch (Spinnaker::Exception &e)
+    for (size_t k = 0; k < started; k++)
     {
-        cout << "Error: " << e.what() << endl;
-        result = -1;
+        if( acqs[k]->stop( ) != 0 )
+            result = -1;
+        acqs[k]->print_stats( cout );
     }
 
+    // Timing budget of the whole session.
+    for( auto& line : describe( take_stats( ) ) )
+        cout << "[STAT] " << line << endl;
+    if( sync_ )
+        cout << "[STAT] sync " << sync_->status( ) << endl;
+#ifdef HAVE_TIFF
+    if( ! recorders_.empty( ) )
+        log_stats( "session", Stats( ) );
+    flush_stats_log( );
+#endif
+    {
+        std::lock_guard<std::mutex> lock( stats_mutex_ );
+        acqs_.clear( );
+        servers_.clear( );
+    }
     return result;
 }
 
-// This function prints the device information of the camera from the transport
-// layer; please see NodeMapInfo example for more in-depth comments on printing
-// device information from the nodemap.
-int PrintDeviceInfo(INodeMap & nodeMap)
+/**
+ * @brief Print usage.
+ */
+void usage( const char* prog )
 {
-    int result = 0;
-
-    cout << endl << "*** DEVICE INFORMATION ***" << endl << endl;
-
-    try
-    {
-        FeatureList_t features;
-        CCategoryPtr category = nodeMap.GetNode("DeviceInformation");
-        if (IsAvailable(category) && IsReadable(category))
-        {
-            category->GetFeatures(features);
+    cout << "Usage: " << prog << " [options]" << endl
+        << "  --source NAME     Frame source: "
+#ifdef USE_SPINNAKER
+        << "spinnaker (default), synthetic"
+#else
+        << "synthetic (default)"
+#endif
+#ifdef HAVE_TIFF
+        << ", replay"
+#endif
+        << endl
+        << "  --fps N           Frame rate of synthetic/replay source; 0 is as fast"
+        << endl << "                    as possible (default " << EXPECTED_FPS << ")" << endl
+        << "  --cameras N       Acquire from N cameras (default " << CAMERAS << "); camera 0 is" << endl
+        << "                    the eye. Camera k > 0 is served on channel _camK of" << endl
+        << "                    the transport, records and replays DIR/camK" << endl
+        << "  --replay PATH     Directory of trial_%03d.tif files (or a tiff file)" << endl
+        << "  --no-loop         Stop when replay reaches the last trial" << endl
+        << "  --no-wait         Don't wait for a subscriber before starting camera" << endl
+        << "  --blink-roi X0,Y0,X1,Y1  ROI for blink signal (default " << BLINK_ROI_X0
+        << "," << BLINK_ROI_Y0 << "," << BLINK_ROI_X1 << "," << BLINK_ROI_Y1 << ")" << endl
+        << "  --no-blink        Don't compute blink signal" << endl
+        << "  --track N         Blink ROI follows the eye; whole frame searched every" << endl
+        << "                    N frames (default " << EYE_TRACK_EVERY << ")" << endl
+        << "  --no-track        Blink ROI stays where it is put" << endl
+        << "  --motion X0,Y0,X1,Y1  Motion energy mask; up to " << FRAME_MOTION_MASKS
+        << " (default whole frame)" << endl
+        << "  --motion-bg S     Motion against a running background which follows" << endl
+        << "                    frames by 1/2^S; 0 is previous frame (default "
+        << MOTION_BG_SHIFT << ")" << endl
+        << "  --no-motion       Don't compute motion energy" << endl
+        << "  --preview BIN,FPS Binned preview on channel _preview: BIN 2 or 4, 0 for" << endl
+        << "                    none (default " << PREVIEW_BIN << "," << PREVIEW_FPS << ")" << endl
+        << "  --crop X0,Y0,X1,Y1|off  Full resolution crop on channel _crop (default" << endl
+        << "                    blink ROI)" << endl
+        << "  --pixel-format F  mono8, mono12p, mono12packed or mono16 (default "
+        << PIXEL_FORMAT << ")" << endl
+        << "  --window LO,HI[,GAMMA]  Pixels LO..HI (units of the pixel format) become" << endl
+        << "                    0..255; HI 0 is full range (default " << PIXEL_WINDOW_LO
+        << "," << PIXEL_WINDOW_HI << ")" << endl
+#ifdef HAVE_TIFF
+        << "  --record-dir DIR  Where 'trial N' (on " << CONTROL_SOCK_PATH << ") writes" << endl
+        << "                    trial_%03d.tif (default .)" << endl
+        << "  --record-format F tiff, ebz (lossless codec, see ebz2tiff) or session" << endl
+        << "                    (one indexed file, see Session.hpp); default "
+        << RECORD_FORMAT << endl
+        << "  --record-on-ttl 0|1  Start and stop trials on the camera TTL edges the" << endl
+        << "                    Arduino reports (default " << RECORD_ON_TTL << ")" << endl
+        << "  --roll PRE,POST   ms recorded before a trial starts and after it stops" << endl
+        << "                    (default " << RECORD_PREROLL_MS << "," << RECORD_POSTROLL_MS << ")" << endl
+        << "  --record-raw      Record full bit depth (16 bit tiff pages); tiff only" << endl
+#endif
+        << "  --transport NAME  socket (default): stream frames, each after a FrameHeader," << endl
+        << "                    to any number of subscribers on " << SOCK_PATH << endl
+        << "                    shm: publish frames in shared memory " << SHM_NAME << endl;
+}
 
-            FeatureList_t::const_iterator it;
-            for (it = features.begin(); it != features.end(); ++it)
-            {
-                CNodePtr pfeatureNode = *it;
-                cout << pfeatureNode->GetName() << " : ";
-                CValuePtr pValue = (CValuePtr)pfeatureNode;
-                cout << (IsReadable(pValue) ? pValue->ToString() : "Node not readable");
-                cout << endl;
-            }
+/**
+ * @brief Create a frame source as per command line options; camera is
+ * the index of the camera (Spinnaker camera list order).
+ */
+FrameSource* make_source( const string& name, double fps, const string& replay, bool loop
+        , unsigned camera = 0, uint32_t pixel_format = PIXEL_FORMAT_MONO8 )
+{
+#ifdef USE_SPINNAKER
+    if( name == "spinnaker" )
+        return new SpinnakerSource( camera, FRAME_RING_SIZE + 16, 1000, pixel_format );
+#endif
+    if( name == "synthetic" )
+        return new SyntheticSource( FRAME_WIDTH, FRAME_HEIGHT, fps, FRAME_RING_SIZE + 16
+                , pixel_format );
+#ifdef HAVE_TIFF
+    if( name == "replay" )
+        return new TiffReplaySource( replay, FRAME_WIDTH, FRAME_HEIGHT, fps, loop
+                , FRAME_RING_SIZE + 16 );
+#endif
+    return NULL;
+}
 
-        }
-        else
-        {
-            cout << "Device control information not available." << endl;
-        }
-    }
-    catch (Spinnaker::Exception &e)
+/* Deinit the first inited sources, then delete them all. */
+void delete_sources( vector<FrameSource*>& sources, size_t inited = 0 )
+{
+    for (size_t k = 0; k < sources.size( ); k++)
     {
-        cout << "Error: " << e.what() << endl;
-        result = -1;
+        if( k < inited )
+            sources[k]->deinit( );
+        delete sources[k];
     }
+    sources.clear( );
+}
 
-    return result;
+/* Per camera processing: converters, sub-streams and motion energy. */
+void delete_converters( )
+{
+    for( auto c : converters_ )
+        delete c;
+    converters_.clear( );
+    for( auto s : substreams_ )
+        delete s;
+    substreams_.clear( );
+    for( auto m : motions_ )
+        delete m;
+    motions_.clear( );
 }
 
-// This function acts as the body of the example; please see NodeMapInfo example
-// for more in-depth comments on setting up cameras.
-int RunSingleCamera(CameraPtr pCam, int socket)
+#ifdef HAVE_TIFF
+/**
+ * @brief Trial n starts at host time at_ns: on 'trial N' or when the camera
+ * TTL goes up (--record-on-ttl). Frames from pre-roll before it on are
+ * recorded. A second start of the trial being recorded changes nothing.
+ */
+void start_trial( int n, uint64_t at_ns )
 {
-    int result = 0;
+    if( n == trial_ )
+        return;
+    for( auto r : recorders_ )
+        r->trigger( n, at_ns );
+    if( trial_ >= 0 )
+        log_stats( "trial " + to_string( trial_ ), trial_stats_ );
+    trial_stats_ = take_stats( );
+    trial_ = n;
+}
 
-    try
-    {
-        // Retrieve TL device nodemap and print device information
-        INodeMap & nodeMapTLDevice = pCam->GetTLDeviceNodeMap();
+/* Trial ends at at_ns (recording goes on for post-roll). */
+void stop_trial( uint64_t at_ns )
+{
+    if( trial_ < 0 )
+        return;
+    for( auto r : recorders_ )
+        r->release( at_ns );
+    log_stats( "trial " + to_string( trial_ ), trial_stats_ );
+    trial_ = -1;
+}
 
-        result = PrintDeviceInfo(nodeMapTLDevice);
+/* Trials go to dir; those of camera k > 0 to dir/camK. */
+void set_record_dir( const string& dir )
+{
+    for (size_t k = 0; k < recorders_.size( ); k++)
+    {
+        string d = camera_dir( dir, k );
+        if( k > 0 && mkdir( d.c_str( ), 0755 ) != 0 && errno != EEXIST )
+            cout << "[WARN] Can't create " << d << ": " << strerror( errno ) << endl;
+        recorders_[k]->set_dir( d );
+    }
+}
 
-        // Initialize camera
-        pCam->Init();
+/**
+ * @brief Commands to record trials, e.g. sent by camera_arduino_client.py
+ * when arduino starts and ends a trial.
+ */
+void add_recorder_commands( ControlServer& control )
+{
+    control.add_command( "trial", "trial N: record following frames as trial N"
+            , []( const vector<string>& args ) {
+                if( args.size( ) != 1 )
+                    throw runtime_error( "usage: trial N" );
+                int n = atoi( args[0].c_str( ) );
+                start_trial( n, monotonic_ns( ) );
+                return "recording trial " + to_string( n );
+            } );
+    control.add_command( "stop", "stop recording"
+            , []( const vector<string>& ) {
+                stop_trial( monotonic_ns( ) );
+                return string( "" );
+            } );
+    control.add_command( "roll", "roll PRE_MS POST_MS: frames kept before and after a trial"
+            , []( const vector<string>& args ) {
+                if( args.size( ) != 2 )
+                    throw runtime_error( "usage: roll PRE_MS POST_MS" );
+                uint64_t pre = strtoull( args[0].c_str( ), NULL, 10 );
+                uint64_t post = strtoull( args[1].c_str( ), NULL, 10 );
+                for( auto r : recorders_ )
+                    r->set_roll( pre * 1000000, post * 1000000 );
+                return args[0] + " " + args[1];
+            } );
+    control.add_command( "dir", "dir PATH: directory of following trials"
+            , []( const vector<string>& args ) {
+                if( args.size( ) != 1 )
+                    throw runtime_error( "usage: dir PATH" );
+                set_record_dir( args[0] );
+                return args[0];
+            } );
+    control.add_command( "meta", "meta TEXT: text in metadata row of following frames"
+            , []( const vector<string>& args ) {
+                string text;
+                for( auto& a : args )
+                    text += (text.empty( ) ? "" : " ") + a;
+                for( auto r : recorders_ )
+                    r->set_meta( text );
+                return string( "" );
+            } );
+    control.add_command( "format", "format tiff|ebz|session: file format of following trials"
+            , []( const vector<string>& args ) {
+                if( args.size( ) != 1 || ! TrialRecorder::valid_format( args[0] ) )
+                    throw runtime_error( "usage: format tiff|ebz|session" );
+                for( auto r : recorders_ )
+                    if( ! r->set_format( args[0] ) )
+                        throw runtime_error( "raw (16 bit) recording is tiff only" );
+                return args[0];
+            } );
+    control.add_command( "status", "recorder counters"
+            , []( const vector<string>& ) {
+                string status;
+                for (size_t k = 0; k < recorders_.size( ); k++)
+                    status += (k ? "; " + camera_prefix( k ) : "") + recorders_[k]->status( );
+                return status;
+            } );
+}
+#endif
 
-        // Retrieve GenICam nodemap
-        INodeMap & nodeMap = pCam->GetNodeMap();
+/**
+ * @brief Window of the 12/16 bit to Mono8 conversion, e.g. to brighten the
+ * dim IR eye while the camera runs.
+ */
+void add_window_commands( ControlServer& control )
+{
+    control.add_command( "window", "window [LO HI [GAMMA]]: pixels LO..HI become 0..255"
+            , []( const vector<string>& args ) {
+                if( args.size( ) == 1 || args.size( ) > 3 )
+                    throw runtime_error( "usage: window LO HI [GAMMA]" );
+                for( auto c : converters_ )
+                    if( args.size( ) >= 2 )
+                        c->set_window( strtoul( args[0].c_str( ), NULL, 10 )
+                                , strtoul( args[1].c_str( ), NULL, 10 )
+                                , args.size( ) == 3 ? atof( args[2].c_str( ) ) : 1.0 );
+                return converters_.empty( ) ? string( "" ) : converters_[0]->window( );
+            } );
+}
 
-        // Set width, height
-        CIntegerPtr width = nodeMap.GetNode("Width");
-        width->SetValue( FRAME_WIDTH );
+/**
+ * @brief Move the crop of a camera, e.g. onto the eye once the animal is
+ * placed; readers of the crop find the origin in each FrameHeader.
+ */
+void add_crop_commands( ControlServer& control )
+{
+    control.add_command( "crop", "crop [X0 Y0 X1 Y1 [K]]: full resolution crop of camera K (0)"
+            , []( const vector<string>& args ) {
+                if( ! args.empty( ) && args.size( ) != 4 && args.size( ) != 5 )
+                    throw runtime_error( "usage: crop X0 Y0 X1 Y1 [K]" );
+                size_t k = args.size( ) == 5 ? strtoul( args[4].c_str( ), NULL, 10 ) : 0;
+                if( k >= substreams_.size( ) || ! substreams_[k]->has_crop( ) )
+                    throw runtime_error( "no crop stream on camera " + to_string( k ) );
+                if( args.size( ) >= 4 )
+                    substreams_[k]->set_crop( strtoul( args[0].c_str( ), NULL, 10 )
+                            , strtoul( args[1].c_str( ), NULL, 10 )
+                            , strtoul( args[2].c_str( ), NULL, 10 )
+                            , strtoul( args[3].c_str( ), NULL, 10 ) );
+                return substreams_[k]->crop( );
+            } );
+}
 
-        CIntegerPtr height = nodeMap.GetNode("Height");
-        height->SetValue( FRAME_HEIGHT );
+/**
+ * @brief Put the blink ROI on the eye, e.g. the box drawn in
+ * camera_arduino_client.py; the tracker keeps it there.
+ */
+void add_eye_commands( ControlServer& control )
+{
+    control.add_command( "eye", "eye [X0 Y0 X1 Y1]: box of blink signal, followed from next frame"
+            , []( const vector<string>& args ) {
+                if( ! args.empty( ) && args.size( ) != 4 )
+                    throw runtime_error( "usage: eye X0 Y0 X1 Y1" );
+                if( args.size( ) == 4 )
+                    eye_->set_box( EyeTracker::Box{ { strtoul( args[0].c_str( ), NULL, 10 )
+                            , strtoul( args[1].c_str( ), NULL, 10 )
+                            , strtoul( args[2].c_str( ), NULL, 10 )
+                            , strtoul( args[3].c_str( ), NULL, 10 ) } } );
+                char diff[32];
+                snprintf( diff, sizeof( diff ), " diff %.1f", eye_->diff( ) );
+                return eye_->describe( ) + diff + ", " + to_string( eye_->searches( ) )
+                    + " searches, " + to_string( eye_->moves( ) ) + " moves";
+            } );
+}
 
-        // Set frame rate manually.
-        CBooleanPtr pAcquisitionManualFrameRate = nodeMap.GetNode( "AcquisitionFrameRateEnable" );
-        pAcquisitionManualFrameRate->SetValue( true );
+/**
+ * @brief Commands which feed the Arduino side of ClockSync; whoever reads the
+ * serial port (arduino_reader, src/arduino_reader.cc) sends every line it reads, and
+ * tells when it writes a ping.
+ */
+void add_sync_commands( ControlServer& control )
+{
+    control.add_command( "arduino", "arduino HOST_NS LINE: line read from arduino at HOST_NS"
+            , []( const vector<string>& args ) {
+                if( args.size( ) < 2 )
+                    throw runtime_error( "usage: arduino HOST_NS LINE" );
+                string line;
+                for (size_t i = 1; i < args.size( ); i++)
+                    line += (i > 1 ? " " : "") + args[i];
+                sync_->arduino_line( strtoull( args[0].c_str( ), NULL, 10 ), line );
+                return string( "" );
+            } );
+    control.add_command( "ping", "ping HOST_NS: ping written to arduino at HOST_NS"
+            , []( const vector<string>& args ) {
+                if( args.size( ) != 1 )
+                    throw runtime_error( "usage: ping HOST_NS" );
+                sync_->ping_sent( strtoull( args[0].c_str( ), NULL, 10 ) );
+                return string( "" );
+            } );
+    control.add_command( "sync", "arduino and camera clock fits"
+            , []( const vector<string>& ) {
+                return sync_->status( );
+            } );
+}
 
-        CFloatPtr ptrAcquisitionFrameRate = nodeMap.GetNode("AcquisitionFrameRate");
+int main(int argc, char** argv)
+{
+    int result = 0;
 
-        try {
-            cout << "Trying to set frame rate to " << EXPECTED_FPS << endl;
-            ptrAcquisitionFrameRate->SetValue( EXPECTED_FPS );
+#ifdef USE_SPINNAKER
+    string sourceName = "spinnaker";
+#else
+    string sourceName = "synthetic";
+#endif
+    double fps = EXPECTED_FPS;
+    string replay = "";
+    bool loop = true;
+    bool waitForClient = true;
+    string transport = "socket";
+    bool blink = true;
+    string recordDir = ".";
+    string recordFormat = RECORD_FORMAT;
+    bool recordOnTtl = RECORD_ON_TTL;
+    unsigned preroll = RECORD_PREROLL_MS, postroll = RECORD_POSTROLL_MS;
+    size_t roi[4] = { BLINK_ROI_X0, BLINK_ROI_Y0, BLINK_ROI_X1, BLINK_ROI_Y1 };
+    unsigned cameras = CAMERAS;
+    string pixelFormat = PIXEL_FORMAT;
+    unsigned window[2] = { PIXEL_WINDOW_LO, PIXEL_WINDOW_HI };
+    double gamma = 1.0;
+    bool recordRaw = false;
+    unsigned previewBin = PREVIEW_BIN;
+    double previewFps = PREVIEW_FPS;
+    bool crop = true, cropSet = false;
+    size_t cropRoi[4] = { 0, 0, 0, 0 };
+    bool motion = true;
+    bool track = true;
+    unsigned trackEvery = EYE_TRACK_EVERY;
+    vector<MotionEnergy::Box> motionMasks;
+    unsigned motionShift = MOTION_BG_SHIFT;
+    MotionEnergy::Box box;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if( arg == "--source" && i + 1 < argc )
+            sourceName = argv[++i];
+        else if( arg == "--fps" && i + 1 < argc )
+            fps = atof( argv[++i] );
+        else if( arg == "--cameras" && i + 1 < argc && atoi( argv[i + 1] ) > 0 )
+            cameras = atoi( argv[++i] );
+        else if( arg == "--replay" && i + 1 < argc )
+        {
+            replay = argv[++i];
+            sourceName = "replay";
         }
-        catch ( std::exception & e )
+        else if( arg == "--no-loop" )
+            loop = false;
+        else if( arg == "--no-wait" )
+            waitForClient = false;
+        else if( arg == "--transport" && i + 1 < argc )
+            transport = argv[++i];
+        else if( arg == "--no-blink" )
+            blink = false;
+        else if( arg == "--no-track" )
+            track = false;
+        else if( arg == "--track" && i + 1 < argc )
+            trackEvery = atoi( argv[++i] );
+        else if( arg == "--no-motion" )
+            motion = false;
+        else if( arg == "--motion" && i + 1 < argc && motionMasks.size( ) < FRAME_MOTION_MASKS
+                && sscanf( argv[++i], "%zu,%zu,%zu,%zu", &box[0], &box[1], &box[2], &box[3] ) == 4 )
+            motionMasks.push_back( box );
+        else if( arg == "--motion-bg" && i + 1 < argc )
+            motionShift = atoi( argv[++i] );
+        else if( arg == "--pixel-format" && i + 1 < argc )
+            pixelFormat = argv[++i];
+        else if( arg == "--window" && i + 1 < argc
+                && sscanf( argv[++i], "%u,%u,%lf", &window[0], &window[1], &gamma ) >= 2 )
+            continue;
+        else if( arg == "--record-raw" )
+            recordRaw = true;
+        else if( arg == "--preview" && i + 1 < argc
+                && sscanf( argv[++i], "%u,%lf", &previewBin, &previewFps ) >= 1 )
+            continue;
+        else if( arg == "--crop" && i + 1 < argc && string( argv[i + 1] ) == "off" )
         {
-            cout << "Failed to set frame rate. Using default ... " << endl;
-            cout << "\tError was " << e.what( ) << endl;
+            crop = false;
+            i += 1;
         }
-
-        if (!IsAvailable(ptrAcquisitionFrameRate) || !IsReadable(ptrAcquisitionFrameRate)) 
-            cout << "Unable to retrieve frame rate. " << endl << endl;
+        else if( arg == "--crop" && i + 1 < argc
+                && sscanf( argv[++i], "%zu,%zu,%zu,%zu", &cropRoi[0], &cropRoi[1], &cropRoi[2]
+                    , &cropRoi[3] ) == 4 )
+            cropSet = true;
+        else if( arg == "--record-dir" && i + 1 < argc )
+            recordDir = argv[++i];
+        else if( arg == "--record-format" && i + 1 < argc )
+            recordFormat = argv[++i];
+        else if( arg == "--record-on-ttl" && i + 1 < argc )
+            recordOnTtl = atoi( argv[++i] ) != 0;
+        else if( arg == "--roll" && i + 1 < argc
+                && sscanf( argv[++i], "%u,%u", &preroll, &postroll ) == 2 )
+            continue;
+        else if( arg == "--blink-roi" && i + 1 < argc
+                && sscanf( argv[++i], "%zu,%zu,%zu,%zu", &roi[0], &roi[1], &roi[2], &roi[3] ) == 4 )
+            continue;
         else
         {
-            fps_ = static_cast<float>(ptrAcquisitionFrameRate->GetValue());
-            cout << "[INFO] Expected frame set to " << fps_ << endl;
+            usage( argv[0] );
+            return arg == "--help" || arg == "-h" ? 0 : -1;
         }
+    }
+
+    // Print application build information
+    cout << "Application build date: " << __DATE__ << " " << __TIME__ << endl << endl;
+
+    uint32_t format = pixel_format_from_name( pixelFormat );
+    if( format == 0 )
+    {
+        cout << "[ERROR] Unknown pixel format " << pixelFormat << endl;
+        usage( argv[0] );
+        return -1;
+    }
 
-        // Switch off auto-exposure and set it manually.
-        CEnumerationPtr ptrExposureAuto = nodeMap.GetNode("ExposureAuto");
-        if (!IsAvailable(ptrExposureAuto) || !IsWritable(ptrExposureAuto))
+    vector<FrameSource*> sources;
+    for (unsigned k = 0; k < cameras; k++)
+    {
+        FrameSource* source = make_source( sourceName, fps, camera_dir( replay, k ), loop, k, format );
+        if( ! source )
         {
-            cout << "Unable to disable automatic exposure (node retrieval). Aborting..." << endl << endl;
+            cout << "[ERROR] Unknown or unsupported frame source " << sourceName << endl;
+            usage( argv[0] );
+            delete_sources( sources );
             return -1;
         }
+        sources.push_back( source );
+    }
 
-        CEnumEntryPtr ptrExposureAutoOff = ptrExposureAuto->GetEntryByName("Off");
-        if (!IsAvailable(ptrExposureAutoOff) || !IsReadable(ptrExposureAutoOff))
+#ifdef HAVE_TIFF
+    if( ! TrialRecorder::valid_format( recordFormat ) )
+    {
+        cout << "[ERROR] Unknown record format " << recordFormat << endl;
+        usage( argv[0] );
+        delete_sources( sources );
+        return -1;
+    }
+    if( recordRaw && recordFormat != "tiff" )
+    {
+        cout << "[ERROR] --record-raw writes tiff only" << endl;
+        delete_sources( sources );
+        return -1;
+    }
+#else
+    (void)recordRaw;
+#endif
+
+    for (unsigned k = 0; k < cameras; k++)
+    {
+        PixelConverter* converter = new PixelConverter( FRAME_WIDTH, FRAME_HEIGHT, UNPACK_THREADS );
+        converter->keep_wide( recordRaw );
+        converters_.push_back( converter );
+        try
         {
-            cout << "Unable to disable automatic exposure (enum entry retrieval). Aborting..." << endl << endl;
-            return -1;
+            converter->set_window( window[0], window[1], gamma );
         }
+        catch( invalid_argument& e )
+        {
+            cout << "[ERROR] " << e.what( ) << endl;
+            result = -1;
+        }
+    }
 
-        ptrExposureAuto->SetIntValue(ptrExposureAutoOff->GetValue());
-        cout << "Automatic exposure disabled..." << endl;
-        CFloatPtr ptrExposureTime = nodeMap.GetNode("ExposureTime");
-        if (!IsAvailable(ptrExposureTime) || !IsWritable(ptrExposureTime))
+    // Crop is the blink ROI unless told otherwise.
+    if( ! cropSet )
+        for (size_t i = 0; i < 4; i++)
+            cropRoi[i] = roi[i];
+    for (unsigned k = 0; k < cameras && result == 0; k++)
+    {
+        try
+        {
+            substreams_.push_back( new SubStreams( FRAME_WIDTH, FRAME_HEIGHT, previewBin
+                        , previewFps, cropRoi[0], cropRoi[1], crop ? cropRoi[2] : cropRoi[0]
+                        , cropRoi[3] ) );
+        }
+        catch( invalid_argument& e )
+        {
+            cout << "[ERROR] " << e.what( ) << endl;
+            result = -1;
+        }
+    }
+    if( motionMasks.empty( ) )
+        motionMasks.push_back( MotionEnergy::Box{ { 0, 0, FRAME_WIDTH, FRAME_HEIGHT } } );
+    for (unsigned k = 0; k < cameras && result == 0 && motion; k++)
+    {
+        try
+        {
+            motions_.push_back( new MotionEnergy( FRAME_WIDTH, FRAME_HEIGHT, motionMasks, motionShift ) );
+        }
+        catch( invalid_argument& e )
+        {
+            cout << "[ERROR] " << e.what( ) << endl;
+            result = -1;
+        }
+    }
+    if( result != 0 )
+    {
+        delete_converters( );
+        delete_sources( sources );
+        return -1;
+    }
+    if( motion )
+        cout << "[INFO] Motion energy on " << motions_[0]->describe( ) << " against "
+            << (motionShift ? "background 1/" + to_string( 1 << motionShift ) : string( "previous frame" ))
+            << endl;
+    if( previewBin )
+        cout << "[INFO] Preview " << substreams_[0]->preview_width( ) << "x"
+            << substreams_[0]->preview_height( ) << " at up to " << previewFps << " fps" << endl;
+    if( crop )
+        cout << "[INFO] Crop " << substreams_[0]->crop( ) << " at full rate" << endl;
+    if( format != PIXEL_FORMAT_MONO8 )
+        cout << "[INFO] " << pixel_format_name( format ) << " frames to Mono8 through window "
+            << converters_[0]->window( ) << " on " << UNPACK_THREADS << " threads per camera" << endl;
+
+    if( blink )
+    {
+        try
+        {
+            blink_ = new Blink( roi[0], roi[1], roi[2], roi[3] );
+        }
+        catch( invalid_argument& e )
         {
-            cout << "Unable to set exposure time. Aborting..." << endl << endl;
+            cout << "[ERROR] " << e.what( ) << endl;
+            delete_converters( );
+            delete_sources( sources );
             return -1;
         }
-
-        // Ensure desired exposure time does not exceed the maximum
-        const double exposureTimeMax = ptrExposureTime->GetMax();
-
-        ptrExposureTime->SetValue( EXPOSURE_TIME_IN_US );
-        cout << "Exposure time set to " << ptrExposureTime->GetValue( ) << " us..." << endl << endl;
-
-#if 1
-        // Turn of automatic gain
-        CEnumerationPtr ptrGainAuto = nodeMap.GetNode("GainAuto");
-        if (!IsAvailable(ptrGainAuto) || !IsWritable(ptrGainAuto))
+        cout << "[INFO] Blink signal on ROI " << blink_->cols( ) << "x" << blink_->rows( )
+            << " at (" << roi[0] << "," << roi[1] << ")" << endl;
+    }
+    if( blink_ && track )
+    {
+        try
+        {
+            eye_ = new EyeTracker( FRAME_WIDTH, FRAME_HEIGHT, EyeTracker::Box{ { blink_->x0( )
+                        , blink_->y0( ), blink_->x0( ) + blink_->cols( ), blink_->y0( ) + blink_->rows( ) } }
+                    , trackEvery, EYE_TRACK_MAX_DIFF );
+        }
+        catch( invalid_argument& e )
         {
-            cout << "Unable to disable automatic gain (node retrieval). Aborting..." << endl << endl;
+            cout << "[ERROR] " << e.what( ) << endl;
+            delete_converters( );
+            delete_sources( sources );
+            delete blink_;
             return -1;
         }
-        CEnumEntryPtr ptrGainAutoOff = ptrGainAuto->GetEntryByName("Off");
-        if (!IsAvailable(ptrGainAutoOff) || !IsReadable(ptrGainAutoOff))
+        crop_follows_eye_ = ! cropSet;
+        cout << "[INFO] Blink ROI follows the eye; whole frame searched every " << trackEvery
+            << " frames" << (crop_follows_eye_ ? ", crop follows" : "") << endl;
+    }
+
+    // All cameras are opened before any starts acquiring.
+    size_t ready = 0;
+    for( ; ready < sources.size( ); ready++ )
+    {
+        cout << "[INFO] Using frame source " << sources[ready]->name( )
+            << " for camera " << ready << endl;
+        if( sources[ready]->init( ) != 0 )
         {
-            cout << "Unable to disable automatic gain (enum entry retrieval). Aborting..." << endl << endl;
+            cout << "[ERROR] Failed to initialize " << sources[ready]->name( )
+                << " for camera " << ready << endl;
+            delete_sources( sources, ready );
+            delete_converters( );
+            delete blink_;
+            delete eye_;
             return -1;
         }
+    }
+
+    // Commands while camera runs (start/stop recording a trial etc.).
+    ControlServer control( CONTROL_SOCK_PATH );
+#ifdef HAVE_TIFF
+    // Frames wait in the pre-roll ring for the trigger, which comes up to
+    // RECORD_TRIGGER_LAG_MS after the edge it is about.
+    size_t rollFrames = (size_t)((preroll + RECORD_TRIGGER_LAG_MS)
+            * (fps > 0 ? fps : EXPECTED_FPS) / 1000.0 + 1);
+    for (unsigned k = 0; k < cameras; k++)
+    {
+        TrialRecorder* recorder = new TrialRecorder( recordDir, FRAME_WIDTH, FRAME_HEIGHT
+                , RECORD_QUEUE_SIZE, RECORD_BIGTIFF, recordFormat
+                , RECORD_KEY_INTERVAL, RECORD_THREADS, SESSION_CHUNK_FRAMES, rollFrames, recordRaw );
+        recorder->set_roll( preroll * 1000000ull, postroll * 1000000ull );
+        recorder->start( );
+        recorders_.push_back( recorder );
+    }
+    set_record_dir( recordDir );
+    add_recorder_commands( control );
+    cout << "[INFO] Trials keep " << preroll << " ms before and " << postroll
+        << " ms after (" << rollFrames << " frames in pre-roll ring)" << endl;
+#endif
+    ClockSync sync( SYNC_BLOCK_MS, SYNC_BLOCKS, ARDUINO_BAUD_RATE, ARDUINO_BINARY_SAMPLES );
+    sync_ = &sync;
+    add_sync_commands( control );
+    add_window_commands( control );
+    add_crop_commands( control );
+    if( eye_ )
+        add_eye_commands( control );
+#ifdef HAVE_TIFF
+    if( recordOnTtl )
+        sync.on_ttl( []( bool high, uint64_t host_ns, int trial ) {
+                if( high )
+                    start_trial( trial, host_ns );
+                else
+                    stop_trial( host_ns );
+                } );
+#else
+    (void)recordOnTtl;
+#endif
+    control.add_command( "stats", "latency of every stage and counters since start"
+            , []( const vector<string>& ) {
+                return join( describe( take_stats( ) ), "; " );
+            } );
+    control.start( );
+    cout << "[INFO] Accepting commands on " << CONTROL_SOCK_PATH << endl;
 
-        // Set gain; gain recorded in decibels
-        CFloatPtr ptrGain = nodeMap.GetNode("Gain");
-        if (!IsAvailable(ptrGain) || !IsWritable(ptrGain))
+    install_signal_handlers( );
+
+    if( transport == "shm" )
+    {
+        // Readers attach (and detach) whenever they like; nobody to wait for.
+        vector<ShmWriter*> shms;
+        vector<Acquisition::Sink> sinks;
+        try
         {
-            cout << "[WARN] Unable to set gain (node retrieval). Using default ..." << endl;
+            for (unsigned k = 0; k < cameras; k++)
+            {
+                string name = channel_name( SHM_NAME, k );
+                ShmWriter* shm = new ShmWriter( name, SHM_NUM_SLOTS, FRAME_WIDTH, FRAME_HEIGHT );
+                shms.push_back( shm );
+                sinks.push_back( [shm]( const Frame& f ) { return shm->publish( f ); } );
+                cout << "[INFO] Publishing frames of camera " << k << " to shared memory "
+                    << name << " (" << SHM_NUM_SLOTS << " slots, "
+                    << shm->size( ) / 1024 / 1024 << " MB)" << endl;
+
+                // The origin of each frame is in its slot header, which
+                // matters as the crop follows the eye.
+                SubStreams* sub = substreams_[k];
+                if( sub->has_preview( ) )
+                {
+                    ShmWriter* preview = new ShmWriter( name + "_preview", SUBSTREAM_SHM_SLOTS
+                            , sub->preview_width( ), sub->preview_height( ) );
+                    shms.push_back( preview );
+                    cout << "[INFO] Publishing preview of camera " << k << " to shared memory "
+                        << name << "_preview" << endl;
+                    sub->set_preview_sink( [preview]( const Frame& f ) { return preview->publish( f ); } );
+                }
+                if( sub->has_crop( ) )
+                {
+                    ShmWriter* cropShm = new ShmWriter( name + "_crop", SUBSTREAM_SHM_SLOTS
+                            , FRAME_WIDTH, FRAME_HEIGHT );
+                    shms.push_back( cropShm );
+                    cout << "[INFO] Publishing crop of camera " << k << " to shared memory "
+                        << name << "_crop" << endl;
+                    sub->set_crop_sink( [cropShm]( const Frame& f ) { return cropShm->publish( f ); } );
+                }
+            }
         }
-        else
+        catch( runtime_error& e )
         {
-            double gainMax = ptrGain->GetMax();
-            double gainToSet = ptrGain->GetMin( );
-            ptrGain->SetValue(gainToSet);
+            cout << "[ERROR] " << e.what( ) << endl;
+            result = -1;
         }
 
-#endif
-
         /*-----------------------------------------------------------------------------
          *  IMAGE ACQUISITION
          *-----------------------------------------------------------------------------*/
-        result = AcquireImages(pCam, nodeMap, nodeMapTLDevice, socket );
-
-        // Reset settings.
-        ResetExposure( nodeMap );
-
-        // Deinitialize camera
-        pCam->DeInit();
+        if( result == 0 )
+            result = AcquireImages( sources, sinks );
+        for( auto shm : shms )
+            delete shm;
     }
-    catch (Spinnaker::Exception &e)
+    else if( transport == "socket" )
     {
-        cout << "Error: " << e.what() << endl;
-        result = -1;
-    }
-
-    return result;
-}
+        // Any number of readers (preview, recorder, analysis) may subscribe
+        // and leave while the camera runs. A subscriber picks its policy by
+        // sending 'lossless', 'latest' or 'nth N' (see broadcast-server.h).
+        // Every frame goes out behind a FrameHeader unless it asks for 'raw'.
+        // Each camera has a socket of its own.
+        vector<BroadcastServer*> servers;
+        vector<BroadcastServer*> subServers;
+        vector<Acquisition::Sink> sinks;
+        for (unsigned k = 0; k < cameras && result == 0; k++)
+        {
+            string path = channel_name( SOCK_PATH, k );
+            BroadcastServer* server = new BroadcastServer( path, BROADCAST_MAX_QUEUE );
+            servers.push_back( server );
+            if( ! server->start( ) )
+                result = -1;
+            else
+                cout << "[INFO] Serving frames of camera " << k << " on " << path << endl;
+            sinks.push_back( [server]( const Frame& f ) {
+#ifdef TEST_WITH_CV
+                    if( f.camera == 0 )
+                    {
+                        cv::Mat img( f.height, f.width, CV_8UC1, f.data );
+                        cv::imshow( "MyImg", img );
+                        cv::waitKey( 10 );
+                    }
+#endif
+                    FrameHeader h = make_frame_header( f );
+                    return server->broadcast( &h, sizeof( h ), f.data, f.size );
+                    } );
 
-// Example entry point; please see Enumeration example for more in-depth
-// comments on preparing and cleaning up the system.
-int main(int /*argc*/, char** /*argv*/)
-{
-    int result = 0;
+            // Preview and crop have sockets of their own; nobody waits for them.
+            SubStreams* sub = substreams_[k];
+            for( int s = 0; s < 2; s++ )
+            {
+                if( s == 0 ? ! sub->has_preview( ) : ! sub->has_crop( ) )
+                    continue;
+                string subPath = path + (s == 0 ? "_preview" : "_crop");
+                BroadcastServer* subServer = new BroadcastServer( subPath, BROADCAST_MAX_QUEUE );
+                subServers.push_back( subServer );
+                if( ! subServer->start( ) )
+                    result = -1;
+                else
+                    cout << "[INFO] Serving " << (s == 0 ? "preview" : "crop") << " of camera "
+                        << k << " on " << subPath << endl;
+                auto subSink = [subServer]( const Frame& f ) {
+                    FrameHeader h = make_frame_header( f );
+                    return subServer->broadcast( &h, sizeof( h ), f.data, f.size );
+                };
+                if( s == 0 )
+                    sub->set_preview_sink( subSink );
+                else
+                    sub->set_crop_sink( subSink );
+            }
+        }
+        // UnixServer installs its own SIGINT handler; ours must win.
+        install_signal_handlers( );
 
-    // Print application build information
-    cout << "Application build date: " << __DATE__ << " " << __TIME__ << endl << endl;
+        // There is no point starting the camera if there is not one to read
+        // the data (of the eye camera).
+        if( result == 0 && waitForClient )
+            cout << "Waiting for a connection..." << endl;
+        while( result == 0 && waitForClient && ! interrupted_ && servers[0]->num_clients( ) == 0 )
+            this_thread::sleep_for( milliseconds( 100 ) );
 
-    // Retrieve singleton reference to system object
-    system_ = System::GetInstance();
-    if( system_->IsInUse( ) )
+        /*-----------------------------------------------------------------------------
+         *  IMAGE ACQUISITION
+         *-----------------------------------------------------------------------------*/
+        if( result == 0 && ! interrupted_ )
+            result = AcquireImages( sources, sinks, servers );
+        servers.insert( servers.end( ), subServers.begin( ), subServers.end( ) );
+        for( auto server : servers )
+        {
+            server->stop( );
+            delete server;
+        }
+    }
+    else
     {
-        cout << "Warn: Camera is already in use. Reattach and continue";
-        exit( -1 );
+        cout << "[ERROR] Unknown transport " << transport << endl;
+        usage( argv[0] );
+        result = -1;
     }
 
-    // Retrieve list of cameras from the system
-    cam_list_ = system_->GetCameras();
-
-    unsigned int numCameras = cam_list_.GetSize();
-
-    cout << "Number of cameras detected: " << numCameras << endl << endl;
-
-    // Finish if there are no cameras
-    if (numCameras == 0)
+    control.stop( );
+    sync_ = NULL;
+#ifdef HAVE_TIFF
+    // Writes what is still queued.
+    for( auto r : recorders_ )
     {
-        // Clear camera list before releasing system_
-        cam_list_.Clear();
-
-        // Release system_
-        system_->ReleaseInstance();
-        cout << "Not enough cameras! Existing ..." << endl;
-        return -1;
+        r->stop( );
+        delete r;
     }
+    recorders_.clear( );
+#endif
+    delete_sources( sources, sources.size( ) );
+    delete_converters( );
+    if( eye_ )
+        cout << "[INFO] Eye tracker: " << eye_->searches( ) << " searches, "
+            << eye_->moves( ) << " moves, box " << eye_->describe( ) << endl;
+    delete blink_;
+    delete eye_;
 
-    CameraPtr pCam = NULL;
-
-    // Since there are enough camera lets initialize socket to write acquired
-    // frames.
-
-    socket_ = create_socket( true );
-
-    pCam = cam_list_.GetByIndex( 0 );
-
-    // Configure camera here.
-    // configure_camera( pCam );
-    result = RunSingleCamera(pCam, socket_);
-
-
-    pCam = NULL;
-    // Clear camera list before releasing system_
-    cam_list_.Clear();
-
-    // Release system_
-    system_->ReleaseInstance();
     std::cout << "All done" << std::endl;
-
-    if( socket_ > 0 )
-        close( socket_ );
-
-    return 0;
+    return result;
 }
@@ -0,0 +1,261 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  mouse_server.cc
+ *
+ *    Description:  Treadmill speed from the mouse under it (was
+ *    mouse_server.py).
+ *
+ *      $ ./mouse_server /dev/input/mouse2 [options]
+ *
+ *    Reads the input events of the mouse as they come (epoll; /dev/input/mouseN
+ *    is taken as the eventN of the same device), stamped by the kernel with
+ *    CLOCK_MONOTONIC, the clock of frame host_ns. Every report updates speed
+ *    and direction over the last MOUSE_WINDOW_MS (Treadmill.hpp) and goes
+ *    out:
+ *
+ *      - into shared memory MOUSE_SHM_NAME: the latest TreadmillSample
+ *        (seqlock; treadmill_client.py reads it),
+ *      - to subscribers of MOUSE_SOCK_PATH: every TreadmillSample, 48 bytes
+ *        each (BroadcastServer, same policies as SOCK_PATH).
+ *
+ *    When the mouse stops, reports leave the window on a timer and samples
+ *    with dx = dy = 0 bring speed down to 0.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <dirent.h>
+#include <climits>
+#include <cstdlib>
+#include <signal.h>
+#include <iostream>
+#include <string>
+
+#include "config.h"
+#include "FrameSource.hpp"
+#include "Treadmill.hpp"
+#include "broadcast-server.h"
+
+using namespace std;
+
+volatile sig_atomic_t interrupted_ = 0;         /* Set on Ctrl+C */
+
+void sig_handler( int s )
+{
+    interrupted_ = 1;
+}
+
+/**
+ * @brief eventN of /dev/input/mouseN (same device, with timestamps).
+ *
+ * @return path unchanged if it is not a mouseN or no eventN is found.
+ */
+string event_device( const string& path )
+{
+    char real[PATH_MAX];
+    string dev = realpath( path.c_str( ), real ) ? real : path;
+    string name = dev.substr( dev.rfind( '/' ) + 1 );
+    if( name.compare( 0, 5, "mouse" ) != 0 )
+        return path;
+
+    string sys = "/sys/class/input/" + name + "/device";
+    DIR* dir = opendir( sys.c_str( ) );
+    if( ! dir )
+        return path;
+    string event = path;
+    while( struct dirent* e = readdir( dir ) )
+        if( strncmp( e->d_name, "event", 5 ) == 0 )
+        {
+            event = "/dev/input/" + string( e->d_name );
+            break;
+        }
+    closedir( dir );
+    return event;
+}
+
+void usage( const char* prog )
+{
+    cout << "Usage: " << prog << " DEVICE [options]" << endl
+        << "  DEVICE            /dev/input/eventN or /dev/input/mouseN" << endl
+        << "  --window-ms N     Speed is over last N ms (default " << MOUSE_WINDOW_MS << ")" << endl
+        << "  --tick-ms N       Window moves on when still every N ms (default 5)" << endl
+        << "  --socket PATH     Stream samples here (default " << MOUSE_SOCK_PATH << ")" << endl
+        << "  --shm NAME        Latest sample here (default " << MOUSE_SHM_NAME << ")" << endl;
+}
+
+int main( int argc, char** argv )
+{
+    string device;
+    unsigned windowMs = MOUSE_WINDOW_MS;
+    unsigned tickMs = 5;
+    string sockPath = MOUSE_SOCK_PATH;
+    string shmName = MOUSE_SHM_NAME;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if( arg == "--window-ms" && i + 1 < argc )
+            windowMs = atoi( argv[++i] );
+        else if( arg == "--tick-ms" && i + 1 < argc )
+            tickMs = atoi( argv[++i] );
+        else if( arg == "--socket" && i + 1 < argc )
+            sockPath = argv[++i];
+        else if( arg == "--shm" && i + 1 < argc )
+            shmName = argv[++i];
+        else if( arg[0] != '-' && device.empty( ) )
+            device = arg;
+        else
+        {
+            usage( argv[0] );
+            return arg == "--help" || arg == "-h" ? 0 : -1;
+        }
+    }
+    if( device.empty( ) || windowMs == 0 || tickMs == 0 )
+    {
+        usage( argv[0] );
+        return -1;
+    }
+
+    // evdev gives every report with its kernel time; mousedev (mouseN) gives
+    // 3 byte PS/2 packets only, stamped here when read.
+    string path = event_device( device );
+    int fd = open( path.c_str( ), O_RDONLY | O_NONBLOCK | O_CLOEXEC );
+    if( fd < 0 )
+    {
+        cout << "[ERROR] Could not open " << path << ": " << strerror( errno ) << endl;
+        return -1;
+    }
+    bool evdev = path.find( "/event" ) != string::npos;
+    if( evdev )
+    {
+        int clock = CLOCK_MONOTONIC;
+        if( ioctl( fd, EVIOCSCLOCKID, &clock ) != 0 )
+        {
+            cout << "[ERROR] " << path << ": can't get CLOCK_MONOTONIC stamps" << endl;
+            close( fd );
+            return -1;
+        }
+    }
+    cout << "[INFO] Reading " << path << (evdev ? " (kernel stamps)" : " (stamped on read)")
+        << ", speed over " << windowMs << " ms" << endl;
+
+    MouseReports reports;
+    MotionEstimator motion( windowMs * 1000000ull );
+    TreadmillWriter shm( shmName, windowMs );
+    BroadcastServer server( sockPath, BROADCAST_MAX_QUEUE );
+    if( ! server.start( ) )
+    {
+        close( fd );
+        return -1;
+    }
+
+    signal( SIGINT, sig_handler );
+    signal( SIGTERM, sig_handler );
+    signal( SIGPIPE, SIG_IGN );
+
+    int tick = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+    struct itimerspec its;
+    its.it_interval.tv_sec = tickMs / 1000;
+    its.it_interval.tv_nsec = (tickMs % 1000) * 1000000L;
+    its.it_value = its.it_interval;
+    timerfd_settime( tick, 0, &its, NULL );
+
+    int epoll = epoll_create1( EPOLL_CLOEXEC );
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl( epoll, EPOLL_CTL_ADD, fd, &ev );
+    ev.data.fd = tick;
+    epoll_ctl( epoll, EPOLL_CTL_ADD, tick, &ev );
+
+    TreadmillSample s;
+    memset( &s, 0, sizeof( s ) );
+    shm.publish( s );
+
+    auto publish = [&]( uint64_t t_ns, int dx, int dy ) {
+        s.host_ns = t_ns;
+        s.dx = dx;
+        s.dy = dy;
+        s.x += dx;
+        s.y += dy;
+        s.speed = motion.speed( );
+        s.direction = motion.direction( );
+        shm.publish( s );
+        server.broadcast( &s, sizeof( s ) );
+    };
+
+    int result = 0;
+    struct input_event events[64];
+    while( ! interrupted_ )
+    {
+        struct epoll_event ready[2];
+        int n = epoll_wait( epoll, ready, 2, 1000 );
+        if( n < 0 && errno != EINTR )
+        {
+            perror( "epoll_wait" );
+            result = -1;
+            break;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            if( ready[i].data.fd == tick )
+            {
+                uint64_t expirations;
+                if( read( tick, &expirations, sizeof( expirations ) ) < 0 )
+                    continue;
+                uint64_t now = monotonic_ns( );
+                if( motion.expire( now ) )
+                    publish( now, 0, 0 );
+                continue;
+            }
+
+            if( ! evdev )
+            {
+                signed char packet[3];
+                while( read( fd, packet, sizeof( packet ) ) == sizeof( packet ) )
+                {
+                    uint64_t now = monotonic_ns( );
+                    s.reports += 1;
+                    motion.add( now, packet[1], packet[2] );
+                    publish( now, packet[1], packet[2] );
+                }
+                continue;
+            }
+
+            ssize_t got;
+            while( (got = read( fd, events, sizeof( events ) )) > 0 )
+                for (size_t k = 0; k < got / sizeof( events[0] ); k++)
+                {
+                    int dx, dy;
+                    uint64_t t;
+                    if( ! reports.feed( events[k], dx, dy, t ) )
+                        continue;
+                    s.reports += 1;
+                    motion.add( t, dx, dy );
+                    publish( t, dx, dy );
+                }
+            if( got < 0 && errno != EAGAIN && errno != EINTR )
+            {
+                cout << "[ERROR] " << path << ": " << strerror( errno ) << endl;
+                result = -1;
+                interrupted_ = 1;
+            }
+        }
+    }
+
+    cout << "[INFO] " << s.reports << " reports, " << reports.dropped( )
+        << " times kernel dropped events" << endl;
+    server.stop( );
+    close( epoll );
+    close( tick );
+    close( fd );
+    return result;
+}
@@ -7,7 +7,7 @@ Server::Server() {
 }
 
 Server::~Server() {
-    delete buf_;
+    delete[] buf_;
 }
 
 void
@@ -50,7 +50,7 @@ Server::handle(int client) {
         if (request.empty())
             break;
         // send response
-        bool success = send_response(client,request);
+        bool success = send_response(client,process(request));
         // break if an error occurred
         if (not success)
             break;
@@ -58,11 +58,19 @@ Server::handle(int client) {
     close(client);
 }
 
+string
+Server::process(const string& request) {
+    // echo by default
+    return request;
+}
+
 string
 Server::get_request(int client) {
     string request = "";
-    // read until we get a newline
-    while (request.find("\n") == string::npos) {
+    // read until the request ends with a newline; a client may send many
+    // lines at once (e.g. a batch of arduino lines) and recv() can split
+    // them anywhere
+    while (request.empty() or request[request.size() - 1] != '\n') {
         int nread = recv(client,buf_,1024,0);
         if (nread < 0) {
             if (errno == EINTR)
@@ -16,15 +16,16 @@ using namespace std;
 class Server {
 public:
     Server();
-    ~Server();
+    virtual ~Server();
 
     void run();
     
 protected:
     virtual void create();
     virtual void close_socket();
-    void serve();
-    void handle(int);
+    virtual void serve();
+    virtual void handle(int);
+    virtual string process(const string&);
     string get_request(int);
     bool send_response(int, string);
 
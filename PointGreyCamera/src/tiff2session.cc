@@ -0,0 +1,258 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  tiff2session.cc
+ *
+ *    Description:  Convert a session recorded as trial_%03d.tif files (and the
+ *    arduino trial=N.dat files next to them) to one session file.
+ *
+ *      $ ./tiff2session DATA_DIR [session.ebs]
+ *
+ *    The text row of each page becomes a SESSION_EVENT_ROW event, and its
+ *    fields fill the binary metadata of the frame:
+ *
+ *      camera_arduino_client.py rows   isotime,arduino line...,mouse,blink
+ *      cam_server rows                 frame_id,camera_ns,blink,meta
+ *
+ *    Lines of trial=N.dat go in as text events, in time order with frames.
+ *    Host times of converted sessions are wall clock.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <dirent.h>
+
+#include <tiffio.h>
+
+#include "config.h"
+#include "Session.hpp"
+
+using namespace std;
+
+/* 2016-12-06T14:03:48.123456 (local time) to ns since epoch; 0 if not one. */
+uint64_t iso_to_ns( const string& s )
+{
+    struct tm tm;
+    memset( &tm, 0, sizeof( tm ) );
+    double sec = 0;
+    if( sscanf( s.c_str( ), "%d-%d-%dT%d:%d:%lf", &tm.tm_year, &tm.tm_mon, &tm.tm_mday
+                , &tm.tm_hour, &tm.tm_min, &sec ) != 6 )
+        return 0;
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    tm.tm_sec = (int)sec;
+    time_t t = mktime( &tm );
+    return (uint64_t)t * 1000000000ull + (uint64_t)((sec - tm.tm_sec) * 1e9 + 0.5);
+}
+
+vector<string> split( const string& s, char sep )
+{
+    vector<string> fields;
+    istringstream is( s );
+    string f;
+    while( getline( is, f, sep ) )
+        fields.push_back( f );
+    return fields;
+}
+
+/* Binary metadata from text row; index is used when the row has no id. */
+SessionFrame parse_row( const string& row, uint64_t index, uint64_t last_ns )
+{
+    SessionFrame info = { index, 0, last_ns, -1.0f, SESSION_NO_TRIAL };
+    vector<string> f = split( row, ',' );
+    if( f.empty( ) )
+        return info;
+
+    uint64_t ns = iso_to_ns( f[0] );
+    if( ns > 0 )
+    {
+        info.host_ns = ns;
+        if( f.size( ) > 1 )
+            info.blink = atof( f.back( ).c_str( ) );
+    }
+    else if( f.size( ) >= 3 && f[0].find_first_not_of( "0123456789" ) == string::npos )
+    {
+        info.frame_id = strtoull( f[0].c_str( ), NULL, 10 );
+        info.camera_ns = strtoull( f[1].c_str( ), NULL, 10 );
+        info.host_ns = info.camera_ns;
+        info.blink = atof( f[2].c_str( ) );
+    }
+    return info;
+}
+
+struct DatLine
+{
+    uint64_t ns;
+    string text;
+};
+
+/* Lines of the trial=N.dat files in dir, by trial. */
+map<int, vector<DatLine> > read_dat_files( const string& dir, const vector<string>& names )
+{
+    map<int, vector<DatLine> > lines;
+    for( auto& name : names )
+    {
+        size_t at = name.rfind( "trial=" );
+        if( at == string::npos || name.size( ) < 4 || name.substr( name.size( ) - 4 ) != ".dat" )
+            continue;
+        int trial = atoi( name.c_str( ) + at + 6 );
+        ifstream in( dir + "/" + name );
+        string line;
+        while( getline( in, line ) )
+            if( ! line.empty( ) )
+                lines[trial].push_back( DatLine{ iso_to_ns( line ), line } );
+    }
+    return lines;
+}
+
+/* Append pages of one tiff as trial; returns frames written or -1. */
+long convert_tiff( SessionWriter& session, const string& filename, int trial
+        , vector<DatLine> dat, uint64_t& last_ns )
+{
+    ::TIFF* tif = TIFFOpen( filename.c_str( ), "r" );
+    if( ! tif )
+        return -1;
+
+    long n = 0;
+    size_t next = 0;
+    bool begun = false;
+    do
+    {
+        uint32_t w = 0, h = 0;
+        TIFFGetField( tif, TIFFTAG_IMAGEWIDTH, &w );
+        TIFFGetField( tif, TIFFTAG_IMAGELENGTH, &h );
+        if( w != FRAME_WIDTH || h < FRAME_HEIGHT )
+        {
+            cout << "[WARN] " << filename << ": page " << w << "x" << h << " is not "
+                << FRAME_WIDTH << "x" << FRAME_HEIGHT << "; skipped" << endl;
+            continue;
+        }
+
+        // Frames have metadata in the first (h - FRAME_HEIGHT) rows.
+        uint32_t skip = h - FRAME_HEIGHT;
+        vector<uint8_t> page( w * h );
+        bool ok = true;
+        for (uint32_t row = 0; row < h && ok; row++)
+            ok = TIFFReadScanline( tif, &page[row * w], row, 0 ) >= 0;
+        if( ! ok )
+            break;
+
+        string text;
+        if( skip > 0 )
+        {
+            text.assign( (const char*)&page[0], w );
+            text.erase( text.find_last_not_of( " \0", string::npos, 2 ) + 1 );
+        }
+        SessionFrame info = parse_row( text, session.frames( ), last_ns );
+        last_ns = info.host_ns;
+
+        if( ! begun )
+        {
+            session.begin_trial( trial, info.host_ns );
+            begun = true;
+        }
+        // Arduino lines read before this frame.
+        while( next < dat.size( ) && dat[next].ns <= info.host_ns )
+        {
+            session.add_text( dat[next].text, dat[next].ns );
+            next++;
+        }
+        if( ! text.empty( ) )
+            session.add_text( text, info.host_ns, SESSION_EVENT_ROW );
+        if( ! session.append( info, &page[skip * w] ) )
+        {
+            TIFFClose( tif );
+            return -1;
+        }
+        n++;
+    } while( TIFFReadDirectory( tif ) );
+    TIFFClose( tif );
+
+    for (; next < dat.size( ); next++)
+        session.add_text( dat[next].text, dat[next].ns );
+    session.end_trial( last_ns );
+    return n;
+}
+
+int main( int argc, char** argv )
+{
+    if( argc < 2 )
+    {
+        cout << "Usage: " << argv[0] << " DATA_DIR [session.ebs]" << endl;
+        return -1;
+    }
+    string dir = argv[1];
+    string out = argc > 2 ? argv[2] : dir + "/session.ebs";
+
+    vector<string> names;
+    DIR* d = opendir( dir.c_str( ) );
+    if( ! d )
+    {
+        cout << "[ERROR] Can't read directory " << dir << endl;
+        return -1;
+    }
+    while( struct dirent* e = readdir( d ) )
+        names.push_back( e->d_name );
+    closedir( d );
+    sort( names.begin( ), names.end( ) );
+
+    // trial_%03d.tif by trial number (-1: frames of no trial).
+    vector<pair<int, string> > tiffs;
+    for( auto& name : names )
+    {
+        int trial;
+        char ext[8];
+        if( sscanf( name.c_str( ), "trial_%d.%7s", &trial, ext ) == 2
+                && (string( ext ) == "tif" || string( ext ) == "tiff") )
+            tiffs.push_back( make_pair( trial, name ) );
+    }
+    sort( tiffs.begin( ), tiffs.end( ) );
+    if( tiffs.empty( ) )
+    {
+        cout << "[ERROR] No trial_%03d.tif in " << dir << endl;
+        return -1;
+    }
+
+    map<int, vector<DatLine> > dat = read_dat_files( dir, names );
+    SessionWriter session( out, FRAME_WIDTH, FRAME_HEIGHT, SESSION_CHUNK_FRAMES );
+    if( ! session.is_open( ) )
+    {
+        cout << "[ERROR] Could not open " << out << " for writing" << endl;
+        return -1;
+    }
+
+    uint64_t last_ns = 0;
+    for( auto& t : tiffs )
+    {
+        long n = convert_tiff( session, dir + "/" + t.second, t.first, dat[t.first], last_ns );
+        if( n < 0 )
+        {
+            cout << "[ERROR] Failed to convert " << t.second << endl;
+            return -1;
+        }
+        cout << "[INFO] " << t.second << ": " << n << " frames" << endl;
+    }
+
+    size_t frames = session.frames( );
+    if( ! session.close( ) )
+    {
+        cout << "[ERROR] Failed to write " << out << endl;
+        return -1;
+    }
+    cout << "[INFO] Wrote " << frames << " frames of " << tiffs.size( ) << " trials to "
+        << out << endl;
+    return 0;
+}
@@ -1,8 +1,11 @@
 #include "unix-server.h"
 
-const char* UnixServer::socket_name_ = "/tmp/unix-socket";
+std::vector<string> UnixServer::sockets_;
+
+UnixServer::UnixServer(const string& socket_name) {
+    socket_name_ = socket_name;
+    sockets_.push_back(socket_name);
 
-UnixServer::UnixServer() {
     // setup handler for Control-C so we can properly unlink the UNIX
     // socket when that occurs
     struct sigaction sigIntHandler;
@@ -22,15 +25,18 @@ UnixServer::create() {
     // setup socket address structure
     bzero(&server_addr,sizeof(server_addr));
     server_addr.sun_family = AF_UNIX;
-    strncpy(server_addr.sun_path,socket_name_,sizeof(server_addr.sun_path) - 1);
+    strncpy(server_addr.sun_path,socket_name_.c_str(),sizeof(server_addr.sun_path) - 1);
 
     // create socket
     server_ = socket(PF_UNIX,SOCK_STREAM,0);
-    if (!server_) {
+    if (server_ < 0) {
         perror("socket");
         exit(-1);
     }
 
+    // remove socket left behind by a previous run
+    unlink(socket_name_.c_str());
+
     // call bind to associate the socket with the UNIX file system
     if (bind(server_,(const struct sockaddr *)&server_addr,sizeof(server_addr)) < 0) {
         perror("bind");
@@ -46,10 +52,11 @@ UnixServer::create() {
 
 void
 UnixServer::close_socket() {
-    unlink(socket_name_);
+    unlink(socket_name_.c_str());
 }
 
 void
 UnixServer::interrupt(int) {
-    unlink(socket_name_);
+    for (auto& name : sockets_)
+        unlink(name.c_str());
 }
@@ -5,12 +5,14 @@
 #include <stdio.h>
 #include <sys/un.h>
 
+#include <vector>
+
 #include "server.h"
 
 class UnixServer : public Server {
 
 public:
-    UnixServer();
+    UnixServer(const string& socket_name = "/tmp/unix-socket");
     ~UnixServer();
 
 protected:
@@ -19,6 +21,8 @@ protected:
 
 private:
     static void interrupt(int);
-    
-    static const char* socket_name_;
+
+    string socket_name_;
+    // sockets of all servers, removed on Control-C
+    static std::vector<string> sockets_;
 };
@@ -0,0 +1,101 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  BlinkReference.hpp
+ *
+ *    Description:  Plain, slow blink signal written as close as possible to
+ *    blinky.find_blinks_using_pixals( ) and the OpenCV functions it calls.
+ *    BlinkDetector must agree with it exactly.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  BlinkReference_INC
+#define  BlinkReference_INC
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+
+/* cv::GaussianBlur( 13x13, sigma=1 ) fixed point kernel for 8 bit images. */
+static const int reference_kernel_[] = { 1, 14, 62, 102, 62, 14, 1 };
+static const int reference_radius_ = 3;
+
+inline int reference_reflect101( int i, int n )
+{
+    while( i < 0 || i >= n )
+        i = i < 0 ? -i : 2 * (n - 1) - i;
+    return i;
+}
+
+/**
+ * @brief Blink signal of roi (rows x cols). Blurred roi is returned in blurred.
+ */
+inline float reference_blink( const std::vector<uint8_t>& roi, int rows, int cols
+        , std::vector<uint8_t>& blurred )
+{
+    // cv2.equalizeHist
+    int hist[256] = { 0 };
+    for( auto v : roi )
+        hist[v]++;
+    int total = rows * cols;
+    int first = 0;
+    while( hist[first] == 0 )
+        first++;
+    uint8_t lut[256] = { 0 };
+    if( hist[first] == total )
+        for (int i = 0; i < 256; i++)
+            lut[i] = first;
+    else
+    {
+        float scale = 255.f / (total - hist[first]);
+        int sum = 0;
+        for (int i = first + 1; i < 256; i++)
+        {
+            sum += hist[i];
+            long v = std::lrint( sum * scale );
+            lut[i] = v > 255 ? 255 : v;
+        }
+    }
+
+    // cv2.GaussianBlur, done in 2D.
+    blurred.assign( total, 0 );
+    for (int y = 0; y < rows; y++)
+        for (int x = 0; x < cols; x++)
+        {
+            uint64_t acc = 0;
+            for (int i = -reference_radius_; i <= reference_radius_; i++)
+                for (int j = -reference_radius_; j <= reference_radius_; j++)
+                {
+                    int yy = reference_reflect101( y + i, rows );
+                    int xx = reference_reflect101( x + j, cols );
+                    acc += reference_kernel_[i + reference_radius_]
+                        * reference_kernel_[j + reference_radius_]
+                        * lut[roi[yy * cols + xx]];
+                }
+            blurred[y * cols + x] = (acc + (1 << 15)) >> 16;
+        }
+
+    // frame.mean( ), frame.std( )
+    double m = 0, s = 0;
+    for( auto v : blurred )
+        m += v;
+    m /= total;
+    for( auto v : blurred )
+        s += (v - m) * (v - m);
+    s = std::sqrt( s / total );
+    double thres = m - s > 0 ? m - s : 0;
+
+    int r0 = rows / 2, c0 = cols / 2;
+    int count = 0;
+    for (int y = r0 - rows / 4; y < r0 + rows / 4; y++)
+        for (int x = c0 - cols / 4; x < c0 + cols / 4; x++)
+            count += blurred[y * cols + x] < thres;
+    return 255.0f * count / (rows * cols / 4);
+}
+
+#endif   /* ----- #ifndef BlinkReference_INC  ----- */
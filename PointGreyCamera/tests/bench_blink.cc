@@ -0,0 +1,81 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  bench_blink.cc
+ *
+ *    Description:  Time per frame of BlinkDetector (and of the plain reference
+ *    for comparison) on synthetic frames.
+ *
+ *      $ ./bench-blink [frames]
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <iostream>
+#include <chrono>
+
+#include "config.h"
+#include "src/FrameSource.hpp"
+#include "src/SyntheticSource.hpp"
+#include "src/BlinkDetector.hpp"
+#include "tests/BlinkReference.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+int main( int argc, char** argv )
+{
+    size_t nframes = argc > 1 ? atoi( argv[1] ) : 2000;
+    const size_t x0 = BLINK_ROI_X0, y0 = BLINK_ROI_Y0;
+    const size_t x1 = BLINK_ROI_X1, y1 = BLINK_ROI_Y1;
+
+    SyntheticSource synthetic( FRAME_WIDTH, FRAME_HEIGHT, 0, 64 );
+    synthetic.init( );
+    synthetic.begin_acquisition( );
+
+    // Keep frames around so that only the kernel is timed.
+    vector<Frame> frames( 64 );
+    for( auto& f : frames )
+        synthetic.next_frame( f );
+
+    BlinkDetector<FRAME_WIDTH, FRAME_HEIGHT> blink( x0, y0, x1, y1 );
+    double total = 0;
+    auto t0 = steady_clock::now( );
+    for (size_t i = 0; i < nframes; i++)
+        total += blink.process( frames[i % frames.size( )].data );
+    duration<double, micro> native = steady_clock::now( ) - t0;
+
+    size_t nref = max( nframes / 50, (size_t)1 );
+    vector<uint8_t> roi, blurred;
+    t0 = steady_clock::now( );
+    for (size_t i = 0; i < nref; i++)
+    {
+        const uint8_t* f = frames[i % frames.size( )].data;
+        roi.clear( );
+        for (size_t y = y0; y < y1; y++)
+            roi.insert( roi.end( ), f + y * FRAME_WIDTH + x0, f + y * FRAME_WIDTH + x1 );
+        total += reference_blink( roi, y1 - y0, x1 - x0, blurred );
+    }
+    duration<double, micro> reference = steady_clock::now( ) - t0;
+
+    cout << "ROI " << x1 - x0 << "x" << y1 - y0
+#if defined(__AVX2__)
+        << " (AVX2)"
+#elif defined(__SSE2__)
+        << " (SSE2)"
+#endif
+        << endl;
+    cout << "BlinkDetector: " << native.count( ) / nframes << " us/frame ("
+        << 1e6 * nframes / native.count( ) << " frames/s)" << endl;
+    cout << "Reference:     " << reference.count( ) / nref << " us/frame" << endl;
+    cout << "(checksum " << total << ")" << endl;
+
+    for( auto& f : frames )
+        synthetic.release( f );
+    synthetic.end_acquisition( );
+    return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  bench_codec.cc
+ *
+ *    Description:  Compression ratio, encode and decode speed of FrameCodec
+ *    for 1 .. all threads, on recorded trials or on synthetic frames. Every
+ *    frame is decoded and compared with the original.
+ *
+ *      $ ./bench-codec                              # synthetic
+ *      $ ./bench-codec data/trial_001.tif ...       # recorded trials
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <random>
+
+#include "config.h"
+#include "src/FrameSource.hpp"
+#include "src/SyntheticSource.hpp"
+#include "src/FrameCodec.hpp"
+
+#ifdef HAVE_TIFF
+#include "src/TiffReplaySource.hpp"
+#endif
+
+using namespace std;
+using namespace std::chrono;
+
+typedef vector<vector<uint8_t> > Frames;
+
+void take( FrameSource& source, Frames& frames, size_t max_frames )
+{
+    source.begin_acquisition( );
+    Frame frame;
+    while( frames.size( ) < max_frames && source.next_frame( frame ) )
+    {
+        frames.push_back( vector<uint8_t>( frame.data, frame.data + frame.size ) );
+        source.release( frame );
+    }
+    source.end_acquisition( );
+    source.deinit( );
+}
+
+/* Returns false if a frame does not survive the round trip. */
+bool bench( const string& name, const Frames& frames )
+{
+    const size_t w = FRAME_WIDTH, h = FRAME_HEIGHT;
+    const double raw = (double)w * h * frames.size( );
+    cout << name << ": " << frames.size( ) << " frames" << endl;
+
+    vector<size_t> threads = { 1, 2, 4 };
+    size_t cores = thread::hardware_concurrency( );
+    if( cores > 4 )
+        threads.push_back( cores );
+
+    bool ok = true;
+    for( auto n : threads )
+    {
+        FrameEncoder enc( w, h, 200, n );
+        vector<uint8_t> buf;
+        buf.reserve( frames.size( ) * w * h / 2 );
+        vector<size_t> sizes;
+
+        auto t0 = steady_clock::now( );
+        for( auto& f : frames )
+            sizes.push_back( enc.encode( &f[0], buf ) );
+        duration<double> encode = steady_clock::now( ) - t0;
+
+        FrameDecoder dec( n );
+        vector<uint8_t> out( w * h );
+        size_t offset = 0, bad = 0;
+        t0 = steady_clock::now( );
+        for (size_t i = 0; i < frames.size( ); i++)
+        {
+            if( ! dec.decode( &buf[offset], sizes[i], &out[0], out.size( ) ) || out != frames[i] )
+                bad += 1;
+            offset += sizes[i];
+        }
+        duration<double> decode = steady_clock::now( ) - t0;
+
+        cout << "  threads " << setw( 2 ) << n << fixed << setprecision( 2 )
+            << "  ratio " << raw / buf.size( )
+            << setprecision( 0 )
+            << "  encode " << setw( 5 ) << frames.size( ) / encode.count( ) << " fps ("
+            << raw / encode.count( ) / 1e6 << " MB/s)"
+            << "  decode " << setw( 5 ) << frames.size( ) / decode.count( ) << " fps"
+            << (bad ? "  ROUND TRIP FAILED" : "") << endl;
+        ok &= bad == 0;
+    }
+    cout << "  (camera needs " << EXPECTED_FPS << " fps)" << endl;
+    return ok;
+}
+
+int main( int argc, char** argv )
+{
+    bool ok = true;
+
+    if( argc > 1 )
+    {
+#ifdef HAVE_TIFF
+        for (int i = 1; i < argc; i++)
+        {
+            Frames frames;
+            TiffReplaySource replay( argv[i], FRAME_WIDTH, FRAME_HEIGHT, 0, false, 4 );
+            if( replay.init( ) != 0 )
+                continue;
+            take( replay, frames, 1000 );
+            ok &= bench( argv[i], frames );
+        }
+#else
+        cout << "[ERROR] Built without libtiff; can't read recorded trials" << endl;
+        return 1;
+#endif
+        return ok ? 0 : 1;
+    }
+
+    Frames frames;
+    SyntheticSource synthetic( FRAME_WIDTH, FRAME_HEIGHT, 0, 4 );
+    synthetic.init( );
+    take( synthetic, frames, 400 );
+    ok &= bench( "synthetic (noise sd 6, worst case)", frames );
+
+    // One still frame with a little sensor noise, closer to a real session.
+    mt19937 rng( 1 );
+    for (size_t i = 1; i < frames.size( ); i++)
+    {
+        frames[i] = frames[0];
+        for (size_t j = rng( ) % 5; j < frames[i].size( ); j += 5)
+            frames[i][j] += rng( ) % 3 - 1;
+    }
+    ok &= bench( "still scene (noise +-1 on 1/5 of pixels)", frames );
+    return ok ? 0 : 1;
+}
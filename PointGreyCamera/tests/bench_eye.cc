@@ -0,0 +1,70 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  bench_eye.cc
+ *
+ *    Description:  Time per frame of EyeTracker on synthetic frames: local
+ *    search only, and with a whole frame search every frame.
+ *
+ *      $ ./bench-eye [frames]
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <iostream>
+#include <chrono>
+
+#include "config.h"
+#include "src/FrameSource.hpp"
+#include "src/SyntheticSource.hpp"
+#include "src/EyeTracker.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+int main( int argc, char** argv )
+{
+    size_t nframes = argc > 1 ? atoi( argv[1] ) : 2000;
+
+    SyntheticSource synthetic( FRAME_WIDTH, FRAME_HEIGHT, 0, 64 );
+    synthetic.init( );
+    synthetic.begin_acquisition( );
+
+    // Keep frames around so that only the tracker is timed.
+    vector<Frame> frames( 64 );
+    for( auto& f : frames )
+        synthetic.next_frame( f );
+
+    const EyeTracker::Box roi = { { BLINK_ROI_X0, BLINK_ROI_Y0, BLINK_ROI_X1, BLINK_ROI_Y1 } };
+    cout << "Frame " << FRAME_WIDTH << "x" << FRAME_HEIGHT << ", box " << roi[2] - roi[0]
+        << "x" << roi[3] - roi[1]
+#if defined(__AVX2__)
+        << " (AVX2)"
+#elif defined(__SSE2__)
+        << " (SSE2)"
+#endif
+        << endl;
+
+    size_t moves = 0;
+    for( unsigned every : { (unsigned)nframes + 1, 1u } )
+    {
+        EyeTracker eye( FRAME_WIDTH, FRAME_HEIGHT, roi, every );
+        eye.process( frames[0].data );
+        auto t0 = steady_clock::now( );
+        for (size_t i = 0; i < nframes; i++)
+            moves += eye.process( frames[i % frames.size( )].data );
+        duration<double, micro> took = steady_clock::now( ) - t0;
+        cout << (every == 1 ? "Whole frame search: " : "Local search:       ")
+            << took.count( ) / nframes << " us/frame" << endl;
+    }
+    cout << "(" << moves << " moves)" << endl;
+
+    for( auto& f : frames )
+        synthetic.release( f );
+    synthetic.end_acquisition( );
+    return 0;
+}
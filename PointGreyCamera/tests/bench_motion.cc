@@ -0,0 +1,75 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  bench_motion.cc
+ *
+ *    Description:  Time per frame of MotionEnergy on synthetic frames: one
+ *    whole frame mask, and four masks against a running background.
+ *
+ *      $ ./bench-motion [frames]
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <iostream>
+#include <chrono>
+
+#include "config.h"
+#include "src/FrameSource.hpp"
+#include "src/SyntheticSource.hpp"
+#include "src/MotionEnergy.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+int main( int argc, char** argv )
+{
+    size_t nframes = argc > 1 ? atoi( argv[1] ) : 2000;
+
+    SyntheticSource synthetic( FRAME_WIDTH, FRAME_HEIGHT, 0, 64 );
+    synthetic.init( );
+    synthetic.begin_acquisition( );
+
+    // Keep frames around so that only the kernel is timed.
+    vector<Frame> frames( 64 );
+    for( auto& f : frames )
+        synthetic.next_frame( f );
+
+    const size_t w = FRAME_WIDTH, h = FRAME_HEIGHT;
+    vector<MotionEnergy::Box> quarters = { { { 0, 0, w / 2, h / 2 } }, { { w / 2, 0, w, h / 2 } }
+        , { { 0, h / 2, w / 2, h } }, { { w / 2, h / 2, w, h } } };
+    MotionEnergy whole( w, h, { MotionEnergy::Box{ { 0, 0, w, h } } } );
+    MotionEnergy background( w, h, quarters, 4 );
+
+    float out[FRAME_MOTION_MASKS];
+    double total = 0;
+    cout << "Frame " << w << "x" << h
+#if defined(__AVX2__)
+        << " (AVX2)"
+#elif defined(__SSE2__)
+        << " (SSE2)"
+#endif
+        << endl;
+    for( MotionEnergy* m : { &whole, &background } )
+    {
+        auto t0 = steady_clock::now( );
+        for (size_t i = 0; i < nframes; i++)
+        {
+            m->process( frames[i % frames.size( )].data, out );
+            total += out[0];
+        }
+        duration<double, micro> took = steady_clock::now( ) - t0;
+        cout << (m == &whole ? "Previous frame, 1 mask:  " : "Background 1/16, 4 masks: ")
+            << took.count( ) / nframes << " us/frame" << endl;
+    }
+    cout << "(checksum " << total << ")" << endl;
+
+    for( auto& f : frames )
+        synthetic.release( f );
+    synthetic.end_acquisition( );
+    return 0;
+}
@@ -0,0 +1,510 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  bench_transport.cc
+ *
+ *    Description:  Frame transport benchmark at FRAME_WIDTH x FRAME_HEIGHT;
+ *    the experiments of NOTES.md, made repeatable.
+ *
+ *    Every variant sends frames from a writer thread to a reader thread:
+ *    AF_UNIX stream with blocking and non-blocking ends, write sizes and
+ *    SO_SNDBUF, SOCK_SEQPACKET, shared memory (ShmTransport.hpp) and the
+ *    BroadcastServer which cam_server serves frames with. Each variant runs
+ *    once as fast as it can (fps) and once paced at EXPECTED_FPS (latency
+ *    from write to whole frame read, and the longest write( ) which is how
+ *    long the camera thread would have been stuck).
+ *
+ *    Slow consumer scenarios pace the writer at EXPECTED_FPS with a reader
+ *    which needs 1.5 frame periods per frame.
+ *
+ *      $ ./bench-transport                 # 1000 frames per variant
+ *      $ ./bench-transport --quick         # what ctest runs
+ *      $ ./bench-transport --min-fps 400   # also fail below 400 fps
+ *
+ *    Fails if a lossless variant loses, reorders or corrupts a frame.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "src/FrameSource.hpp"
+#include "src/FrameHeader.hpp"
+#include "src/ShmTransport.hpp"
+#include "src/LatencyHistogram.hpp"
+#include "src/broadcast-server.h"
+
+using namespace std;
+
+const size_t frame_size_ = FRAME_WIDTH * FRAME_HEIGHT;
+
+#define BENCH_SOCK_PATH     "/tmp/bench_transport_socket"
+#define BENCH_SHM_NAME      "/bench_transport_frames"
+
+struct Run
+{
+    size_t frames;
+    double fps;                                 /* Writer pace; 0 as fast as it can. */
+    double reader_ms;                           /* Reader's work per frame. */
+};
+
+struct Result
+{
+    size_t delivered;
+    uint64_t lost;                              /* Gaps in frame ids seen by reader. */
+    bool intact;                                /* In order and not corrupted. */
+    double seconds;                             /* First write to last frame read. */
+    atomic<uint64_t> last_ns;
+    uint64_t max_write_ns;
+    LatencyHistogram latency;
+    string note;
+
+    Result( ) : delivered( 0 ), lost( 0 ), intact( true ), seconds( 0 ), last_ns( 0 )
+                , max_write_ns( 0 )
+    { }
+
+    double fps( ) const
+    {
+        return seconds > 0 ? delivered / seconds : 0;
+    }
+};
+
+/* First 16 bytes of a frame: id and monotonic_ns( ) when it was written. */
+void stamp( vector<uint8_t>& frame, uint64_t id )
+{
+    uint64_t now = monotonic_ns( );
+    memcpy( &frame[0], &id, 8 );
+    memcpy( &frame[8], &now, 8 );
+    frame[frame_size_ - 1] = (uint8_t)id;
+}
+
+/* Reader side bookkeeping of one whole frame. */
+void received( const uint8_t* frame, uint64_t& expect, Result& res, const Run& run )
+{
+    uint64_t id, sent;
+    memcpy( &id, frame, 8 );
+    memcpy( &sent, frame + 8, 8 );
+    res.last_ns = monotonic_ns( );
+    res.latency.record_diff( res.last_ns, sent );
+    if( id < expect || frame[frame_size_ - 1] != (uint8_t)id )
+        res.intact = false;
+    if( id > expect )
+        res.lost += id - expect;
+    expect = id + 1;
+    res.delivered += 1;
+    if( run.reader_ms > 0 )
+        this_thread::sleep_for( chrono::microseconds( (long)(run.reader_ms * 1000) ) );
+}
+
+/* Sleep till frame i is due. */
+void pace( const Run& run, size_t i, uint64_t t0 )
+{
+    if( run.fps <= 0 )
+        return;
+    uint64_t due = t0 + (uint64_t)(i * 1e9 / run.fps);
+    uint64_t now = monotonic_ns( );
+    if( due > now )
+        this_thread::sleep_for( chrono::nanoseconds( due - now ) );
+}
+
+/*-----------------------------------------------------------------------------
+ *  Sockets
+ *-----------------------------------------------------------------------------*/
+struct SocketVariant
+{
+    int type;                                   /* SOCK_STREAM or SOCK_SEQPACKET */
+    size_t chunk;                               /* Bytes per send( ); 0 is whole frame. */
+    int sndbuf;                                 /* SO_SNDBUF; 0 leaves default. */
+    bool nonblocking;                           /* Writer O_NONBLOCK, poll( ) on EAGAIN. */
+    bool reader_sleeps;                         /* Reader O_NONBLOCK, 100 ms sleep on EAGAIN. */
+};
+
+void read_socket( int fd, const SocketVariant& v, const Run& run, Result& res )
+{
+    vector<uint8_t> frame( frame_size_ );
+    uint64_t expect = 0;
+    while( true )
+    {
+        size_t got = 0;
+        while( got < frame_size_ )
+        {
+            ssize_t n = recv( fd, &frame[got], frame_size_ - got, 0 );
+            if( n > 0 )
+                got += n;
+            else if( n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+                // What camera_client.py did; NOTES.md's "10 FPS with O_NONBLOCK".
+                this_thread::sleep_for( chrono::milliseconds( 100 ) );
+            else if( n < 0 && errno == EINTR )
+                continue;
+            else
+                return;
+        }
+        received( &frame[0], expect, res, run );
+    }
+}
+
+/* false on error other than a full socket (e.g. EMSGSIZE). */
+bool send_frame( int fd, const SocketVariant& v, const vector<uint8_t>& frame, Result& res )
+{
+    size_t chunk = v.chunk ? v.chunk : frame_size_;
+    size_t sent = 0;
+    while( sent < frame_size_ )
+    {
+        size_t n = min( chunk, frame_size_ - sent );
+        ssize_t w = send( fd, &frame[sent], n, MSG_NOSIGNAL );
+        if( w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+        {
+            struct pollfd p = { fd, POLLOUT, 0 };
+            poll( &p, 1, 1000 );
+            continue;
+        }
+        if( w < 0 && errno == EINTR )
+            continue;
+        if( w < 0 )
+        {
+            res.note = strerror( errno );
+            return false;
+        }
+        sent += w;
+    }
+    return true;
+}
+
+void bench_socket( const SocketVariant& v, const Run& run, Result& res )
+{
+    int sv[2];
+    if( socketpair( AF_UNIX, v.type, 0, sv ) != 0 )
+    {
+        res.note = strerror( errno );
+        res.intact = false;
+        return;
+    }
+    if( v.sndbuf > 0 )
+        setsockopt( sv[0], SOL_SOCKET, SO_SNDBUF, &v.sndbuf, sizeof( v.sndbuf ) );
+    int sndbuf = 0;
+    socklen_t len = sizeof( sndbuf );
+    getsockopt( sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, &len );
+    res.note = "sndbuf " + to_string( sndbuf / 1024 ) + "K";
+    if( v.nonblocking )
+        fcntl( sv[0], F_SETFL, fcntl( sv[0], F_GETFL ) | O_NONBLOCK );
+    if( v.reader_sleeps )
+        fcntl( sv[1], F_SETFL, fcntl( sv[1], F_GETFL ) | O_NONBLOCK );
+
+    thread reader( read_socket, sv[1], cref( v ), cref( run ), ref( res ) );
+
+    vector<uint8_t> frame( frame_size_, 0x5a );
+    uint64_t t0 = monotonic_ns( );
+    for (size_t i = 0; i < run.frames; i++)
+    {
+        pace( run, i, t0 );
+        stamp( frame, i );
+        uint64_t w0 = monotonic_ns( );
+        if( ! send_frame( sv[0], v, frame, res ) )
+            break;
+        res.max_write_ns = max( res.max_write_ns, monotonic_ns( ) - w0 );
+    }
+    shutdown( sv[0], SHUT_WR );
+    reader.join( );
+    res.seconds = res.last_ns > t0 ? (res.last_ns - t0) / 1e9 : 0;
+    close( sv[0] );
+    close( sv[1] );
+}
+
+/*-----------------------------------------------------------------------------
+ *  Shared memory
+ *-----------------------------------------------------------------------------*/
+void bench_shm( const Run& run, Result& res )
+{
+    ShmWriter writer( BENCH_SHM_NAME, SHM_NUM_SLOTS, FRAME_WIDTH, FRAME_HEIGHT );
+    ShmReader shm( BENCH_SHM_NAME );
+    atomic<bool> done( false );
+
+    thread reader( [&]( ) {
+            uint64_t expect = 0;
+            vector<uint8_t> frame( frame_size_ );
+            while( true )
+            {
+                if( ! shm.wait( 100 ) )
+                {
+                    if( done )
+                        break;
+                    continue;
+                }
+                // Copy: the reader works on the frame after the slot may be reused.
+                if( shm.read( [&]( const ShmSlotHeader&, const unsigned char* px ) {
+                            memcpy( &frame[0], px, frame_size_ );
+                            } ) )
+                    received( &frame[0], expect, res, run );
+            }
+            res.lost = max( res.lost, shm.missed( ) );
+            } );
+
+    vector<uint8_t> pixels( frame_size_, 0x5a );
+    Frame f;
+    f.data = &pixels[0];
+    f.width = FRAME_WIDTH;
+    f.height = FRAME_HEIGHT;
+    f.size = frame_size_;
+    uint64_t t0 = monotonic_ns( );
+    for (size_t i = 0; i < run.frames; i++)
+    {
+        pace( run, i, t0 );
+        stamp( pixels, i );
+        f.frame_id = i;
+        uint64_t w0 = monotonic_ns( );
+        writer.publish( f );
+        res.max_write_ns = max( res.max_write_ns, monotonic_ns( ) - w0 );
+    }
+    done = true;
+    reader.join( );
+    res.seconds = res.last_ns > t0 ? (res.last_ns - t0) / 1e9 : 0;
+    res.note = to_string( SHM_NUM_SLOTS ) + " slots";
+}
+
+/*-----------------------------------------------------------------------------
+ *  BroadcastServer, as in cam_server
+ *-----------------------------------------------------------------------------*/
+int connect_to( const char* path )
+{
+    int s = socket( AF_UNIX, SOCK_STREAM, 0 );
+    struct sockaddr_un remote;
+    memset( &remote, 0, sizeof( remote ) );
+    remote.sun_family = AF_UNIX;
+    strncpy( remote.sun_path, path, sizeof( remote.sun_path ) - 1 );
+    if( connect( s, (struct sockaddr *)&remote, sizeof( remote ) ) != 0 )
+    {
+        close( s );
+        return -1;
+    }
+    return s;
+}
+
+void bench_broadcast( const string& request, const Run& run, Result& res )
+{
+    BroadcastServer server( BENCH_SOCK_PATH, BROADCAST_MAX_QUEUE );
+    server.start( );
+    int s = connect_to( BENCH_SOCK_PATH );
+    string line = request + "\n";
+    if( s < 0 || write( s, line.c_str( ), line.size( ) ) < 0 )
+    {
+        res.note = "can't connect";
+        res.intact = false;
+        return;
+    }
+    for (int i = 0; i < 100 && server.num_clients( ) == 0; i++)
+        this_thread::sleep_for( chrono::milliseconds( 5 ) );
+    this_thread::sleep_for( chrono::milliseconds( 50 ) );
+
+    atomic<bool> eof( false );
+    thread reader( [&]( ) {
+            vector<uint8_t> frame( frame_size_ );
+            uint64_t expect = 0;
+            FrameHeader h;
+            while( true )
+            {
+                size_t got = 0;
+                while( got < sizeof( h ) )
+                {
+                    ssize_t n = recv( s, (char*)&h + got, sizeof( h ) - got, 0 );
+                    if( n <= 0 )
+                    {
+                        eof = true;
+                        return;
+                    }
+                    got += n;
+                }
+                got = 0;
+                while( got < h.payload_size )
+                {
+                    ssize_t n = recv( s, &frame[got], h.payload_size - got, 0 );
+                    if( n <= 0 )
+                    {
+                        eof = true;
+                        return;
+                    }
+                    got += n;
+                }
+                received( &frame[0], expect, res, run );
+            }
+            } );
+
+    vector<uint8_t> pixels( frame_size_, 0x5a );
+    Frame f;
+    f.data = &pixels[0];
+    f.width = FRAME_WIDTH;
+    f.height = FRAME_HEIGHT;
+    f.size = frame_size_;
+    uint64_t t0 = monotonic_ns( );
+    for (size_t i = 0; i < run.frames; i++)
+    {
+        pace( run, i, t0 );
+        stamp( pixels, i );
+        f.frame_id = i;
+        f.host_ns = monotonic_ns( );
+        FrameHeader h = make_frame_header( f );
+        server.broadcast( &h, sizeof( h ), f.data, f.size );
+        res.max_write_ns = max( res.max_write_ns, monotonic_ns( ) - f.host_ns );
+    }
+
+    // Let the reader drain what is queued for it, then hang up.
+    uint64_t idle = (uint64_t)((200 + 2 * run.reader_ms) * 1e6);
+    while( ! eof && res.delivered + res.lost < run.frames
+            && monotonic_ns( ) - max( res.last_ns.load( ), t0 ) < idle )
+        this_thread::sleep_for( chrono::milliseconds( 5 ) );
+    if( eof )
+        res.note = "disconnected";
+    server.stop( );
+    reader.join( );
+    res.seconds = res.last_ns > t0 ? (res.last_ns - t0) / 1e9 : 0;
+    close( s );
+}
+
+/*-----------------------------------------------------------------------------
+ *  Report
+ *-----------------------------------------------------------------------------*/
+typedef function<void( const Run&, Result& )> Bench;
+
+struct Variant
+{
+    string name;
+    Bench bench;
+    bool lossless;                              /* Must deliver every frame intact. */
+    size_t max_frames;                          /* Cap for slow variants; 0 none. */
+};
+
+void print_header( const string& title )
+{
+    cout << endl << title << endl
+        << left << setw( 36 ) << "  variant" << right
+        << setw( 8 ) << "fps" << setw( 9 ) << "p50 ms" << setw( 9 ) << "p99 ms"
+        << setw( 9 ) << "max ms" << setw( 10 ) << "write ms"
+        << setw( 7 ) << "lost" << "  note" << endl;
+}
+
+void print_row( const string& name, double fps, const Result& lat )
+{
+    LatencyCounts c = lat.latency.snapshot( );
+    cout << "  " << left << setw( 34 ) << name << right << fixed
+        << setprecision( 0 ) << setw( 8 ) << fps
+        << setprecision( 2 ) << setw( 9 ) << c.percentile( 0.5 ) / 1e6
+        << setw( 9 ) << c.percentile( 0.99 ) / 1e6 << setw( 9 ) << c.max( ) / 1e6
+        << setw( 10 ) << lat.max_write_ns / 1e6
+        << setw( 7 ) << lat.lost << "  " << lat.note << endl;
+}
+
+int main( int argc, char** argv )
+{
+    size_t frames = 1000;
+    double minFps = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if( arg == "--quick" )
+            frames = 100;
+        else if( arg == "--frames" && i + 1 < argc )
+            frames = atoi( argv[++i] );
+        else if( arg == "--min-fps" && i + 1 < argc )
+            minFps = atof( argv[++i] );
+        else
+        {
+            cout << "Usage: " << argv[0] << " [--quick] [--frames N] [--min-fps F]" << endl;
+            return 1;
+        }
+    }
+
+    auto sock = []( SocketVariant v ) {
+        return [v]( const Run& run, Result& res ) { bench_socket( v, run, res ); };
+    };
+    auto broadcast = []( string request ) {
+        return [request]( const Run& run, Result& res ) { bench_broadcast( request, run, res ); };
+    };
+
+    vector<Variant> variants = {
+        { "stream, whole frame", sock( { SOCK_STREAM, 0, 0, false, false } ), true, 0 },
+        { "stream, 4096 B writes", sock( { SOCK_STREAM, 4096, 0, false, false } ), true, 0 },
+        { "stream, 40960 B writes", sock( { SOCK_STREAM, 40960, 0, false, false } ), true, 0 },
+        { "stream, SO_SNDBUF 64K", sock( { SOCK_STREAM, 0, 64 << 10, false, false } ), true, 0 },
+        { "stream, SO_SNDBUF 1M", sock( { SOCK_STREAM, 0, 1 << 20, false, false } ), true, 0 },
+        { "stream, non-blocking writer", sock( { SOCK_STREAM, 0, 0, true, false } ), true, 0 },
+        { "stream, reader sleeps on EAGAIN", sock( { SOCK_STREAM, 0, 0, false, true } ), true, 20 },
+        { "seqpacket, 64K messages", sock( { SOCK_SEQPACKET, 65536, 0, false, false } ), true, 0 },
+        { "seqpacket, frame per message", sock( { SOCK_SEQPACKET, 0, 1 << 20, false, false } ), false, 0 },
+        { "shm ring", bench_shm, true, 0 },
+        { "broadcast (cam_server), lossless", broadcast( "lossless" ), true, 0 },
+    };
+
+    bool ok = true;
+    double period = 1000.0 / EXPECTED_FPS;
+    cout << "Frames of " << FRAME_WIDTH << "x" << FRAME_HEIGHT << " (" << frame_size_ / 1024
+        << " KB). fps: as fast as possible, " << frames << " frames. Latency and"
+        << " longest write: paced at " << EXPECTED_FPS << " fps." << endl;
+
+    print_header( "Transports" );
+    for( auto& v : variants )
+    {
+        size_t n = v.max_frames ? min( frames, v.max_frames ) : frames;
+        Result fast, paced;
+        v.bench( Run{ n, 0, 0 }, fast );
+        v.bench( Run{ min( n, frames / 2 ), (double)EXPECTED_FPS, 0 }, paced );
+        double fps = fast.fps( );
+        if( fast.note != paced.note )
+            paced.note = fast.note;
+        print_row( v.name, fps, paced );
+
+        if( v.lossless )
+        {
+            bool intact = fast.intact && paced.intact && fast.lost == 0 && paced.lost == 0
+                && fast.delivered == n && paced.delivered == min( n, frames / 2 );
+            if( ! intact )
+                cout << "  [FAIL] " << v.name << " lost or damaged frames" << endl;
+            if( minFps > 0 && v.max_frames == 0 && fps < minFps )
+                cout << "  [FAIL] " << v.name << " below " << minFps << " fps" << endl;
+            ok &= intact && (minFps <= 0 || v.max_frames > 0 || fps >= minFps);
+        }
+    }
+
+    // Camera keeps its pace; the reader needs 1.5 frame periods per frame.
+    vector<Variant> slow = {
+        { "stream, blocking (camera stalls)", sock( { SOCK_STREAM, 0, 0, false, false } ), true, 0 },
+        { "shm ring", bench_shm, false, 0 },
+        { "broadcast, lossless", broadcast( "lossless" ), false, 0 },
+        { "broadcast, latest", broadcast( "latest" ), false, 0 },
+        { "broadcast, nth 2", broadcast( "nth 2" ), false, 0 },
+    };
+    ostringstream title;
+    title << "Slow consumer (" << setprecision( 2 ) << fixed << 1.5 * period << " ms per frame)";
+    print_header( title.str( ) );
+    for( auto& v : slow )
+    {
+        Result res;
+        size_t n = max( frames / 2, (size_t)1 );
+        v.bench( Run{ n, (double)EXPECTED_FPS, 1.5 * period }, res );
+        print_row( v.name, res.fps( ), res );
+        if( v.lossless && (! res.intact || res.delivered != n) )
+        {
+            cout << "  [FAIL] " << v.name << " lost or damaged frames" << endl;
+            ok = false;
+        }
+    }
+
+    cout << endl << (ok ? "[PASS]" : "[FAIL]") << " transports" << endl;
+    return ok ? 0 : 1;
+}
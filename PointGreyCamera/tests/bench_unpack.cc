@@ -0,0 +1,129 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  bench_unpack.cc
+ *
+ *    Description:  Time per frame of PixelConverter for each 12/16 bit
+ *    format on synthetic frames: Mono8 for the stream (linear window and
+ *    gamma table), Mono8 plus full depth pixels for --record-raw, on 1 and
+ *    more threads; and of the plain loops for comparison.
+ *
+ *      $ ./bench-unpack [frames] [threads]
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+
+#include "config.h"
+#include "src/FrameSource.hpp"
+#include "src/SyntheticSource.hpp"
+#include "src/PixelUnpack.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+const size_t npix_ = FRAME_WIDTH * FRAME_HEIGHT;
+
+void report( const string& what, double us, size_t nframes )
+{
+    double perFrame = us / nframes;
+    cout << "  " << left << setw( 28 ) << what << right << fixed << setprecision( 1 )
+        << setw( 8 ) << perFrame << " us/frame " << setw( 8 ) << npix_ / perFrame << " Mpx/s "
+        << setw( 8 ) << 1e6 / perFrame << " frames/s" << endl;
+}
+
+/* us to convert nframes of frames (cycled) with converter. */
+double time_converter( PixelConverter& converter, const vector<Frame>& frames, size_t nframes
+        , double& checksum )
+{
+    auto t0 = steady_clock::now( );
+    for (size_t i = 0; i < nframes; i++)
+    {
+        Frame f = frames[i % frames.size( )];
+        converter.convert( f );
+        checksum += f.data[i % npix_];
+    }
+    duration<double, micro> dt = steady_clock::now( ) - t0;
+    return dt.count( );
+}
+
+int main( int argc, char** argv )
+{
+    size_t nframes = argc > 1 ? atoi( argv[1] ) : 2000;
+    size_t threads = argc > 2 ? atoi( argv[2] ) : UNPACK_THREADS;
+    double checksum = 0;
+
+    cout << "Frame " << FRAME_WIDTH << "x" << FRAME_HEIGHT
+#if defined(__AVX2__)
+        << " (AVX2)"
+#elif defined(__SSSE3__)
+        << " (SSSE3)"
+#elif defined(__SSE2__)
+        << " (SSE2)"
+#endif
+        << endl;
+
+    for( uint32_t format : { PIXEL_FORMAT_MONO12P, PIXEL_FORMAT_MONO12PACKED, PIXEL_FORMAT_MONO16 } )
+    {
+        SyntheticSource synthetic( FRAME_WIDTH, FRAME_HEIGHT, 0, 16, format );
+        synthetic.init( );
+        synthetic.begin_acquisition( );
+
+        // Keep frames around so that only conversion is timed.
+        vector<Frame> frames( 16 );
+        for( auto& f : frames )
+            synthetic.next_frame( f );
+
+        cout << pixel_format_name( format ) << endl;
+        for( size_t t : { (size_t)1, threads } )
+        {
+            PixelConverter converter( FRAME_WIDTH, FRAME_HEIGHT, t );
+            string on = " x" + to_string( t );
+            report( "window" + on, time_converter( converter, frames, nframes, checksum ), nframes );
+            converter.set_window( 0, 0, 2.2 );
+            report( "gamma table" + on, time_converter( converter, frames, nframes, checksum ), nframes );
+            converter.set_window( 0, 0 );
+            converter.keep_wide( true );
+            report( "window + raw" + on, time_converter( converter, frames, nframes, checksum ), nframes );
+            if( t == threads )
+                break;
+        }
+
+        // Plain loops: what the SIMD kernels replace.
+        size_t nref = max( nframes / 10, (size_t)1 );
+        PixelMap map( pixel_format_shift( format ), 0, (4096u << pixel_format_shift( format )) - 1, 1.0 );
+        vector<uint16_t> wide( npix_ );
+        vector<uint8_t> out( npix_ );
+        auto t0 = steady_clock::now( );
+        for (size_t i = 0; i < nref; i++)
+        {
+            const Frame& f = frames[i % frames.size( )];
+            if( format == PIXEL_FORMAT_MONO16 )
+                for (size_t p = 0; p < npix_; p++)
+                    out[p] = map.lut[((const uint16_t*)f.data)[p] >> 4];
+            else
+            {
+                unpack_mono12_scalar( f.data, npix_, &wide[0], format );
+                for (size_t p = 0; p < npix_; p++)
+                    out[p] = map.lut[wide[p]];
+            }
+            checksum += out[i % npix_];
+        }
+        duration<double, micro> plain = steady_clock::now( ) - t0;
+        report( "plain loops x1", plain.count( ), nref );
+
+        for( auto& f : frames )
+            synthetic.release( f );
+        synthetic.end_acquisition( );
+        synthetic.deinit( );
+    }
+    cout << "(checksum " << checksum << ")" << endl;
+    return 0;
+}
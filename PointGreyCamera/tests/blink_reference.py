@@ -0,0 +1,52 @@
+#!/usr/bin/env python
+"""blink_reference.py: Blink signal of recorded frames as computed by the
+python client (blinky.find_blinks_using_pixals on an equalized ROI). Output
+is compared with cam_server's BlinkDetector by test-blink:
+
+    $ python blink_reference.py trial_001.tif [x0 y0 x1 y1] > blink.csv
+    $ ./test-blink trial_001.tif blink.csv
+
+"""
+from __future__ import print_function
+
+__license__          = "GNU GPL"
+__version__          = "1.0.0"
+__status__           = "Development"
+
+import os
+import re
+import sys
+import cv2
+import tifffile
+
+script_dir = os.path.dirname( os.path.realpath( __file__ ) )
+sys.path.append( os.path.join( script_dir, '..', '..' ) )
+import blinky
+
+def read_config( ):
+    with open( os.path.join( script_dir, '..', 'config.h' ) ) as cf:
+        text = cf.read( )
+    get = lambda name: int( re.search( r'#define\s+%s\s+(\d+)' % name, text ).group(1) )
+    roi = [ get( 'BLINK_ROI_%s' % x ) for x in [ 'X0', 'Y0', 'X1', 'Y1' ] ]
+    return get( 'FRAME_HEIGHT' ), roi
+
+def main( ):
+    height, roi = read_config( )
+    if len( sys.argv ) == 6:
+        roi = [ int( x ) for x in sys.argv[2:] ]
+    x0, y0, x1, y1 = roi
+
+    frames = tifffile.imread( sys.argv[1] )
+    if frames.ndim == 2:
+        frames = frames[None, :, :]
+
+    print( '# roi %d,%d,%d,%d' % ( x0, y0, x1, y1 ) )
+    for i, img in enumerate( frames ):
+        # Recorded frames carry metadata in the first rows.
+        img = img[ img.shape[0] - height:, : ]
+        roi = cv2.equalizeHist( img[y0:y1, x0:x1] )
+        _, _, res, _ = blinky.find_blinks_using_pixals( roi )
+        print( '%d,%.6f' % ( i, res ) )
+
+if __name__ == '__main__':
+    main( )
@@ -0,0 +1,31 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  check.hpp
+ *
+ *    Description:  check( ) of the tests: prints [PASS] or [FAIL] and the
+ *    message, and counts failures in failed_, which main( ) returns.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#ifndef  check_INC
+#define  check_INC
+
+#include <iostream>
+#include <string>
+
+static int failed_ = 0;
+
+inline void check( bool cond, const std::string& msg )
+{
+    std::cout << (cond ? "[PASS] " : "[FAIL] ") << msg << std::endl;
+    if( ! cond )
+        failed_ += 1;
+}
+
+#endif   /* ----- #ifndef check_INC  ----- */
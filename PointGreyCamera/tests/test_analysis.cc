@@ -0,0 +1,246 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  test_analysis.cc
+ *
+ *    Description:  Offline trial analysis: rows give the numbers
+ *    analysis/analyze_trial_video.py gives, a trial tiff gives the same as
+ *    its rows, the ROI blink is BlinkDetector's, and the work stealing pool
+ *    runs every task, nested ones too.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "config.h"
+#include "src/TrialAnalysis.hpp"
+#include "src/WorkStealingPool.hpp"
+#include "src/TiffWriter.hpp"
+#include "tests/check.hpp"
+
+using namespace std;
+
+/* 2016-12-06T14:03:48.100000 plus ms, as isoformat( ) writes it. */
+string iso( int ms )
+{
+    char buf[64];
+    int total = 48100 + ms, s = total / 1000, us = (total % 1000) * 1000;
+    snprintf( buf, sizeof( buf ), "2016-12-06T14:%02d:%02d.%06d", 3 + s / 60, s % 60, us );
+    return buf;
+}
+
+/* Row of camera_arduino_client.py for a frame at ms; status in the arduino line. */
+string client_row( int ms, const string& status, double blink )
+{
+    char buf[256];
+    snprintf( buf, sizeof( buf ), "%s,%s,1234,%s,1,0,1,,(%s:%.1f),%.3f", iso( ms ).c_str( )
+            , iso( ms - 1 ).c_str( ), status.c_str( ), iso( ms ).c_str( ), ms / 100.0, blink );
+    return buf;
+}
+
+/* A trial at 10 ms per frame: CS+ from 1000 to 1350 ms, PUFF 1600 to 1650 ms. */
+vector<string> trial_rows( double base, double response, bool probe )
+{
+    vector<string> rows;
+    for (int ms = 0; ms < 2500; ms += 10)
+    {
+        string status = "PRE_";
+        if( ms >= 1000 && ms <= 1350 )
+            status = probe ? "PROB" : "CS+";
+        else if( ms >= 1600 && ms <= 1650 )
+            status = "PUFF";
+        double blink = ms > 1000 && ms <= 1300 ? response : base;
+        rows.push_back( client_row( ms, status, blink ) );
+    }
+    return rows;
+}
+
+int main( int argc, char** argv )
+{
+    // Times as strptime takes them.
+    int64_t t = parse_iso_time( "2016-12-06T14:03:48.123456" );
+    check( t == 1481033028123456000ll, "isotime to ns" );
+    check( parse_iso_time( "2016-12-06T14:03:48.5" ) - parse_iso_time( "2016-12-06T14:03:47.999999" )
+            == 500001000, "fraction of 1 to 6 digits" );
+    check( parse_iso_time( "2016-12-06T14:03:48" ) == TRIAL_NO_TIME
+            && parse_iso_time( "2016-12-06T14:03:48.1234567" ) == TRIAL_NO_TIME
+            && parse_iso_time( "2016-12-06T14:03:48.12x" ) == TRIAL_NO_TIME
+            && parse_iso_time( "1234" ) == TRIAL_NO_TIME, "strptime failures" );
+    check( parse_iso_time( "2017-01-01T00:00:00.0" ) - parse_iso_time( "2016-12-31T23:59:59.0" )
+            == 1000000000ll, "over new year" );
+
+    // Rows.
+    {
+        TrialAnalyzer a;
+        for( auto& r : trial_rows( 10, 100, false ) )
+            a.add_row( r );
+        a.add_row( "" );
+        a.add_row( "not a row" );
+        a.add_row( iso( 2500 ) + ",x,notablink" );
+        const TrialResult& r = a.finish( );
+        int64_t t0 = parse_iso_time( iso( 0 ) );
+        check( r.pages == 253 && r.samples.size( ) == 250, "rows with time and blink count" );
+        check( r.cs[0] - t0 == 999000000 && r.cs[1] - t0 == 1349000000, "CS+ slice from line times" );
+        check( r.us[0] - t0 == 1599000000 && r.us[1] - t0 == 1649000000, "PUFF slice" );
+        check( ! r.probe_trial && r.learnt, "blink 90 off baseline after CS+ is learnt" );
+        check( r.samples[5].speed == 0.5 && r.blink_min == 10 && r.blink_max == 100, "speed and blink range" );
+    }
+    {
+        TrialAnalyzer a;
+        for( auto& r : trial_rows( 10, 85, true ) )
+            a.add_row( r );
+        const TrialResult& r = a.finish( );
+        check( r.probe_trial && r.cs[0] == TRIAL_NO_TIME && ! r.learnt, "probe trial, no CS+" );
+
+        TrialAnalyzer b( 80 );
+        for( auto& row : trial_rows( 10, 85, false ) )
+            b.add_row( row );
+        TrialAnalyzer c( 80 );
+        for( auto& row : trial_rows( 10, 95, false ) )
+            c.add_row( row );
+        check( ! b.finish( ).learnt && c.finish( ).learnt, "threshold 80" );
+    }
+    {
+        // Status in two rows only is no slice for python.
+        TrialAnalyzer a;
+        a.add_row( client_row( 0, "CS+", 1 ) );
+        a.add_row( client_row( 10, "CS+", 1 ) );
+        a.add_row( client_row( 20, "X", 1 ) );
+        check( a.finish( ).cs[0] == TRIAL_NO_TIME, "two CS+ rows are not a slice" );
+    }
+    {
+        // cam_server rows: with the client row in them, and without; those
+        // are on the camera clock, used only when there are no others.
+        TrialAnalyzer a;
+        a.add_row( "11,4990000,32.000," );
+        a.add_row( "12,5000000,33.000," + client_row( 0, "CS+", 7 ) );
+        const TrialResult& r = a.finish( );
+        check( r.samples.size( ) == 1 && r.samples[0].blink == 7, "cam_server rows with client row" );
+        TrialAnalyzer b;
+        b.add_row( "11,4990000,32.000," );
+        b.add_row( "13,5010000,34.500,meta" );
+        const TrialResult& q = b.finish( );
+        check( q.samples.size( ) == 2 && q.samples[1].blink == 34.5 && q.samples[1].ns == 5010000
+                , "cam_server rows alone" );
+    }
+
+    // Work stealing: tasks submitting tasks.
+    for( size_t threads : { (size_t)1, (size_t)4 } )
+    {
+        atomic<int> done( 0 );
+        {
+            WorkStealingPool pool( threads );
+            for (int s = 0; s < 8; s++)
+                pool.submit( [&]( ) {
+                        for (int i = 0; i < 100; i++)
+                            pool.submit( [&done]( ) { done += 1; } );
+                        done += 1;
+                        } );
+            pool.wait( );
+            check( done == 808, "all nested tasks on " + to_string( threads ) + " threads" );
+            pool.submit( [&done]( ) { usleep( 10000 ); done += 1; } );
+        }
+        check( done == 809, "destructor waits" );
+    }
+
+    // A trial tiff: pages of text row and frame.
+    char tmpl[] = "/tmp/test_analysis_XXXXXX";
+    string dir = mkdtemp( tmpl );
+    string filename = dir + "/trial_001.tif";
+    vector<string> rows = trial_rows( 10, 100, false );
+    rows.resize( 140 );
+    vector<float> blinks;
+    bool written = true;
+    size_t roi[4] = { 255, 131, 521, 288 };
+    {
+        TiffWriter writer( filename, FRAME_WIDTH, FRAME_HEIGHT + 1, false );
+        BlinkDetector<FRAME_WIDTH, FRAME_HEIGHT> blink( roi[0], roi[1], roi[2], roi[3] );
+        vector<uint8_t> page( FRAME_WIDTH * (FRAME_HEIGHT + 1) );
+        for (size_t i = 0; i < rows.size( ); i++)
+        {
+            memset( &page[0], ' ', FRAME_WIDTH );
+            memcpy( &page[0], rows[i].c_str( ), rows[i].size( ) );
+            // A dark eye closing over the trial.
+            for (size_t y = 0; y < FRAME_HEIGHT; y++)
+                for (size_t x = 0; x < FRAME_WIDTH; x++)
+                {
+                    double dx = x - 388.0, dy = (y - 210.0) * (1 + i / 20.0);
+                    page[(y + 1) * FRAME_WIDTH + x] = dx * dx + dy * dy < 3600 ? 20 + (x * y) % 7
+                        : 180 + (x + 3 * y + i) % 40;
+                }
+            written = written && writer.write( &page[0] );
+            blinks.push_back( blink.process( &page[FRAME_WIDTH] ) );
+        }
+    }
+    check( written, "trial tiff written" );
+
+    string error;
+    TrialResult fromTiff = analyze_tiff<FRAME_WIDTH, FRAME_HEIGHT>( filename, NULL, 80, error );
+    TrialAnalyzer a;
+    for( auto& r : rows )
+        a.add_row( r );
+    const TrialResult& fromRows = a.finish( );
+    bool same = error.empty( ) && fromTiff.pages == rows.size( )
+        && fromTiff.samples.size( ) == fromRows.samples.size( );
+    for (size_t i = 0; same && i < fromRows.samples.size( ); i++)
+        same = fromTiff.samples[i].ns == fromRows.samples[i].ns
+            && fromTiff.samples[i].blink == fromRows.samples[i].blink;
+    check( same && fromTiff.cs[0] == fromRows.cs[0] && fromTiff.learnt == fromRows.learnt
+            , "tiff gives what its rows give" );
+
+    TrialResult recomputed = analyze_tiff<FRAME_WIDTH, FRAME_HEIGHT>( filename, roi, 80, error );
+    same = error.empty( ) && recomputed.samples.size( ) == blinks.size( );
+    for (size_t i = 0; same && i < blinks.size( ); i++)
+        same = recomputed.samples[i].blink == blinks[i];
+    check( same && blinks.front( ) != blinks.back( ), "ROI blink from ROI rows as BlinkDetector" );
+
+    // --record-raw pages are 16 bit: no ROI blink, and it is said so.
+    string raw = dir + "/trial_002.tif";
+    {
+        TiffWriter writer( raw, FRAME_WIDTH, FRAME_HEIGHT + 1, false, 0, 16 );
+        vector<uint16_t> page( FRAME_WIDTH * (FRAME_HEIGHT + 1), 0 );
+        memcpy( &page[0], rows[0].c_str( ), rows[0].size( ) );
+        for (size_t i = 0; i < 3; i++)
+            writer.write( reinterpret_cast<const uint8_t*>( &page[0] ) );
+    }
+    error.clear( );
+    TrialResult wide = analyze_tiff<FRAME_WIDTH, FRAME_HEIGHT>( raw, roi, 80, error );
+    check( wide.pages == 3 && error.find( "3 of 3 pages" ) != string::npos
+            , "pages without ROI blink reported" );
+    error.clear( );
+    analyze_tiff<FRAME_WIDTH, FRAME_HEIGHT>( raw, NULL, 80, error );
+    check( error.empty( ), "no ROI, nothing to report" );
+    unlink( raw.c_str( ) );
+
+    TrialResult missing = analyze_tiff<FRAME_WIDTH, FRAME_HEIGHT>( dir + "/nope.tif", NULL, 80, error );
+    check( ! error.empty( ) && missing.samples.empty( ), "missing file reported" );
+
+    string out = dir + "/trial_001.tif.csv";
+    check( write_trial_result( fromTiff, out ), "result written" );
+    ifstream in( out );
+    string header, summary, first, columns, line;
+    getline( in, header );
+    getline( in, summary );
+    getline( in, first );
+    getline( in, columns );
+    getline( in, line );
+    check( header == "# " + summary_header( ) && columns == "time_ms,blink,speed"
+            && line == "0.000,10.000,0", "result file layout" );
+    check( summary.find( ",999.000,1349.000," ) != string::npos, "CS+ in ms after first frame" );
+
+    unlink( out.c_str( ) );
+    unlink( filename.c_str( ) );
+    rmdir( dir.c_str( ) );
+    return failed_;
+}
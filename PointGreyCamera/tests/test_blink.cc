@@ -0,0 +1,164 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  test_blink.cc
+ *
+ *    Description:  BlinkDetector against the plain reference (BlinkReference.hpp)
+ *    on synthetic and random frames, for a few ROIs.
+ *
+ *    With arguments, also against the python blink signal of recorded frames:
+ *
+ *      $ python tests/blink_reference.py trial_001.tif > blink.csv
+ *      $ ./test-blink trial_001.tif blink.csv
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <cmath>
+
+#include "config.h"
+#include "src/FrameSource.hpp"
+#include "src/SyntheticSource.hpp"
+#include "src/BlinkDetector.hpp"
+#include "tests/BlinkReference.hpp"
+#include "tests/check.hpp"
+
+#ifdef HAVE_TIFF
+#include "src/TiffReplaySource.hpp"
+#endif
+
+using namespace std;
+
+typedef BlinkDetector<FRAME_WIDTH, FRAME_HEIGHT> Blink;
+
+vector<uint8_t> crop( const uint8_t* frame, size_t x0, size_t y0, size_t x1, size_t y1 )
+{
+    vector<uint8_t> roi;
+    for (size_t y = y0; y < y1; y++)
+        roi.insert( roi.end( ), frame + y * FRAME_WIDTH + x0, frame + y * FRAME_WIDTH + x1 );
+    return roi;
+}
+
+/* Compare detector with reference on one frame. */
+bool same_as_reference( Blink& blink, const uint8_t* frame
+        , size_t x0, size_t y0, size_t x1, size_t y1 )
+{
+    vector<uint8_t> blurred;
+    float expected = reference_blink( crop( frame, x0, y0, x1, y1 )
+            , y1 - y0, x1 - x0, blurred );
+    float got = blink.process( frame );
+    if( got != expected || blink.blurred( ) != blurred )
+    {
+        cout << "  ROI (" << x0 << "," << y0 << ")-(" << x1 << "," << y1 << "): got "
+            << got << ", expected " << expected << endl;
+        return false;
+    }
+    return true;
+}
+
+/* Compare with output of tests/blink_reference.py. */
+int compare_with_python( const char* tiff, const char* csv )
+{
+#ifdef HAVE_TIFF
+    ifstream in( csv );
+    string line;
+    int x0, y0, x1, y1;
+    getline( in, line );
+    if( sscanf( line.c_str( ), "# roi %d,%d,%d,%d", &x0, &y0, &x1, &y1 ) != 4 )
+    {
+        cout << "[ERROR] " << csv << " does not start with '# roi x0,y0,x1,y1'" << endl;
+        return 1;
+    }
+
+    TiffReplaySource replay( tiff, FRAME_WIDTH, FRAME_HEIGHT, 0, false, 4 );
+    replay.init( );
+    replay.begin_acquisition( );
+    Blink blink( x0, y0, x1, y1 );
+
+    Frame frame;
+    size_t n = 0, bad = 0;
+    double worst = 0;
+    while( getline( in, line ) && replay.next_frame( frame ) )
+    {
+        double expected = atof( line.substr( line.find( ',' ) + 1 ).c_str( ) );
+        double got = blink.process( frame.data );
+        worst = max( worst, fabs( got - expected ) );
+        if( fabs( got - expected ) > 1e-3 )
+            bad += 1;
+        replay.release( frame );
+        n += 1;
+    }
+    ostringstream msg;
+    msg << n << " recorded frames agree with python (worst difference " << worst << ")";
+    check( n > 0 && bad == 0, msg.str( ) );
+    return failed_;
+#else
+    cout << "[ERROR] Built without libtiff" << endl;
+    return 1;
+#endif
+}
+
+int main( int argc, char** argv )
+{
+    if( argc == 3 )
+        return compare_with_python( argv[1], argv[2] );
+
+    Blink blink( BLINK_ROI_X0, BLINK_ROI_Y0, BLINK_ROI_X1, BLINK_ROI_Y1 );
+    vector<uint16_t> kernel( reference_kernel_, reference_kernel_ + 2 * reference_radius_ + 1 );
+    check( blink.kernel( ) == kernel, "fixed point kernel is the one of cv2.GaussianBlur" );
+
+    // ROIs: default, odd sized, touching frame edges, smallest.
+    size_t rois[][4] = {
+        { BLINK_ROI_X0, BLINK_ROI_Y0, BLINK_ROI_X1, BLINK_ROI_Y1 }
+        , { 3, 5, 160, 98 }
+        , { FRAME_WIDTH - 77, FRAME_HEIGHT - 41, FRAME_WIDTH, FRAME_HEIGHT }
+        , { 10, 10, 14, 14 }
+    };
+
+    SyntheticSource synthetic( FRAME_WIDTH, FRAME_HEIGHT, 0, 4 );
+    synthetic.init( );
+    synthetic.begin_acquisition( );
+
+    mt19937 rng( 7 );
+    vector<uint8_t> noise( FRAME_WIDTH * FRAME_HEIGHT );
+
+    for( auto& r : rois )
+    {
+        blink.set_roi( r[0], r[1], r[2], r[3] );
+        bool ok = true;
+        for (int i = 0; i < 8; i++)
+        {
+            Frame frame;
+            synthetic.next_frame( frame );
+            ok &= same_as_reference( blink, frame.data, r[0], r[1], r[2], r[3] );
+            synthetic.release( frame );
+        }
+        for (int i = 0; i < 4; i++)
+        {
+            // Narrow range of values so that equalization matters.
+            for( auto& v : noise )
+                v = 100 + rng( ) % (8 + 40 * i);
+            ok &= same_as_reference( blink, &noise[0], r[0], r[1], r[2], r[3] );
+        }
+        ostringstream msg;
+        msg << "matches reference on " << r[2] - r[0] << "x" << r[3] - r[1] << " ROI";
+        check( ok, msg.str( ) );
+    }
+
+    // Flat ROI: nothing below threshold.
+    fill( noise.begin( ), noise.end( ), 42 );
+    blink.set_roi( BLINK_ROI_X0, BLINK_ROI_Y0, BLINK_ROI_X1, BLINK_ROI_Y1 );
+    check( blink.process( &noise[0] ) == 0.0f, "flat ROI gives zero" );
+
+    synthetic.end_acquisition( );
+    synthetic.deinit( );
+    return failed_;
+}
@@ -0,0 +1,208 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  test_broadcast.cc
+ *
+ *    Description:  Test BroadcastServer with subscribers of every policy.
+ *
+ *    A lossless reader must get every frame in order, 'nth 3' every third
+ *    frame, 'latest' must end with the last frame, and a subscriber which
+ *    never reads must be disconnected without holding up anyone else.
+ *    Frames broadcast with a FrameHeader arrive behind it, except on 'raw'
+ *    subscribers which get pixels only.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "src/broadcast-server.h"
+#include "src/FrameHeader.hpp"
+#include "tests/check.hpp"
+
+using namespace std;
+
+#define SOCK_PATH       "/tmp/test_broadcast_socket"
+#define FRAME_SIZE      (64 * 1024)
+#define NUM_FRAMES      200
+
+int connect_to( const char* request )
+{
+    int s = socket( AF_UNIX, SOCK_STREAM, 0 );
+    struct sockaddr_un remote;
+    memset( &remote, 0, sizeof( remote ) );
+    remote.sun_family = AF_UNIX;
+    strncpy( remote.sun_path, SOCK_PATH, sizeof( remote.sun_path ) - 1 );
+    if( connect( s, (struct sockaddr *)&remote, sizeof( remote ) ) != 0 )
+    {
+        perror( "connect" );
+        exit( 1 );
+    }
+    if( request )
+        if( write( s, request, strlen( request ) ) < 0 )
+            perror( "write" );
+    return s;
+}
+
+/* Read whole frames till EOF or till frame with id last is seen. */
+vector<uint32_t> read_frames( int s, uint32_t last )
+{
+    vector<uint32_t> ids;
+    vector<char> frame( FRAME_SIZE );
+    while( true )
+    {
+        size_t got = 0;
+        while( got < FRAME_SIZE )
+        {
+            ssize_t n = recv( s, &frame[got], FRAME_SIZE - got, 0 );
+            if( n <= 0 )
+                return ids;
+            got += n;
+        }
+        uint32_t id;
+        memcpy( &id, &frame[0], sizeof( id ) );
+        ids.push_back( id );
+        if( id == last )
+            return ids;
+    }
+}
+
+bool recv_all( int s, void* buf, size_t size )
+{
+    size_t got = 0;
+    while( got < size )
+    {
+        ssize_t n = recv( s, (char*)buf + got, size - got, 0 );
+        if( n <= 0 )
+            return false;
+        got += n;
+    }
+    return true;
+}
+
+/* Every frame with header in front; raw subscriber must not see the header. */
+void test_headers( )
+{
+    BroadcastServer server( SOCK_PATH, 64 );
+    server.start( );
+    int framed = connect_to( NULL );
+    int raw = connect_to( "raw\n" );
+    for (int i = 0; i < 100 && server.num_clients( ) < 2; i++)
+        this_thread::sleep_for( chrono::milliseconds( 10 ) );
+    this_thread::sleep_for( chrono::milliseconds( 100 ) );
+
+    const size_t w = 64, h = 16;
+    vector<unsigned char> pixels( w * h );
+    for (uint32_t i = 0; i < 20; i++)
+    {
+        memset( &pixels[0], i, pixels.size( ) );
+        Frame f;
+        f.data = &pixels[0];
+        f.width = w;
+        f.height = h;
+        f.size = pixels.size( );
+        f.frame_id = 100 + 2 * i;                       /* Every other frame lost. */
+        f.host_ns = monotonic_ns( );
+        f.dropped = i;
+        FrameHeader hdr = make_frame_header( f );
+        server.broadcast( &hdr, sizeof( hdr ), f.data, f.size );
+    }
+
+    bool headers = true, raws = true;
+    vector<unsigned char> buf( w * h );
+    for (uint32_t i = 0; i < 20; i++)
+    {
+        FrameHeader hdr;
+        headers = headers && recv_all( framed, &hdr, sizeof( hdr ) )
+            && hdr.magic == FRAME_HEADER_MAGIC && hdr.header_size == sizeof( hdr )
+            && hdr.frame_id == 100 + 2 * i && hdr.dropped == i
+            && hdr.width == w && hdr.height == h && hdr.payload_size == w * h
+            && hdr.pixel_format == PIXEL_FORMAT_MONO8 && hdr.host_ns <= monotonic_ns( )
+            && recv_all( framed, &buf[0], hdr.payload_size ) && buf[0] == i && buf.back( ) == i;
+        raws = raws && recv_all( raw, &buf[0], buf.size( ) ) && buf[0] == i && buf.back( ) == i;
+    }
+    check( headers, "frames arrive behind their header" );
+    check( raws, "raw subscriber gets pixels only" );
+
+    server.stop( );
+    close( framed );
+    close( raw );
+}
+
+int main( )
+{
+    BroadcastServer server( SOCK_PATH, 8 );
+    check( server.start( ), "server started" );
+
+    int lossless = connect_to( NULL );
+    int latest = connect_to( "latest\n" );
+    int nth = connect_to( "nth 3\n" );
+    int stuck = connect_to( "lossless\n" );
+
+    // Let the server see all subscribers and their requests.
+    for (int i = 0; i < 100 && server.num_clients( ) < 4; i++)
+        this_thread::sleep_for( chrono::milliseconds( 10 ) );
+    this_thread::sleep_for( chrono::milliseconds( 100 ) );
+    check( server.num_clients( ) == 4, "four subscribers" );
+
+    vector<uint32_t> losslessIds, nthIds, latestIds;
+    thread t1( [&]( ) { losslessIds = read_frames( lossless, NUM_FRAMES - 1 ); } );
+    thread t2( [&]( ) { nthIds = read_frames( nth, NUM_FRAMES - 2 ); } );
+
+    vector<char> frame( FRAME_SIZE );
+    auto t0 = chrono::steady_clock::now( );
+    for (uint32_t i = 0; i < NUM_FRAMES; i++)
+    {
+        memcpy( &frame[0], &i, sizeof( i ) );
+        server.broadcast( &frame[0], FRAME_SIZE );
+        this_thread::sleep_for( chrono::microseconds( 500 ) );
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now( ) - t0;
+
+    // Now the slow preview catches up; it should end with the newest frame.
+    latestIds = read_frames( latest, NUM_FRAMES - 1 );
+    t1.join( );
+    t2.join( );
+
+    bool inOrder = losslessIds.size( ) == NUM_FRAMES;
+    for (size_t i = 0; inOrder && i < losslessIds.size( ); i++)
+        inOrder = losslessIds[i] == i;
+    check( inOrder, "lossless got all frames in order" );
+
+    bool everyThird = nthIds.size( ) == (NUM_FRAMES + 2) / 3;
+    for (size_t i = 0; everyThird && i < nthIds.size( ); i++)
+        everyThird = nthIds[i] == 3 * i;
+    check( everyThird, "nth 3 got every third frame" );
+
+    check( ! latestIds.empty( ) && latestIds.back( ) == NUM_FRAMES - 1
+            && latestIds.size( ) < NUM_FRAMES
+            , "latest skipped frames and ended with the newest one" );
+
+    // The stuck subscriber was cut off: EOF after whatever was buffered.
+    vector<uint32_t> stuckIds = read_frames( stuck, NUM_FRAMES );
+    check( stuckIds.size( ) < NUM_FRAMES, "stuck lossless subscriber was disconnected" );
+
+    // Broadcasting only sleeps between frames; nobody blocked it.
+    check( elapsed.count( ) < 2.0, "broadcast never blocked on a subscriber" );
+
+    server.stop( );
+    close( lossless );
+    close( latest );
+    close( nth );
+    close( stuck );
+    check( access( SOCK_PATH, F_OK ) != 0, "socket removed on stop" );
+
+    test_headers( );
+    return failed_;
+}
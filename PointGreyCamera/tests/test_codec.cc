@@ -0,0 +1,159 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  test_codec.cc
+ *
+ *    Description:  FrameEncoder/FrameDecoder round trip on synthetic, still,
+ *    noisy and odd sized frames; corrupt input must be refused.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <iostream>
+#include <sstream>
+#include <random>
+#include <unistd.h>
+
+#include "config.h"
+#include "src/FrameSource.hpp"
+#include "src/SyntheticSource.hpp"
+#include "src/FrameCodec.hpp"
+#include "tests/check.hpp"
+
+using namespace std;
+
+/* Encode frames one by one, decode them back; returns encoded bytes or 0
+ * if any frame differs. */
+size_t round_trip( const vector<vector<uint8_t> >& frames, size_t w, size_t h
+        , size_t key_interval, size_t threads, size_t tiles )
+{
+    FrameEncoder enc( w, h, key_interval, threads, tiles );
+    FrameDecoder dec( threads );
+    vector<uint8_t> buf, out( w * h );
+    size_t total = 0;
+    for( auto& f : frames )
+    {
+        buf.clear( );
+        size_t n = enc.encode( &f[0], buf );
+        total += n;
+        if( n != buf.size( ) || ! dec.decode( &buf[0], n, &out[0], out.size( ) ) || out != f )
+            return 0;
+    }
+    return total;
+}
+
+int main( int argc, char** argv )
+{
+    const size_t w = FRAME_WIDTH, h = FRAME_HEIGHT;
+    for (int v = 0; v < 256; v++)
+        if( codec_detail::unzigzag( codec_detail::zigzag( v ) ) != v )
+            check( false, "zigzag is invertible" );
+
+    SyntheticSource synthetic( w, h, 0, 4 );
+    synthetic.init( );
+    synthetic.begin_acquisition( );
+    vector<vector<uint8_t> > frames;
+    for (int i = 0; i < 30; i++)
+    {
+        Frame frame;
+        synthetic.next_frame( frame );
+        frames.push_back( vector<uint8_t>( frame.data, frame.data + frame.size ) );
+        synthetic.release( frame );
+    }
+    synthetic.end_acquisition( );
+    synthetic.deinit( );
+
+    size_t bytes = round_trip( frames, w, h, 10, 4, 16 );
+    ostringstream msg;
+    msg << "synthetic frames round trip (ratio " << (double)w * h * frames.size( ) / bytes << ")";
+    check( bytes > 0, msg.str( ) );
+    check( round_trip( frames, w, h, 1, 1, 1 ) > 0, "key frames only, one tile, one thread" );
+
+    // A still scene with a little sensor noise compresses well.
+    mt19937 rng( 3 );
+    vector<vector<uint8_t> > still( 20, frames[0] );
+    for( auto& f : still )
+        for (size_t i = 0; i < f.size( ); i += 7)
+            f[i] += rng( ) % 3 - 1;
+    bytes = round_trip( still, w, h, 200, 0, 16 );
+    double ratio = (double)w * h * still.size( ) / max( bytes, (size_t)1 );
+    msg.str( "" );
+    msg << "still scene round trip (ratio " << ratio << ")";
+    check( bytes > 0 && ratio > 4, msg.str( ) );
+
+    // Pure noise: tiles are stored raw, frame a bit larger than raw.
+    vector<vector<uint8_t> > noise( 3, vector<uint8_t>( w * h ) );
+    for( auto& f : noise )
+        for( auto& v : f )
+            v = rng( );
+    bytes = round_trip( noise, w, h, 200, 2, 16 );
+    check( bytes > 0 && bytes < noise.size( ) * (w * h + 200), "noise round trip, stored raw" );
+
+    // Extreme residuals (0 <-> 255 flicker), odd geometry, more tiles than rows.
+    vector<vector<uint8_t> > odd( 4, vector<uint8_t>( 13 * 7 ) );
+    for (size_t i = 0; i < odd.size( ); i++)
+        for (size_t j = 0; j < odd[i].size( ); j++)
+            odd[i][j] = ((i + j) % 2) ? 255 : (j % 5 ? 0 : rng( ));
+    check( round_trip( odd, 13, 7, 2, 3, 64 ) > 0, "13x7 frames, 0/255 flicker" );
+
+    // Delta frame without its key frame, and corrupt data, are refused.
+    {
+        FrameEncoder enc( w, h, 100, 2 );
+        vector<uint8_t> key, delta, out( w * h );
+        enc.encode( &frames[0][0], key );
+        enc.encode( &frames[1][0], delta );
+        FrameDecoder dec( 2 );
+        size_t n = out.size( );
+        check( ! dec.decode( &delta[0], delta.size( ), &out[0], n ), "delta frame without key refused" );
+        check( ! dec.decode( &key[0], key.size( ) / 2, &out[0], n ), "truncated frame refused" );
+        vector<uint8_t> bad( key );
+        bad[0] ^= 0xff;
+        check( ! dec.decode( &bad[0], bad.size( ), &out[0], n ), "bad magic refused" );
+        vector<uint8_t> small( 8 * 8 );
+        check( ! dec.decode( &key[0], key.size( ), &small[0], small.size( ) )
+                , "key frame larger than the buffer refused" );
+        check( dec.decode( &key[0], key.size( ), &out[0], n ) && out == frames[0]
+                && dec.decode( &delta[0], delta.size( ), &out[0], n ) && out == frames[1]
+                , "key then delta decode" );
+    }
+
+    // File round trip.
+    {
+        char name[] = "/tmp/test_codec_XXXXXX";
+        int fd = mkstemp( name );
+        close( fd );
+        {
+            CodecFileWriter writer( name, w, h, 8 );
+            for( auto& f : frames )
+                writer.write( &f[0] );
+        }
+        CodecFileReader reader( name );
+        vector<uint8_t> out( w * h );
+        size_t n = 0, same = 0;
+        while( reader.next( &out[0] ) )
+            same += out == frames[n++];
+        check( reader.width( ) == w && n == frames.size( ) && same == n, "trial file round trip" );
+
+        // An 8x8 file with a w x h key frame in it.
+        {
+            CodecFileWriter writer( name, 8, 8 );
+        }
+        FrameEncoder enc( w, h, 100, 2 );
+        vector<uint8_t> key;
+        enc.encode( &frames[0][0], key );
+        FILE* f = fopen( name, "ab" );
+        fwrite( &key[0], 1, key.size( ), f );
+        fclose( f );
+        CodecFileReader mixed( name );
+        vector<uint8_t> small( 8 * 8 );
+        check( mixed.is_open( ) && ! mixed.next( &small[0] )
+                , "frame of other geometry than the file refused" );
+        unlink( name );
+    }
+
+    return failed_;
+}
@@ -0,0 +1,164 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  test_eye.cc
+ *
+ *    Description:  EyeTracker: the box follows a shifting animal pixel for
+ *    pixel, finds it again after a jump on the next whole frame search, and
+ *    stays put on still frames, noise and a closing eye.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <iostream>
+#include <vector>
+#include <random>
+
+#include "config.h"
+#include "src/FrameSource.hpp"
+#include "src/FrameHeader.hpp"
+#include "src/BlinkDetector.hpp"
+#include "src/EyeTracker.hpp"
+#include "tests/check.hpp"
+
+using namespace std;
+
+const size_t w_ = FRAME_WIDTH, h_ = FRAME_HEIGHT;
+const size_t margin_ = 100;                     /* Scene is this much larger each side */
+const long ex_ = 388, ey_ = 210;                /* Eye centre with no shift */
+
+/* Fur (noise) and a dark eye; open 0 (closed) to 1. */
+vector<uint8_t> make_scene( double open )
+{
+    mt19937 rng( 2026 );
+    size_t sw = w_ + 2 * margin_, sh = h_ + 2 * margin_;
+    vector<uint8_t> scene( sw * sh );
+    for (size_t y = 0; y < sh; y++)
+        for (size_t x = 0; x < sw; x++)
+        {
+            double dx = (long)x - ex_ - (long)margin_, dy = (long)y - ey_ - (long)margin_;
+            bool eye = open > 0 && dx * dx / 4900 + dy * dy / (2025 * open * open) < 1;
+            uint8_t fur = 120 + rng( ) % 100;
+            scene[y * sw + x] = eye ? 15 + fur % 10 : fur;
+        }
+    return scene;
+}
+
+/* Camera frame of the scene with the animal moved by dx, dy. */
+void shot( const vector<uint8_t>& scene, long dx, long dy, vector<uint8_t>& frame )
+{
+    size_t sw = w_ + 2 * margin_;
+    frame.resize( w_ * h_ );
+    for (size_t y = 0; y < h_; y++)
+        memcpy( &frame[y * w_], &scene[(y + margin_ - dy) * sw + margin_ - dx], w_ );
+}
+
+bool at( const EyeTracker& eye, long dx, long dy )
+{
+    EyeTracker::Box b = eye.box( );
+    return (long)b[0] == BLINK_ROI_X0 + dx && (long)b[1] == BLINK_ROI_Y0 + dy
+        && b[2] - b[0] == BLINK_ROI_X1 - BLINK_ROI_X0 && b[3] - b[1] == BLINK_ROI_Y1 - BLINK_ROI_Y0;
+}
+
+int main( int argc, char** argv )
+{
+    const EyeTracker::Box roi = { { BLINK_ROI_X0, BLINK_ROI_Y0, BLINK_ROI_X1, BLINK_ROI_Y1 } };
+    vector<uint8_t> scene = make_scene( 1 ), frame;
+
+    EyeTracker eye( w_, h_, roi, 10 );
+    shot( scene, 0, 0, frame );
+    check( eye.process( &frame[0] ) && at( eye, 0, 0 ), "template from first frame" );
+
+    // Still frames: no jitter.
+    bool still = true;
+    for (int i = 0; i < 20; i++)
+        still = still && ! eye.process( &frame[0] );
+    check( still && at( eye, 0, 0 ) && eye.diff( ) == 0 && eye.searches( ) == 2, "still frames" );
+
+    // Noise of a few grey levels: stays.
+    mt19937 rng( 7 );
+    vector<uint8_t> noisy = frame;
+    for (int i = 0; i < 10; i++)
+    {
+        for (size_t p = 0; p < frame.size( ); p++)
+            noisy[p] = frame[p] + rng( ) % 5;
+        still = still && ! eye.process( &noisy[0] );
+    }
+    check( still && at( eye, 0, 0 ), "noise does not move the box" );
+
+    // Animal drifts 3 px right and 1 px up a frame.
+    bool follows = true;
+    for (long i = 1; i <= 15; i++)
+    {
+        shot( scene, 3 * i, -i, frame );
+        eye.process( &frame[0] );
+        follows = follows && at( eye, 3 * i, -i ) && eye.diff( ) == 0;
+    }
+    check( follows, "box follows a drift pixel for pixel" );
+
+    // Jump out of reach of the local search; found on the next whole frame search.
+    shot( scene, -60, 40, frame );
+    size_t frames = 0, searches = eye.searches( );
+    while( ! at( eye, -60, 40 ) && frames < 10 )
+    {
+        eye.process( &frame[0] );
+        frames += 1;
+    }
+    check( at( eye, -60, 40 ) && eye.searches( ) == searches + 1, "found after a jump by whole frame search" );
+
+    // Eye closing: match gets worse, box holds.
+    size_t moves = eye.moves( );
+    for( double open : { 0.6, 0.3, 0.0, 0.3, 1.0 } )
+    {
+        vector<uint8_t> blinking = make_scene( open );
+        for (int i = 0; i < 6; i++)
+        {
+            shot( blinking, -60, 40, frame );
+            eye.process( &frame[0] );
+        }
+    }
+    check( eye.moves( ) == moves && at( eye, -60, 40 ), "blink holds the box" );
+
+    // A new box takes a new template.
+    eye.set_box( EyeTracker::Box{ { 100, 100, 200, 180 } } );
+    check( eye.box( ) == (EyeTracker::Box{ { BLINK_ROI_X0 - 60, BLINK_ROI_Y0 + 40, BLINK_ROI_X1 - 60
+                , BLINK_ROI_Y1 + 40 } } ), "new box from next frame" );
+    check( eye.process( &frame[0] ) && eye.describe( ) == "100,100,200,180", "new box set" );
+
+    int refused = 0;
+    const EyeTracker::Box bad[] = { { { 10, 10, 20, 100 } }, { { 10, 10, 100, 20 } }
+        , { { 600, 10, w_ + 1, 100 } }, { { 10, 500, 100, h_ + 1 } } };
+    for( auto& b : bad )
+    {
+        try
+        {
+            eye.set_box( b );
+        }
+        catch( invalid_argument& )
+        {
+            refused += 1;
+        }
+    }
+    check( refused == 4, "box under 16x16 or outside frame refused" );
+
+    // Blink ROI where the box is, and the box in the header.
+    BlinkDetector<FRAME_WIDTH, FRAME_HEIGHT> blink( roi[0], roi[1], roi[2], roi[3] );
+    blink.set_roi( 100, 100, 200, 180 );
+    check( blink.x0( ) == 100 && blink.y0( ) == 100 && blink.cols( ) == 100 && blink.rows( ) == 80
+            , "blink ROI moved" );
+    Frame f;
+    FrameHeader hd = make_frame_header( f );
+    check( hd.eye[0] == 0 && hd.eye[2] == 0, "no box without blink" );
+    f.eye[0] = 100;
+    f.eye[1] = 100;
+    f.eye[2] = 200;
+    f.eye[3] = 180;
+    hd = make_frame_header( f );
+    check( hd.header_size == 136 && hd.version == 6 && hd.eye[0] == 100 && hd.eye[3] == 180
+            , "box in header" );
+    return failed_;
+}
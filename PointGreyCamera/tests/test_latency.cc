@@ -0,0 +1,75 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  test_latency.cc
+ *
+ *    Description:  LatencyHistogram: every value lands in a bucket within
+ *    1/16 of it, percentiles of a known distribution, and the difference of
+ *    two snapshots is the histogram of what was recorded in between.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "src/LatencyHistogram.hpp"
+#include "tests/check.hpp"
+
+using namespace std;
+
+int main( int argc, char** argv )
+{
+    bool within = true, ordered = true;
+    size_t last = 0;
+    for (uint64_t v = 0; v < (1ull << 39); v = v * 1.01 + 1)
+    {
+        size_t b = LatencyCounts::bucket( v );
+        uint64_t up = LatencyCounts::upper( b );
+        within = within && up >= v && (up - v) * 16 <= v + 16;
+        ordered = ordered && b >= last && b < LATENCY_NUM_BUCKETS;
+        last = b;
+    }
+    check( within, "bucket of every value is within 1/16 above it" );
+    check( ordered, "buckets grow with value" );
+    check( LatencyCounts::bucket( 1ull << 50 ) == LATENCY_NUM_BUCKETS - 1, "huge values clamp" );
+
+    LatencyHistogram h;
+    LatencyCounts empty = h.snapshot( );
+    check( empty.count( ) == 0 && empty.percentile( 0.5 ) == 0 && empty.max( ) == 0
+            , "empty histogram" );
+
+    // 1..1000 us, from four threads.
+    vector<thread> threads;
+    for (int t = 0; t < 4; t++)
+        threads.push_back( thread( [&h, t]( ) {
+                    for (uint64_t us = 1 + t; us <= 1000; us += 4)
+                        h.record( us * 1000 );
+                    } ) );
+    for( auto& t : threads )
+        t.join( );
+
+    LatencyCounts a = h.snapshot( );
+    auto near = []( uint64_t got, double want ) {
+        return got >= want && got <= want * 1.07;
+    };
+    check( a.count( ) == 1000, "all samples counted" );
+    check( near( a.percentile( 0.5 ), 500e3 ) && near( a.percentile( 0.99 ), 990e3 )
+            && near( a.max( ), 1000e3 ), "p50, p99 and max within 7%" );
+
+    // A trial: 100 samples of 20 ms.
+    for (int i = 0; i < 100; i++)
+        h.record( 20000000 );
+    LatencyCounts trial = h.snapshot( ) - a;
+    check( trial.count( ) == 100 && near( trial.percentile( 0.5 ), 20e6 )
+            && near( trial.max( ), 20e6 ), "difference of snapshots" );
+
+    h.record_diff( 5, 10 );
+    check( (h.snapshot( ) - a - trial).counts[0] == 1, "negative difference counts as 0" );
+    return failed_;
+}
@@ -0,0 +1,162 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  test_motion.cc
+ *
+ *    Description:  MotionEnergy: SIMD sums and background give the same bits
+ *    as the plain loop on any length, each mask is the mean difference over
+ *    it alone, and the value goes out in the frame header.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <iostream>
+#include <vector>
+#include <random>
+#include <cmath>
+
+#include "config.h"
+#include "src/FrameSource.hpp"
+#include "src/FrameHeader.hpp"
+#include "src/MotionEnergy.hpp"
+#include "tests/check.hpp"
+
+using namespace std;
+
+int main( int argc, char** argv )
+{
+    mt19937 rng( 2026 );
+
+    // Lengths around the vector widths, odd ones too.
+    bool sadSame = true, bgSame = true;
+    for( size_t n : { (size_t)1, (size_t)15, (size_t)16, (size_t)31, (size_t)33, (size_t)64
+            , (size_t)97, (size_t)FRAME_WIDTH, (size_t)FRAME_WIDTH + 5 } )
+    {
+        vector<uint8_t> a( n ), b( n );
+        for (size_t i = 0; i < n; i++)
+        {
+            a[i] = rng( ) & 0xFF;
+            b[i] = rng( ) & 0xFF;
+        }
+        uint64_t ref = 0;
+        for (size_t i = 0; i < n; i++)
+            ref += abs( int( a[i] ) - int( b[i] ) );
+        sadSame = sadSame && motion_sad( &a[0], &b[0], n ) == ref;
+
+        for( unsigned shift : { 1u, 3u, 8u } )
+        {
+            vector<uint16_t> bg( n ), bgRef( n );
+            for (size_t i = 0; i < n; i++)
+                bg[i] = bgRef[i] = b[i] << 7;
+            vector<uint8_t> bg8( n + 1, 0xAB ), bg8Ref( n );
+            for (int step = 0; step < 3; step++)
+            {
+                motion_update_bg( &a[0], &bg[0], &bg8[0], n, shift );
+                for (size_t i = 0; i < n; i++)
+                {
+                    bgRef[i] += ((a[i] << 7) - int( bgRef[i] )) >> shift;
+                    bg8Ref[i] = (bgRef[i] + 64) >> 7;
+                }
+            }
+            bgSame = bgSame && bg == bgRef && equal( bg8Ref.begin( ), bg8Ref.end( ), bg8.begin( ) )
+                && bg8.back( ) == 0xAB;
+        }
+    }
+    check( sadSame, "sum of differences as plain loop, any length" );
+    check( bgSame, "background as plain loop, any length" );
+
+    const size_t w = FRAME_WIDTH, h = FRAME_HEIGHT;
+    vector<uint8_t> img( w * h ), next( w * h );
+    for( auto& v : img )
+        v = rng( ) & 0xFF;
+    float out[FRAME_MOTION_MASKS];
+
+    // Previous frame: first has nothing to compare with.
+    {
+        MotionEnergy m( w, h, { MotionEnergy::Box{ { 0, 0, w, h } } } );
+        m.process( &img[0], out );
+        check( out[0] == -1, "first frame -1" );
+        m.process( &img[0], out );
+        check( out[0] == 0, "same frame no motion" );
+
+        next = img;
+        for (size_t i = 0; i < next.size( ); i += 4)
+            next[i] = img[i] > 127 ? img[i] - 100 : img[i] + 100;
+        m.process( &next[0], out );
+        check( fabs( out[0] - 25 ) < 1e-3, "quarter of pixels off by 100 is 25" );
+        m.process( &next[0], out );
+        check( out[0] == 0, "compared with previous frame" );
+
+        m.reset( );
+        m.process( &img[0], out );
+        check( out[0] == -1, "reset starts over" );
+    }
+
+    // Masks see only their own pixels.
+    {
+        vector<MotionEnergy::Box> masks = { { { 0, 0, 100, 100 } }, { { 200, 300, 264, 301 } }
+            , { { 0, 0, w, h } } };
+        MotionEnergy m( w, h, masks );
+        check( m.masks( ) == 3 && m.describe( ) == "0,0,100,100;200,300,264,301;0,0,"
+                + to_string( w ) + "," + to_string( h ), "masks described" );
+        m.process( &img[0], out );
+        next = img;
+        for (size_t x = 200; x < 264; x++)
+            next[300 * w + x] = img[300 * w + x] ^ 0x80;
+        m.process( &next[0], out );
+        check( out[0] == 0 && out[1] == 128 && fabs( out[2] - 128.0 * 64 / (w * h) ) < 1e-4
+                , "each mask its own mean" );
+    }
+
+    // Running background: a step decays by half each frame with shift 1.
+    {
+        vector<uint8_t> dark( w * h, 0 ), bright( w * h, 200 );
+        MotionEnergy m( w, h, { MotionEnergy::Box{ { 10, 10, 74, 20 } } }, 1 );
+        m.process( &dark[0], out );
+        vector<float> seen;
+        for (int i = 0; i < 4; i++)
+        {
+            m.process( &bright[0], out );
+            seen.push_back( out[0] );
+        }
+        check( seen[0] == 200 && seen[1] == 100 && seen[2] == 50 && seen[3] == 25
+                , "background follows by half" );
+    }
+
+    int refused = 0;
+    const vector<vector<MotionEnergy::Box> > bad = { { }, { { { 10, 10, 10, 20 } } }
+        , { { { 0, 0, w + 1, 10 } } }, { { { 0, 0, 10, h + 1 } } } };
+    for( auto& masks : bad )
+    {
+        try
+        {
+            MotionEnergy m( w, h, masks );
+        }
+        catch( invalid_argument& )
+        {
+            refused += 1;
+        }
+    }
+    try
+    {
+        MotionEnergy m( w, h, { MotionEnergy::Box{ { 0, 0, w, h } } }, 9 );
+    }
+    catch( invalid_argument& )
+    {
+        refused += 1;
+    }
+    check( refused == 5, "empty, outside masks and shift 9 refused" );
+
+    Frame f;
+    check( f.motion[0] == -1 && f.motion[FRAME_MOTION_MASKS - 1] == -1, "no motion by default" );
+    f.motion[0] = 12.5;
+    f.motion[1] = 3;
+    FrameHeader hd = make_frame_header( f );
+    check( hd.header_size == 136 && hd.version == 6 && hd.motion[0] == 12.5f && hd.motion[1] == 3
+            && hd.motion[2] == -1, "motion in header" );
+    return failed_;
+}
@@ -0,0 +1,111 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  test_multicam.cc
+ *
+ *    Description:  Three synthetic cameras acquired at once, an Acquisition
+ *    each, as cam_server --cameras 3 does. Every camera runs its own clock
+ *    (offset and drift); ClockSync fits each to the host clock, so that
+ *    exposure_ns of frames of all cameras is on one time base.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+
+#include "config.h"
+#include "src/FrameSource.hpp"
+#include "src/SyntheticSource.hpp"
+#include "src/Acquisition.hpp"
+#include "src/ClockSync.hpp"
+#include "src/FrameHeader.hpp"
+#include "tests/check.hpp"
+
+using namespace std;
+
+/* What the sink of one camera saw; touched by its sender thread only. */
+struct Seen
+{
+    size_t frames = 0;
+    size_t wrongCamera = 0;
+    size_t backwards = 0;
+    int64_t worst = 0;                          /* exposure_ns - host_ns after warm up */
+    uint64_t last = 0;
+    bool header = true;
+};
+
+int main( int argc, char** argv )
+{
+    const size_t N = 3;
+    const double fps = 200;
+    // Camera clocks: ns since some other epoch, running fast or slow.
+    const int64_t offset[N] = { 0, 7000000000ll, -3000000000ll };
+    const double drift[N] = { 0, 40e-6, -25e-6 };
+
+    ClockSync sync( 100, 20, 115200 );
+    vector<unique_ptr<SyntheticSource> > sources;
+    vector<unique_ptr<Acquisition> > acqs;
+    vector<Seen> seen( N );
+    for (size_t k = 0; k < N; k++)
+    {
+        sources.push_back( unique_ptr<SyntheticSource>(
+                    new SyntheticSource( FRAME_WIDTH, FRAME_HEIGHT, fps, FRAME_RING_SIZE + 16 ) ) );
+        sources.back( )->init( );
+        Seen* s = &seen[k];
+        acqs.push_back( unique_ptr<Acquisition>( new Acquisition( sources.back( ).get( )
+                        , [s, k]( const Frame& f ) {
+                            s->frames += 1;
+                            s->wrongCamera += f.camera != k;
+                            s->backwards += f.exposure_ns <= s->last;
+                            s->last = f.exposure_ns;
+                            // Synthetic frames are stamped by host right
+                            // after their timestamp: that is when exposed.
+                            if( s->frames > 100 )
+                                s->worst = max( s->worst, (int64_t)llabs( (int64_t)(f.exposure_ns - f.host_ns) ) );
+                            FrameHeader h = make_frame_header( f );
+                            s->header = s->header && h.camera == k && h.exposure_ns == f.exposure_ns
+                                && h.header_size == 136 && h.version == 6;
+                            return true;
+                        }, FRAME_RING_SIZE, k ) ) );
+        acqs.back( )->set_analyzer( [&sync, &offset, &drift]( Frame& f ) {
+                f.timestamp = offset[f.camera] + (int64_t)(f.timestamp * (1 + drift[f.camera]));
+                sync.tag( f );
+                } );
+    }
+
+    for( auto& acq : acqs )
+        check( acq->start( ) == 0, "camera " + to_string( acq->camera( ) ) + " started" );
+    this_thread::sleep_for( chrono::milliseconds( 1500 ) );
+    for( auto& acq : acqs )
+    {
+        acq->stop( );
+        acq->print_stats( cout );
+    }
+    cout << "[INFO] " << sync.status( ) << endl;
+
+    for (size_t k = 0; k < N; k++)
+    {
+        const Seen& s = seen[k];
+        const PipelineStats& p = acqs[k]->stats( );
+        string cam = "camera " + to_string( k ) + ": ";
+        cout << "[INFO] " << cam << s.frames << " frames, worst " << s.worst / 1000 << " us" << endl;
+        check( s.frames > 1.5 * fps * 0.9 && p.overruns == 0, cam + "every frame at 200 fps" );
+        check( s.wrongCamera == 0 && s.header, cam + "frames and headers carry its index" );
+        check( s.backwards == 0, cam + "exposure_ns increases" );
+        check( s.worst < 1000000, cam + "exposure_ns within 1 ms of host stamp, whatever its clock" );
+    }
+    check( sync.status( ).find( " camera2 points=" ) != string::npos, "a clock fit per camera" );
+
+    for( auto& source : sources )
+        source->deinit( );
+    return failed_;
+}
@@ -0,0 +1,209 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  test_recorder.cc
+ *
+ *    Description:  Record synthetic frames of two trials with TrialRecorder
+ *    and read them back with TiffReplaySource. Then a trial triggered late,
+ *    whose first frames come from the pre-roll ring, on a recorder with a
+ *    handful of pages that a leak would exhaust.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "config.h"
+#include "src/FrameSource.hpp"
+#include "src/SyntheticSource.hpp"
+#include "src/TiffReplaySource.hpp"
+#include "src/TrialRecorder.hpp"
+#include "src/PixelUnpack.hpp"
+#include "tests/check.hpp"
+
+using namespace std;
+
+/* Frames of filename, without metadata row. */
+vector<vector<uint8_t> > read_back( const string& filename )
+{
+    vector<vector<uint8_t> > frames;
+    TiffReplaySource replay( filename, FRAME_WIDTH, FRAME_HEIGHT, 0, false, 4 );
+    if( replay.init( ) != 0 )
+        return frames;
+    replay.begin_acquisition( );
+    Frame frame;
+    while( replay.next_frame( frame ) )
+    {
+        frames.push_back( vector<uint8_t>( frame.data, frame.data + frame.size ) );
+        replay.release( frame );
+    }
+    replay.end_acquisition( );
+    return frames;
+}
+
+int main( int argc, char** argv )
+{
+    char tmpl[] = "/tmp/test_recorder_XXXXXX";
+    string dir = mkdtemp( tmpl );
+
+    SyntheticSource synthetic( FRAME_WIDTH, FRAME_HEIGHT, 0, 4 );
+    synthetic.init( );
+    synthetic.begin_acquisition( );
+
+    TrialRecorder recorder( dir, FRAME_WIDTH, FRAME_HEIGHT, 64 );
+    recorder.start( );
+
+    // Frames outside a trial are not recorded.
+    size_t lengths[] = { 0, 10, 0, 5 };
+    int trials[] = { -1, 1, -1, 2 };
+    vector<vector<uint8_t> > sent[3];
+    for (size_t t = 0; t < 4; t++)
+    {
+        if( trials[t] > 0 )
+            recorder.begin_trial( trials[t] );
+        recorder.set_meta( "arduino line" );
+        for (size_t i = 0; i < (lengths[t] ? lengths[t] : 3); i++)
+        {
+            Frame frame;
+            synthetic.next_frame( frame );
+            bool queued = recorder.record( frame );
+            while( ! queued )
+            {
+                // Queue of 64 is enough here; don't let a slow disk fail us.
+                usleep( 1000 );
+                queued = recorder.record( frame );
+            }
+            if( trials[t] > 0 )
+                sent[trials[t]].push_back( vector<uint8_t>( frame.data, frame.data + frame.size ) );
+            synthetic.release( frame );
+        }
+        recorder.end_trial( );
+    }
+    recorder.stop( );
+    synthetic.end_acquisition( );
+    synthetic.deinit( );
+
+    string status = recorder.status( );
+    cout << "[INFO] " << status << endl;
+    check( status.find( "written=15 dropped=0" ) != string::npos
+            && status.find( "files=2 errors=0" ) != string::npos
+            , "15 frames of 2 trials written, none dropped" );
+
+    for (int trial = 1; trial <= 2; trial++)
+    {
+        ostringstream name;
+        name << dir << "/trial_00" << trial << ".tif";
+        vector<vector<uint8_t> > got = read_back( name.str( ) );
+        ostringstream msg;
+        msg << name.str( ) << " has the " << sent[trial].size( ) << " frames of trial " << trial;
+        check( got == sent[trial], msg.str( ) );
+        unlink( name.str( ).c_str( ) );
+    }
+
+    /*-----------------------------------------------------------------------------
+     *  Pre-roll: frames 5 ms apart; trial 3 starts at frame 220 but the
+     *  trigger comes after frame 221; it ends at 226, told after 227.
+     *-----------------------------------------------------------------------------*/
+    synthetic.init( );
+    synthetic.begin_acquisition( );
+    {
+        TrialRecorder rolling( dir, FRAME_WIDTH, FRAME_HEIGHT, 4, true, "tiff", 200, 0, 200, 8 );
+        rolling.set_roll( 25000000, 10000000 );
+        rolling.start( );
+        const uint64_t t0 = 1000000000, dt = 5000000;
+        vector<vector<uint8_t> > all;
+        for (size_t i = 0; i < 240; i++)
+        {
+            Frame frame;
+            synthetic.next_frame( frame );
+            frame.host_ns = t0 + i * dt;
+            all.push_back( vector<uint8_t>( frame.data, frame.data + frame.size ) );
+            while( ! rolling.record( frame ) )
+                usleep( 1000 );
+            synthetic.release( frame );
+            if( i == 221 )
+                rolling.trigger( 3, t0 + 220 * dt );
+            if( i == 227 )
+                rolling.release( t0 + 226 * dt );
+        }
+        rolling.stop( );
+        status = rolling.status( );
+        cout << "[INFO] " << status << endl;
+        check( status.find( "written=13 dropped=0 " ) != string::npos
+                && status.find( "prerolled=7 " ) != string::npos
+                , "25 ms before and 10 ms after trial 3, 7 frames from the ring" );
+
+        string name = dir + "/trial_003.tif";
+        vector<vector<uint8_t> > want( all.begin( ) + 215, all.begin( ) + 228 );
+        check( read_back( name ) == want, name + " has frames 215 to 227" );
+        unlink( name.c_str( ) );
+    }
+    synthetic.end_acquisition( );
+    synthetic.deinit( );
+
+    /*-----------------------------------------------------------------------------
+     *  --record-raw: a Mono12p camera, 16 bit pages of the 12 bit pixels.
+     *-----------------------------------------------------------------------------*/
+    {
+        SyntheticSource camera( FRAME_WIDTH, FRAME_HEIGHT, 0, 4, PIXEL_FORMAT_MONO12P );
+        camera.init( );
+        camera.begin_acquisition( );
+        PixelConverter converter( FRAME_WIDTH, FRAME_HEIGHT );
+        converter.keep_wide( true );
+        TrialRecorder raw( dir, FRAME_WIDTH, FRAME_HEIGHT, 8, true, "tiff", 200, 0, 200, 0, true );
+        check( ! raw.set_format( "ebz" ), "raw recorder writes tiff only" );
+        raw.start( );
+        raw.begin_trial( 4 );
+        vector<vector<uint16_t> > sent;
+        for (size_t i = 0; i < 6; i++)
+        {
+            Frame frame;
+            camera.next_frame( frame );
+            converter.convert( frame );
+            sent.push_back( vector<uint16_t>( frame.wide, frame.wide + FRAME_WIDTH * FRAME_HEIGHT ) );
+            while( ! raw.record( frame ) )
+                usleep( 1000 );
+            camera.release( frame );
+        }
+        raw.end_trial( );
+        raw.stop( );
+        camera.end_acquisition( );
+        camera.deinit( );
+        cout << "[INFO] " << raw.status( ) << endl;
+
+        string name = dir + "/trial_004.tif";
+        TIFF* tif = TIFFOpen( name.c_str( ), "r" );
+        size_t pages = 0;
+        bool same = tif != NULL;
+        vector<uint16_t> page( FRAME_WIDTH * (FRAME_HEIGHT + 1) );
+        while( tif && same && pages < sent.size( ) )
+        {
+            uint16_t bits = 0;
+            TIFFGetField( tif, TIFFTAG_BITSPERSAMPLE, &bits );
+            same = bits == 16 && TIFFScanlineSize( tif ) == 2 * FRAME_WIDTH;
+            for (uint32_t row = 0; same && row <= FRAME_HEIGHT; row++)
+                same = TIFFReadScanline( tif, &page[row * FRAME_WIDTH], row, 0 ) >= 0;
+            same = same && equal( sent[pages].begin( ), sent[pages].end( ), page.begin( ) + FRAME_WIDTH )
+                && string( (const char*)&page[0], 2 ) == to_string( pages ) + ",";
+            pages += 1;
+            if( ! TIFFReadDirectory( tif ) )
+                break;
+        }
+        if( tif )
+            TIFFClose( tif );
+        check( same && pages == sent.size( ), name + " has 6 pages of 16 bit pixels and a text row" );
+        unlink( name.c_str( ) );
+    }
+
+    rmdir( dir.c_str( ) );
+    return failed_;
+}
@@ -0,0 +1,218 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  test_sample_protocol.cc
+ *
+ *    Description:  SampleDecoder on the packets the firmware sends: a board
+ *    sampling at 1 kHz whose micros( ) wraps, pings, TTL edges, trials and
+ *    messages. Decoded lines must be what the text firmware prints; a
+ *    stream with corrupted and lost bytes must never give a wrong line and
+ *    must lose little more than the packets hit.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <iostream>
+#include <vector>
+#include <set>
+#include <random>
+#include <cstdio>
+
+#include "src/SampleDecoder.hpp"
+#include "tests/check.hpp"
+
+using namespace std;
+
+#define BAUD            500000
+#define PERIOD_US       1000
+
+/* Packets as send_sample( ) of src/main.ino sends them. */
+struct Board
+{
+    vector<uint8_t> bytes;
+    vector<string> lines;                       /* What the text firmware prints. */
+    uint32_t sample_us = 0, trial_us = 0, trial_ms = 0;
+    unsigned since_time = SP_TIME_EVERY, trial = 0;
+    long trial_sent = -1;
+    uint32_t trial_us_sent = 0;
+
+    void send( uint8_t type, const void* payload, uint8_t len )
+    {
+        uint8_t buf[SP_MAX_PACKET];
+        uint8_t n = sp_encode( buf, type, payload, len );
+        bytes.insert( bytes.end( ), buf, buf + n );
+    }
+
+    void sample( uint32_t now, uint8_t pins, uint8_t state, int m1, int m2 )
+    {
+        if( trial_sent != (long)trial || trial_us_sent != trial_us )
+        {
+            sp_trial t = { (uint16_t)trial, trial_ms, trial_us };
+            send( SP_TRIAL, &t, sizeof( t ) );
+            trial_sent = trial;
+            trial_us_sent = trial_us;
+            char line[64];
+            snprintf( line, sizeof( line ), ">>TRIAL %u %u", trial, trial_ms );
+            lines.push_back( line );
+        }
+        uint32_t dt = now - sample_us;
+        if( dt > 0xFFFF || since_time >= SP_TIME_EVERY )
+        {
+            sp_time t = { now };
+            send( SP_TIME, &t, sizeof( t ) );
+            since_time = 0;
+            dt = 0;
+        }
+        sp_sample s = { (uint16_t)dt, pins, state, (int8_t)m1, (int8_t)m2 };
+        send( SP_SAMPLE, &s, sizeof( s ) );
+        since_time += 1;
+        sample_us = now;
+
+        char line[96];
+        snprintf( line, sizeof( line ), "%u,%u,%d,%d,%d,%3d,%3d,%d,%d,%s"
+                , (now - trial_us) / 1000, trial, (pins & SP_PIN_PUFF) != 0
+                , (pins & SP_PIN_TONE) != 0, (pins & SP_PIN_LED) != 0, m1, m2
+                , (pins & SP_PIN_CAMERA) != 0, (pins & SP_PIN_IMAGING) != 0
+                , sp_state_names_[state] );
+        lines.push_back( line );
+    }
+
+    void message( const string& msg )
+    {
+        send( SP_TEXT, msg.c_str( ), msg.size( ) );
+        lines.push_back( msg );
+    }
+};
+
+vector<string> decode( const vector<uint8_t>& bytes, SampleDecoder& dec, mt19937& rng )
+{
+    vector<string> lines;
+    uniform_int_distribution<size_t> chunk( 1, 300 );
+    for (size_t i = 0; i < bytes.size( ); )
+    {
+        size_t n = min( chunk( rng ), bytes.size( ) - i );
+        dec.feed( &bytes[i], n );
+        i += n;
+        string line;
+        while( dec.next_line( line ) )
+            lines.push_back( line );
+    }
+    return lines;
+}
+
+int main( int argc, char** argv )
+{
+    uint8_t check_buf[SP_MAX_PACKET];
+    const uint8_t crc_check[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+    uint8_t crc = 0;
+    for( uint8_t c : crc_check )
+        crc = sp_crc8( crc, c );
+    check( crc == 0xF4, "CRC-8 (poly 0x07) check value" );
+    sp_sample empty = { 0, 0, 0, 0, 0 };
+    check( sp_encode( check_buf, SP_SAMPLE, &empty, sizeof( empty ) ) == 10
+            , "a sample is 10 bytes" );
+
+    /*-----------------------------------------------------------------------------
+     *  20 s of a session; micros( ) wraps after 5 s.
+     *-----------------------------------------------------------------------------*/
+    mt19937 rng( 11 );
+    uniform_int_distribution<uint32_t> late( 0, 80 );            /* Busy loop jitter */
+    Board board;
+    board.message( ">>> Waiting for 's' to be pressed" );
+    uint32_t t0 = 0xFFFFFFFFu - 5000000;
+    uint32_t now = t0;
+    size_t samples = 0;
+    for (uint32_t k = 0; k < 20000; k++)
+    {
+        now = t0 + k * PERIOD_US + late( rng );
+        if( k == 2000 )
+        {
+            board.trial = 1;
+            board.trial_us = now;
+            board.trial_ms = now / 1000;
+        }
+        // ITI: no samples for 3 s, then a new trial number.
+        if( k >= 12000 && k < 15000 )
+            continue;
+        if( k == 15000 )
+            board.trial = 2;
+        uint8_t state = k < 2000 ? ST_INVA : (k < 10000 ? ST_PRE_ : (k < 12000 ? ST_POST : ST_ITI_));
+        uint8_t pins = (k >= 9000 && k < 11000 ? SP_PIN_CAMERA : 0) | ((k / 7) % 2 ? SP_PIN_MOTION1 : 0);
+        board.sample( now, pins, state, (pins & SP_PIN_MOTION1) != 0, 0 );
+        samples += 1;
+        if( k % 100 == 50 )
+        {
+            sp_ping p = { now + 10 };
+            board.send( SP_PING, &p, sizeof( p ) );
+            char line[32];
+            snprintf( line, sizeof( line ), ">>PING %u", p.micros );
+            board.lines.push_back( line );
+        }
+        if( k == 9000 )
+        {
+            sp_ttl t = { 1, now + 5 };
+            board.send( SP_TTL, &t, sizeof( t ) );
+            char line[32];
+            snprintf( line, sizeof( line ), ">>TTL 1 %u", t.micros );
+            board.lines.push_back( line );
+        }
+        if( k == 12000 )
+            board.message( ">>END Trial 1 is over. Starting new" );
+    }
+
+    SampleDecoder dec;
+    vector<string> lines = decode( board.bytes, dec, rng );
+    check( lines == board.lines, "clean stream decodes to the text firmware's lines" );
+    check( dec.errors( ) == 0 && dec.junk( ) == 0, "no errors on a clean stream" );
+    double bytesPerSample = (double)board.bytes.size( ) / samples;
+    cout << "[INFO] " << bytesPerSample << " bytes per sample, "
+        << bytesPerSample * 10 * 1000 / BAUD * 100 << "% of " << BAUD << " baud at 1 kHz" << endl;
+    check( bytesPerSample * 10 * 1000 < BAUD / 2, "1 kHz takes less than half the line" );
+
+    /*-----------------------------------------------------------------------------
+     *  Same stream with a byte flipped every 20 kB and bytes lost now and then.
+     *-----------------------------------------------------------------------------*/
+    vector<uint8_t> bad;
+    size_t hits = 0;
+    for (size_t i = 0; i < board.bytes.size( ); i++)
+    {
+        if( i % 49999 == 100 )
+        {
+            hits += 1;
+            continue;
+        }
+        uint8_t b = board.bytes[i];
+        if( i % 20011 == 7 )
+        {
+            b ^= 1 << (i % 8);
+            hits += 1;
+        }
+        bad.push_back( b );
+    }
+    SampleDecoder dec2;
+    vector<string> got = decode( bad, dec2, rng );
+    multiset<string> expected( board.lines.begin( ), board.lines.end( ) );
+    size_t wrong = 0;
+    for( auto& l : got )
+    {
+        auto it = expected.find( l );
+        if( it == expected.end( ) )
+        {
+            wrong += 1;
+            cout << "[INFO] wrong line: " << l << endl;
+        }
+        else
+            expected.erase( it );
+    }
+    cout << "[INFO] " << hits << " bytes hit, " << dec2.errors( ) << " bad packets, "
+        << board.lines.size( ) - got.size( ) << " lines of " << board.lines.size( ) << " lost" << endl;
+    check( wrong == 0, "corrupted stream never gives a wrong line" );
+    check( dec2.errors( ) >= hits / 2, "bad packets are counted" );
+    // Each hit loses samples up to the next SP_TIME.
+    check( got.size( ) > board.lines.size( ) * 8 / 10, "most lines survive" );
+    return failed_;
+}
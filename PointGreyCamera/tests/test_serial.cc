@@ -0,0 +1,235 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  test_serial.cc
+ *
+ *    Description:  SerialReader.hpp: lines cut from arbitrary chunks (and
+ *    where each ended in its chunk), data lines told from the rest, trial
+ *    files written as the python client wrote them, and a stream of lines
+ *    through a pseudo terminal set up like the board's port, read as
+ *    arduino_reader reads it, without losing a byte.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <sys/epoll.h>
+#include <pty.h>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <random>
+#include <thread>
+#include <cstdio>
+
+#include "src/FrameSource.hpp"
+#include "src/SerialReader.hpp"
+#include "tests/check.hpp"
+
+using namespace std;
+
+/* Data line k of trial, as the text firmware prints it. */
+string data_line( size_t k, int trial )
+{
+    char s[96];
+    snprintf( s, sizeof( s ), "%u,%d,0,%d,0,%3d,%3d,%d,0,%s", (unsigned)(k % 60000), trial
+            , (int)(k % 2), (int)(k % 7) - 3, (int)(k % 5), (int)(k / 10 % 2)
+            , k % 3 ? "PRE_" : "CS" );
+    return s;
+}
+
+vector<string> read_file( const string& path )
+{
+    vector<string> lines;
+    ifstream f( path );
+    string l;
+    while( getline( f, l ) )
+        lines.push_back( l );
+    return lines;
+}
+
+int main( int argc, char** argv )
+{
+    /*-----------------------------------------------------------------------------
+     *  Lines from random chunks.
+     *-----------------------------------------------------------------------------*/
+    mt19937 rng( 3 );
+    vector<string> want;
+    string stream;
+    for (size_t k = 0; k < 5000; k++)
+    {
+        string l = k % 97 == 5 ? ">>PING " + to_string( k ) : data_line( k, 1 + k / 1000 );
+        want.push_back( l );
+        stream += l + (k % 3 ? "\r\n" : "\n");
+        if( k == 10 )
+            stream += string( 300, 'x' ) + "\n";        /* Noise: too long, dropped */
+        if( k == 20 )
+            stream += "\n";                             /* Empty: skipped */
+    }
+    LineSplitter splitter;
+    vector<string> got;
+    bool afterOk = true;
+    uniform_int_distribution<size_t> chunk( 1, 200 );
+    for (size_t i = 0; i < stream.size( ); )
+    {
+        size_t n = min( chunk( rng ), stream.size( ) - i );
+        const char* base = stream.data( ) + i;
+        splitter.feed( base, n, [&]( const char* line, size_t len, size_t after ) {
+                got.push_back( string( line, len ) );
+                // The byte before what came after is the newline.
+                afterOk = afterOk && after < n && base[n - after - 1] == '\n'
+                    && strlen( line ) == len;
+                } );
+        i += n;
+    }
+    check( got == want, "lines from random chunks, \\r\\n and \\n" );
+    check( afterOk, "bytes after each line in its chunk" );
+    check( splitter.dropped( ) == 1, "too long line dropped" );
+
+    /*-----------------------------------------------------------------------------
+     *  Data lines.
+     *-----------------------------------------------------------------------------*/
+    DataLine d;
+    bool ok = parse_data_line( "1234,3,0,1,0,  5, -2,1,0,CS", 27, d );
+    check( ok && d.ms == 1234 && d.trial == 3 && d.camera == 1, "data line fields" );
+    const char* notData[] = { ">>PING 1234", ">>> Waiting for 's' to be pressed"
+        , "1,2,3", "1,2,0,0,0,0,0,1,0,CS,9", "1,x,0,0,0,0,0,1,0,CS", ">>TRIAL 3 100"
+        , "1,2,0,0,0,0,0,1,0," };
+    bool rejected = true;
+    for( const char* s : notData )
+        rejected = rejected && ! parse_data_line( s, strlen( s ), d );
+    check( rejected, "messages, pings, short and long lines are not data" );
+
+    WallClock wall;
+    char t[32];
+    time_t now = time( NULL );
+    struct tm tm;
+    localtime_r( &now, &tm );
+    char date[16];
+    strftime( date, sizeof( date ), "%Y-%m-%dT", &tm );
+    size_t tn = wall.format( monotonic_ns( ), t );
+    check( tn == 26 && strlen( t ) == 26 && strncmp( t, date, 11 ) == 0 && t[19] == '.'
+            , "wall time " + string( t ) + " as isoformat( )" );
+
+    /*-----------------------------------------------------------------------------
+     *  Trial files: a small buffer so that it goes to disk many times.
+     *-----------------------------------------------------------------------------*/
+    char dirTemplate[] = "/tmp/test_serial_XXXXXX";
+    string dir = mkdtemp( dirTemplate );
+    {
+        TrialFiles files( 200 );
+        files.write( 1, t, tn, "1,1,0,0,0,0,0,1,0,CS", 20 );
+        check( files.lines( ) == 0, "nothing written before files are set" );
+        files.set_files( dir, "name=m1_st=1_sn=2" );
+        for (size_t k = 0; k < 3000; k++)
+        {
+            string l = data_line( k, 1 + k / 1000 );
+            files.write( 1 + k / 1000, t, tn, l.c_str( ), l.size( ) );
+        }
+        check( files.trial( ) == 3 && files.files( ) == 3, "one file per trial" );
+        check( files.path( 2 ) == dir + "/name=m1_st=1_sn=2trial=2.dat", "file names as before" );
+    }
+    bool same = true;
+    for (int trial = 1; trial <= 3; trial++)
+    {
+        vector<string> lines = read_file( dir + "/name=m1_st=1_sn=2trial=" + to_string( trial ) + ".dat" );
+        same = same && lines.size( ) == 1000;
+        for (size_t k = 0; same && k < lines.size( ); k++)
+        {
+            string l = data_line( (trial - 1) * 1000 + k, trial );
+            l.erase( remove( l.begin( ), l.end( ), ' ' ), l.end( ) );
+            same = lines[k] == string( t ) + "," + l;
+        }
+        remove( (dir + "/name=m1_st=1_sn=2trial=" + to_string( trial ) + ".dat").c_str( ) );
+    }
+    rmdir( dir.c_str( ) );
+    check( same, "trial files have every line, time first and no spaces" );
+
+    MessageLog log( 4 );
+    vector<string> msgs;
+    for (int i = 0; i < 6; i++)
+        log.add( to_string( i ).c_str( ), 1 );
+    uint64_t next = log.since( 0, msgs );
+    check( next == 6 && msgs == vector<string>( { "2", "3", "4", "5" } ), "message log keeps the last ones" );
+    check( log.since( 5, msgs ) == 6 && msgs.size( ) == 1 && msgs[0] == "5", "messages since" );
+
+    /*-----------------------------------------------------------------------------
+     *  Lines as fast as a pseudo terminal takes them (far more than the
+     *  board's 1 kHz), read the way arduino_reader does.
+     *-----------------------------------------------------------------------------*/
+    int master, slave;
+    char name[256];
+    if( openpty( &master, &slave, name, NULL, NULL ) != 0 )
+    {
+        perror( "openpty" );
+        return failed_ + 1;
+    }
+    const size_t N = 200000;
+    size_t lines = 0, bad = 0, bytes = 0;
+    double rate = 0;
+    bool pinged = false;
+    {
+        SerialPort port( name, 500000 );
+        close( slave );
+        check( port.byte_ns( ) == 20000, "a byte takes 20 us at 500000 baud" );
+        port.write_all( "?", 1 );
+        char c = 0;
+        pinged = read( master, &c, 1 ) == 1 && c == '?';
+
+        thread board( [&]( ) {
+                string chunk;
+                for (size_t k = 0; k < N; k++)
+                {
+                    chunk += data_line( k, 1 ) + "\r\n";
+                    if( chunk.size( ) > 3000 || k == N - 1 )
+                    {
+                        for (size_t done = 0; done < chunk.size( ); )
+                        {
+                            ssize_t w = write( master, chunk.data( ) + done, chunk.size( ) - done );
+                            if( w > 0 )
+                                done += w;
+                        }
+                        chunk.clear( );
+                    }
+                }
+                } );
+
+        int epoll = epoll_create1( 0 );
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = port.fd( );
+        epoll_ctl( epoll, EPOLL_CTL_ADD, port.fd( ), &ev );
+        LineSplitter lineSplitter;
+        static char buf[1 << 16];
+        uint64_t t0 = monotonic_ns( );
+        while( lines < N )
+        {
+            struct epoll_event ready;
+            if( epoll_wait( epoll, &ready, 1, 2000 ) <= 0 )
+                break;
+            ssize_t n;
+            while( (n = read( port.fd( ), buf, sizeof( buf ) )) > 0 )
+            {
+                bytes += n;
+                lineSplitter.feed( buf, n, [&]( const char* line, size_t len, size_t ) {
+                        DataLine x;
+                        if( ! parse_data_line( line, len, x ) || x.ms != lines % 60000 )
+                            bad += 1;
+                        lines += 1;
+                        } );
+            }
+        }
+        rate = lines / ((monotonic_ns( ) - t0) * 1e-9);
+        board.join( );
+        close( epoll );
+    }
+    close( master );
+    cout << "[INFO] " << lines << " lines, " << bytes << " bytes, " << (size_t)rate << " lines/s" << endl;
+    check( pinged, "writes reach the board" );
+    check( lines == N && bad == 0, "every line read, in order" );
+    check( rate > 10000, "keeps up with well over 1 kHz" );
+    return failed_;
+}
@@ -0,0 +1,138 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  test_session.cc
+ *
+ *    Description:  Write a session of a few trials with SessionWriter, read
+ *    it back with SessionReader: frames, metadata, events, trial index and
+ *    seek. Also a file cut short (no index) must still be readable.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <unistd.h>
+
+#include "src/Session.hpp"
+#include "tests/check.hpp"
+
+using namespace std;
+
+const size_t w_ = 37, h_ = 11;                  /* Stride not a multiple of 8. */
+const uint64_t ms_ = 1000000;
+
+uint8_t pixel( uint64_t frame, size_t i )
+{
+    return (uint8_t)(frame * 7 + i);
+}
+
+/* Frame k is taken at k * 5 ms; trial t has frames [10 t, 10 t + 8). */
+void write_session( SessionWriter& s, size_t trials )
+{
+    vector<uint8_t> buf( w_ * h_ );
+    uint64_t k = 0;
+    for (size_t t = 0; t < trials; t++)
+    {
+        for (int i = 0; i < 10; i++, k++)
+        {
+            if( i == 0 )
+                s.begin_trial( t + 1, k * 5 * ms_ );
+            if( i == 8 )
+                s.end_trial( k * 5 * ms_ );
+            if( i == 3 )
+            {
+                ostringstream line;
+                line << "arduino " << t + 1;
+                s.add_text( line.str( ), k * 5 * ms_ );
+            }
+            for (size_t j = 0; j < buf.size( ); j++)
+                buf[j] = pixel( k, j );
+            SessionFrame info = { 1000 + k, k * 1000, k * 5 * ms_, (float)k, 0 };
+            s.append( info, &buf[0] );
+        }
+    }
+}
+
+bool frames_ok( const SessionReader& r )
+{
+    for (uint64_t k = 0; k < r.frames( ); k++)
+    {
+        const uint8_t* f = r.frame( k );
+        for (size_t j = 0; j < w_ * h_; j++)
+            if( f[j] != pixel( k, j ) )
+                return false;
+        if( r.info( k )->frame_id != 1000 + k || r.info( k )->blink != (float)k )
+            return false;
+    }
+    return true;
+}
+
+int main( int argc, char** argv )
+{
+    char name[] = "/tmp/test_session_XXXXXX";
+    close( mkstemp( name ) );
+
+    {
+        SessionWriter s( name, w_, h_, 7 );
+        check( s.is_open( ), "session file created" );
+        write_session( s, 5 );
+        check( s.close( ), "session file closed" );
+    }
+
+    {
+        SessionReader r( name );
+        check( r.is_open( ) && r.indexed( ), "session file mapped, index found" );
+        check( r.width( ) == w_ && r.height( ) == h_ && r.frames( ) == 50, "50 frames" );
+        check( frames_ok( r ), "every frame and its metadata is where the index says" );
+
+        bool trials = r.trials( ).size( ) == 5;
+        for (size_t t = 0; trials && t < 5; t++)
+        {
+            const SessionTrial& tr = r.trials( )[t];
+            trials = tr.trial == (int)t + 1 && tr.first_frame == 10 * t && tr.end_frame == 10 * t + 8;
+        }
+        check( trials, "trial index" );
+        check( r.info( 13 )->trial == 2 && r.info( 18 )->trial == SESSION_NO_TRIAL
+                , "frames know their trial" );
+
+        // Trial 3 begins at frame 20 (100 ms); 22 ms later is frame 25.
+        check( r.seek( 3, 22 * ms_ ) == 25 && r.seek( 3, 0 ) == 20, "seek by time in trial" );
+        check( r.seek( 3, 500 * ms_ ) == -1 && r.seek( 9, 0 ) == -1, "seek past trial or to no trial" );
+
+        size_t texts = 0;
+        for( auto& ev : r.events( ) )
+            if( ev.info.kind == SESSION_EVENT_TEXT && ev.text.find( "arduino" ) == 0 )
+                texts += ev.info.frame % 10 == 3;
+        check( texts == 5, "arduino lines with their frame" );
+    }
+
+    // cam_server killed: no index, last chunk cut in the middle of a frame.
+    {
+        SessionWriter s( name, w_, h_, 7 );
+        write_session( s, 3 );
+        check( s.close( ), "session file rewritten" );
+    }
+    {
+        SessionReader full( name );
+        const uint8_t* base = full.frame( 0 ) - sizeof( SessionFrame ) - sizeof( SessionChunk )
+            - sizeof( SessionFileHeader );
+        off_t cut = (full.frame( 26 ) - base) + 100;
+        check( truncate( name, cut ) == 0, "file cut short" );
+    }
+    {
+        SessionReader r( name );
+        check( r.is_open( ) && ! r.indexed( ) && r.frames( ) == 26 && frames_ok( r )
+                , "cut file: 26 whole frames found by walking chunks" );
+        check( r.trials( ).size( ) >= 2 && r.trials( )[1].first_frame == 10
+                && r.trials( )[1].end_frame == 18, "cut file: trials rebuilt from events" );
+    }
+
+    unlink( name );
+    return failed_;
+}
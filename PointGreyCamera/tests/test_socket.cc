@@ -5,7 +5,9 @@
  *
  *    Description:  Test a socket. 
  *
- *    Here I create a socket and write images to it. When no one is reading,
+ *    Here I create a socket and write data to it; a client thread connects,
+ *    reads what was written and hangs up, which ends the test. It gives up
+ *    after a few seconds instead of waiting for a client forever.
  *
  *        Version:  1.0
  *        Created:  12/03/2016 04:17:27 AM
@@ -28,10 +30,14 @@
 #include <sys/un.h>
 #include <cstdlib>
 #include <csignal>
+#include <thread>
+#include <poll.h>
 
 using namespace std;
 
 #define SOCK_PATH "/tmp/echo_socket"
+#define WRITES    100
+#define TIMEOUT_MS 5000
 
 void sig_handler( int s )
 {
@@ -40,15 +46,43 @@ void sig_handler( int s )
     exit( 1 );
 }
 
-void write_data( int socket )
+bool write_data( int socket )
 {
     char buf[50] = "Heellow duniya waalo";
-    cout << "Writing some data" << endl;
     if( -1 == write( socket, (void *) buf,  10 ) )
     {
         cout <<"[ERROR] Failed to write to socket" << endl;
         cout << "\t Error was " << strerror( errno ) << endl;
+        return false;
     }
+    return true;
+}
+
+/* Reads WRITES writes of 10 bytes into got, then hangs up. */
+void client( string& got )
+{
+    int c = socket( AF_UNIX, SOCK_STREAM, 0 );
+    struct sockaddr_un remote;
+    remote.sun_family = AF_UNIX;
+    strcpy( remote.sun_path, SOCK_PATH );
+    if( connect( c, (struct sockaddr *)&remote, sizeof( remote ) ) == -1 )
+    {
+        perror( "connect" );
+        close( c );
+        return;
+    }
+    char buf[100];
+    while( got.size( ) < WRITES * 10 )
+    {
+        struct pollfd p = { c, POLLIN, 0 };
+        if( poll( &p, 1, TIMEOUT_MS ) <= 0 )
+            break;
+        ssize_t n = read( c, buf, sizeof( buf ) );
+        if( n <= 0 )
+            break;
+        got.append( buf, n );
+    }
+    close( c );
 }
 
 int main(void)
@@ -77,39 +111,37 @@ int main(void)
         exit(1);
     }
 
-    for(;;) {
-        int done;
-        cout << "Waiting for a connection..." << endl;
-        socklen_t t = sizeof(remote);
-        if ((s2 = accept(s, (struct sockaddr *)&remote, &t)) == -1) {
-            perror("accept");
-            exit(1);
-        }
-
-        cout << "Connected." << endl;
+    string got;
+    thread reader( client, std::ref( got ) );
 
-        done = 0;
-        do {
-            write_data( s2 );
-
-        #if 0
-            n = recv(s2, str, 100, 0);
-            if (n <= 0) {
-                if (n < 0) perror("recv");
-                done = 1;
-            }
-
-            if (!done) 
-                if (send(s2, str, n, 0) < 0) {
-                    perror("send");
-                    done = 1;
-                }
-            cout << "Recieved : " << str << endl;
-#endif 
-        } while (!done);
-
-        shutdown(s2, 0);
+    cout << "Waiting for a connection..." << endl;
+    struct pollfd p = { s, POLLIN, 0 };
+    if( poll( &p, 1, TIMEOUT_MS ) <= 0 )
+    {
+        cout << "[ERROR] No client in " << TIMEOUT_MS << " ms" << endl;
+        reader.join( );
+        remove( SOCK_PATH );
+        return 1;
     }
+    socklen_t t = sizeof(remote);
+    if ((s2 = accept(s, (struct sockaddr *)&remote, &t)) == -1) {
+        perror("accept");
+        exit(1);
+    }
+    cout << "Connected." << endl;
+
+    bool written = true;
+    for (int i = 0; i < WRITES && written; i++)
+        written = write_data( s2 );
+    shutdown( s2, SHUT_WR );
+    reader.join( );
+    close( s2 );
+    close( s );
+    remove( SOCK_PATH );
 
-    return 0;
+    bool same = got.size( ) == WRITES * 10;
+    for (size_t i = 0; same && i < got.size( ); i += 10)
+        same = got.compare( i, 10, "Heellow du" ) == 0;
+    cout << (same ? "[PASS] " : "[FAIL] ") << "client read " << got.size( ) << " bytes" << endl;
+    return written && same ? 0 : 1;
 }
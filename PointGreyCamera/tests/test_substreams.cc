@@ -0,0 +1,207 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  test_substreams.cc
+ *
+ *    Description:  Preview and crop of SubStreams: SIMD binning gives the
+ *    same pixels as the plain loop on any width, the crop is the frame's
+ *    pixels with its origin in the header, and the preview keeps its rate.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <iostream>
+#include <vector>
+#include <random>
+#include <cstring>
+
+#include "config.h"
+#include "src/FrameSource.hpp"
+#include "src/FrameHeader.hpp"
+#include "src/SubStreams.hpp"
+#include "src/ShmTransport.hpp"
+#include "tests/check.hpp"
+
+using namespace std;
+
+/* Rounded mean of each bin x bin block: what bin_frame must give. */
+vector<uint8_t> reference( const vector<uint8_t>& img, size_t w, size_t h, unsigned bin )
+{
+    size_t ow = w / bin, oh = h / bin;
+    vector<uint8_t> out( ow * oh );
+    for (size_t y = 0; y < oh; y++)
+        for (size_t x = 0; x < ow; x++)
+        {
+            unsigned sum = 0;
+            for (size_t dy = 0; dy < bin; dy++)
+                for (size_t dx = 0; dx < bin; dx++)
+                    sum += img[(y * bin + dy) * w + x * bin + dx];
+            out[y * ow + x] = (sum + bin * bin / 2) / (bin * bin);
+        }
+    return out;
+}
+
+int main( int argc, char** argv )
+{
+    mt19937 rng( 2026 );
+
+    // Widths around the vector widths, odd ones too; last column and row
+    // which do not fill a bin are left out.
+    for( unsigned bin : { 2u, 4u } )
+    {
+        bool same = true;
+        for( size_t w : { (size_t)4, (size_t)7, (size_t)33, (size_t)64, (size_t)65, (size_t)130
+                , (size_t)131, (size_t)257, (size_t)FRAME_WIDTH } )
+        {
+            size_t h = 4 * bin + 1;
+            vector<uint8_t> img( w * h );
+            for( auto& v : img )
+                v = rng( ) & 0xFF;
+            vector<uint8_t> ref = reference( img, w, h, bin );
+            vector<uint8_t> out( ref.size( ) + 1, 0xAB );
+            bin_frame( &img[0], w, h, bin, &out[0] );
+            same = same && equal( ref.begin( ), ref.end( ), out.begin( ) ) && out.back( ) == 0xAB;
+        }
+        check( same, to_string( bin ) + "x" + to_string( bin ) + " binning as plain loop, any width" );
+    }
+
+    {
+        vector<uint8_t> white( 64 * 4, 255 ), out( 16 );
+        bin_frame( &white[0], 64, 4, 4, &out[0] );
+        check( out[0] == 255 && out[15] == 255, "binning white stays white" );
+    }
+
+    vector<uint8_t> img( FRAME_WIDTH * FRAME_HEIGHT );
+    for (size_t i = 0; i < img.size( ); i++)
+        img[i] = (i * 7 + i / FRAME_WIDTH) & 0xFF;
+    Frame f;
+    f.data = &img[0];
+    f.width = FRAME_WIDTH;
+    f.height = FRAME_HEIGHT;
+    f.size = img.size( );
+    f.frame_id = 10;
+
+    // Crop: pixels, origin and stream; frame's metadata kept.
+    {
+        SubStreams sub( FRAME_WIDTH, FRAME_HEIGHT, 0, 0, 100, 50, 301, 90 );
+        check( ! sub.has_preview( ) && sub.has_crop( ), "crop only" );
+        Frame c;
+        vector<uint8_t> got;
+        sub.set_crop_sink( [&]( const Frame& d ) {
+                c = d;
+                got.assign( d.data, d.data + d.size );
+                return true;
+                } );
+        sub.process( f );
+        bool same = got.size( ) == 201 * 40;
+        for (size_t y = 0; same && y < 40; y++)
+            same = memcmp( &got[y * 201], &img[(50 + y) * FRAME_WIDTH + 100], 201 ) == 0;
+        check( same && c.width == 201 && c.height == 40, "crop has the frame's pixels" );
+        check( c.x0 == 100 && c.y0 == 50 && c.bin == 1 && c.stream == FRAME_STREAM_CROP
+                && c.frame_id == 10, "crop origin and stream" );
+
+        FrameHeader h = make_frame_header( c );
+        check( h.header_size == 136 && h.version == 6 && h.x0 == 100 && h.y0 == 50
+                && h.bin == 1 && h.stream == FRAME_STREAM_CROP, "crop origin in header" );
+
+        // Shared memory readers get the same: the crop may follow the eye.
+        c.motion[0] = 2.5f;
+        c.eye[0] = 110, c.eye[1] = 60, c.eye[2] = 150, c.eye[3] = 80;
+        c.tag.trial = 7;
+        memcpy( c.tag.state, "PUFF", 4 );
+        ShmWriter writer( "/test_substreams_crop", 2, FRAME_WIDTH, FRAME_HEIGHT );
+        ShmReader reader( "/test_substreams_crop" );
+        writer.publish( c );
+        bool inSlot = false;
+        bool read = reader.wait( 100 ) && reader.read( [&]( const ShmSlotHeader& slot
+                    , const unsigned char* px ) {
+                inSlot = memcmp( px, &got[0], got.size( ) ) == 0 && slot.version == 2
+                    && slot.header_size == 128 && slot.x0 == 100 && slot.y0 == 50
+                    && slot.bin == 1 && slot.stream == FRAME_STREAM_CROP
+                    && slot.motion[0] == 2.5f && slot.motion[1] == -1 && slot.eye[2] == 150
+                    && slot.trial == 7 && memcmp( slot.state, "PUFF", 4 ) == 0;
+                } );
+        check( read && inSlot, "crop origin, tag, motion and eye in shared memory slot" );
+
+        sub.set_crop( 0, 0, 8, 2 );
+        sub.process( f );
+        check( sub.crop( ) == "0,0,8,2" && c.width == 8 && c.height == 2 && c.x0 == 0
+                && memcmp( &got[8], &img[FRAME_WIDTH], 8 ) == 0, "crop moved" );
+        check( sub.crops( ) == 2, "crops counted" );
+
+        int refused = 0;
+        const size_t bad[][4] = { { 10, 10, 10, 20 }, { 10, 20, 30, 5 }
+            , { 0, 0, FRAME_WIDTH + 1, 10 }, { 0, 0, 10, FRAME_HEIGHT + 1 } };
+        for( auto& b : bad )
+        {
+            try
+            {
+                sub.set_crop( b[0], b[1], b[2], b[3] );
+            }
+            catch( invalid_argument& )
+            {
+                refused += 1;
+            }
+        }
+        check( refused == 4 && sub.crop( ) == "0,0,8,2", "crop outside frame refused" );
+
+        Frame wide = f;
+        wide.pixel_format = PIXEL_FORMAT_MONO16;
+        sub.process( wide );
+        check( sub.crops( ) == 2, "only Mono8 frames" );
+    }
+
+    // Preview at 20 fps of a 100 fps camera: every 5th frame.
+    {
+        SubStreams sub( FRAME_WIDTH, FRAME_HEIGHT, 2, 20, 0, 0, 0, 0 );
+        check( sub.has_preview( ) && ! sub.has_crop( ), "preview only" );
+        check( sub.preview_width( ) == FRAME_WIDTH / 2 && sub.preview_height( ) == FRAME_HEIGHT / 2
+                , "preview size" );
+        Frame p;
+        bool same = true;
+        sub.set_preview_sink( [&]( const Frame& d ) {
+                p = d;
+                vector<uint8_t> ref = reference( img, FRAME_WIDTH, FRAME_HEIGHT, 2 );
+                same = same && d.size == ref.size( ) && memcmp( d.data, &ref[0], d.size ) == 0;
+                return true;
+                } );
+        for (size_t i = 0; i < 100; i++)
+        {
+            f.frame_id = i;
+            f.host_ns = 1000000000ull + i * 10000000ull;
+            sub.process( f );
+        }
+        check( sub.previews( ) == 20, "preview keeps 20 fps" );
+        check( same && p.bin == 2 && p.stream == FRAME_STREAM_PREVIEW && p.frame_id == 95
+                , "preview binned, stream and frame id" );
+
+        // After a pause it starts over rather than catching up.
+        f.host_ns += 5000000000ull;
+        sub.process( f );
+        f.host_ns += 10000000ull;
+        sub.process( f );
+        check( sub.previews( ) == 21, "no burst after a gap" );
+    }
+
+    bool threw = false;
+    try
+    {
+        SubStreams sub( FRAME_WIDTH, FRAME_HEIGHT, 3, 20, 0, 0, 0, 0 );
+    }
+    catch( invalid_argument& )
+    {
+        threw = true;
+    }
+    check( threw, "bin 3 refused" );
+
+    Frame plain;
+    FrameHeader h = make_frame_header( plain );
+    check( h.x0 == 0 && h.y0 == 0 && h.bin == 1 && h.stream == FRAME_STREAM_CAMERA
+            , "camera frames: whole frame, not binned" );
+
+    return failed_;
+}
@@ -0,0 +1,216 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  test_sync.cc
+ *
+ *    Description:  ClockSync against a simulated rig: an Arduino whose
+ *    clock runs 400 ppm fast and whose micros( ) wraps during the run,
+ *    serial lines which take random time to be noticed and to arrive, and a
+ *    camera with its own drifting clock. Frames must be placed on the
+ *    Arduino clock within a millisecond and carry the trial state and
+ *    camera pin of when they were exposed.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <iostream>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cstdio>
+
+#include "src/ClockSync.hpp"
+#include "tests/check.hpp"
+
+using namespace std;
+
+#define BAUD            38400
+#define MS              1000000ll           /* ns */
+
+const int64_t h0_ = 1000000 * MS;           /* Host ns when simulation starts. */
+const int64_t m0_ = (1ll << 32) - 20000000; /* Arduino micros( ) then; wraps after 20 s. */
+const int64_t trial_ms_ = 5000;             /* Host ms trial 1 starts at. */
+
+/* Unwrapped micros( ) at host time h. */
+int64_t micros_at( int64_t h )
+{
+    return m0_ + (int64_t)((h - h0_) * (1 + 400e-6) / 1000);
+}
+
+/* Trial 1: PRE_ 8 s, CS+ 50 ms, TRAC 250 ms, PUFF 50 ms, POST; camera pin
+ * high from 7.5 s to 500 ms into POST. */
+string state_at( int64_t h, bool& camera )
+{
+    int64_t t = (h - h0_) / MS - trial_ms_;
+    camera = t >= 7500 && t < 8850;
+    if( t < 0 )
+        return "INVA";
+    if( t < 8000 )
+        return "PRE_";
+    if( t < 8050 )
+        return "CS+";
+    if( t < 8300 )
+        return "TRAC";
+    if( t < 8350 )
+        return "PUFF";
+    return "POST";
+}
+
+struct Event
+{
+    int64_t at;                             /* Host ns. */
+    int kind;                               /* 0 line, 1 ping sent, 2 frame */
+    string line;
+    int64_t exposed;                        /* Frame: host ns of exposure. */
+};
+
+int main( int argc, char** argv )
+{
+    ClockFit fit( 1000, 10 );
+    for (int64_t x = 0; x < 20000; x += 100)
+        fit.add( x, 7 + x + x / 1000, (x % 1000) == 0 ? 0 : 5 );
+    fit.add( 5000, 0, 0 );
+    check( fit.size( ) == 10, "fit keeps one point per block, last nblocks" );
+    check( fit.residual( ) <= 1 && fabs( fit.drift_ppm( ) - 1000 ) < 1e-3
+            , "fit finds offset and drift from best points" );
+    check( fit.unmap( fit.map( 123456 ) ) == 123456, "unmap inverts map" );
+
+    /*-----------------------------------------------------------------------------
+     *  Simulated session of 30 s.
+     *-----------------------------------------------------------------------------*/
+    mt19937 rng( 7 );
+    uniform_int_distribution<int64_t> notice( 0, 8 * MS );      /* Arduino busy flushing */
+    uniform_int_distribution<int64_t> usb( MS / 5, 3 * MS / 2 );
+    uniform_int_distribution<int64_t> transfer( 0, MS / 4 );
+    auto wire = []( size_t bytes ) { return (int64_t)bytes * 10 * 1000000000ll / BAUD; };
+
+    vector<Event> events;
+    int64_t end = h0_ + 30000 * MS;
+    for (int64_t h = h0_; h < end; h += 100 * MS)
+    {
+        events.push_back( Event{ h, 1, "", 0 } );
+        int64_t stamped = h + notice( rng );
+        char line[64];
+        snprintf( line, sizeof( line ), ">>PING %lu"
+                , (unsigned long)(micros_at( stamped ) & 0xffffffff) );
+        events.push_back( Event{ stamped + wire( strlen( line ) + 2 ) + usb( rng ), 0, line, 0 } );
+    }
+
+    int64_t trialStartUs = micros_at( h0_ + trial_ms_ * MS );
+    int64_t hStart = h0_ + trial_ms_ * MS;
+    for (int64_t h = h0_; h < end; h += 10 * MS)
+    {
+        bool camera;
+        string state = state_at( h, camera );
+        int64_t ms = micros_at( h ) / 1000 - (h >= hStart ? trialStartUs / 1000 : 0);
+        char line[96];
+        snprintf( line, sizeof( line ), "%ld,%d,%d,0,%d,  0,  0,%d,%d,%s", (long)ms
+                , h >= hStart ? 1 : 0, state == "PUFF", state == "CS+", camera, 1, state.c_str( ) );
+        events.push_back( Event{ h + wire( strlen( line ) + 2 ) + usb( rng ), 0, line, 0 } );
+        if( h <= hStart && h + 10 * MS > hStart )
+        {
+            snprintf( line, sizeof( line ), ">>TRIAL 1 %ld", (long)(trialStartUs / 1000) );
+            events.push_back( Event{ hStart + usb( rng ), 0, line, 0 } );
+        }
+    }
+    // TTL edges, reported the moment the pin is driven.
+    for( int64_t t : { 7500ll, 8850ll } )
+    {
+        int64_t h = h0_ + (trial_ms_ + t) * MS;
+        char line[64];
+        snprintf( line, sizeof( line ), ">>TTL %d %lu", t == 7500
+                , (unsigned long)(micros_at( h ) & 0xffffffff) );
+        events.push_back( Event{ h + wire( strlen( line ) + 2 ) + usb( rng ), 0, line, 0 } );
+    }
+    for (int64_t h = h0_ + 1; h < end; h += 5 * MS)
+        events.push_back( Event{ h + MS / 10 + transfer( rng ), 2, "", h } );
+    stable_sort( events.begin( ), events.end( )
+            , []( const Event& a, const Event& b ) { return a.at < b.at; } );
+
+    ClockSync sync( 2000, 60, BAUD );
+    // The handler may call back into sync: the lock is not held by then.
+    size_t edges = 0;
+    sync.on_ttl( [&]( bool, uint64_t, int ) {
+            edges += ! sync.status( ).empty( );
+            } );
+    int64_t worst = 0;
+    size_t frames = 0, tagged = 0, final = 0, wrongState = 0, wrongCamera = 0, wrongTrial = 0;
+    bool syncedEarly = false;
+    for( auto& e : events )
+    {
+        if( e.kind == 0 )
+            sync.arduino_line( e.at, e.line );
+        else if( e.kind == 1 )
+            sync.ping_sent( e.at );
+        else
+        {
+            Frame f;
+            f.host_ns = e.at;
+            f.timestamp = 5000 * MS + (int64_t)((e.exposed - h0_) * (1 - 30e-6));
+            sync.tag( f );
+            frames += 1;
+            // Fit has a couple of blocks after 3 s.
+            if( e.exposed < h0_ + 3000 * MS )
+            {
+                syncedEarly = syncedEarly || (f.tag.flags & SYNC_SYNCED);
+                continue;
+            }
+            if( ! (f.tag.flags & SYNC_SYNCED) )
+                continue;
+            tagged += 1;
+            worst = max( worst, (int64_t)llabs( f.tag.arduino_us - micros_at( e.exposed ) ) );
+
+            // Away from transitions (samples are 10 ms apart).
+            bool camera;
+            string state = state_at( e.exposed, camera );
+            bool c0, c1;
+            bool steady = state_at( e.exposed - 15 * MS, c0 ) == state
+                && state_at( e.exposed + 15 * MS, c1 ) == state;
+            // Lines come later than frames: the last sample can be 30 ms old.
+            steady = steady && state_at( e.exposed - 30 * MS, c0 ) == state;
+            final += (f.tag.flags & SYNC_FINAL) != 0;
+            if( steady )
+            {
+                wrongState += string( f.tag.state, strnlen( f.tag.state, 4 ) ) != state;
+                wrongTrial += f.tag.trial != (e.exposed >= hStart ? 1 : 0);
+            }
+            bool camSteady = c0 == camera && c1 == camera;
+            if( camSteady && f.tag.sample_ms > 0 )
+                wrongCamera += ((f.tag.pins & SYNC_PIN_CAMERA) != 0) != camera;
+        }
+    }
+    cout << "[INFO] " << sync.status( ) << endl;
+    cout << "[INFO] frames=" << frames << " tagged=" << tagged << " final=" << final
+        << " worst=" << worst << " us" << endl;
+
+    check( syncedEarly, "frames are synced after the first ping" );
+    check( tagged > frames * 8 / 10, "frames after 3 s are synced" );
+    check( worst < 1000, "frame time on arduino clock within 1 ms across micros( ) wrap" );
+    check( final == 0, "live tags are not final; lines come after frames" );
+    check( wrongState == 0, "trial state of frames away from transitions" );
+    check( wrongTrial == 0, "trial of frames" );
+    check( wrongCamera == 0, "camera pin of frames from TTL edges" );
+    check( sync.ttl_lag( ).snapshot( ).count( ) == 2
+            && sync.ttl_lag( ).snapshot( ).max( ) < 3 * MS, "TTL reports agree with the fit" );
+    check( sync.rtt( ).snapshot( ).count( ) == 300, "every ping answered" );
+    check( edges == 2, "TTL handler called without the lock" );
+
+    // A frame held up 40 ms (e.g. in the ring) is tagged by when it was
+    // exposed, and the samples after it are in by then.
+    Frame late;
+    int64_t exposed = end - 20 * MS;
+    late.timestamp = 5000 * MS + (int64_t)((exposed - h0_) * (1 - 30e-6));
+    late.host_ns = exposed + 40 * MS;
+    sync.arduino_line( end + 30 * MS, "25000,1,0,0,0,  0,  0,0,1,POST" );
+    sync.tag( late );
+    check( (late.tag.flags & SYNC_FINAL) && llabs( late.tag.arduino_us - micros_at( exposed ) ) < 1000
+            , "late frame: by camera time, final" );
+
+    sync.arduino_line( end, ">>> Waiting for 's' to be pressed" );
+    check( ! sync.synced( ), "arduino reboot drops its fit" );
+    return failed_;
+}
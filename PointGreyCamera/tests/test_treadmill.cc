@@ -0,0 +1,165 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  test_treadmill.cc
+ *
+ *    Description:  Treadmill.hpp: input events to reports (SYN_DROPPED
+ *    discards a partial report), the running window estimate against one
+ *    computed from scratch, and readers of the shared memory slot never
+ *    seeing a half written sample while the writer publishes flat out.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <iostream>
+#include <vector>
+#include <random>
+#include <thread>
+#include <cmath>
+
+#include "src/Treadmill.hpp"
+#include "tests/check.hpp"
+
+using namespace std;
+
+struct input_event event( uint64_t t_us, int type, int code, int value )
+{
+    struct input_event ev;
+    ev.time.tv_sec = t_us / 1000000;
+    ev.time.tv_usec = t_us % 1000000;
+    ev.type = type;
+    ev.code = code;
+    ev.value = value;
+    return ev;
+}
+
+int main( int argc, char** argv )
+{
+    /*-----------------------------------------------------------------------------
+     *  Events to reports.
+     *-----------------------------------------------------------------------------*/
+    vector<struct input_event> evs = {
+        event( 1000, EV_REL, REL_X, 3 ), event( 1000, EV_REL, REL_Y, 2 )
+            , event( 1000, EV_SYN, SYN_REPORT, 0 )
+        , event( 2000, EV_REL, REL_X, 5 ), event( 2000, EV_SYN, SYN_DROPPED, 0 )
+            , event( 2000, EV_REL, REL_Y, 7 ), event( 2000, EV_SYN, SYN_REPORT, 0 )
+        , event( 3000, EV_MSC, MSC_SCAN, 1 ), event( 3000, EV_SYN, SYN_REPORT, 0 )
+        , event( 4500, EV_REL, REL_X, -1 ), event( 4500, EV_REL, REL_WHEEL, 1 )
+            , event( 4500, EV_SYN, SYN_REPORT, 0 )
+    };
+    MouseReports parser;
+    vector<vector<int64_t> > got;
+    for( auto& ev : evs )
+    {
+        int dx, dy;
+        uint64_t t;
+        if( parser.feed( ev, dx, dy, t ) )
+            got.push_back( { (int64_t)t, dx, dy } );
+    }
+    vector<vector<int64_t> > want = { { 1000000, 3, -2 }, { 4500000, -1, 0 } };
+    check( got == want, "reports: y up is +, dropped and empty reports skipped" );
+    check( parser.dropped( ) == 1, "SYN_DROPPED counted" );
+
+    /*-----------------------------------------------------------------------------
+     *  Window estimate against brute force over the same window.
+     *-----------------------------------------------------------------------------*/
+    const uint64_t window = 50000000;
+    MotionEstimator motion( window );
+    mt19937 rng( 5 );
+    uniform_int_distribution<int> step( -20, 20 );
+    uniform_int_distribution<uint64_t> gap( 100000, 12000000 );
+    vector<vector<int64_t> > all;
+    uint64_t t = 1000000000;
+    double worstSpeed = 0, worstDir = 0;
+    for (int i = 0; i < 20000; i++)
+    {
+        t += gap( rng ) * (i % 500 == 0 ? 20 : 1);          /* Stops now and then */
+        int dx = step( rng ) + 10, dy = step( rng );
+        motion.add( t, dx, dy );
+        all.push_back( { (int64_t)t, dx, dy } );
+
+        double path = 0;
+        int64_t sx = 0, sy = 0;
+        for (size_t k = all.size( ); k-- > 0 && (uint64_t)all[k][0] + window > t; )
+        {
+            path += sqrt( (double)all[k][1] * all[k][1] + (double)all[k][2] * all[k][2] );
+            sx += all[k][1];
+            sy += all[k][2];
+        }
+        worstSpeed = max( worstSpeed, fabs( motion.speed( ) - path * 1e9 / window ) );
+        if( sx || sy )
+            worstDir = max( worstDir, fabs( motion.direction( ) - atan2( (double)sy, (double)sx ) ) );
+    }
+    cout << "[INFO] worst speed error " << worstSpeed << " counts/s, direction "
+        << worstDir << " rad" << endl;
+    check( worstSpeed < 1e-6 && worstDir < 1e-9, "running window equals window from scratch" );
+    motion.expire( t + window - 1 );
+    check( ! motion.idle( ) && motion.speed( ) > 0, "last report still in window" );
+    check( motion.expire( t + window ) && motion.idle( ) && motion.speed( ) == 0
+            && motion.direction( ) == 0, "speed is 0 once window has passed" );
+
+    /*-----------------------------------------------------------------------------
+     *  Seqlock slot. Every sample the writer publishes has x = 3 * n,
+     *  y = -n, reports = n; a torn read breaks that.
+     *-----------------------------------------------------------------------------*/
+    string name = "/test_treadmill_" + to_string( getpid( ) );
+    uint64_t torn = 0, reads = 0, retries = 0;
+    bool monotonic = true, alive = false, gone = true;
+    {
+        TreadmillWriter writer( name, 50 );
+        TreadmillReader reader( name );
+        TreadmillSample s;
+        check( ! reader.read( s ), "nothing to read before first publish" );
+        const uint64_t N = 2000000;
+        std::atomic<bool> done( false );
+        thread w( [&]( ) {
+                TreadmillSample x;
+                memset( &x, 0, sizeof( x ) );
+                for (uint64_t n = 1; n <= N; n++)
+                {
+                    x.reports = n;
+                    x.x = 3 * n;
+                    x.y = - (int64_t)n;
+                    x.host_ns = n * 1000;
+                    x.speed = n;
+                    writer.publish( x );
+                }
+                done = true;
+                } );
+        uint64_t last = 0;
+        while( ! done )
+        {
+            if( ! reader.read( s ) )
+                continue;
+            reads += 1;
+            uint64_t n = s.reports;
+            if( s.x != (int64_t)(3 * n) || s.y != - (int64_t)n || s.host_ns != n * 1000 )
+                torn += 1;
+            monotonic = monotonic && n >= last;
+            last = n;
+        }
+        w.join( );
+        retries = reader.retries( );
+        alive = reader.writer_alive( );
+        reader.read( s );
+        check( s.reports == N, "reader gets the last sample" );
+    }
+    cout << "[INFO] " << reads << " reads, " << retries << " retried" << endl;
+    check( reads > 0 && torn == 0, "no torn sample" );
+    check( monotonic, "samples never go back" );
+    check( alive, "writer alive while publishing" );
+    try
+    {
+        TreadmillReader reader( name );
+        gone = false;
+    }
+    catch( runtime_error& e )
+    {
+    }
+    check( gone, "slot removed with writer" );
+    return failed_;
+}
@@ -0,0 +1,193 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  test_unpack.cc
+ *
+ *    Description:  Mono12p, Mono12Packed and Mono16 to Mono8: SIMD unpacking
+ *    and windowing give the same pixels as the plain loops, on any length
+ *    and with the frame split across threads.
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+
+#include <iostream>
+#include <vector>
+#include <random>
+#include <cstring>
+
+#include "config.h"
+#include "src/FrameSource.hpp"
+#include "src/SyntheticSource.hpp"
+#include "src/PixelUnpack.hpp"
+#include "tests/check.hpp"
+
+using namespace std;
+
+const uint32_t packed_[2] = { PIXEL_FORMAT_MONO12P, PIXEL_FORMAT_MONO12PACKED };
+
+/* What PixelConverter must give for a frame: plain loops. */
+vector<uint8_t> reference( const Frame& f, const PixelMap& map, vector<uint16_t>& wide )
+{
+    size_t n = f.width * f.height;
+    wide.resize( n );
+    if( f.pixel_format == PIXEL_FORMAT_MONO16 )
+        for (size_t i = 0; i < n; i++)
+            wide[i] = ((const uint16_t*)f.data)[i];
+    else
+        unpack_mono12_scalar( f.data, n, &wide[0], f.pixel_format );
+    vector<uint8_t> out( n );
+    for (size_t i = 0; i < n; i++)
+        out[i] = map.lut[wide[i] >> map.shift];
+    return out;
+}
+
+int main( int argc, char** argv )
+{
+    mt19937 rng( 2026 );
+
+    // Two pixels 0x123, 0x456 as each camera packs them.
+    {
+        const uint8_t usb3[3] = { 0x23, 0x61, 0x45 }, gige[3] = { 0x12, 0x63, 0x45 };
+        uint16_t a[2], b[2];
+        unpack_mono12( usb3, 2, a, PIXEL_FORMAT_MONO12P );
+        unpack_mono12( gige, 2, b, PIXEL_FORMAT_MONO12PACKED );
+        check( a[0] == 0x123 && a[1] == 0x456, "Mono12p bit layout" );
+        check( b[0] == 0x123 && b[1] == 0x456, "Mono12Packed bit layout" );
+    }
+
+    // Every length around the vector widths, and a frame.
+    const size_t lengths[] = { 2, 8, 10, 16, 18, 20, 22, 32, 34, 38, 62, 64, 66, 1002
+        , FRAME_WIDTH * FRAME_HEIGHT };
+    for( uint32_t format : packed_ )
+    {
+        bool same = true;
+        for( size_t n : lengths )
+        {
+            vector<uint16_t> in( n ), out( n + 1, 0xBEEF ), ref( n );
+            for( auto& v : in )
+                v = rng( ) & 0xFFF;
+            vector<uint8_t> packed( pixel_format_bytes( format, n ) );
+            pack_mono12( &in[0], n, &packed[0], format );
+            unpack_mono12( &packed[0], n, &out[0], format );
+            unpack_mono12_scalar( &packed[0], n, &ref[0], format );
+            same = same && equal( in.begin( ), in.end( ), out.begin( ) )
+                && equal( in.begin( ), in.end( ), ref.begin( ) ) && out[n] == 0xBEEF;
+        }
+        check( same, string( pixel_format_name( format ) ) + " unpacks what was packed, any length" );
+    }
+
+    {
+        size_t n = 1003;
+        vector<uint16_t> in( n ), out( n );
+        for( auto& v : in )
+            v = rng( ) & 0xFFFF;
+        unpack_mono16( &in[0], n, &out[0] );
+        bool same = true;
+        for (size_t i = 0; i < n; i++)
+            same = same && out[i] == in[i] >> 4;
+        check( same, "mono16 to 12 bit" );
+    }
+
+    // SIMD window against its table, over every 12 bit value.
+    {
+        vector<uint16_t> all( 4096 + 5 );
+        for (size_t i = 0; i < all.size( ); i++)
+            all[i] = i & 0xFFF;
+        bool same = true, ends = true;
+        for( auto w : { make_pair( 0u, 4095u ), make_pair( 100u, 900u )
+                , make_pair( 1000u, 1256u ), make_pair( 3000u, 4095u ) } )
+        {
+            PixelMap map( 0, w.first, w.second, 1.0 );
+            check( map.linear, "window " + to_string( w.first ) + "-" + to_string( w.second ) + " is linear" );
+            vector<uint8_t> out( all.size( ) );
+            map_window( &all[0], all.size( ), map.lo, map.mul, &out[0] );
+            for (size_t i = 0; i < all.size( ); i++)
+                same = same && out[i] == map.lut[all[i]];
+            ends = ends && map.lut[w.first] == 0 && map.lut[w.second] == 255
+                && (w.first == 0 || map.lut[w.first - 1] == 0)
+                && (w.second == 4095 || map.lut[w.second + 1] == 255);
+        }
+        check( same, "map_window matches table" );
+        check( ends, "window ends map to 0 and 255" );
+
+        PixelMap gamma( 0, 0, 1000, 2.0 );
+        PixelMap narrow( 0, 10, 100, 1.0 );
+        bool rising = true;
+        for (size_t i = 1; i < 4096; i++)
+            rising = rising && gamma.lut[i] >= gamma.lut[i - 1];
+        check( ! gamma.linear && ! narrow.linear, "gamma and narrow windows use the table" );
+        check( rising && gamma.lut[250] > 64 && gamma.lut[1000] == 255, "gamma 2 brightens dark end" );
+        check( narrow.lut[10] == 0 && narrow.lut[55] == 128 && narrow.lut[100] == 255, "narrow window" );
+    }
+
+    // Whole frames of the stand-in camera, on 1 and 3 threads.
+    for( uint32_t format : { PIXEL_FORMAT_MONO12P, PIXEL_FORMAT_MONO12PACKED, PIXEL_FORMAT_MONO16 } )
+    {
+        SyntheticSource synthetic( FRAME_WIDTH, FRAME_HEIGHT, 0, 4, format );
+        synthetic.init( );
+        synthetic.begin_acquisition( );
+        Frame f;
+        synthetic.next_frame( f );
+        string name = pixel_format_name( format );
+        check( f.pixel_format == format && f.size == pixel_format_bytes( format, FRAME_WIDTH * FRAME_HEIGHT )
+                , name + " frame from synthetic source" );
+
+        unsigned full = (4096u << pixel_format_shift( format )) - 1;
+        for( size_t threads : { (size_t)1, (size_t)3 } )
+        {
+            for( double gamma : { 1.0, 1.8 } )
+            {
+                PixelConverter converter( FRAME_WIDTH, FRAME_HEIGHT, threads );
+                converter.keep_wide( true );
+                converter.set_window( full / 8, full / 2, gamma );
+                vector<uint16_t> wide;
+                vector<uint8_t> ref = reference( f, PixelMap( pixel_format_shift( format )
+                            , full / 8, full / 2, gamma ), wide );
+
+                Frame g = f;
+                bool ok = converter.convert( g );
+                string what = name + " on " + to_string( threads ) + " threads, gamma "
+                    + to_string( gamma ).substr( 0, 3 );
+                check( ok && g.pixel_format == PIXEL_FORMAT_MONO8 && g.size == FRAME_WIDTH * FRAME_HEIGHT
+                        && memcmp( g.data, &ref[0], ref.size( ) ) == 0, what + ": same as plain loops" );
+                check( g.wide && memcmp( g.wide, &wide[0], 2 * wide.size( ) ) == 0
+                        , what + ": full depth pixels kept" );
+            }
+        }
+        synthetic.release( f );
+        synthetic.end_acquisition( );
+        synthetic.deinit( );
+    }
+
+    {
+        PixelConverter converter( FRAME_WIDTH, FRAME_HEIGHT );
+        Frame f;
+        vector<uint8_t> buf( FRAME_WIDTH * FRAME_HEIGHT, 7 );
+        f.data = &buf[0];
+        f.width = FRAME_WIDTH;
+        f.height = FRAME_HEIGHT;
+        f.size = buf.size( );
+        check( converter.convert( f ) && f.data == &buf[0] && ! f.wide, "mono8 frames pass through" );
+        f.pixel_format = PIXEL_FORMAT_MONO16;
+        check( ! converter.convert( f ), "short buffer refused" );
+
+        bool threw = false;
+        try
+        {
+            converter.set_window( 500, 100 );
+        }
+        catch( invalid_argument& )
+        {
+            threw = true;
+        }
+        check( threw, "window with hi < lo refused" );
+        converter.set_gain( 0.25, 40 );
+        check( converter.window( ) == "40,1060,1", "gain and offset as a window" );
+    }
+
+    return failed_;
+}
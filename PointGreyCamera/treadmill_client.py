@@ -0,0 +1,107 @@
+#!/usr/bin/env python
+"""treadmill_client.py: Read treadmill speed published by mouse_server.
+
+mouse_server keeps the latest sample in /dev/shm (see src/Treadmill.hpp); a
+read copies it, retrying while the writer is in the middle of an update. It
+takes a couple of microseconds, so call it for every frame.
+
+"""
+from __future__ import print_function
+
+__license__          = "GNU GPL"
+__version__          = "1.0.0"
+__status__           = "Development"
+
+import os
+import re
+import sys
+import mmap
+import time
+import struct
+import collections
+
+TREADMILL_MAGIC = 0x4d444254
+TREADMILL_VERSION = 1
+
+# struct ShmLatest (src/ShmLatest.hpp) up to seq, then the value at 32.
+header_fmt_ = '<IIIIII'
+writer_alive_offset_ = 16
+seq_offset_ = 24
+value_offset_ = 32
+
+# TreadmillSample, 48 bytes.
+sample_fmt_ = '<QiiqqffQ'
+
+Sample = collections.namedtuple( 'Sample'
+        , 'host_ns dx dy x y speed direction reports' )
+
+def shm_name_from_config( config_file, key = 'MOUSE_SHM_NAME' ):
+    with open( config_file, "r" ) as cf:
+        m = re.search( r'#define\s+%s\s+\"(.+?)\"' % key, cf.read( ) )
+    return m.group(1) if m else None
+
+def shm_path( name ):
+    return os.path.join( '/dev/shm', name.lstrip( '/' ) )
+
+class LatestReader( object ):
+    """Latest value a ShmLatestWriter publishes: struct fmt unpacked into
+    namedtuple cls. """
+
+    def __init__( self, name, magic, version, fmt, cls ):
+        self.path = shm_path( name )
+        self.fmt, self.cls = fmt, cls
+        fd = os.open( self.path, os.O_RDONLY )
+        try:
+            size = os.fstat( fd ).st_size
+            self.mm = mmap.mmap( fd, size, mmap.MAP_SHARED, mmap.PROT_READ )
+        finally:
+            os.close( fd )
+        m, v, valueSize, self.param = struct.unpack_from( header_fmt_, self.mm, 0 )[:4]
+        if m != magic or v != version or valueSize != struct.calcsize( fmt ):
+            raise RuntimeError( '%s: not what was expected (or version mismatch)' % self.path )
+
+    def writer_alive( self ):
+        return struct.unpack_from( '<I', self.mm, writer_alive_offset_ )[0] != 0
+
+    def read( self ):
+        """Latest value, None before the first one. """
+        while True:
+            seq = struct.unpack_from( '<Q', self.mm, seq_offset_ )[0]
+            if seq == 0:
+                return None
+            if seq % 2 == 0:
+                v = self.cls( *struct.unpack_from( self.fmt, self.mm, value_offset_ ) )
+                if struct.unpack_from( '<Q', self.mm, seq_offset_ )[0] == seq:
+                    return v
+
+    def close( self ):
+        self.mm.close( )
+
+class TreadmillReader( LatestReader ):
+    """read( ) gives a Sample: host_ns (CLOCK_MONOTONIC, same clock as frame
+    host_ns), dx, dy of that report, x, y since start, speed (counts/s) and
+    direction (radians) over the window. """
+
+    def __init__( self, name ):
+        LatestReader.__init__( self, name, TREADMILL_MAGIC, TREADMILL_VERSION
+                , sample_fmt_, Sample )
+        self.window_ms = self.param
+
+def main( ):
+    script_dir = os.path.dirname( os.path.realpath( __file__ ) )
+    name = shm_name_from_config( os.path.join( script_dir, 'config.h' ) )
+    reader = TreadmillReader( sys.argv[1] if len( sys.argv ) > 1 else name )
+    print( '[INFO] speed over %d ms' % reader.window_ms )
+    while reader.writer_alive( ):
+        s = reader.read( )
+        if s is not None:
+            print( '[STAT] t=%d ns speed=%.1f dir=%.2f x=%d y=%d reports=%d' % (
+                s.host_ns, s.speed, s.direction, s.x, s.y, s.reports ) )
+        time.sleep( 0.1 )
+    print( '[INFO] Writer has quit' )
+
+if __name__ == '__main__':
+    try:
+        main( )
+    except KeyboardInterrupt:
+        print( "User terminated" )
@@ -0,0 +1,199 @@
+#!/usr/bin/env python
+"""session.py: Read session files (session.ebs) written by cam_server
+--record-format session, or by tiff2session from old trial_%03d.tif
+recordings.
+
+The file is memory mapped; frames are numpy views, nothing is decoded. See
+PointGreyCamera/src/Session.hpp for the layout.
+
+    s = Session( 'session.ebs' )
+    k = s.seek( 37, 200 )             # trial 37, 200 ms after it began
+    img = s.frame( k )                # (height, width) uint8 view
+    meta = s.metadata( )              # frame_id, camera_ns, host_ns, blink, trial
+    for host_ns, frame, kind, trial, text in s.events( ): ...
+
+"""
+from __future__ import print_function
+
+__license__          = "GNU GPL"
+__version__          = "1.0.0"
+__status__           = "Development"
+
+import sys
+import struct
+import numpy as np
+
+SESSION_MAGIC = b'EBSESS01'
+SESSION_INDEX_MAGIC = b'EBSINDEX'
+SESSION_VERSION = 1
+
+FRAMES_CHUNK, EVENTS_CHUNK, INDEX_CHUNK = 1, 2, 3
+EVENT_TEXT, EVENT_TRIAL_BEGIN, EVENT_TRIAL_END, EVENT_ROW = 1, 2, 3, 4
+NO_TRIAL = -1000
+
+header_fmt_ = '<8sIIIIIIQ24x'
+chunk_fmt_ = '<IIQ'
+event_fmt_ = '<QQIiII'
+index_fmt_ = '<QIIII'
+trial_fmt_ = '<iIQQQQ'
+trailer_fmt_ = '<Q8s'
+
+meta_fields_ = [ ('frame_id', '<u8'), ('camera_ns', '<u8'), ('host_ns', '<u8')
+        , ('blink', '<f4'), ('trial', '<i4') ]
+
+def align8( n ):
+    return ( n + 7 ) & ~7
+
+class Session( object ):
+
+    def __init__( self, path ):
+        self.path = path
+        self.mm = np.memmap( path, dtype = np.uint8, mode = 'r' )
+        fields = struct.unpack_from( header_fmt_, self.mm, 0 )
+        magic, version, self.header_size, self.width, self.height = fields[:5]
+        self.stride, self.chunk_frames, self.created_ns = fields[5:]
+        if magic != SESSION_MAGIC or version != SESSION_VERSION:
+            raise RuntimeError( '%s is not a session file' % path )
+
+        self.record = np.dtype( meta_fields_ +
+                [ ('pixels', 'u1', ( self.height, self.width )) ] )
+        self.chunks, self.event_chunks, self.trials = [ ], [ ], [ ]
+        self.nframes = 0
+        self.indexed = self._read_index( )
+        if not self.indexed:
+            self._scan( )
+        self._views = [ None ] * len( self.chunks )
+        self._host = None
+
+    def __len__( self ):
+        return self.nframes
+
+    def _unpack( self, fmt, off ):
+        return struct.unpack_from( fmt, self.mm, off )
+
+    def _read_index( self ):
+        size = len( self.mm )
+        tsize = struct.calcsize( trailer_fmt_ )
+        if size < self.header_size + tsize:
+            return False
+        offset, magic = self._unpack( trailer_fmt_, size - tsize )
+        if magic != SESSION_INDEX_MAGIC:
+            return False
+        p = offset + struct.calcsize( chunk_fmt_ )
+        self.nframes, nchunks, ntrials, nevents, _ = self._unpack( index_fmt_, p )
+        p += struct.calcsize( index_fmt_ )
+        self.chunks = list( self._unpack( '<%dQ' % nchunks, p ) )
+        p += 8 * nchunks
+        for i in range( ntrials ):
+            t = self._unpack( trial_fmt_, p )
+            self.trials.append( dict( trial = t[0], first_frame = t[2], end_frame = t[3]
+                , begin_ns = t[4], end_ns = t[5] ) )
+            p += struct.calcsize( trial_fmt_ )
+        self.event_chunks = list( self._unpack( '<%dQ' % nevents, p ) )
+        return True
+
+    def _scan( self ):
+        # No index (writer was killed): walk chunks; last one may be short.
+        size, off = len( self.mm ), self.header_size
+        csize = struct.calcsize( chunk_fmt_ )
+        while off + csize <= size:
+            ctype, count, nbytes = self._unpack( chunk_fmt_, off )
+            avail = size - off - csize
+            if ctype == FRAMES_CHUNK:
+                n = min( count, avail // self.stride )
+                self.chunks.append( off )
+                self.nframes += n
+                if n < count:
+                    break
+            elif ctype == EVENTS_CHUNK:
+                if nbytes > avail:
+                    break
+                self.event_chunks.append( off )
+            elif ctype != INDEX_CHUNK:
+                break
+            off += csize + nbytes
+
+        running = False
+        for host_ns, frame, kind, value, text in self.events( ):
+            if kind == EVENT_TRIAL_BEGIN:
+                self.trials.append( dict( trial = value, first_frame = frame
+                    , end_frame = frame, begin_ns = host_ns, end_ns = host_ns ) )
+                running = True
+            elif kind == EVENT_TRIAL_END and running:
+                self.trials[-1].update( end_frame = frame, end_ns = host_ns )
+                running = False
+        if running:
+            self.trials[-1][ 'end_frame' ] = self.nframes
+        for t in self.trials:
+            t[ 'end_frame' ] = min( t[ 'end_frame' ], self.nframes )
+
+    def _chunk( self, c ):
+        # Records of frame chunk c as a strided view on the file.
+        if self._views[c] is None:
+            n = min( self.chunk_frames, self.nframes - c * self.chunk_frames )
+            off = self.chunks[c] + struct.calcsize( chunk_fmt_ )
+            self._views[c] = np.ndarray( ( n, ), dtype = self.record
+                    , buffer = self.mm, offset = off, strides = ( self.stride, ) )
+        return self._views[c]
+
+    def frame( self, k ):
+        """Pixels of frame k, a view (no copy)."""
+        if k < 0 or k >= self.nframes:
+            raise IndexError( 'frame %d of %d' % ( k, self.nframes ) )
+        return self._chunk( k // self.chunk_frames )[ k % self.chunk_frames ][ 'pixels' ]
+
+    def info( self, k ):
+        return self._chunk( k // self.chunk_frames )[ k % self.chunk_frames ][
+                [ f for f, _ in meta_fields_ ] ]
+
+    def metadata( self ):
+        """Metadata of all frames (a copy) as a numpy record array."""
+        out = np.empty( self.nframes, dtype = meta_fields_ )
+        for c in range( len( self.chunks ) ):
+            view = self._chunk( c )
+            start = c * self.chunk_frames
+            for f, _ in meta_fields_:
+                out[f][ start : start + len( view ) ] = view[f]
+        return out
+
+    def events( self ):
+        """List of ( host_ns, frame, kind, trial, text )."""
+        out = [ ]
+        esize = struct.calcsize( event_fmt_ )
+        for off in self.event_chunks:
+            ctype, count, nbytes = self._unpack( chunk_fmt_, off )
+            p = off + struct.calcsize( chunk_fmt_ )
+            for i in range( count ):
+                host_ns, frame, kind, value, n, _ = self._unpack( event_fmt_, p )
+                text = self.mm[ p + esize : p + esize + n ].tobytes( ).decode( 'ascii', 'replace' )
+                out.append( ( host_ns, frame, kind, value, text ) )
+                p += align8( esize + n )
+        return out
+
+    def trial( self, trial ):
+        for t in self.trials:
+            if t[ 'trial' ] == trial:
+                return t
+        return None
+
+    def seek( self, trial, ms ):
+        """First frame recorded at least ms after trial began, or None."""
+        t = self.trial( trial )
+        if t is None:
+            return None
+        if self._host is None:
+            self._host = self.metadata( )[ 'host_ns' ]
+        host = self._host[ t[ 'first_frame' ] : t[ 'end_frame' ] ]
+        i = np.searchsorted( host, t[ 'begin_ns' ] + int( ms * 1e6 ) )
+        return t[ 'first_frame' ] + int( i ) if i < len( host ) else None
+
+def main( ):
+    s = Session( sys.argv[1] )
+    print( '%s: %dx%d, %d frames, %d trials%s' % ( s.path, s.width, s.height
+        , len( s ), len( s.trials ), '' if s.indexed else ' (no index; rebuilt)' ) )
+    for t in s.trials:
+        print( '  trial %3d: frames %d - %d, %.2f s' % ( t[ 'trial' ], t[ 'first_frame' ]
+            , t[ 'end_frame' ], ( t[ 'end_ns' ] - t[ 'begin_ns' ] ) / 1e9 ) )
+
+if __name__ == '__main__':
+    main( )
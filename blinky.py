@@ -59,9 +59,9 @@ def find_blinks_using_pixals( frame ):
 
     # Read the signal from half of the boundbox.
     rs, cs = newframe.shape
-    r0, c0 = rs / 2, cs / 2
-    signal = np.sum( newframe[r0-rs/4:r0+rs/4,c0-cs/4:c0+cs/4] )
-    return frame, newframe, 1.0 * signal / float(rs*cs/4), -1
+    r0, c0 = rs // 2, cs // 2
+    signal = np.sum( newframe[r0-rs//4:r0+rs//4,c0-cs//4:c0+cs//4] )
+    return frame, newframe, 1.0 * signal / float(rs*cs//4), -1
 
 
 def process_frame(frame, method = 0):
@@ -15,20 +15,26 @@ __email__            = "dilawars@ncbs.res.in"
 __status__           = "Development"
 
 import time
+import socket
+import binascii
 import serial
 import serial.tools.list_ports 
 import config
 import logging
+import sample_protocol
 #logging = logging.getLogger('')
 
 # Create a class to handle serial port.
 class ArduinoPort( ):
 
-    def __init__(self, path, baud_rate = 38400, **kwargs):
+    def __init__(self, path, baud_rate = 38400, binary = False, **kwargs):
         self.path = path
         config.args_.port = path
         self.baudRate = baud_rate
         self.port = None
+        # Board sends binary packets (BINARY_SAMPLES), see sample_protocol.py
+        self.decoder = sample_protocol.SampleDecoder( ) if binary else None
+        self.pending = [ ]
 
     def open(self, wait = True):
         # ATTN: timeout is essential else realine will block.
@@ -63,15 +69,95 @@ class ArduinoPort( ):
         print(" ... OPEN")
 
     def read_line(self, **kwargs):
+        if self.decoder is not None:
+            if not self.pending:
+                self.pending = self.read_lines( )
+            return self.pending.pop( 0 ) if self.pending else ''
         line = self.port.readline()
         logging.debug('RX< %s' % line)
         # mysql.insert_line( line , auto_commit = True)
         return line.strip()
 
+    def read_lines(self):
+        """All lines which have come so far (waits for at least one byte, or
+        the timeout). From a binary board, lines are decoded from its packets.
+        """
+        if self.decoder is None:
+            line = self.read_line( )
+            return [ line ] if line else [ ]
+        lines = self.pending
+        self.pending = [ ]
+        data = self.port.read( max( 1, self.port.inWaiting( ) ) )
+        return lines + [ l for l, n in self.decoder.feed( data ) ]
+
     def write_msg(self, msg):
         logging.info('Writing %s to serial port' % msg)
         self.port.write( bytes(msg) )
 
+class ReaderPort( ):
+    """The board while arduino_reader (PointGreyCamera/src/arduino_reader.cc)
+    reads its port: writes go to the board and messages (lines which are not
+    data: >>PING, acks, ">>> Waiting ...") come back through the reader's
+    command socket. The reader writes the trial files itself; the latest
+    data line is in its shared memory (PointGreyCamera/serial_client.py).
+    """
+
+    def __init__(self, sock_path):
+        self.path = sock_path
+        self.port = self                # Callers write to port.port.
+        self.next = 0
+        self.pending = [ ]
+
+    def open(self, wait = True):
+        self.command( 'stats' )
+
+    def command(self, cmd):
+        """Reply of arduino_reader to cmd, without OK; IOError if it fails. """
+        s = socket.socket( socket.AF_UNIX, socket.SOCK_STREAM )
+        s.settimeout( 2.0 )
+        try:
+            s.connect( self.path )
+            s.sendall( (cmd + '\n').encode( ) )
+            reply = b''
+            while not reply.endswith( b'\n' ):
+                got = s.recv( 65536 )
+                if not got:
+                    break
+                reply += got
+        finally:
+            s.close( )
+        reply = reply.decode( 'ascii', 'replace' ).rstrip( '\n' )
+        if not reply.startswith( 'OK' ):
+            raise IOError( 'arduino_reader: %s: %s' % ( cmd, reply ) )
+        return reply[3:]
+
+    def read_line(self, **kwargs):
+        if not self.pending:
+            self.pending = self.read_lines( )
+        return self.pending.pop( 0 ) if self.pending else ''
+
+    def read_lines(self):
+        """Messages which have come since the last call (waits 10 ms if none
+        has). """
+        lines = self.pending
+        self.pending = [ ]
+        fields = self.command( 'messages %d' % self.next ).split( '\t' )
+        self.next = int( fields[0] )
+        if not lines and len( fields ) == 1:
+            time.sleep( 0.01 )
+        return lines + fields[1:]
+
+    def write(self, data):
+        self.command( 'sendhex ' + binascii.hexlify( bytearray( data ) ).decode( ) )
+
+    def write_msg(self, msg):
+        logging.info('Writing %s to serial port' % msg)
+        self.write( msg if isinstance( msg, bytes ) else msg.encode( ) )
+
+    def set_files(self, data_dir, prefix):
+        """Data lines of trial N to data_dir/prefix + 'trial=N.dat'. """
+        return self.command( 'files %s %s' % ( data_dir, prefix ) )
+
 def get_default_serial_port( ):
     # If port part is not given from command line, find a serial port by
     # default.
@@ -0,0 +1,141 @@
+"""sample_protocol.py:
+
+    Decoder of the binary packets the board sends when built with
+    BINARY_SAMPLES (see src/sample_protocol.h). Packets are turned back into
+    the lines the text firmware prints, so that everything downstream reads
+    lines as before. Same as PointGreyCamera/src/SampleDecoder.hpp.
+
+"""
+from __future__ import print_function
+
+__license__          = "GNU GPL"
+__version__          = "1.0.0"
+__status__           = "Development"
+
+import struct
+
+SP_SYNC = 0xA5
+SP_MAX_PAYLOAD = 64
+SP_OVERHEAD = 4
+
+SP_SAMPLE, SP_TIME, SP_TRIAL, SP_PING, SP_TTL, SP_TEXT = range( 1, 7 )
+
+PIN_PUFF, PIN_TONE, PIN_LED, PIN_CAMERA, PIN_IMAGING = [ 1 << i for i in range(5) ]
+
+STATE_NAMES = [ 'INVA', 'PRE_', 'CS+', 'NOCS', 'TRAC', 'PUFF', 'NOPF', 'PROB'
+        , 'POST', 'ITI_' ]
+
+sample_fmt_ = '<HBBbb'
+time_fmt_ = '<I'
+trial_fmt_ = '<HII'
+ping_fmt_ = '<I'
+ttl_fmt_ = '<BI'
+
+def crc8( data ):
+    """CRC-8, poly 0x07, init 0. """
+    crc = 0
+    for b in data:
+        crc ^= b
+        for i in range( 8 ):
+            crc = ((crc << 1) ^ 0x07) & 0xff if crc & 0x80 else (crc << 1) & 0xff
+    return crc
+
+def encode( kind, payload ):
+    """Packet of given type; the host sends SP_SCHEDULE and SP_PHASES. """
+    payload = bytearray( payload )
+    body = bytearray( [ kind, len( payload ) ] ) + payload
+    return bytes( bytearray( [ SP_SYNC ] ) + body + bytearray( [ crc8( body ) ] ) )
+
+class SampleDecoder( ):
+
+    def __init__( self ):
+        self.buf = bytearray( )
+        self.errors = 0                 # Packets with bad crc or length.
+        self.junk = 0                   # Bytes skipped looking for sync.
+        self.micros = 0                 # Of last sample.
+        self.timed = False              # micros is known (since last SP_TIME).
+        self.trial = 0
+        self.trial_ms = 0
+        self.trial_us = 0
+
+    def feed( self, data ):
+        """Bytes read from the port. Returns list of (line, nbytes): the lines
+        of the complete packets so far and bytes each took on the wire.
+        """
+        self.buf.extend( bytearray( data ) )
+        lines = [ ]
+        pos = 0
+        buf = self.buf
+        while True:
+            start = buf.find( bytearray( [ SP_SYNC ] ), pos )
+            if start < 0:
+                self.junk += len( buf ) - pos
+                pos = len( buf )
+                break
+            self.junk += start - pos
+            pos = start
+            if len( buf ) - pos < 3:
+                break
+            n = buf[pos+2]
+            if n > SP_MAX_PAYLOAD:
+                self._bad( )
+                pos += 1
+                continue
+            if len( buf ) - pos < n + SP_OVERHEAD:
+                break
+            if crc8( buf[pos+1:pos+3+n] ) != buf[pos+3+n]:
+                self._bad( )
+                pos += 1
+                continue
+            line = self._line( buf[pos+1], bytes( buf[pos+3:pos+3+n] ) )
+            if line is not None:
+                lines.append( (line, n + SP_OVERHEAD) )
+            pos += n + SP_OVERHEAD
+        del self.buf[:pos]
+        return lines
+
+    def _bad( self ):
+        # Whatever was lost, time of next samples is not known till SP_TIME.
+        self.errors += 1
+        self.timed = False
+
+    def _line( self, kind, payload ):
+        n = len( payload )
+        if kind == SP_SAMPLE and n == struct.calcsize( sample_fmt_ ):
+            dt, pins, state, m1, m2 = struct.unpack( sample_fmt_, payload )
+            self.micros = (self.micros + dt) & 0xffffffff
+            if not self.timed:
+                return None
+            ms = ((self.micros - self.trial_us) & 0xffffffff) // 1000
+            name = STATE_NAMES[state] if state < len( STATE_NAMES ) else '????'
+            return '%d,%d,%d,%d,%d,%3d,%3d,%d,%d,%s' % ( ms, self.trial
+                    , (pins & PIN_PUFF) != 0, (pins & PIN_TONE) != 0
+                    , (pins & PIN_LED) != 0, m1, m2, (pins & PIN_CAMERA) != 0
+                    , (pins & PIN_IMAGING) != 0, name )
+        elif kind == SP_TIME and n == struct.calcsize( time_fmt_ ):
+            self.micros, = struct.unpack( time_fmt_, payload )
+            self.timed = True
+        elif kind == SP_TRIAL and n == struct.calcsize( trial_fmt_ ):
+            self.trial, self.trial_ms, self.trial_us = struct.unpack( trial_fmt_, payload )
+            return '>>TRIAL %d %d' % ( self.trial, self.trial_ms )
+        elif kind == SP_PING and n == struct.calcsize( ping_fmt_ ):
+            return '>>PING %d' % struct.unpack( ping_fmt_, payload )
+        elif kind == SP_TTL and n == struct.calcsize( ttl_fmt_ ):
+            return '>>TTL %d %d' % struct.unpack( ttl_fmt_, payload )
+        elif kind == SP_TEXT:
+            return payload.decode( 'ascii', 'replace' )
+        return None
+
+def main( ):
+    """Decode a binary capture of the port, e.g.
+        $ cat /dev/ttyACM0 > capture.bin; python sample_protocol.py capture.bin
+    """
+    import sys
+    dec = SampleDecoder( )
+    with open( sys.argv[1], 'rb' ) as f:
+        for line, n in dec.feed( f.read( ) ):
+            print( line )
+    print( '# errors=%d junk=%d' % ( dec.errors, dec.junk ), file = sys.stderr )
+
+if __name__ == '__main__':
+    main( )
@@ -0,0 +1,109 @@
+"""schedule.py:
+
+    Trial schedule of a session, uploaded to the board before it starts (see
+    SP_SCHEDULE and SP_PHASES in src/sample_protocol.h). The same firmware
+    then runs any session type; nothing is rebuilt or flashed.
+
+    A schedule is a dict:
+
+        trials, session_type, session_num, name, shutter_ms,
+        iti_ms: (min, max), probes: [trial, ...],
+        phases: [ (state, [pin, ...], ms), ... ]
+
+    Pins are 'puff', 'tone', 'led', 'camera', 'imaging' and 'probe' (the
+    phase gives no stimulus on probe trials and is PROB). It can be written
+    as JSON and passed with --schedule.
+
+"""
+from __future__ import print_function
+
+__license__          = "GNU GPL"
+__version__          = "1.0.0"
+__status__           = "Development"
+
+import json
+import random
+import struct
+import time
+import sample_protocol as sp
+
+SP_SCHEDULE = 7
+SP_PHASES = 8
+MAX_TRIALS = 127
+MAX_PHASES = 16
+
+PINS = { 'puff' : 1 << 0, 'tone' : 1 << 1, 'led' : 1 << 2, 'camera' : 1 << 3
+        , 'imaging' : 1 << 4, 'probe' : 1 << 7 }
+
+schedule_fmt_ = '<BBBBHH16s8s'
+phase_fmt_ = '<BBH'
+
+def trace_duration( session_type ):
+    """Same as trace_duration( ) in src/main.ino. """
+    return { 3 : 350, 4 : 500, 5 : 650, 6 : 800, 7 : 1000 }.get( session_type, 250 )
+
+def probe_trials( trials, mean = 6, sd = 2 ):
+    """One probe trial every mean +/- sd trials, as proble_trial_index_init( )
+    of the firmware. """
+    probes = [ i * mean + random.randint( -sd, sd ) for i in range( 1, trials // mean + 1 ) ]
+    return sorted( set( x for x in probes if 1 <= x <= trials ) )
+
+def default_schedule( session_type, session_num = 0, name = '' ):
+    """What the firmware does for SESSION_TYPE when nothing is uploaded. """
+    session_type = int( session_type )
+    img, cam = [ 'imaging' ], [ 'imaging', 'camera' ]
+    phases = [ ('PRE_', img, 7500), ('PRE_', cam, 500) ]
+    if session_type == 1:
+        phases.append( ('NOCS', cam, 50) )
+    else:
+        phases.append( ('CS+', cam + [ 'led' ], 50) )
+    phases.append( ('TRAC', cam, trace_duration( session_type ) ) )
+    if session_type in ( 1, 2 ):
+        phases.append( ('NOPF', cam, 50) )
+    else:
+        phases.append( ('PUFF', cam + [ 'puff', 'probe' ], 50) )
+    phases += [ ('POST', cam, 500), ('POST', img, 7500) ]
+    return dict( trials = 62, session_type = session_type
+            , session_num = int( session_num ), name = name, shutter_ms = 60
+            , iti_ms = (23000, 25000), probes = probe_trials( 62 )
+            , phases = phases )
+
+def load( filename ):
+    with open( filename ) as f:
+        return json.load( f )
+
+def encode( s ):
+    """The two packets of schedule s. """
+    if s['trials'] > MAX_TRIALS or len( s['phases'] ) > MAX_PHASES:
+        raise ValueError( 'At most %d trials and %d phases' % (MAX_TRIALS, MAX_PHASES) )
+    probes = bytearray( (MAX_TRIALS + 1) // 8 )
+    for t in s['probes']:
+        probes[t // 8] |= 1 << (t % 8)
+    itiMin, itiMax = s['iti_ms']
+    header = struct.pack( schedule_fmt_, s['trials'], s['session_type']
+            , s['session_num'], s['shutter_ms'], itiMin, itiMax, bytes( probes )
+            , s['name'].encode( 'ascii' )[:8] )
+    phases = b''
+    for state, pins, ms in s['phases']:
+        mask = 0
+        for p in pins:
+            mask |= PINS[p]
+        phases += struct.pack( phase_fmt_, sp.STATE_NAMES.index( state ), mask, ms )
+    return sp.encode( SP_SCHEDULE, header ) + sp.encode( SP_PHASES, phases )
+
+def upload( port, s, timeout = 5.0 ):
+    """Send schedule s to the board (an arduino.ArduinoPort) and wait for it
+    to take both packets. Returns False if it did not; it then runs its
+    default schedule.
+    """
+    port.port.write( encode( s ) )
+    acks = [ ]
+    t = time.time( )
+    while len( acks ) < 2 and time.time( ) - t < timeout:
+        line = port.read_line( )
+        if line.startswith( '>>SCHEDULE' ) or line.startswith( '>>PHASES' ):
+            print( '[INFO] Board: %s' % line )
+            if 'error' in line:
+                return False
+            acks.append( line )
+    return len( acks ) == 2
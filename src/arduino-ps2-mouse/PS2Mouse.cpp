@@ -1,23 +1,46 @@
 #include "PS2Mouse.h"
 #include "Arduino.h"
+#include <avr/interrupt.h>
 
 #define INTELLI_MOUSE 3
 #define SCALING_1_TO_1 0xE6
 #define RESOLUTION_8_COUNTS_PER_MM 3
 
+// Bits of a frame come every 60-100 us and bytes of a packet within about a
+// ms; packets at 100 Hz are 10 ms apart.
+#define FRAME_GAP_US 1000
+#define PACKET_GAP_US 2000
+
 enum Commands {
     SET_RESOLUTION = 0xE8,
     REQUEST_DATA = 0xEB,
+    SET_STREAM_MODE = 0xEA,
     SET_REMOTE_MODE = 0xF0,
     GET_DEVICE_ID = 0xF2,
     SET_SAMPLE_RATE = 0xF3,
+    ENABLE_DATA_REPORTING = 0xF4,
     RESET = 0xFF,
 };
 
+PS2Mouse *PS2Mouse::_streaming = 0;
+
+// Whichever port the clock pin is on. Sketches using this library can't use
+// another one defining these (e.g. SoftwareSerial).
+ISR(PCINT0_vect) {
+    PS2Mouse::handleInterrupt();
+}
+
+ISR(PCINT1_vect, ISR_ALIASOF(PCINT0_vect));
+ISR(PCINT2_vect, ISR_ALIASOF(PCINT0_vect));
+
 PS2Mouse::PS2Mouse(int clockPin, int dataPin) {
     _clockPin = clockPin;
     _dataPin = dataPin;
     _supportsIntelliMouseExtensions = false;
+    _bitCount = _byteCount = _shift = _parity = 0;
+    _lastEdge = 0;
+    _dx = _dy = _status = 0;
+    _errors = 0;
 }
 
 void PS2Mouse::high(int pin) {
@@ -197,3 +220,122 @@ MouseData PS2Mouse::readData() {
 void PS2Mouse::requestData() {
     writeAndReadAck(REQUEST_DATA);
 }
+
+bool PS2Mouse::startStreaming(int rate) {
+    volatile uint8_t *pcmsk = digitalPinToPCMSK(_clockPin);
+    if (pcmsk == 0)
+        return false;
+
+    _clockReg = portInputRegister(digitalPinToPort(_clockPin));
+    _clockMask = digitalPinToBitMask(_clockPin);
+    _dataReg = portInputRegister(digitalPinToPort(_dataPin));
+    _dataMask = digitalPinToBitMask(_dataPin);
+
+    setSampleRate(rate);
+    writeAndReadAck(SET_STREAM_MODE);
+    writeAndReadAck(ENABLE_DATA_REPORTING);
+
+    // The clock is held low since the last ack: the mouse sends nothing till
+    // it is released, after the interrupt is on.
+    uint8_t sreg = SREG;
+    cli();
+    _bitCount = _byteCount = 0;
+    _dx = _dy = _status = 0;
+    _lastEdge = micros();
+    _streaming = this;
+    *pcmsk |= _BV(digitalPinToPCMSKbit(_clockPin));
+    PCIFR = _BV(digitalPinToPCICRbit(_clockPin));
+    *digitalPinToPCICR(_clockPin) |= _BV(digitalPinToPCICRbit(_clockPin));
+    SREG = sreg;
+    high(_clockPin);
+    return true;
+}
+
+void PS2Mouse::handleInterrupt() {
+    if (_streaming)
+        _streaming->onClockEdge();
+}
+
+// Device to host: the mouse sets the data line while the clock is high and
+// we read it on the falling edge. 11 bits: start (0), 8 data (lsb first),
+// odd parity, stop (1).
+void PS2Mouse::onClockEdge() {
+    if (*_clockReg & _clockMask)
+        return;
+
+    int bit = (*_dataReg & _dataMask) ? 1 : 0;
+    unsigned long now = micros();
+    unsigned long gap = now - _lastEdge;
+    _lastEdge = now;
+    if (gap > FRAME_GAP_US) {
+        if (_bitCount != 0)
+            _errors++;
+        _bitCount = 0;
+        if (gap > PACKET_GAP_US)
+            _byteCount = 0;
+    }
+
+    if (_bitCount == 0) {
+        if (bit)
+            return;                         // Not a start bit; wait for one.
+        _shift = 0;
+        _parity = 0;
+    } else if (_bitCount <= 8) {
+        _shift |= bit << (_bitCount - 1);
+        _parity ^= bit;
+    } else if (_bitCount == 9) {
+        _parity ^= bit;
+    } else {
+        _bitCount = 0;
+        if (bit && _parity) {
+            receiveByte(_shift);
+        } else {
+            _errors++;
+            _byteCount = 0;
+        }
+        return;
+    }
+    _bitCount++;
+}
+
+void PS2Mouse::receiveByte(uint8_t data) {
+    // Bit 3 of the first byte is always set.
+    if (_byteCount == 0 && !(data & 0x08)) {
+        _errors++;
+        return;
+    }
+    _packet[_byteCount++] = data;
+    if (_byteCount < (_supportsIntelliMouseExtensions ? 4 : 3))
+        return;
+    _byteCount = 0;
+
+    uint8_t status = _packet[0];
+    _status = status & 0x07;
+    if (status & 0xC0)
+        return;                             // X or Y overflow
+    _dx += (int) _packet[1] - ((status & 0x10) ? 256 : 0);
+    _dy += (int) _packet[2] - ((status & 0x20) ? 256 : 0);
+}
+
+Position PS2Mouse::takeMotion() {
+    Position p;
+    uint8_t sreg = SREG;
+    cli();
+    p.x = _dx;
+    p.y = _dy;
+    _dx = _dy = 0;
+    SREG = sreg;
+    return p;
+}
+
+int PS2Mouse::buttons() {
+    return _status;
+}
+
+unsigned int PS2Mouse::errors() {
+    uint8_t sreg = SREG;
+    cli();
+    unsigned int e = _errors;
+    SREG = sreg;
+    return e;
+}
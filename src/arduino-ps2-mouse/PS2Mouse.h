@@ -2,6 +2,8 @@
 
 #define MOUSE_H_
 
+#include <stdint.h>
+
 typedef struct {
     int x, y;
 } Position;
@@ -50,12 +52,44 @@ private:
 
     void writeBit(int bit);
 
+    // Stream mode: bits of the packets the mouse sends by itself are taken
+    // on clock edges by a pin change interrupt (see startStreaming).
+    volatile uint8_t *_clockReg, *_dataReg;
+    uint8_t _clockMask, _dataMask;
+    volatile uint8_t _bitCount, _byteCount, _shift, _parity;
+    uint8_t _packet[4];
+    volatile unsigned long _lastEdge;
+    volatile int _dx, _dy, _status;
+    volatile unsigned int _errors;
+    static PS2Mouse *_streaming;
+
+    void onClockEdge();
+
+    void receiveByte(uint8_t data);
+
 public:
     PS2Mouse(int clockPin, int dataPin);
 
     void initialize();
 
+    // Remote mode: ask for a packet and wait for it (a few ms).
     MouseData readData();
+
+    // Switch to stream mode after initialize(). The mouse then sends a
+    // packet at every sample rate tick it moved, and readData() must not be
+    // used. Returns false if the clock pin has no pin change interrupt.
+    bool startStreaming(int rate = 100);
+
+    // Motion since last call; a few cycles, safe in an ISR.
+    Position takeMotion();
+
+    // Buttons of last packet (status bits 0-2).
+    int buttons();
+
+    // Frames with bad start/parity/stop bit or out of place packet bytes.
+    unsigned int errors();
+
+    static void handleInterrupt();
 };
 
 #endif // MOUSE_H_
\ No newline at end of file
@@ -15,6 +15,11 @@
 #include <avr/wdt.h>
 #include "config.h"
 #include "random_trial.h"
+#include "sample_protocol.h"
+
+#ifdef USE_MOUSE
+#include "arduino-ps2-mouse/PS2Mouse.h"
+#endif
 
 // Pins etc.
 #define         TONE_PIN                    2
@@ -42,6 +47,13 @@
 #define         MOTION2_PIN                 7
 #endif 
 
+// read_pins( ) reads these from PORTD (2, 3, 6, 7) and PORTB (10, 11, 13)
+// directly, all in one go.
+#if TONE_PIN != 2 || LED_PIN != 3 || CAMERA_TTL_PIN != 10 || PUFF_PIN != 11 \
+    || IMAGING_TRIGGER_PIN != 13
+#error "Pins moved: fix read_pins( )"
+#endif
+
 
 // Motion detection based on motor
 #define         MOTOR_OUT              A1
@@ -62,7 +74,54 @@ char msg_[80];
 unsigned long trial_start_time_ = 0;
 
 
-char trial_state_[5]            = "PRE_";
+volatile uint8_t trial_state_   = ST_PRE_;
+unsigned long trial_start_us_   = 0;
+
+/*-----------------------------------------------------------------------------
+ *  Samples. Timer1 takes one every SAMPLE_PERIOD_US into a ring; the busy
+ *  loops send them (write_data_line). Trial number and start change only
+ *  when the ring is empty (set_trial), so samples go out with the trial they
+ *  were taken in.
+ *-----------------------------------------------------------------------------*/
+#define         SAMPLE_RING_SIZE            32  /* Power of 2; 32 ms at 1 kHz */
+#if BINARY_SAMPLES
+#define         SAMPLE_MAX_BYTES            (3 * SP_OVERHEAD + sizeof( sp_trial ) \
+        + sizeof( sp_time ) + sizeof( sp_sample ))
+#else
+#define         SAMPLE_MAX_BYTES            48
+#endif
+#if SAMPLE_PERIOD_US < 100 || SAMPLE_PERIOD_US > 32000
+#error "SAMPLE_PERIOD_US must be 100 to 32000 (Timer1, prescaler 8)"
+#endif
+
+struct Sample
+{
+    uint32_t us;
+    uint8_t pins;
+    uint8_t state;
+    int8_t motion1;
+    int8_t motion2;
+};
+
+Sample samples_[SAMPLE_RING_SIZE];
+volatile uint8_t sample_head_   = 0;            /* Written by ISR */
+volatile uint8_t sample_tail_   = 0;            /* Written by loop */
+volatile unsigned sample_overruns_ = 0;
+
+// What the host was last told about time and trial.
+unsigned long sample_us_        = 0;
+unsigned samples_since_time_    = SP_TIME_EVERY;
+bool trial_pending_             = true;
+
+/*-----------------------------------------------------------------------------
+ *  Trial schedule: what each trial does (phases_), how many trials, which
+ *  are probes and ITI. Uploaded by the host before 's' (read_host_packet),
+ *  else default_schedule( ) of SESSION_TYPE.
+ *-----------------------------------------------------------------------------*/
+sp_schedule schedule_;
+sp_phase phases_[SCHED_MAX_PHASES];
+uint8_t num_phases_             = 0;
+uint8_t outputs_                = 0;            /* Pins set_outputs( ) drives */
 
 /*-----------------------------------------------------------------------------
  *  User response
@@ -129,7 +188,7 @@ bool is_command_read( char command, bool consume = true )
         return false;
 
     // Peek for the first character.
-    if( command == Serial.peek( ) )
+    if( (uint8_t)command == Serial.peek( ) )
     {
         if( consume )
             Serial.read( );
@@ -140,55 +199,243 @@ bool is_command_read( char command, bool consume = true )
 }
 
 /**
- * @brief Write data line to Serial port.
- *   NOTE: Use python dictionary format. It can't be written at baud rate of
- *   38400 at least.
- * @param data
- * @param timestamp
+ * @brief Send one packet (sample_protocol.h). Serial.write only waits when
+ * its 64 byte buffer is full.
  */
-void write_data_line( )
+void send_packet( uint8_t type, const void* payload, uint8_t len )
 {
-    reset_watchdog( );
+    uint8_t buf[SP_MAX_PACKET];
+    Serial.write( buf, sp_encode( buf, type, payload, len ) );
+}
 
-    // Just read the registers where pin data is saved.
-    int tone = digitalRead( TONE_PIN );
-    int led = digitalRead( LED_PIN ); 
+/**
+ * @brief Print a message line, e.g. ">>> Waiting ...". In binary mode it goes
+ * in a SP_TEXT packet which the host turns back into the line.
+ */
+void message( const char* msg )
+{
+#if BINARY_SAMPLES
+    send_packet( SP_TEXT, msg, strlen( msg ) );
+#else
+    Serial.println( msg );
+#endif
+}
 
-    int puff = digitalRead( PUFF_PIN ); 
-    int microscope = digitalRead( IMAGING_TRIGGER_PIN);
-    int camera = digitalRead( CAMERA_TTL_PIN ); 
+/**
+ * @brief All output pins and motion pins, read from the port registers at
+ * once (digitalRead takes ~4 us each). Bits are SP_PIN_*.
+ */
+uint8_t read_pins( )
+{
+    uint8_t d = PIND;
+    uint8_t b = PINB;
+    return ((b >> 3) & 1)                       /* PUFF, PB3 */
+        | (((d >> 2) & 1) << 1)                 /* TONE, PD2 */
+        | (((d >> 3) & 1) << 2)                 /* LED, PD3 */
+        | (((b >> 2) & 1) << 3)                 /* CAMERA, PB2 */
+        | (((b >> 5) & 1) << 4)                 /* IMAGING, PB5 */
+        | (((d >> 6) & 3) << 5);                /* MOTION1, MOTION2; PD6, PD7 */
+}
 
-    unsigned long timestamp = millis() - trial_start_time_;
+/**
+ * @brief Answer ping ('?') of the host with micros( ) right now; the host
+ * aligns our clock with its own from these (PointGreyCamera/src/ClockSync.hpp).
+ *
+ * @return True if there was a ping.
+ */
+bool check_for_ping( )
+{
+    if( ! is_command_read( '?', true ) )
+        return false;
+    unsigned long now = micros( );
+#if BINARY_SAMPLES
+    sp_ping p = { (uint32_t)now };
+    send_packet( SP_PING, &p, sizeof( p ) );
+#else
+    Serial.print( ">>PING " );
+    Serial.println( now );
+#endif
+    return true;
+}
 
-    int motion1;
-    int motion2;
+/**
+ * @brief Drive CAMERA_TTL_PIN and report the edge with its micros( ).
+ *
+ * @param level
+ */
+void camera_ttl( int level )
+{
+    if( level == digitalRead( CAMERA_TTL_PIN ) )
+        return;
+    digitalWrite( CAMERA_TTL_PIN, level );
+    unsigned long now = micros( );
+#if BINARY_SAMPLES
+    sp_ttl t = { (uint8_t)level, (uint32_t)now };
+    send_packet( SP_TTL, &t, sizeof( t ) );
+#else
+    Serial.print( ">>TTL " );
+    Serial.print( level );
+    Serial.print( ' ' );
+    Serial.println( now );
+#endif
+}
 
+/**
+ * @brief Take a sample every SAMPLE_PERIOD_US, whatever the protocol is
+ * doing. A full ring drops the sample (counted); the host sees the gap in
+ * time.
+ */
+ISR(TIMER1_COMPA_vect)
+{
+    uint8_t next = (sample_head_ + 1) & (SAMPLE_RING_SIZE - 1);
+    if( next == sample_tail_ )
+    {
+        sample_overruns_ += 1;
+        return;
+    }
+    Sample& s = samples_[sample_head_];
+    s.us = micros( );
+    s.pins = read_pins( );
+    s.state = trial_state_;
 #ifdef USE_MOUSE
-    // Read mouse data.
-    MouseData data = mouse.readData( );
-    motion1 = data.position.x;
-    motion2 = data.position.y;
+    // Motion since the last sample taken; the mouse interrupt adds it up.
+    Position p = mouse.takeMotion( );
+    s.motion1 = constrain( p.x, -128, 127 );
+    s.motion2 = constrain( p.y, -128, 127 );
 #else
-    motion1 = digitalRead( MOTION1_PIN );
-    motion2 = digitalRead( MOTION2_PIN );
+    s.motion1 = (s.pins & SP_PIN_MOTION1) != 0;
+    s.motion2 = (s.pins & SP_PIN_MOTION2) != 0;
 #endif
-    
+    sample_head_ = next;
+}
+
+/**
+ * @brief Timer1 in CTC mode, interrupt every SAMPLE_PERIOD_US. Pins 9 and 10
+ * lose PWM, which we don't use.
+ */
+void start_sampling( )
+{
+    noInterrupts( );
+    TCCR1A = 0;
+    TCCR1B = (1 << WGM12) | (1 << CS11);        /* CTC, clk/8 */
+    TCNT1 = 0;
+    OCR1A = SAMPLE_PERIOD_US * (F_CPU / 8000000UL) - 1;
+    TIMSK1 = (1 << OCIE1A);
+    interrupts( );
+}
+
+/**
+ * @brief Send one sample, preceded by the trial when it changed and by the
+ * time when needed (sample_protocol.h). Text: one line
+ *   time,trial,puff,tone,led,motion1,motion2,camera,imaging,state
+ */
+void send_sample( const Sample& x )
+{
+#if BINARY_SAMPLES
+    if( trial_pending_ )
+    {
+        sp_trial t = { (uint16_t)trial_count_, (uint32_t)trial_start_time_
+            , (uint32_t)trial_start_us_ };
+        send_packet( SP_TRIAL, &t, sizeof( t ) );
+        trial_pending_ = false;
+    }
+
+    unsigned long dt = x.us - sample_us_;
+    if( dt > 0xFFFF || samples_since_time_ >= SP_TIME_EVERY )
+    {
+        sp_time t = { x.us };
+        send_packet( SP_TIME, &t, sizeof( t ) );
+        samples_since_time_ = 0;
+        dt = 0;
+    }
+    sp_sample s = { (uint16_t)dt, x.pins, x.state, x.motion1, x.motion2 };
+    send_packet( SP_SAMPLE, &s, sizeof( s ) );
+    samples_since_time_ += 1;
+    sample_us_ = x.us;
+#else
+    if( trial_pending_ )
+    {
+        sprintf( msg_, ">>TRIAL %u %lu", trial_count_, trial_start_time_ );
+        Serial.println( msg_ );
+        trial_pending_ = false;
+    }
     sprintf(msg_  
             , "%lu,%d,%d,%d,%d,%3d,%3d,%d,%d,%s"
-            , timestamp, trial_count_, puff, tone, led
-            , motion1, motion2, camera, microscope, trial_state_
+            , (x.us - trial_start_us_) / 1000, trial_count_, (x.pins & SP_PIN_PUFF) != 0
+            , (x.pins & SP_PIN_TONE) != 0, (x.pins & SP_PIN_LED) != 0
+            , x.motion1, x.motion2, (x.pins & SP_PIN_CAMERA) != 0
+            , (x.pins & SP_PIN_IMAGING) != 0, sp_state_names_[x.state]
             );
     Serial.println(msg_);
-    //delay( 3 );
-    Serial.flush( );
-    //delay( 3 );
+#endif
+}
+
+/**
+ * @brief Send the samples Timer1 has taken, as many as fit in the serial
+ * buffer without waiting. Called from every busy loop.
+ */
+void write_data_line( )
+{
+    reset_watchdog( );
+    check_for_ping( );
+
+    while( sample_tail_ != sample_head_ )
+    {
+#ifdef SERIAL_TX_BUFFER_SIZE
+        if( Serial.availableForWrite( ) < (int)SAMPLE_MAX_BYTES )
+            return;
+#endif
+        send_sample( samples_[sample_tail_] );
+        sample_tail_ = (sample_tail_ + 1) & (SAMPLE_RING_SIZE - 1);
+#ifndef SERIAL_TX_BUFFER_SIZE
+        // Arduino 1.0 can't tell if a write would wait: one per call.
+        return;
+#endif
+    }
+}
+
+/**
+ * @brief Wait, sending samples meanwhile (instead of delay( )).
+ */
+void wait_ms( unsigned long duration )
+{
+    unsigned long start = millis( );
+    while( millis( ) - start < duration )
+        write_data_line( );
+}
+
+/**
+ * @brief Change trial number (and start it) once every sample of the old
+ * one has been sent.
+ *
+ * @param count
+ * @param start Trial starts now: data lines count time from here.
+ */
+void set_trial( unsigned count, bool start )
+{
+    while( true )
+    {
+        write_data_line( );
+        noInterrupts( );
+        if( sample_tail_ == sample_head_ )
+            break;
+        interrupts( );
+    }
+    trial_count_ = count;
+    if( start )
+    {
+        trial_start_time_ = millis( );
+        trial_start_us_ = micros( );
+    }
+    trial_pending_ = true;
+    interrupts( );
 }
 
 void check_for_reset( void )
 {
     if( is_command_read( 'r', true ) )
     {
-        Serial.println( ">>>Received r. Reboot in 2 seconds" );
+        message( ">>>Received r. Reboot in 2 seconds" );
         reboot_ = true;
     }
 }
@@ -248,12 +495,121 @@ void led_on( unsigned int duration )
 }
 
 
+void print_trial_info( )
+{
+    sprintf( msg_, ">> ANIMAL NAME: %.8s SESSION NUM: %d SESSION TYPE: %d"
+            , schedule_.name, schedule_.session_num, schedule_.session_type );
+    message( msg_ );
+}
+
+/**
+ * @brief Schedule of SESSION_TYPE, used until the host uploads one.
+ * pyblink/schedule.py builds the same.
+ */
+void default_schedule( )
+{
+    memset( &schedule_, 0, sizeof( schedule_ ) );
+    schedule_.trials = 62;
+    schedule_.session_type = SESSION_TYPE;
+    schedule_.session_num = SESSION_NUM;
+    schedule_.shutter_ms = 60;
+    schedule_.iti_min_ms = 23000;
+    schedule_.iti_max_ms = 25000;
+    strncpy( schedule_.name, ANIMAL_NAME, sizeof( schedule_.name ) );
+
+    // Probe trials index. Mean 6 +/- 2 trials. 
+    proble_trial_index_init( 6, 2 );
+    for (unsigned i = 1; i <= SCHED_MAX_TRIALS && i < NUM_MAX_TRIALS; i++)
+        if( probe_trials_[i] )
+            schedule_.probes[i / 8] |= 1 << (i % 8);
+
+    // PRE_ 8 s with camera on for the last 500 ms; CS 50 ms (no CS in
+    // session 1); trace; US 50 ms (no puff in sessions 1 and 2); POST 8 s
+    // with camera on for the first 500 ms. Imaging all along.
+    const uint8_t img = SP_PIN_IMAGING, cam = SP_PIN_IMAGING | SP_PIN_CAMERA;
+    uint8_t n = 0;
+    phases_[n++] = { ST_PRE_, img, 7500 };
+    phases_[n++] = { ST_PRE_, cam, 500 };
+    if( 1 == SESSION_TYPE )
+        phases_[n++] = { ST_NOCS, cam, LED_DURATION };
+    else
+        phases_[n++] = { ST_CS, cam | SP_PIN_LED, LED_DURATION };
+    phases_[n++] = { ST_TRAC, cam, (uint16_t)trace_duration( SESSION_TYPE ) };
+    if( 1 == SESSION_TYPE || 2 == SESSION_TYPE )
+        phases_[n++] = { ST_NOPF, cam, PUFF_DURATION };
+    else
+        phases_[n++] = { ST_PUFF, cam | SP_PIN_PUFF | SP_PHASE_PROBE, PUFF_DURATION };
+    phases_[n++] = { ST_POST, cam, 500 };
+    phases_[n++] = { ST_POST, img, 7500 };
+    num_phases_ = n;
+}
+
+/**
+ * @brief Read a packet from the host (SP_SYNC is next on Serial) and take the
+ * schedule from it. Answers with >>SCHEDULE or >>PHASES.
+ */
+void read_host_packet( )
+{
+    uint8_t buf[SP_MAX_PACKET];
+    Serial.setTimeout( 100 );
+    uint8_t n = Serial.readBytes( (char*)buf, 3 );
+    if( n == 3 && buf[2] <= SP_MAX_PAYLOAD )
+        n += Serial.readBytes( (char*)buf + 3, buf[2] + 1 );
+    if( ! sp_valid( buf, n ) )
+    {
+        message( ">>SCHEDULE error: bad packet" );
+        return;
+    }
+
+    uint8_t len = buf[2];
+    const uint8_t* payload = buf + 3;
+    if( buf[1] == SP_SCHEDULE && len == sizeof( sp_schedule ) )
+    {
+        sp_schedule h;
+        memcpy( &h, payload, sizeof( h ) );
+        if( h.trials > SCHED_MAX_TRIALS || h.iti_min_ms > h.iti_max_ms )
+        {
+            message( ">>SCHEDULE error: trials or ITI" );
+            return;
+        }
+        schedule_ = h;
+        unsigned probes = 0;
+        for (unsigned i = 1; i <= h.trials; i++)
+            probes += (h.probes[i / 8] >> (i % 8)) & 1;
+        sprintf( msg_, ">>SCHEDULE trials=%u probes=%u iti=%u-%u"
+                , h.trials, probes, h.iti_min_ms, h.iti_max_ms );
+        message( msg_ );
+    }
+    else if( buf[1] == SP_PHASES && len % sizeof( sp_phase ) == 0 && len > 0 )
+    {
+        uint8_t count = len / sizeof( sp_phase );
+        unsigned long total = 0;
+        for (uint8_t i = 0; i < count; i++)
+        {
+            sp_phase p;
+            memcpy( &p, payload + i * sizeof( p ), sizeof( p ) );
+            if( p.state >= ST_COUNT )
+            {
+                message( ">>PHASES error: state" );
+                return;
+            }
+            total += p.ms;
+        }
+        memcpy( phases_, payload, len );
+        num_phases_ = count;
+        sprintf( msg_, ">>PHASES %u total=%lums", count, total );
+        message( msg_ );
+    }
+    else
+        message( ">>SCHEDULE error: unknown packet" );
+}
+
 /**
  * @brief Wait for trial to start.
  */
 void wait_for_start( )
 {
-    sprintf( trial_state_, "INVA" );
+    trial_state_ = ST_INVA;
     while( true )
     {
 
@@ -264,22 +620,26 @@ void wait_for_start( )
         write_data_line( );
         if( is_command_read( 's', true ) )
         {
-            Serial.println( ">>>Received r. Start" );
+            message( ">>>Received r. Start" );
             break;                              /* Only START can break the loop */
         }
+        else if( check_for_ping( ) )
+            continue;
+        else if( is_command_read( (char)SP_SYNC, false ) )
+            read_host_packet( );
         else if( is_command_read( 'p', true ) ) 
         {
-            Serial.println( ">>>Received p. Playing puff" );
+            message( ">>>Received p. Playing puff" );
             play_puff( PUFF_DURATION );
         }
         else if( is_command_read( 't', true ) ) 
         {
-            Serial.println( ">>>Received t. Playing tone" );
+            message( ">>>Received t. Playing tone" );
             play_tone( TONE_DURATION, 1.0);
         }
         else if( is_command_read( 'l', true ) ) 
         {
-            Serial.println( ">>>Received l. LED ON" );
+            message( ">>>Received l. LED ON" );
             led_on( LED_DURATION );
         }
         else
@@ -287,26 +647,16 @@ void wait_for_start( )
             char c = Serial.read( );
             if( c != -1 )
             {
-                Serial.print( ">>> Unknown command : " );
-                Serial.println( c );
+                sprintf( msg_, ">>> Unknown command : %c", c );
+                message( msg_ );
             }
         }
     }
 }
 
-void print_trial_info( )
-{
-    Serial.print( ">> ANIMAL NAME: " );
-    Serial.print( ANIMAL_NAME );
-    Serial.print( " SESSION NUM: " );
-    Serial.print( SESSION_NUM );
-    Serial.print( " SESSION TYPE: " );
-    Serial.println( SESSION_TYPE );
-}
-
 void setup()
 {
-    Serial.begin( 38400 );
+    Serial.begin( BAUD_RATE );
 
     // Random seed.
     randomSeed( analogRead(A5) );
@@ -323,7 +673,19 @@ void setup()
     pinMode( CAMERA_TTL_PIN, OUTPUT );
     pinMode( IMAGING_TRIGGER_PIN, OUTPUT );
 
-    Serial.println( ">>> Waiting for 's' to be pressed" );
+#ifdef USE_MOUSE
+    // Stream mode: packets come in on clock interrupts, nothing here waits
+    // for the mouse.
+    mouse.initialize( );
+    if( ! mouse.startStreaming( 100 ) )
+        message( ">>> Mouse clock pin has no pin change interrupt" );
+    wdt_reset( );
+#endif
+
+    default_schedule( );
+    start_sampling( );
+
+    message( ">>> Waiting for 's' to be pressed" );
     wait_for_start( );
 }
 
@@ -344,18 +706,44 @@ void do_first_trial( )
  */
 void do_empty_trial( size_t trial_num, int duration = 10 )
 {
-    Serial.print( ">> TRIAL NUM: " );
-    Serial.println( trial_num );
+    sprintf( msg_, ">> TRIAL NUM: %u", (unsigned)trial_num );
+    message( msg_ );
     //print_trial_info( );
-    delay( duration );
-    Serial.println( ">>     TRIAL OVER." );
+    wait_ms( duration );
+    message( ">>     TRIAL OVER." );
+}
+
+/**
+ * @brief Drive stimulus, camera and imaging pins; only those which change.
+ *
+ * @param pins SP_PIN_PUFF, TONE, LED, CAMERA, IMAGING.
+ */
+void set_outputs( uint8_t pins )
+{
+    uint8_t changed = pins ^ outputs_;
+    if( changed & SP_PIN_TONE )
+    {
+        if( pins & SP_PIN_TONE )
+            tone( TONE_PIN, TONE_FREQ );
+        else
+            noTone( TONE_PIN );
+    }
+    if( changed & SP_PIN_LED )
+        digitalWrite( LED_PIN, (pins & SP_PIN_LED) ? HIGH : LOW );
+    if( changed & SP_PIN_PUFF )
+        digitalWrite( PUFF_PIN, (pins & SP_PIN_PUFF) ? HIGH : LOW );
+    if( changed & SP_PIN_IMAGING )
+        digitalWrite( IMAGING_TRIGGER_PIN, (pins & SP_PIN_IMAGING) ? HIGH : LOW );
+    if( changed & SP_PIN_CAMERA )
+        camera_ttl( (pins & SP_PIN_CAMERA) ? HIGH : LOW );
+    outputs_ = pins;
 }
 
 /**
- * @brief Do a single trial.
+ * @brief Do a single trial: the phases of the schedule one after another.
  *
  * @param trial_num. Index of the trial.
- * @param ttype. Type of the trial.
+ * @param isprobe. Phases marked SP_PHASE_PROBE give no stimulus (PROB).
  */
 void do_trial( unsigned int trial_num, bool isprobe = false )
 {
@@ -363,161 +751,83 @@ void do_trial( unsigned int trial_num, bool isprobe = false )
     check_for_reset( );
 
     print_trial_info( );
-    trial_start_time_ = millis( );
 
-    /*-----------------------------------------------------------------------------
-     *  PRE. Start imaging;  for 8 seconds.
-     *-----------------------------------------------------------------------------*/
-    unsigned duration = 8000;
-    if (trial_num == 1)
-	delay(60); // Shutter delay; Only for the first trial
-
-    stamp_ = millis( );
-
-    sprintf( trial_state_, "PRE_" );
-    digitalWrite( IMAGING_TRIGGER_PIN, HIGH);   /* Start imaging. */
-
-    digitalWrite( CAMERA_TTL_PIN, LOW );
-    digitalWrite( LED_PIN, LOW );
+    // Data lines carry millis( ) since this; the host is told with the next
+    // sample (>>TRIAL or SP_TRIAL).
+    set_trial( trial_count_, true );
 
-    while( (millis( ) - trial_start_time_ ) <= duration ) /* PRE_ time */
-    {
-        // 500 ms before the PRE_ ends, start camera pin high. We start
-        // recording as well.
-        if( (millis( ) - stamp_) >= (duration - 500 ) )
-            if( LOW == digitalRead( CAMERA_TTL_PIN ) )
-                digitalWrite( CAMERA_TTL_PIN, HIGH );
-
-        write_data_line( );
-    }
-    stamp_ = millis( );
+    trial_state_ = ST_PRE_;
+    if (trial_num == 1)
+        wait_ms( schedule_.shutter_ms ); // Shutter delay; Only for the first trial
 
-    /*-----------------------------------------------------------------------------
-     *  CS: 50 ms duration. No tone is played here. Write LED pin to HIGH.
-     *  Play CS only when SESSION_TYPE is not 5.
-     *-----------------------------------------------------------------------------*/
-    if( 1 == SESSION_TYPE )
-    {
-        sprintf( trial_state_, "NOCS" );
-        duration =  LED_DURATION;
-        while( (millis( ) - stamp_) <= duration )
-            write_data_line( );
-    }
-    else
+    for (uint8_t i = 0; i < num_phases_; i++) 
     {
-        duration = LED_DURATION;
-        stamp_ = millis( );
-        sprintf( trial_state_, "CS+" );
-        led_on( duration );
+        const sp_phase& p = phases_[i];
+        uint8_t state = p.state;
+        uint8_t pins = p.pins & ~SP_PHASE_PROBE;
+        if( isprobe && (p.pins & SP_PHASE_PROBE) )
+        {
+            state = ST_PROB;
+            pins &= SP_PIN_CAMERA | SP_PIN_IMAGING;
+        }
+        trial_state_ = state;
+        set_outputs( pins );
+        wait_ms( p.ms );
+        check_for_reset( );
     }
 
-    stamp_ = millis( );
-
     /*-----------------------------------------------------------------------------
-     *  TRACE. The duration of trace varies from trial to trial.
+     *  End trial.
      *-----------------------------------------------------------------------------*/
-    duration = trace_duration( SESSION_TYPE );
-    sprintf( trial_state_, "TRAC" );
-    while( (millis( ) - stamp_) <= duration )
-        write_data_line( );
-    stamp_ = millis( );
+    set_outputs( 0 );                           /* Shut down the imaging. */
+    trial_state_ = ST_ITI_;
 
-    /*-----------------------------------------------------------------------------
-     *  PUFF for 50 ms if trial is not a probe type.
-     *-----------------------------------------------------------------------------*/
-    if( 1 == SESSION_TYPE || 2 == SESSION_TYPE )
-    {
-        sprintf( trial_state_, "NOPF" );
-        duration =  PUFF_DURATION;
-        while( (millis( ) - stamp_) <= duration )
-            write_data_line( );
-    }
-    else
+    sprintf( msg_, ">>END Trial %u is over. Starting new", trial_count_ );
+    message( msg_ );
+    if( sample_overruns_ > 0 )
     {
-        duration = PUFF_DURATION;
-        if( isprobe )
-        {
-            sprintf( trial_state_, "PROB" );
-            while( (millis( ) - stamp_) <= duration )
-                write_data_line( );
-        }
-        else
-        {
-            sprintf( trial_state_, "PUFF" );
-            play_puff( duration );
-        }
+        sprintf( msg_, ">>SAMPLES lost %u", sample_overruns_ );
+        message( msg_ );
     }
-    stamp_ = millis( );
-    
-    /*-----------------------------------------------------------------------------
-     *  POST, flexible duration till trial is over. It is 8 second long.
-     *-----------------------------------------------------------------------------*/
-    // Last phase is post. If we are here just spend rest of time here.
-    duration = 8000;
-    sprintf( trial_state_, "POST" );
-    while( (millis( ) - stamp_) <= duration )
+#ifdef USE_MOUSE
+    if( mouse.errors( ) > 0 )
     {
-        write_data_line( );
-        // Switch camera OFF after 500 ms into POST.
-        if( (millis() - stamp_) >= 500 )
-            digitalWrite( CAMERA_TTL_PIN, LOW );
+        sprintf( msg_, ">>MOUSE errors %u", mouse.errors( ) );
+        message( msg_ );
     }
-
-
-    /*-----------------------------------------------------------------------------
-     *  End trial.
-     *-----------------------------------------------------------------------------*/
-    digitalWrite( IMAGING_TRIGGER_PIN, LOW ); /* Shut down the imaging. */
-    sprintf( trial_state_, "ITI_" );
-
-    Serial.print( ">>END Trial " );
-    Serial.print( trial_count_ );
-    Serial.println( " is over. Starting new");
+#endif
 }
 
 void loop()
 {
     reset_watchdog( );
 
-    // Initialize probe trials index. Mean 6 +/- 2 trials. 
-    proble_trial_index_init( 6, 2 );
-
-    //for (size_t i = 0; i < NUM_MAX_TRIALS; i++) 
-    //{
-    //    Serial.print( probe_trials_[i] );
-    //    Serial.print( " " );
-    //}
-
-    for (size_t i = 1; i <= 62; i++) 
+    for (size_t i = 1; i <= schedule_.trials; i++) 
     {
 
         reset_watchdog( );
 
         // Probe trial.
-        if( 1 == probe_trials_[i] )
-            do_trial( i, true );
-        else
-            do_trial( i, false );
+        do_trial( i, schedule_.probes[i / 8] & (1 << (i % 8)) );
         
         /*-----------------------------------------------------------------------------
          *  ITI.
          *-----------------------------------------------------------------------------*/
-        unsigned long rduration = random( 23000, 25001);
+        unsigned long rduration = random( schedule_.iti_min_ms
+                , (unsigned long)schedule_.iti_max_ms + 1 );
         stamp_ = millis( );
-        sprintf( trial_state_, "ITI_" );
+        trial_state_ = ST_ITI_;
+        // Timer keeps sampling through ITI.
         while((millis( ) - stamp_) <= rduration )
-        {
-            reset_watchdog( );
-            delay( 10 );
-        }
-        trial_count_ += 1;
+            write_data_line( );
+        set_trial( trial_count_ + 1, false );
     }
 
     // Don't do anything once trails are over.
     while( true )
     {
         reset_watchdog( );
-        Serial.println( ">>> All done" );
-        delay( 1000 );
+        message( ">>> All done" );
+        wait_ms( 1000 );
     }
 }
@@ -0,0 +1,182 @@
+/***
+ *       Filename:  sample_protocol.h
+ *
+ *    Description:  Binary packets the board sends instead of text lines
+ *    (BINARY_SAMPLES in config.h). Shared by the firmware and the host
+ *    decoders (PointGreyCamera/src/SampleDecoder.hpp, pyblink/sample_protocol.py).
+ *
+ *    Every packet is
+ *
+ *      SP_SYNC | type | len | payload (len bytes) | crc8
+ *
+ *    crc8 is CRC-8 (poly 0x07, init 0, as _crc8_ccitt_update of avr-libc)
+ *    over type, len and payload. A decoder which sees a bad crc drops the
+ *    sync byte and looks for the next one. Multi-byte fields are little
+ *    endian (AVR and x86 both).
+ *
+ *    A SP_SAMPLE carries micros( ) since the previous sample (dt_us); a
+ *    SP_TIME before it gives absolute micros( ) whenever the gap does not
+ *    fit in 16 bits, and every SP_TIME_EVERY samples so that a decoder
+ *    which lost packets is back on time quickly. SP_TRIAL is sent before
+ *    the first sample of a new trial number or trial start.
+ *
+ *    The host sends the trial schedule the same way before the session
+ *    starts: SP_SCHEDULE (trials, ITI, probe trials) and SP_PHASES (what a
+ *    trial does, phase by phase). The board answers each with a SP_TEXT
+ *    ">>SCHEDULE ..." or ">>PHASES ..." (or "... error ...").
+ *
+ *        Version:  0.0.1
+ *
+ *        License:  GNU GPL2
+ */
+
+#ifndef  sample_protocol_h_INC
+#define  sample_protocol_h_INC
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __AVR__
+#include <util/crc16.h>
+#endif
+
+#define         SP_SYNC                     0xA5
+#define         SP_MAX_PAYLOAD              64
+#define         SP_OVERHEAD                 4   /* sync, type, len, crc */
+#define         SP_MAX_PACKET               (SP_MAX_PAYLOAD + SP_OVERHEAD)
+#define         SP_TIME_EVERY               250
+
+/* Packet types. */
+#define         SP_SAMPLE                   1
+#define         SP_TIME                     2
+#define         SP_TRIAL                    3
+#define         SP_PING                     4   /* Reply to '?' */
+#define         SP_TTL                      5   /* CAMERA_TTL_PIN driven */
+#define         SP_TEXT                     6   /* What used to be println */
+#define         SP_SCHEDULE                 7   /* Host to board */
+#define         SP_PHASES                   8   /* Host to board */
+
+/* sp_sample.pins; bits 0-4 are SYNC_PIN_* of ClockSync.hpp. */
+#define         SP_PIN_PUFF                 (1 << 0)
+#define         SP_PIN_TONE                 (1 << 1)
+#define         SP_PIN_LED                  (1 << 2)
+#define         SP_PIN_CAMERA               (1 << 3)
+#define         SP_PIN_IMAGING              (1 << 4)
+#define         SP_PIN_MOTION1              (1 << 5)
+#define         SP_PIN_MOTION2              (1 << 6)
+
+/* sp_phase.pins: on probe trials this phase drives no stimulus and is PROB. */
+#define         SP_PHASE_PROBE              (1 << 7)
+
+#define         SCHED_MAX_PHASES            (SP_MAX_PAYLOAD / 4)
+#define         SCHED_MAX_TRIALS            127
+
+/* Trial states, was a 4 char string. */
+enum sp_state
+{
+    ST_INVA = 0, ST_PRE_, ST_CS, ST_NOCS, ST_TRAC, ST_PUFF, ST_NOPF, ST_PROB
+        , ST_POST, ST_ITI_, ST_COUNT
+};
+
+/* Name of each state on text lines. */
+static const char sp_state_names_[ST_COUNT][5] = {
+    "INVA", "PRE_", "CS+", "NOCS", "TRAC", "PUFF", "NOPF", "PROB", "POST", "ITI_"
+};
+
+struct sp_sample
+{
+    uint16_t dt_us;
+    uint8_t pins;
+    uint8_t state;
+    int8_t motion1;
+    int8_t motion2;
+} __attribute__((packed));
+
+struct sp_time
+{
+    uint32_t micros;
+} __attribute__((packed));
+
+struct sp_trial
+{
+    uint16_t trial;
+    uint32_t millis;                            /* Text lines count ms from this */
+    uint32_t micros;                            /* and samples from this. */
+} __attribute__((packed));
+
+struct sp_ping
+{
+    uint32_t micros;
+} __attribute__((packed));
+
+struct sp_ttl
+{
+    uint8_t level;
+    uint32_t micros;
+} __attribute__((packed));
+
+struct sp_schedule
+{
+    uint8_t trials;                             /* Numbered from 1 */
+    uint8_t session_type;                       /* Only printed */
+    uint8_t session_num;
+    uint8_t shutter_ms;                         /* Before first trial */
+    uint16_t iti_min_ms;
+    uint16_t iti_max_ms;
+    uint8_t probes[(SCHED_MAX_TRIALS + 1) / 8]; /* Bit n: trial n is a probe */
+    char name[8];                               /* Animal, not 0 terminated if 8 */
+} __attribute__((packed));
+
+/* SP_PHASES is up to SCHED_MAX_PHASES of these. */
+struct sp_phase
+{
+    uint8_t state;
+    uint8_t pins;                               /* SP_PIN_PUFF|TONE|LED|CAMERA|IMAGING, SP_PHASE_PROBE */
+    uint16_t ms;
+} __attribute__((packed));
+
+static inline uint8_t sp_crc8( uint8_t crc, uint8_t data )
+{
+#ifdef __AVR__
+    return _crc8_ccitt_update( crc, data );
+#else
+    crc ^= data;
+    for (int i = 0; i < 8; i++)
+        crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    return crc;
+#endif
+}
+
+/**
+ * @brief Write packet of given type and payload into buf (SP_MAX_PACKET
+ * bytes at least).
+ *
+ * @return Bytes written.
+ */
+static inline uint8_t sp_encode( uint8_t* buf, uint8_t type, const void* payload, uint8_t len )
+{
+    if( len > SP_MAX_PAYLOAD )
+        len = SP_MAX_PAYLOAD;
+    buf[0] = SP_SYNC;
+    buf[1] = type;
+    buf[2] = len;
+    memcpy( buf + 3, payload, len );
+    uint8_t crc = 0;
+    for (uint8_t i = 1; i < len + 3; i++)
+        crc = sp_crc8( crc, buf[i] );
+    buf[len + 3] = crc;
+    return len + SP_OVERHEAD;
+}
+
+/* True if buf holds a whole packet with good crc. */
+static inline int sp_valid( const uint8_t* buf, uint8_t n )
+{
+    if( n < SP_OVERHEAD || buf[0] != SP_SYNC || buf[2] + SP_OVERHEAD != n )
+        return 0;
+    uint8_t crc = 0;
+    for (uint8_t i = 1; i < n - 1; i++)
+        crc = sp_crc8( crc, buf[i] );
+    return crc == buf[n - 1];
+}
+
+#endif   /* ----- #ifndef sample_protocol_h_INC ----- */